@@ -1,12 +1,33 @@
 /*!
- * Generate "libmijit_bee.la" for the benefit of projects that build using
- * libtool.
+ * Generate the instruction opcodes from `bee/insns.h`, and
+ * "libmijit_bee.la" for the benefit of projects that build using libtool.
  */
 extern crate libtool;
 
 use std::env;
 use std::fs;
-use std::path::PathBuf;
+use std::path::{Path, PathBuf};
+
+/** Write `Insn2` to `out`, with a variant for each `BEE_INSN` in `spec`. */
+fn generate_insns(spec: &Path, out: &Path) {
+    let text = fs::read_to_string(spec).unwrap();
+    let mut code = String::from(
+        "/** Instruction opcodes, generated from `bee/insns.h`. */\n\
+         #[allow(non_camel_case_types)]\n\
+         #[allow(unused)]\n\
+         pub enum Insn2 {\n"
+    );
+    for line in text.lines() {
+        if let Some(args) = line.strip_prefix("BEE_INSN(") {
+            let mut fields = args.split(',').map(str::trim);
+            let name = fields.next().unwrap();
+            let opcode = fields.next().unwrap();
+            code.push_str(&format!("    {} = {},\n", name, opcode));
+        }
+    }
+    code.push_str("}\n");
+    fs::write(out, code).unwrap();
+}
 
 fn main() {
     let lib = "libmijit_bee";
@@ -18,4 +39,13 @@ fn main() {
     // FIXME: add this to a fork of libtool-rs
     let _ = fs::remove_file(new_lib_path);
     libtool::generate_convenience_lib(lib).unwrap();
+
+    let spec = PathBuf::from(format!("{}/../src/include/bee/insns.h", topdir));
+    let out_dir = env::var("OUT_DIR").unwrap();
+    generate_insns(&spec, &PathBuf::from(format!("{}/insns.rs", out_dir)));
+    // Naming any file stops Cargo from watching the whole package.
+    for path in ["build.rs", "Cargo.toml", "src"] {
+        println!("cargo:rerun-if-changed={}", path);
+    }
+    println!("cargo:rerun-if-changed={}", spec.display());
 }
@@ -12,6 +12,7 @@
 #define MIJIT_BEE
 
 #include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 typedef struct mijit_bee_jit mijit_bee_jit;
@@ -21,6 +22,7 @@ static_assert(sizeof(intptr_t *) == 8);
 
 typedef struct mijit_bee_registers {
     intptr_t *pc;
+    intptr_t ir;
     intptr_t *s0;
     uintptr_t ssize;
     uintptr_t sp;
@@ -30,10 +32,16 @@ typedef struct mijit_bee_registers {
     uintptr_t handler_sp;
 } mijit_bee_registers;
 
-mijit_bee_jit *mijit_bee_new(void);
+mijit_bee_jit *mijit_bee_new(bool lazy);
 
 void mijit_bee_drop(mijit_bee_jit *jit);
 
 void mijit_bee_run(mijit_bee_jit *jit, mijit_bee_registers *registers);
 
+bool mijit_bee_compile(mijit_bee_jit *jit, intptr_t *addr, void (*code)(intptr_t *start, intptr_t *end));
+
+void mijit_bee_invalidate(mijit_bee_jit *jit, intptr_t *addr);
+
+void mijit_bee_set_code_bounds(mijit_bee_jit *jit, intptr_t *start, intptr_t *end);
+
 #endif
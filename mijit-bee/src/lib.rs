@@ -8,10 +8,13 @@ pub struct Jit {
     bee: Option<Bee<Native>>,
 }
 
-/** Allocates a new Jit. */
+/**
+ * Allocates a new Jit. If `lazy` is `true`, instruction handlers are
+ * compiled when first used.
+ */
 #[no_mangle]
-pub extern fn mijit_bee_new() -> Box<Jit> {
-    Box::new(Jit {bee: Some(Bee::new(native()))})
+pub extern fn mijit_bee_new(lazy: bool) -> Box<Jit> {
+    Box::new(Jit {bee: Some(Bee::new(native(), lazy))})
 }
 
 /** Frees a Jit. */
@@ -25,3 +28,32 @@ pub unsafe extern fn mijit_bee_run(jit: &mut Jit, registers: &mut Registers) {
     let bee = bee.run(registers).expect("Execute failed");
     jit.bee = Some(bee);
 }
+
+/**
+ * Compile the code at `addr`, so that `run()` can start there, calling
+ * `code` with the bounds of each instruction word translated.
+ */
+#[no_mangle]
+pub unsafe extern fn mijit_bee_compile(
+    jit: &mut Jit,
+    addr: *const i64,
+    code: extern fn(*const i64, *const i64),
+) -> bool {
+    let bee = jit.bee.as_mut().expect("Trying to call compile() after error");
+    bee.compile(addr, code);
+    true
+}
+
+/** Discard the code compiled for `addr`. */
+#[no_mangle]
+pub extern fn mijit_bee_invalidate(jit: &mut Jit, addr: *const i64) {
+    let bee = jit.bee.as_mut().expect("Trying to call invalidate() after error");
+    bee.invalidate(addr);
+}
+
+/** Set the bounds of the code that has been translated. */
+#[no_mangle]
+pub extern fn mijit_bee_set_code_bounds(jit: &mut Jit, start: *const i64, end: *const i64) {
+    let bee = jit.bee.as_mut().expect("Trying to call set_code_bounds() after error");
+    bee.set_code_bounds(start, end);
+}
@@ -1,8 +1,10 @@
 use memoffset::{offset_of};
 
+use std::collections::HashMap;
+
 use mijit::code::{
     UnaryOp, BinaryOp, Width, AliasMask,
-    Global, Marshal,
+    Global, Marshal, Register, EBB,
 };
 use mijit::target::{Target, Word};
 use mijit::jit::{Jit, EntryId};
@@ -23,6 +25,11 @@ pub use enums::{Insn1, Insn2};
 const NOT_IMPLEMENTED: i64 = 0;
 /** Dummy return code which should never actually occur. */
 const UNDEFINED: i64 = i64::MAX;
+/**
+ * Return codes from `MISSING_HANDLER` onwards mean that the instruction
+ * handler with index `code - MISSING_HANDLER` has not been compiled.
+ */
+const MISSING_HANDLER: i64 = 1;
 
 /** AliasMask constants. */
 mod am {
@@ -44,17 +51,240 @@ use builder::{build, build_block, Builder};
 
 //-----------------------------------------------------------------------------
 
+/** Pop the data stack into `dest`. */
+fn pop(b: &mut Builder<EntryId>, dest: Register) {
+    b.array_load(dest, (D0, DP), Eight, am::DATA_STACK);
+    b.const_binary(Sub, DP, DP, 1);
+}
+
+/** Push `src` on to the data stack. */
+fn push(b: &mut Builder<EntryId>, src: Register) {
+    b.const_binary(Add, DP, DP, 1);
+    b.array_store(src, (D0, DP), Eight, am::DATA_STACK);
+}
+
+/** Pop the return stack into `dest`. */
+fn pop_s(b: &mut Builder<EntryId>, dest: Register) {
+    b.array_load(dest, (S0, SP), Eight, am::RETURN_STACK);
+    b.const_binary(Sub, SP, SP, 1);
+}
+
+/** Push `src` on to the return stack. */
+fn push_s(b: &mut Builder<EntryId>, src: Register) {
+    b.const_binary(Add, SP, SP, 1);
+    b.array_store(src, (S0, SP), Eight, am::RETURN_STACK);
+}
+
+/** Apply `op` to the top of the data stack. */
+fn unary(b: &mut Builder<EntryId>, op: UnaryOp) {
+    pop(b, R1);
+    b.unary(op, R1, R1);
+    push(b, R1);
+}
+
+/** Apply `op` to the top two items on the data stack. */
+fn binary(b: &mut Builder<EntryId>, op: BinaryOp) {
+    pop(b, R1);
+    pop(b, R2);
+    b.binary(op, R1, R2, R1);
+    push(b, R1);
+}
+
+/**
+ * A virtual data stack, used when compiling straight-line code. The top
+ * items are kept in registers, and are only written to the data stack in
+ * memory when the registers run out, or when control leaves the
+ * straight-line code, at which point the stack must be flushed.
+ * Items below the cached ones are in memory, with `DP` pointing to the
+ * top one.
+ */
+#[derive(Clone)]
+struct Stack {
+    /** Registers holding the top items on the stack, the top one last. */
+    cached: Vec<Register>,
+    /** Registers neither cached nor held by the caller. */
+    free: Vec<Register>,
+}
+
+impl Stack {
+    fn new() -> Self {
+        Stack {cached: Vec::new(), free: vec![R1, R2, OPCODE]}
+    }
+
+    /**
+     * Return a register for the caller to hold, spilling the bottom cached
+     * item if necessary. The caller must hold at most two registers.
+     */
+    fn alloc(&mut self, b: &mut Builder<EntryId>) -> Register {
+        if let Some(r) = self.free.pop() {
+            return r;
+        }
+        let r = self.cached.remove(0);
+        push(b, r);
+        r
+    }
+
+    /** Release a register held by the caller. */
+    fn release(&mut self, r: Register) {
+        self.free.push(r);
+    }
+
+    /** Pop the top item into a register held by the caller. */
+    fn pop(&mut self, b: &mut Builder<EntryId>) -> Register {
+        if let Some(r) = self.cached.pop() {
+            return r;
+        }
+        let r = self.alloc(b);
+        pop(b, r);
+        r
+    }
+
+    /** Push a register held by the caller, which no longer holds it. */
+    fn push(&mut self, r: Register) {
+        self.cached.push(r);
+    }
+
+    /** Pop the top item and discard it. */
+    fn discard(&mut self, b: &mut Builder<EntryId>) {
+        match self.cached.pop() {
+            Some(r) => self.release(r),
+            None => b.const_binary(Sub, DP, DP, 1),
+        }
+    }
+
+    /** Push a constant. */
+    fn constant(&mut self, b: &mut Builder<EntryId>, value: i64) {
+        let r = self.alloc(b);
+        b.const_(r, value);
+        self.push(r);
+    }
+
+    /** Write the cached items to memory. */
+    fn flush(&mut self, b: &mut Builder<EntryId>) {
+        for r in self.cached.drain(..) {
+            push(b, r);
+            self.free.push(r);
+        }
+    }
+
+    /** Apply `op` to the top of the stack. */
+    fn unary(&mut self, b: &mut Builder<EntryId>, op: UnaryOp) {
+        let r = self.pop(b);
+        b.unary(op, r, r);
+        self.push(r);
+    }
+
+    /** Apply `op` to the top two items on the stack. */
+    fn binary(&mut self, b: &mut Builder<EntryId>, op: BinaryOp) {
+        let r1 = self.pop(b);
+        let r2 = self.pop(b);
+        b.binary(op, r2, r2, r1);
+        self.release(r1);
+        self.push(r2);
+    }
+}
+
+/** The byte offset encoded in the immediate operand of `opcode`. */
+fn operand(opcode: i64) -> i64 {
+    opcode & !0x7
+}
+
+/** Instruction opcodes that `specialise()` compiles. */
+const SPECIALISED: [u64; 11] = [
+    Insn2::NOT as u64, Insn2::AND as u64, Insn2::OR as u64, Insn2::XOR as u64,
+    Insn2::POP as u64, Insn2::NEG as u64, Insn2::ADD as u64, Insn2::MUL as u64,
+    Insn2::EQ as u64, Insn2::LT as u64, Insn2::ULT as u64,
+];
+
+/** Calls to words of at most this many instruction words are inlined. */
+const MAX_INLINE_WORDS: usize = 4;
+
+/**
+ * Return `true` if the code at `addr` is short straight-line code ending
+ * with `RET` as the last instruction in its word, all of whose instructions
+ * are specialised.
+ */
+unsafe fn inlinable(addr: *const i64) -> bool {
+    for i in 0..MAX_INLINE_WORDS {
+        let opcode = *addr.add(i);
+        match (opcode & 0x7) as u8 {
+            x if x == Insn1::PushI as u8 || x == Insn1::PushrelI as u8 => {},
+            x if x == Insn1::Insn as u8 => {
+                let mut ops = (opcode as u64) >> 3;
+                loop {
+                    let op = ops & (NUM_OP2_INSNS - 1) as u64;
+                    if op == Insn2::NOP as u64 {
+                        break;
+                    } else if op == Insn2::RET as u64 {
+                        // Instructions after `RET` would run at the return address.
+                        return (ops >> 6) & (NUM_OP2_INSNS - 1) as u64 == Insn2::NOP as u64;
+                    } else if !SPECIALISED.contains(&op) {
+                        return false;
+                    }
+                    ops >>= 6;
+                }
+            },
+            _ => return false,
+        }
+    }
+    false
+}
+
+/**
+ * Emit code for instruction opcode `op` on the virtual stack `s` if it can
+ * be compiled without a guard, and return `true`; otherwise, return
+ * `false`.
+ */
+fn specialise(b: &mut Builder<EntryId>, s: &mut Stack, op: u64) -> bool {
+    match op {
+        x if x == Insn2::NOT as u64 => s.unary(b, Not),
+        x if x == Insn2::AND as u64 => s.binary(b, And),
+        x if x == Insn2::OR as u64 => s.binary(b, Or),
+        x if x == Insn2::XOR as u64 => s.binary(b, Xor),
+        x if x == Insn2::POP as u64 => s.discard(b),
+        x if x == Insn2::NEG as u64 => s.unary(b, Negate),
+        x if x == Insn2::ADD as u64 => s.binary(b, Add),
+        x if x == Insn2::MUL as u64 => s.binary(b, Mul),
+        x if x == Insn2::EQ as u64 => s.binary(b, Eq),
+        x if x == Insn2::LT as u64 => s.binary(b, Lt),
+        x if x == Insn2::ULT as u64 => s.binary(b, Ult),
+        _ => return false,
+    }
+    true
+}
+
+//-----------------------------------------------------------------------------
+
 /** The performance-critical part of the virtual machine. */
 #[derive(Debug)]
 pub struct Bee<T: Target> {
     pub jit: Jit<T>,
+    pub marshal: Marshal,
+    /** The generic dispatch loop. */
     pub root: EntryId,
+    /** Return to the caller. */
+    pub exit: EntryId,
+    /**
+     * Instruction handlers: first-level instructions, indexed by `Insn1`,
+     * then instructions, indexed by `NUM_OP1_INSNS` plus `Insn2`. Each is
+     * an entry point of its own.
+     */
+    pub handlers: Vec<EntryId>,
+    /** The code of each handler that has not yet been compiled. */
+    pub handler_code: Vec<Option<EBB<EntryId>>>,
+    /** Compiled entry points, indexed by VM address. */
+    pub words: HashMap<u64, EntryId>,
 }
 
 impl<T: Target> Bee<T> {
+    /**
+     * If `lazy` is `true`, each instruction handler is compiled the first
+     * time it is needed, which makes short runs start faster; otherwise,
+     * they are all compiled at once.
+     */
     #[allow(clippy::too_many_lines)]
-    pub fn new(target: T) -> Self {
-        let mut jit = Jit::new(target, 1);
+    pub fn new(target: T, lazy: bool) -> Self {
+        let mut jit = Jit::new(target, 3);
         let marshal = Marshal {
             prologue: build_block(&|b| {
                 for (reg, offset) in offsets() {
@@ -81,7 +311,16 @@ impl<T: Target> Bee<T> {
             b.jump(not_implemented2)
         }));
 
-        let mut op1_insns: Vec<_> = (0..NUM_OP1_INSNS - 1).map(
+        let handlers: Vec<EntryId> = (0..NUM_OP1_INSNS + NUM_OP2_INSNS - 1).map(
+            |i| jit.new_entry(&marshal, MISSING_HANDLER + i as i64)
+        ).collect();
+        let dispatch = |first: usize, n: usize| -> Box<[EBB<EntryId>]> {
+            handlers[first..first + n].iter().map(
+                |&handler| build(&move |b| { b.jump(handler) })
+            ).collect()
+        };
+
+        let mut op1_insns: Vec<_> = (0..NUM_OP1_INSNS).map(
             |_| build(&move |b| { b.jump(not_implemented) })
         ).collect();
 
@@ -90,22 +329,6 @@ impl<T: Target> Bee<T> {
         ).collect();
 
         // Helper functions.
-        let pop = |b: &mut Builder<EntryId>, dest| {
-            b.array_load(dest, (D0, DP), Eight, am::DATA_STACK);
-            b.const_binary(Sub, DP, DP, 1);
-        };
-        let push = |b: &mut Builder<EntryId>, src| {
-            b.const_binary(Add, DP, DP, 1);
-            b.array_store(src, (D0, DP), Eight, am::DATA_STACK);
-        };
-        let pop_s = |b: &mut Builder<EntryId>, dest| {
-            b.array_load(dest, (S0, SP), Eight, am::RETURN_STACK);
-            b.const_binary(Sub, SP, SP, 1);
-        };
-        let push_s = |b: &mut Builder<EntryId>, src| {
-            b.const_binary(Add, SP, SP, 1);
-            b.array_store(src, (S0, SP), Eight, am::RETURN_STACK);
-        };
         let load = |width: Width| build(&move |mut b| {
             pop(&mut b, R1);
             b.const_binary(And, TEST, R1, (1 << (width as usize)) - 1);
@@ -124,30 +347,27 @@ impl<T: Target> Bee<T> {
                 b.const_binary(Add, DP, DP, 1);
                 b.jump(not_implemented)
             }));
+            // Writes that might be to translated code are left to the
+            // interpreter. `Global(1)` and `Global(2)` hold the start and
+            // length of the range of such code (see `set_code_bounds()`).
+            b.binary(Sub, TEST, R1, Global(1));
+            b.binary(Ult, TEST, TEST, Global(2));
+            b.guard(TEST, false, build(&move |mut b| {
+                b.const_binary(Add, DP, DP, 1);
+                b.jump(not_implemented)
+            }));
             pop(&mut b, R2);
             b.store(R2, (R1, 0), width, am::MEMORY);
             b.jump(root)
         });
-        let unary = |op: UnaryOp| build(&move |mut b| {
-            pop(&mut b, R1);
-            b.unary(op, R1, R1);
-            push(&mut b, R1);
+        let unary_insn = |op: UnaryOp| build(&move |mut b| {
+            unary(&mut b, op);
             b.jump(root)
         });
-        let binary_with_callback = |callback: &dyn Fn(&mut Builder<EntryId>)| build(&move |mut b| {
-            pop(&mut b, R1);
-            pop(&mut b, R2);
-            callback(&mut b);
-            push(&mut b, R1);
+        let binary_insn = |op: BinaryOp| build(&move |mut b| {
+            binary(&mut b, op);
             b.jump(root)
         });
-        let binary = |op: BinaryOp| binary_with_callback(&|b| {
-            b.binary(op, R1, R2, R1);
-        });
-        let compare = |op: BinaryOp| binary_with_callback(&|b| {
-            b.binary(op, R1, R2, R1);
-            b.unary(Negate, R1, R1);
-        });
 
         // Define the first level instructions.
         op1_insns[Insn1::CallI as usize] = build(&move |mut b| {
@@ -185,22 +405,22 @@ impl<T: Target> Bee<T> {
         });
 
         // Define the second level instructions.
-        op2_insns[Insn2::Nop as usize] = build(&move |b| {
+        op2_insns[Insn2::NOP as usize] = build(&move |b| {
             b.jump(root)
         });
-        op2_insns[Insn2::Not as usize] = unary(Not);
-        op2_insns[Insn2::And as usize] = binary(And);
-        op2_insns[Insn2::Or as usize] = binary(Or);
-        op2_insns[Insn2::Xor as usize] = binary(Xor);
-        op2_insns[Insn2::LShift as usize] = binary(Lsl);
-        op2_insns[Insn2::RShift as usize] = binary(Lsr);
-        op2_insns[Insn2::ARShift as usize] = binary(Asr);
-        op2_insns[Insn2::Pop as usize] = build(&move |mut b| {
+        op2_insns[Insn2::NOT as usize] = unary_insn(Not);
+        op2_insns[Insn2::AND as usize] = binary_insn(And);
+        op2_insns[Insn2::OR as usize] = binary_insn(Or);
+        op2_insns[Insn2::XOR as usize] = binary_insn(Xor);
+        op2_insns[Insn2::LSHIFT as usize] = binary_insn(Lsl);
+        op2_insns[Insn2::RSHIFT as usize] = binary_insn(Lsr);
+        op2_insns[Insn2::ARSHIFT as usize] = binary_insn(Asr);
+        op2_insns[Insn2::POP as usize] = build(&move |mut b| {
             b.const_binary(Sub, DP, DP, 1);
             b.jump(root)
         });
         // TODO: Specialize for small arguments.
-        op2_insns[Insn2::Dup as usize] = build(&move |mut b| {
+        op2_insns[Insn2::DUP as usize] = build(&move |mut b| {
             pop(&mut b, TEST);
             b.binary(Sub, TEST, DP, TEST);
             b.array_load(R2, (D0, TEST), Eight, am::DATA_STACK);
@@ -208,7 +428,7 @@ impl<T: Target> Bee<T> {
             b.jump(root)
         });
         // TODO: Specialize for small arguments.
-        op2_insns[Insn2::Set as usize] = build(&move |mut b| {
+        op2_insns[Insn2::SET as usize] = build(&move |mut b| {
             pop(&mut b, TEST);
             pop(&mut b, R1);
             b.binary(Sub, TEST, DP, TEST);
@@ -216,7 +436,7 @@ impl<T: Target> Bee<T> {
             b.jump(root)
         });
         // TODO: Specialize for small arguments.
-        op2_insns[Insn2::Swap as usize] = build(&move |mut b| {
+        op2_insns[Insn2::SWAP as usize] = build(&move |mut b| {
             pop(&mut b, TEST);
             pop(&mut b, R1);
             b.binary(Sub, TEST, DP, TEST);
@@ -225,7 +445,7 @@ impl<T: Target> Bee<T> {
             push(&mut b, R2);
             b.jump(root)
         });
-        op2_insns[Insn2::Jump as usize] = build(&move |mut b| {
+        op2_insns[Insn2::JUMP as usize] = build(&move |mut b| {
             pop(&mut b, R1);
             b.const_binary(And, TEST, R1, 7);
             b.guard(TEST, false, build(&move |mut b| {
@@ -235,7 +455,7 @@ impl<T: Target> Bee<T> {
             b.move_(PC, R1);
             b.jump(root)
         });
-        op2_insns[Insn2::JumpZ as usize] = build(&move |mut b| {
+        op2_insns[Insn2::JUMPZ as usize] = build(&move |mut b| {
             pop(&mut b, R1);
             pop(&mut b, TEST);
             b.guard(TEST, false, build(&move |b| { b.jump(root) }));
@@ -247,7 +467,7 @@ impl<T: Target> Bee<T> {
             b.move_(PC, R1);
             b.jump(root)
         });
-        op2_insns[Insn2::Call as usize] = build(&move |mut b| {
+        op2_insns[Insn2::CALL as usize] = build(&move |mut b| {
             pop(&mut b, R1);
             b.const_binary(And, TEST, R1, 7);
             b.guard(TEST, false, build(&move |mut b| {
@@ -258,7 +478,7 @@ impl<T: Target> Bee<T> {
             b.move_(PC, R1);
             b.jump(root)
         });
-        op2_insns[Insn2::Ret as usize] = build(&move |mut b| {
+        op2_insns[Insn2::RET as usize] = build(&move |mut b| {
             pop_s(&mut b, R1);
             b.const_binary(And, TEST, R1, 7);
             b.guard(TEST, false, build(&move |mut b| {
@@ -274,18 +494,18 @@ impl<T: Target> Bee<T> {
             b.move_(PC, R1);
             b.jump(root)
         });
-        op2_insns[Insn2::Load as usize] = load(Eight);
-        op2_insns[Insn2::Store as usize] = store(Eight);
-        op2_insns[Insn2::Load1 as usize] = load(One);
-        op2_insns[Insn2::Store1 as usize] = store(One);
-        op2_insns[Insn2::Load2 as usize] = load(Two);
-        op2_insns[Insn2::Store2 as usize] = store(Two);
-        op2_insns[Insn2::Load4 as usize] = load(Four);
-        op2_insns[Insn2::Store4 as usize] = store(Four);
-        op2_insns[Insn2::Neg as usize] = unary(Negate);
-        op2_insns[Insn2::Add as usize] = binary(Add);
-        op2_insns[Insn2::Mul as usize] = binary(Mul);
-        op2_insns[Insn2::DivMod as usize] = build(&move |mut b| {
+        op2_insns[Insn2::LOAD as usize] = load(Eight);
+        op2_insns[Insn2::STORE as usize] = store(Eight);
+        op2_insns[Insn2::LOAD1 as usize] = load(One);
+        op2_insns[Insn2::STORE1 as usize] = store(One);
+        op2_insns[Insn2::LOAD2 as usize] = load(Two);
+        op2_insns[Insn2::STORE2 as usize] = store(Two);
+        op2_insns[Insn2::LOAD4 as usize] = load(Four);
+        op2_insns[Insn2::STORE4 as usize] = store(Four);
+        op2_insns[Insn2::NEG as usize] = unary_insn(Negate);
+        op2_insns[Insn2::ADD as usize] = binary_insn(Add);
+        op2_insns[Insn2::MUL as usize] = binary_insn(Mul);
+        op2_insns[Insn2::DIVMOD as usize] = build(&move |mut b| {
             pop(&mut b, R1);
             pop(&mut b, R2);
             b.const_binary(Eq, TEST, R2, i64::MIN);
@@ -309,7 +529,7 @@ impl<T: Target> Bee<T> {
             push(&mut b, TEST);
             b.jump(root)
         });
-        op2_insns[Insn2::UDivMod as usize] = build(&move |mut b| {
+        op2_insns[Insn2::UDIVMOD as usize] = build(&move |mut b| {
             pop(&mut b, R1);
             pop(&mut b, R2);
             b.guard(R1, true, build(&move |mut b| {
@@ -324,53 +544,233 @@ impl<T: Target> Bee<T> {
             push(&mut b, TEST);
             b.jump(root)
         });
-        op2_insns[Insn2::Eq as usize] = compare(Eq);
-        op2_insns[Insn2::Lt as usize] = compare(Lt);
-        op2_insns[Insn2::ULt as usize] = compare(Ult);
-        op2_insns[Insn2::PushR as usize] = build(&move |mut b| {
+        op2_insns[Insn2::EQ as usize] = binary_insn(Eq);
+        op2_insns[Insn2::LT as usize] = binary_insn(Lt);
+        op2_insns[Insn2::ULT as usize] = binary_insn(Ult);
+        op2_insns[Insn2::PUSHS as usize] = build(&move |mut b| {
             pop(&mut b, R1);
             push_s(&mut b, R1);
             b.jump(root)
         });
-        op2_insns[Insn2::PopR as usize] = build(&move |mut b| {
+        op2_insns[Insn2::POPS as usize] = build(&move |mut b| {
             pop_s(&mut b, R1);
             push(&mut b, R1);
             b.jump(root)
         });
-        op2_insns[Insn2::DupR as usize] = build(&move |mut b| {
+        op2_insns[Insn2::DUPS as usize] = build(&move |mut b| {
             b.array_load(R1, (S0, SP), Eight, am::RETURN_STACK);
             push(&mut b, R1);
             b.jump(root)
         });
 
         // Main dispatch loop.
-        let op1_insns = &op1_insns;
-        let op2_insns = &op2_insns;
+        let op2_dispatch = &dispatch(NUM_OP1_INSNS, NUM_OP2_INSNS - 1);
+        op1_insns[Insn1::Insn as usize] = build(&move |mut b| {
+            b.const_binary(Lsr, OPCODE, OPCODE, 3);
+            b.const_binary(And, TEST, OPCODE, (NUM_OP2_INSNS - 1) as i64);
+            b.index(
+                TEST,
+                op2_dispatch.clone(),
+                build(&move |b| { b.jump(not_implemented) }),
+            )
+        });
+        let op1_dispatch = &dispatch(0, NUM_OP1_INSNS);
         jit.define(root, &build(&move |mut b| {
             b.pop(OPCODE, PC, am::MEMORY);
             b.const_binary(And, TEST, OPCODE, (NUM_OP1_INSNS - 1) as i64);
             b.index(
                 TEST,
-                op1_insns.clone().into(),
-                build(&move |mut b| {
-                    b.const_binary(Lsr, OPCODE, OPCODE, 3);
-                    b.const_binary(And, TEST, OPCODE, (NUM_OP2_INSNS - 1) as i64);
-                    b.index(
-                        TEST,
-                        op2_insns.clone().into(),
-                        build(&move |b| { b.jump(not_implemented) }),
-                    )
-                })
+                op1_dispatch.clone(),
+                build(&move |b| { b.jump(not_implemented) }),
             )
         }));
-        Bee {jit, root}
+
+        let handler_code = op1_insns.into_iter().chain(op2_insns).map(Some).collect();
+        let mut bee = Bee {
+            jit, marshal, root, exit: not_implemented2,
+            handlers, handler_code, words: HashMap::new(),
+        };
+        if !lazy {
+            for index in 0..bee.handlers.len() {
+                bee.compile_handler(index);
+            }
+        }
+        bee
+    }
+
+    /** Compile instruction handler `index`, if it has not been compiled. */
+    fn compile_handler(&mut self, index: usize) {
+        if let Some(code) = self.handler_code[index].take() {
+            self.jit.define(self.handlers[index], &code);
+        }
+    }
+
+    /**
+     * Compile the straight-line code starting at `addr` into an entry point
+     * of its own, in which each instruction is specialised for its operand
+     * and needs no dispatch. Compilation stops at the first control
+     * transfer, or instruction that is not specialised, where the generic
+     * dispatch loop takes over. Within the code, the top of the data stack
+     * is kept in registers (see `Stack`), and only written to memory when
+     * control leaves it. Calls to short words that need no guards are
+     * inlined, so they never touch the return stack. `code` is called
+     * with the start and end of each instruction word that is translated.
+     */
+    pub unsafe fn compile(&mut self, addr: *const i64, code: extern fn(*const i64, *const i64)) {
+        if self.words.contains_key(&(addr as u64)) {
+            return;
+        }
+        let entry = self.jit.new_entry(&self.marshal, UNDEFINED);
+        self.words.insert(addr as u64, entry);
+        let (root, exit) = (self.root, self.exit);
+
+        // Continue at `pc` in the generic dispatch loop, or at `entry` if
+        // that is where `pc` points.
+        let goto = move |mut b: Builder<EntryId>, pc: *const i64| {
+            b.const_(PC, pc as i64);
+            b.jump(if pc == addr { entry } else { root })
+        };
+        // Return to the interpreter part way through an instruction
+        // word, leaving the remaining instructions, `ops`, in `ir`.
+        let leave = move |mut b: Builder<EntryId>, next: *const i64, ops: u64| {
+            b.const_(PC, next as i64);
+            b.const_(R1, (ops << 3) as i64);
+            b.store(R1, (Global(0), offset_of!(Registers, ir) as i64), Eight, am::REGISTERS);
+            b.jump(exit)
+        };
+
+        let mut b = Builder::new();
+        let mut s = Stack::new();
+        // The return address of the call being inlined, if any.
+        let mut ret: Option<*const i64> = None;
+        let mut pc = addr;
+        let ebb: EBB<EntryId> = loop {
+            let opcode = *pc;
+            let next = pc.add(1);
+            code(pc, next);
+            let target = (next as i64 + operand(opcode)) as *const i64;
+            match (opcode & 0x7) as u8 {
+                x if x == Insn1::CallI as u8 && ret.is_none() && inlinable(target) => {
+                    // Returning from a CATCH frame is left to the dispatch
+                    // loop, which would otherwise run the call. `SP` is one
+                    // less than the interpreter's `sp`, so this tests
+                    // `sp < handler_sp`. The dispatch loop is entered at
+                    // `root`, as `entry` would run this guard again.
+                    let r = s.alloc(&mut b);
+                    b.load(r, (Global(0), offset_of!(Registers, handler_sp) as i64), Eight, am::REGISTERS);
+                    b.const_binary(Add, TEST, SP, 1);
+                    b.binary(Ult, TEST, TEST, r);
+                    s.release(r);
+                    let saved = s.clone();
+                    b.guard(TEST, false, build(&move |mut b| {
+                        let mut s = saved.clone();
+                        s.flush(&mut b);
+                        b.const_(PC, pc as i64);
+                        b.jump(root)
+                    }));
+                    ret = Some(next);
+                    pc = target;
+                    continue;
+                },
+                x if x == Insn1::CallI as u8 => {
+                    s.flush(&mut b);
+                    b.const_(R1, next as i64);
+                    push_s(&mut b, R1);
+                    break goto(b, target);
+                },
+                x if x == Insn1::PushI as u8 => {
+                    s.constant(&mut b, opcode >> 3);
+                },
+                x if x == Insn1::PushrelI as u8 => {
+                    s.constant(&mut b, target as i64);
+                },
+                x if x == Insn1::JumpI as u8 => {
+                    s.flush(&mut b);
+                    break goto(b, target);
+                },
+                x if x == Insn1::JumpzI as u8 => {
+                    let r = s.pop(&mut b);
+                    s.flush(&mut b);
+                    b.guard(r, true, build(&move |b| goto(b, target)));
+                    s.release(r);
+                },
+                x if x == Insn1::Insn as u8 => {
+                    // Find the first instruction in the word that is not
+                    // specialised, if any.
+                    let mut ops = (opcode as u64) >> 3;
+                    let mut first = true;
+                    let mut stop = false;
+                    let mut returned = false;
+                    while ops != 0 {
+                        let op = ops & (NUM_OP2_INSNS - 1) as u64;
+                        if op == Insn2::NOP as u64 {
+                            // The rest of the word is ignored.
+                            break;
+                        }
+                        if op == Insn2::RET as u64 && ret.is_some() {
+                            returned = true;
+                            break;
+                        }
+                        if !specialise(&mut b, &mut s, op) {
+                            stop = true;
+                            break;
+                        }
+                        ops >>= 6;
+                        first = false;
+                    }
+                    if stop {
+                        s.flush(&mut b);
+                        if first {
+                            break goto(b, pc);
+                        }
+                        break leave(b, next, ops);
+                    }
+                    if returned {
+                        pc = ret.take().unwrap();
+                        continue;
+                    }
+                },
+                _ => {
+                    s.flush(&mut b);
+                    break goto(b, pc);
+                },
+            }
+            pc = next;
+        };
+        self.jit.define(entry, &ebb);
+    }
+
+    /** Stop using the code compiled by `compile(addr)`. */
+    pub fn invalidate(&mut self, addr: *const i64) {
+        self.words.remove(&(addr as u64));
+    }
+
+    /**
+     * Set the bounds of the VM code that has been translated, writes to
+     * which must be made by the interpreter.
+     */
+    pub fn set_code_bounds(&mut self, start: *const i64, end: *const i64) {
+        *self.jit.global_mut(Global(1)) = Word {u: start as u64};
+        *self.jit.global_mut(Global(2)) = Word {u: (end as u64).wrapping_sub(start as u64)};
     }
 
+    /** Run from `registers.pc`, using compiled code if there is any. */
     pub unsafe fn run(mut self, registers: &mut Registers) -> std::io::Result<Self> {
         *self.jit.global_mut(Global(0)) = Word {mp: (registers as *mut Registers).cast()};
-        let (jit, result) = self.jit.run(self.root)?;
-        assert_eq!(result, Word {s: NOT_IMPLEMENTED});
-        self.jit = jit;
-        Ok(self)
+        let mut entry = self.words.get(&(registers.pc as u64)).copied().unwrap_or(self.root);
+        loop {
+            let (jit, result) = self.jit.run(entry)?;
+            self.jit = jit;
+            if result == (Word {s: NOT_IMPLEMENTED}) {
+                return Ok(self);
+            }
+            // An instruction whose handler has not been compiled: compile
+            // it, and dispatch the instruction word again.
+            let index = result.s - MISSING_HANDLER;
+            assert!(index >= 0 && (index as usize) < self.handlers.len());
+            self.compile_handler(index as usize);
+            registers.pc = registers.pc.sub(1);
+            entry = self.root;
+        }
     }
 }
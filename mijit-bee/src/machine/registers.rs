@@ -5,6 +5,7 @@ use mijit::code::{Register, REGISTERS};
 #[repr(C)]
 pub struct Registers {
     pub pc: *const i64,
+    pub ir: i64,
     pub s0: *mut i64,
     pub ssize: u64,
     pub sp: u64,
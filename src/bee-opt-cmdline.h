@@ -0,0 +1,32 @@
+// Command-line help for bee-opt.
+//
+// Copyright (c) 2023 Reuben Thomas
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+// See cmdline.h.
+
+OPT("output", 'o', required_argument, "FILE", "write the optimized object file to FILE\n"
+  "                            [default OBJECT-FILE]")
+OPT("verify", '\0', no_argument, "", "run the program before and after optimization with\n"
+  "                            the ARGUMENTs, and fail if the results differ")
+OPT("profile", '\0', required_argument, "FILE", "move the hottest code together, using the profile\n"
+  "                            FILE written by bee --profile")
+OPT("relocations", '\0', required_argument, "FILE", "when moving code, fix up the words whose byte\n"
+  "                            offsets are listed in FILE, which hold offsets in\n"
+  "                            the object file")
+OPT("verbose", 'v', no_argument, "", "report the number of each kind of rewrite")
+OPT("help", '\0', no_argument, "", "display this help message and exit")
+OPT("version", '\0', no_argument, "", "display version information and exit")
+ARG("OBJECT-FILE", "optimize object OBJECT-FILE")
+DOC("")
+DOC("Constants are folded, calls followed by RET become jumps, jumps to jumps")
+DOC("are threaded, and instructions are packed into fewer words. Runs of")
+DOC("padding left by rewrites are jumped over. Code is moved only when a")
+DOC("profile is given.")
+DOC("")
+DOC("Report bugs to " PACKAGE_BUGREPORT ".")
@@ -0,0 +1,920 @@
+// Peephole optimizer for Bee object files.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "progname.h"
+#include "xvasprintf.h"
+
+#include "bee/bee.h"
+#include "bee/opcodes.h"
+
+#include "private.h"
+
+
+// Object files have no relocation information, so rewrites do not move
+// code: each replaces some words with the same number of words, padding
+// with NOP words, and runs of NOP words are finally jumped over. Code is
+// moved only by the layout pass (see below), when a profile is given.
+//
+// Code is found as in bee2c, by following control flow from the start of
+// the object file. The word after a CALLI is taken to be code unless the
+// word called starts with POPS, as when calling over a literal or other
+// inline data. Only code is rewritten, and no rewrite spans a word that
+// control may reach other than from the word before: a branch target, a
+// return address, or an address taken with PUSHRELI. Code addresses are
+// assumed not to be made any other way.
+//
+// Folding constants removes intermediate stack items, so a stack overflow
+// part-way through the original code may not happen.
+
+#define DEFAULT_MEMORY 1048576 // Default size of VM memory in words (4MB)
+
+// A word of NOP instructions
+#define NOP_WORD ((bee_word_t)BEE_OP_INSN)
+
+// The number of instructions that fit in a word
+#define MAX_INSNS ((BEE_WORD_BIT - BEE_OP2_SHIFT) / BEE_INSN_BITS)
+
+static bool verbose = false;
+
+static _GL_ATTRIBUTE_FORMAT_PRINTF_STANDARD(1, 2) void die(const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+
+// The object file, as loaded at address 0, any #! line before it, and a
+// copy of the original code
+static bee_word_t *image, *original;
+static size_t image_words, image_bytes;
+static uint8_t *header;
+static size_t header_len;
+
+// Read the object file, keeping any #! header
+static bool load_object(FILE *fp)
+{
+    size_t size = 0, len = 0;
+    uint8_t *bytes = NULL;
+    for (size_t n = 1; n != 0; len += n) {
+        if (len == size) {
+            size = size == 0 ? 4096 : size * 2;
+            if ((bytes = realloc(bytes, size)) == NULL)
+                die("could not allocate memory");
+        }
+        n = fread(bytes + len, 1, size - len, fp);
+    }
+    if (ferror(fp) || fclose(fp) == EOF)
+        return false;
+    header = bytes;
+    header_len = 0;
+    if (len >= 2 && bytes[0] == '#' && bytes[1] == '!') {
+        uint8_t *nl = memchr(bytes, '\n', len);
+        if (nl == NULL)
+            return false;
+        header_len = (size_t)(nl - bytes) + 1;
+    }
+    image_bytes = len - header_len;
+    image_words = (image_bytes + BEE_WORD_BYTES - 1) / BEE_WORD_BYTES;
+    if ((image = calloc(image_words + 1, BEE_WORD_BYTES)) == NULL ||
+        (original = calloc(image_words + 1, BEE_WORD_BYTES)) == NULL)
+        die("could not allocate memory");
+    memcpy(image, bytes + header_len, image_bytes);
+    memcpy(original, image, image_words * BEE_WORD_BYTES);
+    return true;
+}
+
+
+// Control flow
+
+#define NONE ((size_t)-1)
+static bool *is_code, *is_leader;
+
+// Return the word offset `offset` words after `w` if it is in the image,
+// or NONE.
+static size_t target(size_t w, bee_word_t offset)
+{
+    bee_word_t t = (bee_word_t)w + offset;
+    return t >= 0 && (size_t)t < image_words ? (size_t)t : NONE;
+}
+
+// Whether control can continue after instruction `opcode`
+static bool continues(bee_uword_t opcode)
+{
+    switch (opcode) {
+    case BEE_INSN_JUMP:
+    case BEE_INSN_RET:
+    case BEE_INSN_THROW:
+        return false;
+    default:
+        return opcode <= BEE_INSN_GET_HANDLER_SP;
+    }
+}
+
+// Whether instruction `opcode` may transfer control
+static bool transfers(bee_uword_t opcode)
+{
+    switch (opcode) {
+    case BEE_INSN_JUMPZ:
+    case BEE_INSN_CALL:
+    case BEE_INSN_CATCH:
+    case BEE_INSN_BREAK:
+        return true;
+    default:
+        return !continues(opcode);
+    }
+}
+
+// Whether the INSN word `ir` contains an instruction satisfying `pred`
+static bool has_insn(bee_word_t ir, bool (*pred)(bee_uword_t))
+{
+    for (bee_uword_t ops = (bee_uword_t)ir >> BEE_OP2_SHIFT;
+         (ops & BEE_INSN_MASK) != BEE_INSN_NOP; ops >>= BEE_INSN_BITS)
+        if (pred(ops & BEE_INSN_MASK))
+            return true;
+    return false;
+}
+
+static bool is_call(bee_uword_t opcode)
+{
+    return opcode == BEE_INSN_CALL || opcode == BEE_INSN_CATCH;
+}
+
+static bool is_stop(bee_uword_t opcode)
+{
+    return !continues(opcode);
+}
+
+static bool is_insn(bee_word_t ir)
+{
+    return (ir & BEE_OP2_MASK) == BEE_OP_INSN;
+}
+
+// The first instruction of the INSN word `ir`
+static bee_uword_t first_insn(bee_word_t ir)
+{
+    return ((bee_uword_t)ir >> BEE_OP2_SHIFT) & BEE_INSN_MASK;
+}
+
+// Find the code and leaders.
+static void analyse(void)
+{
+    memset(is_code, 0, image_words * sizeof(bool));
+    memset(is_leader, 0, image_words * sizeof(bool));
+    size_t *todo = malloc(image_words * sizeof(size_t)), ntodo = 0;
+    if (todo == NULL)
+        die("could not allocate memory");
+    if (image_words > 0) {
+        is_leader[0] = is_code[0] = true;
+        todo[ntodo++] = 0;
+    }
+#define REACH(w)                                \
+    do {                                        \
+        size_t _w = (w);                        \
+        if (_w != NONE && !is_code[_w]) {       \
+            is_code[_w] = true;                 \
+            todo[ntodo++] = _w;                 \
+        }                                       \
+    } while (0)
+    while (ntodo > 0) {
+        size_t w = todo[--ntodo], next = w + 1 < image_words ? w + 1 : NONE, t;
+        bee_word_t ir = image[w];
+        switch (ir & BEE_OP1_MASK) {
+        case BEE_OP_CALLI:
+            if ((t = target(w + 1, ARSHIFT(ir, BEE_OP1_SHIFT))) == NONE)
+                break;
+            is_leader[t] = true;
+            REACH(t);
+            if (next != NONE && !(is_insn(image[t]) && first_insn(image[t]) == BEE_INSN_POPS)) {
+                is_leader[next] = true;
+                REACH(next);
+            }
+            break;
+        case BEE_OP_PUSHRELI:
+            if ((t = target(w + 1, ARSHIFT(ir, BEE_OP1_SHIFT))) != NONE)
+                is_leader[t] = true;
+            REACH(next);
+            break;
+        case BEE_OP_PUSHI:
+            REACH(next);
+            break;
+        default:
+            switch (ir & BEE_OP2_MASK) {
+            case BEE_OP_JUMPI:
+            case BEE_OP_JUMPZI:
+                if ((t = target(w + 1, ARSHIFT(ir, BEE_OP2_SHIFT))) != NONE) {
+                    is_leader[t] = true;
+                    REACH(t);
+                }
+                if ((ir & BEE_OP2_MASK) == BEE_OP_JUMPZI)
+                    REACH(next);
+                break;
+            case BEE_OP_TRAP:
+                REACH(next);
+                break;
+            case BEE_OP_INSN:
+                if (has_insn(ir, is_call) && next != NONE)
+                    is_leader[next] = true;
+                if (!has_insn(ir, is_stop))
+                    REACH(next);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+#undef REACH
+    free(todo);
+}
+
+// Return the next word of code after `w`, skipping NOP words, if control
+// can only reach it and any NOP words from `w`; otherwise, NONE.
+static _GL_ATTRIBUTE_PURE size_t next_word(size_t w)
+{
+    for (size_t n = w + 1; n < image_words && is_code[n] && !is_leader[n]; n++)
+        if (image[n] != NOP_WORD)
+            return n;
+    return NONE;
+}
+
+// Remove the first instruction from the INSN word at `w`.
+static void drop_insn(size_t w)
+{
+    image[w] = (bee_word_t)((((bee_uword_t)image[w] >> BEE_OP2_SHIFT >> BEE_INSN_BITS) << BEE_OP2_SHIFT) | BEE_OP_INSN);
+}
+
+// Return the word for `op` with operand `n`, shifted by `shift`, or NOP_WORD if
+// `n` does not fit.
+static bee_word_t encode(bee_word_t op, int shift, bee_word_t n)
+{
+    bee_word_t ir = (bee_word_t)LSHIFT((bee_uword_t)n, shift);
+    return ARSHIFT(ir, shift) == n ? ir | op : NOP_WORD;
+}
+
+
+// Rewrites
+
+static size_t folds, tail_calls, threads, packs, nop_jumps;
+
+// Evaluate instruction `opcode` on `a` and `b` (which is on top), or on
+// `b` alone if `unary` is set. Return false if it cannot be folded.
+static bool evaluate(bee_uword_t opcode, bee_word_t a, bee_word_t b, bool *unary, bee_word_t *result)
+{
+    bee_uword_t ua = (bee_uword_t)a, ub = (bee_uword_t)b;
+    *unary = false;
+    switch (opcode) {
+    case BEE_INSN_NOT:
+        *unary = true;
+        *result = ~b;
+        return true;
+    case BEE_INSN_NEG:
+        *unary = true;
+        *result = (bee_word_t)-ub;
+        return true;
+    case BEE_INSN_AND:
+        *result = a & b;
+        return true;
+    case BEE_INSN_OR:
+        *result = a | b;
+        return true;
+    case BEE_INSN_XOR:
+        *result = a ^ b;
+        return true;
+    case BEE_INSN_ADD:
+        *result = (bee_word_t)(ua + ub);
+        return true;
+    case BEE_INSN_MUL:
+        *result = (bee_word_t)(ua * ub);
+        return true;
+    case BEE_INSN_EQ:
+        *result = a == b;
+        return true;
+    case BEE_INSN_LT:
+        *result = a < b;
+        return true;
+    case BEE_INSN_ULT:
+        *result = ua < ub;
+        return true;
+    case BEE_INSN_LSHIFT:
+    case BEE_INSN_RSHIFT:
+    case BEE_INSN_ARSHIFT:
+        // Shifts by a word or more raise no error, but are left alone.
+        if (ub >= BEE_WORD_BIT)
+            return false;
+        *result = opcode == BEE_INSN_LSHIFT ? (bee_word_t)(ua << ub) :
+            opcode == BEE_INSN_RSHIFT ? (bee_word_t)(ua >> ub) : ARSHIFT(a, ub);
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Fold PUSHI a [PUSHI b] OP into PUSHI c.
+static bool fold(size_t w)
+{
+    bee_word_t ir = image[w];
+    if ((ir & BEE_OP1_MASK) != BEE_OP_PUSHI)
+        return false;
+    bee_word_t a = 0, b = ARSHIFT(ir, BEE_OP1_SHIFT), result;
+    size_t second = NONE, op = next_word(w);
+    if (op != NONE && (image[op] & BEE_OP1_MASK) == BEE_OP_PUSHI) {
+        second = op;
+        a = b;
+        b = ARSHIFT(image[second], BEE_OP1_SHIFT);
+        op = next_word(second);
+    }
+    bool unary;
+    if (op == NONE || !is_insn(image[op]) ||
+        !evaluate(first_insn(image[op]), a, b, &unary, &result) ||
+        unary != (second == NONE))
+        return false;
+    bee_word_t new_ir = encode(BEE_OP_PUSHI, BEE_OP1_SHIFT, result);
+    if (new_ir == NOP_WORD)
+        return false;
+    image[w] = new_ir;
+    if (second != NONE)
+        image[second] = NOP_WORD;
+    drop_insn(op);
+    folds++;
+    return true;
+}
+
+// Turn CALLI x RET into JUMPI x, unless x starts by popping the return
+// stack, or the RET is followed by instructions, which run at the return
+// address. The RET is not changed, so it may be reached in other ways.
+static bool tail_call(size_t w)
+{
+    bee_word_t ir = image[w];
+    size_t t, ret = w + 1;
+    while (ret < image_words && image[ret] == NOP_WORD)
+        ret++;
+    if (ret == image_words)
+        ret = NONE;
+    if ((ir & BEE_OP1_MASK) != BEE_OP_CALLI ||
+        (t = target(w + 1, ARSHIFT(ir, BEE_OP1_SHIFT))) == NONE ||
+        ret == NONE || image[ret] != LITERAL_INSN(BEE_INSN_RET) ||
+        (is_insn(image[t]) && first_insn(image[t]) == BEE_INSN_POPS))
+        return false;
+    bee_word_t new_ir = encode(BEE_OP_JUMPI, BEE_OP2_SHIFT, ARSHIFT(ir, BEE_OP1_SHIFT));
+    if (new_ir == NOP_WORD)
+        return false;
+    image[w] = new_ir;
+    tail_calls++;
+    return true;
+}
+
+// Make a CALLI, JUMPI or JUMPZI to a JUMPI go to its target.
+static bool thread_jump(size_t w)
+{
+    bee_word_t ir = image[w];
+    bee_word_t op;
+    int shift;
+    if ((ir & BEE_OP1_MASK) == BEE_OP_CALLI) {
+        op = BEE_OP_CALLI;
+        shift = BEE_OP1_SHIFT;
+    } else if ((ir & BEE_OP2_MASK) == BEE_OP_JUMPI || (ir & BEE_OP2_MASK) == BEE_OP_JUMPZI) {
+        op = ir & BEE_OP2_MASK;
+        shift = BEE_OP2_SHIFT;
+    } else
+        return false;
+    size_t t = target(w + 1, ARSHIFT(ir, shift)), final = t;
+    for (size_t steps = 0; final != NONE && steps < image_words &&
+             (image[final] & BEE_OP2_MASK) == BEE_OP_JUMPI; steps++)
+        final = target(final + 1, ARSHIFT(image[final], BEE_OP2_SHIFT));
+    if (final == NONE || final == t || (image[final] & BEE_OP2_MASK) == BEE_OP_JUMPI)
+        return false;
+    bee_word_t new_ir = encode(op, shift, (bee_word_t)final - (bee_word_t)(w + 1));
+    if (new_ir == NOP_WORD)
+        return false;
+    image[w] = new_ir;
+    threads++;
+    return true;
+}
+
+// Return the number of instructions in the INSN word `ir`.
+static _GL_ATTRIBUTE_CONST unsigned count_insns(bee_word_t ir)
+{
+    unsigned n = 0;
+    for (bee_uword_t ops = (bee_uword_t)ir >> BEE_OP2_SHIFT;
+         (ops & BEE_INSN_MASK) != BEE_INSN_NOP; ops >>= BEE_INSN_BITS)
+        n++;
+    return n;
+}
+
+static bool is_call_or_break(bee_uword_t opcode)
+{
+    return is_call(opcode) || opcode == BEE_INSN_BREAK;
+}
+
+// Move the instructions of the next INSN word into the INSN word at `w`.
+// A word that pushes a large literal is left as POPS LOAD.
+static bool pack(size_t w)
+{
+    bee_word_t ir = image[w];
+    size_t next = next_word(w);
+    if (!is_insn(ir) || ir == NOP_WORD || has_insn(ir, transfers) ||
+        next == NONE || !is_insn(image[next]) || has_insn(image[next], is_call_or_break))
+        return false;
+    if (w >= 2 && image[w - 2] == LITERAL_CALLI &&
+        (ir != LITERAL_INSN(BEE_INSN_POPS) || image[next] != LITERAL_INSN(BEE_INSN_LOAD)))
+        return false;
+    unsigned n = count_insns(ir);
+    if (n + count_insns(image[next]) > MAX_INSNS)
+        return false;
+    bee_uword_t ops = (bee_uword_t)ir >> BEE_OP2_SHIFT;
+    ops |= ((bee_uword_t)image[next] >> BEE_OP2_SHIFT) << (n * BEE_INSN_BITS);
+    image[w] = (bee_word_t)((ops << BEE_OP2_SHIFT) | BEE_OP_INSN);
+    image[next] = NOP_WORD;
+    packs++;
+    return true;
+}
+
+// Jump over a run of two or more NOP words.
+static void jump_nops(size_t w)
+{
+    if (image[w] != NOP_WORD)
+        return;
+    size_t end = w + 1;
+    while (end < image_words && image[end] == NOP_WORD && is_code[end] && !is_leader[end])
+        end++;
+    if (end - w >= 2) {
+        image[w] = encode(BEE_OP_JUMPI, BEE_OP2_SHIFT, (bee_word_t)(end - (w + 1)));
+        nop_jumps++;
+    }
+}
+
+static void optimize(void)
+{
+    is_code = malloc(image_words * sizeof(bool));
+    is_leader = malloc(image_words * sizeof(bool));
+    if (is_code == NULL || is_leader == NULL)
+        die("could not allocate memory");
+
+    for (bool changed = true; changed; ) {
+        changed = false;
+        analyse();
+        for (size_t w = 0; w < image_words; w++)
+            if (is_code[w])
+                changed |= fold(w) || tail_call(w) || thread_jump(w) || pack(w);
+    }
+    analyse();
+    for (size_t w = 0; w < image_words; w++)
+        if (is_code[w])
+            jump_nops(w);
+
+    if (verbose)
+        fprintf(stderr, "%zu constants folded, %zu tail calls, %zu jumps threaded, "
+                "%zu words packed, %zu runs of NOPs jumped\n",
+                folds, tail_calls, threads, packs, nop_jumps);
+    free(is_code);
+    free(is_leader);
+}
+
+
+// Layout
+//
+// The code is divided into bodies, each starting at the start of the
+// object file or at a word called by CALLI, other than one that starts
+// with POPS, and running up to the next. A body that control can leave
+// other than by a branch, including by returning from a call in its last
+// word, is joined to the next. The bodies are then sorted by the total of
+// the profile counts of the addresses in them, hottest first, except that
+// the first stays first, as execution starts there.
+//
+// The relative offsets of CALLI, PUSHRELI, JUMPI and JUMPZI in code are
+// then fixed up, as are the words listed in the relocations file, which
+// each hold the offset of an address in the object file. Offsets outside
+// the object file are left pointing to the same place. Other words are
+// assumed not to hold addresses.
+
+// The new position of each word, and the old position of each word after
+// layout; NULL if the code has not been moved
+static size_t *new_pos, *old_pos;
+static bool *relocated; // Whether each word is listed in the relocations
+
+// The profile count of each word, from the file written by bee --profile.
+static bee_uword_t *read_profile(const char *file)
+{
+    FILE *fp = fopen(file, "r");
+    bee_uword_t *counts = calloc(image_words, sizeof(bee_uword_t));
+    if (fp == NULL || counts == NULL)
+        die("could not read profile %s", file);
+    bee_uword_t offset, count;
+    while (fscanf(fp, "%zx %zu", &offset, &count) == 2)
+        if (offset < image_bytes)
+            counts[offset / BEE_WORD_BYTES] += count;
+    if (ferror(fp) || !feof(fp) || fclose(fp) == EOF)
+        die("could not read profile %s", file);
+    return counts;
+}
+
+// Note the words listed in the relocations file, as byte offsets in the
+// object file.
+static void read_relocations(const char *file)
+{
+    if ((relocated = calloc(image_words, sizeof(bool))) == NULL)
+        die("could not allocate memory");
+    if (file == NULL)
+        return;
+    FILE *fp = fopen(file, "r");
+    if (fp == NULL)
+        die("could not read relocations %s", file);
+    bee_word_t offset;
+    while (fscanf(fp, "%zi", &offset) == 1) {
+        if (offset < 0 || offset % BEE_WORD_BYTES != 0 ||
+            (size_t)offset >= image_words * BEE_WORD_BYTES)
+            die("bad relocation %zd", offset);
+        relocated[offset / BEE_WORD_BYTES] = true;
+    }
+    if (ferror(fp) || !feof(fp) || fclose(fp) == EOF)
+        die("could not read relocations %s", file);
+}
+
+// Whether control may go from word `w` of code to the next word, other
+// than by a branch
+static bool falls_through(size_t w)
+{
+    bee_word_t ir = image[w];
+    switch (ir & BEE_OP1_MASK) {
+    case BEE_OP_CALLI:
+        {
+            size_t t = target(w + 1, ARSHIFT(ir, BEE_OP1_SHIFT));
+            return t == NONE || !(is_insn(image[t]) && first_insn(image[t]) == BEE_INSN_POPS);
+        }
+    case BEE_OP_PUSHI:
+    case BEE_OP_PUSHRELI:
+        return true;
+    default:
+        switch (ir & BEE_OP2_MASK) {
+        case BEE_OP_JUMPI:
+            return false;
+        case BEE_OP_INSN:
+            return has_insn(ir, is_call) || !has_insn(ir, is_stop);
+        default:
+            return true;
+        }
+    }
+}
+
+typedef struct {
+    size_t start, end;
+    bee_uword_t count;
+} body;
+
+static int compare_bodies(const void *a, const void *b)
+{
+    const body *b1 = a, *b2 = b;
+    if (b1->count != b2->count)
+        return b1->count < b2->count ? 1 : -1;
+    return b1->start < b2->start ? -1 : b1->start > b2->start;
+}
+
+// Map the word offset `w`, which may be outside the object file.
+static bee_word_t map_word(bee_word_t w)
+{
+    return w >= 0 && (size_t)w < image_words ? (bee_word_t)new_pos[w] : w;
+}
+
+// Map the byte offset `offset`, which may be outside the object file.
+static bee_word_t map_offset(bee_word_t offset)
+{
+    if (offset < 0 || (bee_uword_t)offset >= image_words * BEE_WORD_BYTES)
+        return offset;
+    return (bee_word_t)(new_pos[offset / BEE_WORD_BYTES] * BEE_WORD_BYTES +
+                        offset % BEE_WORD_BYTES);
+}
+
+// Fix up the offset of the word at old position `w` with opcode `op` and
+// operand shifted by `shift`, now at `new_image[new_pos[w]]`.
+static void fix_offset(bee_word_t *new_image, size_t w, bee_word_t op, int shift)
+{
+    bee_word_t t = (bee_word_t)(w + 1) + ARSHIFT(image[w], shift);
+    bee_word_t ir = encode(op, shift, map_word(t) - (bee_word_t)(new_pos[w] + 1));
+    if (ir == NOP_WORD)
+        die("cannot move code at %#zx: offset too large", w * BEE_WORD_BYTES);
+    new_image[new_pos[w]] = ir;
+}
+
+static size_t moved_bodies;
+
+static void layout(const char *profile_file, const char *relocations_file)
+{
+    bee_uword_t *counts = read_profile(profile_file);
+    read_relocations(relocations_file);
+    is_code = malloc(image_words * sizeof(bool));
+    is_leader = malloc(image_words * sizeof(bool));
+    bool *starts = calloc(image_words + 1, sizeof(bool));
+    body *bodies = malloc(image_words * sizeof(body));
+    new_pos = malloc(image_words * sizeof(size_t));
+    old_pos = malloc(image_words * sizeof(size_t));
+    bee_word_t *new_image = calloc(image_words + 1, BEE_WORD_BYTES);
+    if (is_code == NULL || is_leader == NULL || starts == NULL || bodies == NULL ||
+        new_pos == NULL || old_pos == NULL || new_image == NULL)
+        die("could not allocate memory");
+    analyse();
+
+    // Find the bodies.
+    starts[0] = starts[image_words] = true;
+    for (size_t w = 0; w < image_words; w++) {
+        size_t t;
+        if (is_code[w] && (image[w] & BEE_OP1_MASK) == BEE_OP_CALLI &&
+            (t = target(w + 1, ARSHIFT(image[w], BEE_OP1_SHIFT))) != NONE &&
+            is_code[t] && !(is_insn(image[t]) && first_insn(image[t]) == BEE_INSN_POPS))
+            starts[t] = true;
+    }
+    size_t nbodies = 0;
+    for (size_t w = 0; w < image_words; w++) {
+        if (starts[w])
+            bodies[nbodies++] = (body){w, w, 0};
+        body *b = &bodies[nbodies - 1];
+        b->end = w + 1;
+        b->count += counts[w];
+        if (starts[w + 1] && w + 1 < image_words && is_code[w] && falls_through(w))
+            starts[w + 1] = false;
+    }
+    if (nbodies > 1)
+        qsort(bodies + 1, nbodies - 1, sizeof(body), compare_bodies);
+
+    // Move them.
+    size_t pos = 0;
+    for (size_t i = 0; i < nbodies; i++) {
+        if (bodies[i].start != pos)
+            moved_bodies++;
+        for (size_t w = bodies[i].start; w < bodies[i].end; w++) {
+            new_pos[w] = pos;
+            old_pos[pos++] = w;
+            new_image[new_pos[w]] = image[w];
+        }
+    }
+    for (size_t w = 0; w < image_words; w++) {
+        bee_word_t ir = image[w];
+        if (relocated[w])
+            new_image[new_pos[w]] = map_offset(ir);
+        else if (is_code[w]) {
+            switch (ir & BEE_OP1_MASK) {
+            case BEE_OP_CALLI:
+            case BEE_OP_PUSHRELI:
+                fix_offset(new_image, w, ir & BEE_OP1_MASK, BEE_OP1_SHIFT);
+                break;
+            case BEE_OP_PUSHI:
+                break;
+            default:
+                if ((ir & BEE_OP2_MASK) == BEE_OP_JUMPI || (ir & BEE_OP2_MASK) == BEE_OP_JUMPZI)
+                    fix_offset(new_image, w, ir & BEE_OP2_MASK, BEE_OP2_SHIFT);
+                break;
+            }
+        }
+    }
+    // A partial last word may have moved.
+    if (moved_bodies > 0)
+        image_bytes = image_words * BEE_WORD_BYTES;
+
+    if (verbose)
+        fprintf(stderr, "%zu bodies, %zu moved\n", nbodies, moved_bodies);
+    free(image);
+    image = new_image;
+    free(counts);
+    free(starts);
+    free(bodies);
+    free(is_code);
+    free(is_leader);
+}
+
+
+// Verification
+
+typedef struct {
+    bee_word_t *memory;
+    bee_state *S;
+    bee_word_t ret;
+    bool moved; // Whether the code has been moved by layout
+} run;
+
+// Run `code` with the interpreter.
+static run run_image(bee_word_t *code, bool moved, int argc, char *argv[])
+{
+    run r;
+    r.moved = moved;
+    if ((r.memory = calloc(DEFAULT_MEMORY, BEE_WORD_BYTES)) == NULL)
+        die("could not allocate memory");
+    memcpy(r.memory, code, image_bytes);
+    if ((r.S = bee_init(r.memory, BEE_DEFAULT_STACK_SIZE, BEE_DEFAULT_STACK_SIZE)) == NULL)
+        die("could not allocate Bee state");
+    bee_register_args(argc, (const char **)argv);
+    r.ret = bee_run(r.S);
+    fflush(stdout);
+    return r;
+}
+
+// Addresses in memory are compared as offsets in the original code.
+static bee_word_t normalize(run *r, bee_word_t v)
+{
+    bee_uword_t offset = (bee_uword_t)v - (bee_uword_t)r->memory;
+    if (offset >= DEFAULT_MEMORY * BEE_WORD_BYTES)
+        return v;
+    if (r->moved && offset < image_words * BEE_WORD_BYTES)
+        offset = old_pos[offset / BEE_WORD_BYTES] * BEE_WORD_BYTES +
+            offset % BEE_WORD_BYTES;
+    return (bee_word_t)offset;
+}
+
+// Run the original and optimized programs, and compare their results,
+// final data stacks and memory, apart from the rewritten words, and the
+// moved words, which are compared in their new places. Instruction
+// traces are not compared, as the optimized program runs fewer
+// instructions.
+static bool verify(int argc, char *argv[])
+{
+    bee_set_jit(BEE_JIT_NONE);
+    run a = run_image(original, false, argc, argv);
+    run b = run_image(image, new_pos != NULL, argc, argv);
+    bool ok = true;
+    if (a.ret != b.ret) {
+        fprintf(stderr, "result %zd is now %zd\n", a.ret, b.ret);
+        ok = false;
+    }
+    if (a.S->dp != b.S->dp) {
+        fprintf(stderr, "data stack depth %zu is now %zu\n", a.S->dp, b.S->dp);
+        ok = false;
+    } else
+        for (bee_uword_t i = 0; i < a.S->dp; i++)
+            if (normalize(&a, a.S->d0[i]) != normalize(&b, b.S->d0[i])) {
+                fprintf(stderr, "data stack item %zu: %#zx is now %#zx\n", i,
+                        (bee_uword_t)a.S->d0[i], (bee_uword_t)b.S->d0[i]);
+                ok = false;
+            }
+    for (size_t w = 0; w < DEFAULT_MEMORY; w++) {
+        size_t v = w < image_words && new_pos != NULL ? new_pos[w] : w;
+        bee_word_t x = normalize(&a, a.memory[w]), y = normalize(&b, b.memory[v]);
+        if (w < image_words && new_pos != NULL && relocated[w]) {
+            x = map_offset(a.memory[w]);
+            y = b.memory[v];
+        } else if (w < image_words && original[w] != image[v])
+            continue;
+        if (x != y) {
+            fprintf(stderr, "memory word %#zx: %#zx is now %#zx\n", w * BEE_WORD_BYTES,
+                    (bee_uword_t)a.memory[w], (bee_uword_t)b.memory[v]);
+            ok = false;
+        }
+    }
+    bee_destroy(a.S);
+    bee_destroy(b.S);
+    bee_finish();
+    free(a.memory);
+    free(b.memory);
+    return ok;
+}
+
+
+// Options table
+struct option longopts[] = {
+#define OPT(longname, shortname, arg, argstring, docstring) \
+  {longname, arg, NULL, shortname},
+#define ARG(argstring, docstring)
+#define DOC(docstring)
+#include "bee-opt-cmdline.h"
+#undef OPT
+#undef ARG
+#undef DOC
+  {0, 0, 0, 0}
+};
+
+#define COPYRIGHT_STRING "(c) Reuben Thomas 2023"
+
+static void usage(void)
+{
+    char *shortopt, *buf;
+    printf ("Usage: %s [OPTION...] OBJECT-FILE [ARGUMENT...]\n"
+            "\n"
+            "Optimize a " PACKAGE_NAME " object file.\n"
+            "\n",
+            program_name);
+#define OPT(longname, shortname, arg, argstring, docstring)             \
+    shortopt = xasprintf(", -%c ", shortname);                           \
+    buf = xasprintf("--%s%s%s", longname, shortname ? shortopt : (arg != no_argument ? "=" : ""), argstring); \
+    printf("  %-26s%s\n", buf, docstring);                              \
+    free(buf);                                                          \
+    free(shortopt);
+#define ARG(argstring, docstring)                 \
+    printf("  %-26s%s\n", argstring, docstring);
+#define DOC(text)                                 \
+    printf(text "\n");
+#include "bee-opt-cmdline.h"
+#undef OPT
+#undef ARG
+#undef DOC
+}
+
+int main(int argc, char *argv[])
+{
+    set_program_name(argv[0]);
+
+    const char *output = NULL, *profile_file = NULL, *relocations_file = NULL;
+    bool verify_mode = false;
+    for (;;) {
+        int this_optind = optind ? optind : 1, longindex = -1;
+        int c = getopt_long(argc, argv, "+:o:v", longopts, &longindex);
+
+        if (c == -1)
+            break;
+        else if (c == ':')
+            die("option '%s' requires an argument", argv[this_optind]);
+        else if (c == '?')
+            die("unrecognised option '%s'\nTry '%s --help' for more information.", argv[this_optind], program_name);
+        else if (c == 'o')
+            longindex = 0;
+        else if (c == 'v')
+            longindex = 4;
+
+        switch (longindex) {
+            case 0:
+                output = optarg;
+                break;
+            case 1:
+                verify_mode = true;
+                break;
+            case 2:
+                profile_file = optarg;
+                break;
+            case 3:
+                relocations_file = optarg;
+                break;
+            case 4:
+                verbose = true;
+                break;
+            case 5:
+                usage();
+                exit(EXIT_SUCCESS);
+            case 6:
+                printf("bee-opt (" PACKAGE_NAME ") " VERSION " (%d-bit)\n"
+                       COPYRIGHT_STRING "\n"
+                       PACKAGE_NAME " comes with ABSOLUTELY NO WARRANTY.\n"
+                       "You may redistribute copies of " PACKAGE_NAME "\n"
+                       "under the terms of the GNU General Public License.\n"
+                       "For more information about these matters, see the file named COPYING.\n",
+                       BEE_WORD_BIT);
+                exit(EXIT_SUCCESS);
+            default:
+                break;
+            }
+    }
+
+    if (argc - optind < 1 || (!verify_mode && argc - optind != 1)) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+    const char *object_name = argv[optind];
+    FILE *handle = fopen(object_name, "rb");
+    if (handle == NULL)
+        die("cannot open file %s", object_name);
+    if (!load_object(handle))
+        die("could not read file %s", object_name);
+    if (image_words > DEFAULT_MEMORY)
+        die("file %s is too big", object_name);
+
+    optimize();
+    if (profile_file != NULL)
+        layout(profile_file, relocations_file);
+    else if (relocations_file != NULL)
+        die("option '--relocations' needs option '--profile'");
+
+    if (verify_mode && !verify(argc - optind, argv + optind))
+        die("optimized program behaves differently");
+
+    if (output == NULL)
+        output = object_name;
+    FILE *out = fopen(output, "wb");
+    if (out == NULL)
+        die("cannot open file %s", output);
+    if (fwrite(header, 1, header_len, out) != header_len ||
+        fwrite(image, 1, image_bytes, out) != image_bytes ||
+        fclose(out) == EOF)
+        die("error writing output");
+    free(header);
+    free(image);
+    free(original);
+    free(new_pos);
+    free(old_pos);
+    free(relocated);
+    return EXIT_SUCCESS;
+}
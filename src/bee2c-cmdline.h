@@ -0,0 +1,21 @@
+// Command-line help for bee2c.
+//
+// Copyright (c) 2023 Reuben Thomas
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+// See cmdline.h.
+
+OPT("output", 'o', required_argument, "FILE", "write the C program to FILE [default standard output]")
+OPT("help", '\0', no_argument, "", "display this help message and exit")
+OPT("version", '\0', no_argument, "", "display version information and exit")
+ARG("OBJECT-FILE", "compile object OBJECT-FILE")
+DOC("")
+DOC("The C program should be linked with lib" PACKAGE ". Code that cannot be")
+DOC("compiled is run by its interpreter.")
+DOC("")
+DOC("Report bugs to " PACKAGE_BUGREPORT ".")
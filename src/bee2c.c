@@ -0,0 +1,872 @@
+// Ahead-of-time compiler from Bee object files to C.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "progname.h"
+#include "xvasprintf.h"
+
+#include "bee/bee.h"
+#include "bee/opcodes.h"
+
+#include "private.h"
+
+
+// The object file is translated into a C program that holds a copy of it,
+// and has a function for each word it calls with CALLI, plus one for the
+// code at the start. Each word's function contains all the code reachable
+// from its start by falling through or by JUMPI and JUMPZI, which become
+// `goto`s, so code reachable from more than one function is compiled into
+// each. CALLI becomes a C call, after pushing the return address as usual;
+// RET returns from the function, which then checks that it has returned to
+// the caller. Large literals are pushed directly, as by the interpreter.
+//
+// As in the template JIT, each instruction is only compiled for the common
+// case: if a stack check, alignment check or guard fails, or for
+// instructions that cannot be compiled, such as computed JUMP and CALL,
+// and CATCH and THROW, the program falls back to the interpreter, which
+// resumes at the instruction that was about to run, and then runs to the
+// end of the program. The interpreter also takes over after a store to a
+// word of compiled code.
+
+#define DEFAULT_MEMORY 1048576 // Default size of VM memory in words (4MB)
+
+static FILE *out;
+static const char *object_name;
+
+static _GL_ATTRIBUTE_FORMAT_PRINTF_STANDARD(1, 2) void die(const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+static _GL_ATTRIBUTE_FORMAT_PRINTF_STANDARD(1, 2) void emit(const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vfprintf(out, format, args);
+    va_end(args);
+}
+
+
+// The object file, as loaded at address 0
+static bee_word_t *image;
+static size_t image_words;
+
+// Read the object file, skipping any #! header
+static bool load_object(FILE *fp)
+{
+    size_t size = 0, len = 0;
+    uint8_t *bytes = NULL;
+    if (getc(fp) != '#' || getc(fp) != '!') {
+        if (fseek(fp, 0, SEEK_SET) != 0)
+            return false;
+    } else
+        for (int c; (c = getc(fp)) != '\n'; )
+            if (c == EOF)
+                return false;
+    for (size_t n = 1; n != 0; len += n) {
+        if (len == size) {
+            size = size == 0 ? 4096 : size * 2;
+            if ((bytes = realloc(bytes, size)) == NULL)
+                die("could not allocate memory");
+        }
+        n = fread(bytes + len, 1, size - len, fp);
+    }
+    if (ferror(fp) || fclose(fp) == EOF)
+        return false;
+    image_words = (len + BEE_WORD_BYTES - 1) / BEE_WORD_BYTES;
+    if ((image = calloc(image_words + 1, BEE_WORD_BYTES)) == NULL)
+        die("could not allocate memory");
+    memcpy(image, bytes, len);
+    free(bytes);
+    return true;
+}
+
+
+// Control flow
+
+// Words reached from the start of a function are marked in `seen`, and the
+// targets of its branches in `label`, with a number that is different each
+// time code is explored.
+#define NONE ((size_t)-1)
+static size_t *seen, *label;
+static bool *is_entry, *is_code;
+
+// Return the word offset `offset` words after `w` if it is in the image,
+// or NONE.
+static size_t target(size_t w, bee_word_t offset)
+{
+    bee_word_t t = (bee_word_t)w + offset;
+    return t >= 0 && (size_t)t < image_words ? (size_t)t : NONE;
+}
+
+// Return the number of words of a large literal at `w`, as literal_words()
+// does in the VM, or 0 if there is none there.
+static unsigned literal_length(size_t w)
+{
+    if (image[w] != LITERAL_CALLI || w + 2 >= image_words)
+        return 0;
+    if (image[w + 2] == LITERAL_INSN(BEE_INSN_POPS | BEE_INSN_LOAD << BEE_INSN_BITS))
+        return 3;
+    if (w + 3 < image_words && image[w + 2] == LITERAL_INSN(BEE_INSN_POPS) &&
+        image[w + 3] == LITERAL_INSN(BEE_INSN_LOAD))
+        return 4;
+    return 0;
+}
+
+// Whether an instruction always leaves compiled code
+static bool leaves(bee_uword_t opcode)
+{
+    switch (opcode) {
+    case BEE_INSN_JUMP:
+    case BEE_INSN_JUMPZ:
+    case BEE_INSN_CALL:
+    case BEE_INSN_RET:
+    case BEE_INSN_CATCH:
+    case BEE_INSN_THROW:
+    case BEE_INSN_BREAK:
+        return true;
+    default:
+        return opcode > BEE_INSN_GET_HANDLER_SP;
+    }
+}
+
+// Find the successors of word `w`. Set `*call` to the target of a CALLI,
+// `*branch` to the target of a JUMPI or JUMPZI, and return the number of
+// words after which control falls through, or 0 if it cannot.
+static unsigned successors(size_t w, size_t *call, size_t *branch)
+{
+    bee_word_t ir = image[w];
+    *call = *branch = NONE;
+    switch (ir & BEE_OP1_MASK) {
+    case BEE_OP_CALLI:
+        {
+            unsigned words = literal_length(w);
+            if (words != 0)
+                return words;
+            *call = target(w + 1, ARSHIFT(ir, BEE_OP1_SHIFT));
+            return *call != NONE;
+        }
+    case BEE_OP_PUSHI:
+    case BEE_OP_PUSHRELI:
+        return 1;
+    default:
+        switch (ir & BEE_OP2_MASK) {
+        case BEE_OP_JUMPI:
+            *branch = target(w + 1, ARSHIFT(ir, BEE_OP2_SHIFT));
+            return 0;
+        case BEE_OP_JUMPZI:
+            *branch = target(w + 1, ARSHIFT(ir, BEE_OP2_SHIFT));
+            return *branch != NONE;
+        case BEE_OP_TRAP:
+            return 1;
+        case BEE_OP_INSN:
+            for (bee_uword_t ops = (bee_uword_t)ir >> BEE_OP2_SHIFT;
+                 (ops & BEE_INSN_MASK) != BEE_INSN_NOP; ops >>= BEE_INSN_BITS)
+                if (leaves(ops & BEE_INSN_MASK))
+                    return 0;
+            return 1;
+        default:
+            return 0;
+        }
+    }
+}
+
+// Mark the code reached from `entry` with `mark`, and record any new entry
+// points in `entries`.
+static void explore(size_t mark, size_t entry, size_t *entries, size_t *nentries)
+{
+    size_t *todo = malloc(image_words * sizeof(size_t)), ntodo = 0;
+    if (todo == NULL)
+        die("could not allocate memory");
+    todo[ntodo++] = entry;
+    seen[entry] = mark;
+    while (ntodo > 0) {
+        size_t w = todo[--ntodo], call, branch;
+        unsigned words = successors(w, &call, &branch);
+        for (size_t i = w; i < w + (words > 1 ? words : 1); i++)
+            is_code[i] = true;
+        if (call != NONE && !is_entry[call]) {
+            is_entry[call] = true;
+            entries[(*nentries)++] = call;
+        }
+        if (branch != NONE) {
+            label[branch] = mark;
+            if (seen[branch] != mark) {
+                seen[branch] = mark;
+                todo[ntodo++] = branch;
+            }
+        }
+        size_t next = w + words;
+        if (words != 0 && next < image_words && seen[next] != mark) {
+            seen[next] = mark;
+            todo[ntodo++] = next;
+        }
+    }
+    free(todo);
+}
+
+
+// Code generation
+
+// The resume state before and after the instruction being compiled
+static char *here, *after;
+
+static void set_state(char **state, size_t pc, bee_uword_t ir)
+{
+    free(*state);
+    *state = xasprintf("%zu, %#zx", pc, ir);
+}
+
+static void check_aligned(const char *addr, int bytes)
+{
+    if (bytes > 1)
+        emit("    if (UNALIGNED(%s, %d)) EXIT(%s);\n", addr, bytes, here);
+}
+
+// Exit after a store to `addr` if it overwrote code.
+static void check_code(const char *addr)
+{
+    emit("        if (is_code(%s)) EXIT(%s);\n", addr, after);
+}
+
+static void binary(const char *expr)
+{
+    emit("    CHECKD(2, 1, %s);\n"
+         "    D(2) = (bee_word_t)(%s);\n"
+         "    S->dp--;\n", here, expr);
+}
+
+static void push(const char *expr)
+{
+    emit("    CHECKD(0, 1, %s);\n"
+         "    S->d0[S->dp] = (bee_word_t)(%s);\n"
+         "    S->dp++;\n", here, expr);
+}
+
+// Shifts by a word or more are left to the interpreter.
+static void shift(const char *expr)
+{
+    emit("    CHECKD(2, 1, %s);\n"
+         "    if ((bee_uword_t)D(1) >= BEE_WORD_BIT) EXIT(%s);\n"
+         "    D(2) = (bee_word_t)(%s);\n"
+         "    S->dp--;\n", here, here, expr);
+}
+
+static void load(const char *type, int bytes)
+{
+    emit("    CHECKD(1, 1, %s);\n", here);
+    check_aligned("D(1)", bytes);
+    emit("    D(1) = (bee_word_t)*(%s *)D(1);\n", type);
+}
+
+static void store(const char *type, int bytes)
+{
+    emit("    CHECKD(2, 0, %s);\n", here);
+    check_aligned("D(1)", bytes);
+    emit("    {\n"
+         "        %s *addr = (%s *)D(1);\n"
+         "        *addr = (%s)D(2);\n"
+         "        S->dp -= 2;\n", type, type, type);
+    check_code("addr");
+    emit("    }\n");
+}
+
+static void load_step(int offset, int delta)
+{
+    emit("    CHECKD(1, 2, %s);\n", here);
+    check_aligned("D(1)", BEE_WORD_BYTES);
+    emit("    {\n"
+         "        bee_word_t *addr = (bee_word_t *)D(1);\n"
+         "        D(1) = addr[%d];\n"
+         "        S->d0[S->dp++] = (bee_word_t)(addr + %d);\n"
+         "    }\n", offset, delta);
+}
+
+static void store_step(int offset, int delta)
+{
+    emit("    CHECKD(2, 1, %s);\n", here);
+    check_aligned("D(1)", BEE_WORD_BYTES);
+    emit("    {\n"
+         "        bee_word_t *addr = (bee_word_t *)D(1);\n"
+         "        addr[%d] = D(2);\n"
+         "        D(2) = (bee_word_t)(addr + %d);\n"
+         "        S->dp--;\n", offset, delta);
+    char *addr = xasprintf("addr + %d", offset);
+    check_code(addr);
+    free(addr);
+    emit("    }\n");
+}
+
+// Compile instruction `opcode`. Return false if control cannot continue
+// to the next instruction.
+static bool compile_insn(bee_uword_t opcode)
+{
+    switch (opcode) {
+    case BEE_INSN_NOT:
+        emit("    CHECKD(1, 1, %s);\n"
+             "    D(1) = ~D(1);\n", here);
+        break;
+    case BEE_INSN_AND:
+        binary("D(2) & D(1)");
+        break;
+    case BEE_INSN_OR:
+        binary("D(2) | D(1)");
+        break;
+    case BEE_INSN_XOR:
+        binary("D(2) ^ D(1)");
+        break;
+    case BEE_INSN_LSHIFT:
+        shift("(bee_uword_t)D(2) << D(1)");
+        break;
+    case BEE_INSN_RSHIFT:
+        shift("(bee_uword_t)D(2) >> D(1)");
+        break;
+    case BEE_INSN_ARSHIFT:
+        shift("ARSHIFT(D(2), D(1))");
+        break;
+    case BEE_INSN_POP:
+        emit("    CHECKD(1, 0, %s);\n"
+             "    S->dp--;\n", here);
+        break;
+    case BEE_INSN_DUP:
+        // Out-of-range depths are left to the interpreter.
+        emit("    CHECKD(1, 1, %s);\n"
+             "    if ((bee_uword_t)D(1) >= S->dp - 1) EXIT(%s);\n"
+             "    D(1) = S->d0[S->dp - 2 - D(1)];\n", here, here);
+        break;
+    case BEE_INSN_SET:
+        emit("    CHECKD(2, 1, %s);\n"
+             "    if (S->dp < 2 || (bee_uword_t)D(1) >= S->dp - 2) EXIT(%s);\n"
+             "    S->d0[S->dp - 3 - D(1)] = D(2);\n"
+             "    S->dp -= 2;\n", here, here);
+        break;
+    case BEE_INSN_SWAP:
+        emit("    CHECKD(1, 0, %s);\n"
+             "    if (S->dp < 2 || (bee_uword_t)D(1) >= S->dp - 2) EXIT(%s);\n"
+             "    {\n"
+             "        bee_uword_t depth = D(1);\n"
+             "        S->dp--;\n"
+             "        bee_word_t temp = D(depth + 2);\n"
+             "        D(depth + 2) = D(1);\n"
+             "        D(1) = temp;\n"
+             "    }\n", here, here);
+        break;
+    case BEE_INSN_RET:
+        // Returning from a CATCH frame is left to the interpreter.
+        emit("    CHECKS(1, 0, %s);\n"
+             "    if (S->sp <= S->handler_sp || UNALIGNED(S->s0[S->sp - 1], BEE_WORD_BYTES)) EXIT(%s);\n"
+             "    S->pc = (bee_word_t *)S->s0[--S->sp];\n"
+             "    return BEE_ERROR_OK;\n", here, here);
+        return false;
+    case BEE_INSN_LOAD:
+        load("bee_word_t", BEE_WORD_BYTES);
+        break;
+    case BEE_INSN_STORE:
+        store("bee_word_t", BEE_WORD_BYTES);
+        break;
+    case BEE_INSN_LOAD1:
+        load("uint8_t", 1);
+        break;
+    case BEE_INSN_STORE1:
+        store("uint8_t", 1);
+        break;
+    case BEE_INSN_LOAD2:
+        load("uint16_t", 2);
+        break;
+    case BEE_INSN_STORE2:
+        store("uint16_t", 2);
+        break;
+    case BEE_INSN_LOAD4:
+        load("uint32_t", 4);
+        break;
+    case BEE_INSN_STORE4:
+        store("uint32_t", 4);
+        break;
+    case BEE_INSN_LOAD_IA:
+        load_step(0, 1);
+        break;
+    case BEE_INSN_STORE_DB:
+        store_step(-1, -1);
+        break;
+    case BEE_INSN_LOAD_IB:
+        load_step(1, 1);
+        break;
+    case BEE_INSN_STORE_DA:
+        store_step(0, -1);
+        break;
+    case BEE_INSN_LOAD_DA:
+        load_step(0, -1);
+        break;
+    case BEE_INSN_STORE_IB:
+        store_step(1, 1);
+        break;
+    case BEE_INSN_LOAD_DB:
+        load_step(-1, -1);
+        break;
+    case BEE_INSN_STORE_IA:
+        store_step(0, 1);
+        break;
+    case BEE_INSN_NEG:
+        emit("    CHECKD(1, 1, %s);\n"
+             "    D(1) = (bee_word_t)-(bee_uword_t)D(1);\n", here);
+        break;
+    case BEE_INSN_ADD:
+        binary("(bee_uword_t)D(2) + (bee_uword_t)D(1)");
+        break;
+    case BEE_INSN_MUL:
+        binary("(bee_uword_t)D(2) * (bee_uword_t)D(1)");
+        break;
+    case BEE_INSN_DIVMOD:
+        emit("    CHECKD(2, 2, %s);\n"
+             "    if (D(1) == 0 || D(1) == -1) EXIT(%s);\n"
+             "    {\n"
+             "        bee_word_t divisor = D(1), dividend = D(2);\n"
+             "        D(2) = dividend / divisor;\n"
+             "        D(1) = dividend %% divisor;\n"
+             "    }\n", here, here);
+        break;
+    case BEE_INSN_UDIVMOD:
+        emit("    CHECKD(2, 2, %s);\n"
+             "    if (D(1) == 0) EXIT(%s);\n"
+             "    {\n"
+             "        bee_uword_t divisor = D(1), dividend = D(2);\n"
+             "        D(2) = (bee_word_t)(dividend / divisor);\n"
+             "        D(1) = (bee_word_t)(dividend %% divisor);\n"
+             "    }\n", here, here);
+        break;
+    case BEE_INSN_EQ:
+        binary("D(2) == D(1)");
+        break;
+    case BEE_INSN_LT:
+        binary("D(2) < D(1)");
+        break;
+    case BEE_INSN_ULT:
+        binary("(bee_uword_t)D(2) < (bee_uword_t)D(1)");
+        break;
+    case BEE_INSN_PUSHS:
+        emit("    CHECKD(1, 0, %s);\n"
+             "    CHECKS(0, 1, %s);\n"
+             "    S->s0[S->sp++] = S->d0[--S->dp];\n", here, here);
+        break;
+    case BEE_INSN_POPS:
+        emit("    CHECKS(1, 0, %s);\n"
+             "    CHECKD(0, 1, %s);\n"
+             "    S->d0[S->dp++] = S->s0[--S->sp];\n", here, here);
+        break;
+    case BEE_INSN_DUPS:
+        emit("    CHECKS(1, 1, %s);\n", here);
+        push("S->s0[S->sp - 1]");
+        break;
+    case BEE_INSN_WORD_BYTES:
+        push("BEE_WORD_BYTES");
+        break;
+    case BEE_INSN_GET_SSIZE:
+        push("S->ssize");
+        break;
+    case BEE_INSN_GET_SP:
+        push("S->sp");
+        break;
+    case BEE_INSN_SET_SP:
+        emit("    CHECKD(1, 0, %s);\n"
+             "    S->sp = (bee_uword_t)S->d0[--S->dp];\n", here);
+        break;
+    case BEE_INSN_GET_DSIZE:
+        push("S->dsize");
+        break;
+    case BEE_INSN_GET_DP:
+        push("S->dp");
+        break;
+    case BEE_INSN_SET_DP:
+        emit("    CHECKD(1, 0, %s);\n"
+             "    S->dp = (bee_uword_t)D(1);\n", here);
+        break;
+    case BEE_INSN_GET_HANDLER_SP:
+        push("S->handler_sp");
+        break;
+    default:
+        // JUMP, JUMPZ, CALL, CATCH, THROW, BREAK and invalid opcodes
+        emit("    EXIT(%s);\n", here);
+        return false;
+    }
+    return true;
+}
+
+// Compile the instruction word at `w`, and any following words that are
+// compiled with it. Return the number of words compiled, or 0 if control
+// cannot fall through to the next word.
+static unsigned compile_word(size_t w)
+{
+    bee_word_t ir = image[w];
+    size_t next = w + 1, t;
+    set_state(&here, next, (bee_uword_t)ir);
+    set_state(&after, next, 0);
+
+    switch (ir & BEE_OP1_MASK) {
+    case BEE_OP_CALLI:
+        {
+            // Push a large literal; the return address is still written,
+            // as by the interpreter.
+            unsigned words = literal_length(w);
+            if (words != 0) {
+                char *value = xasprintf("%#zx", (bee_uword_t)image[next]);
+                emit("    CHECKS(0, 1, %s);\n"
+                     "    S->s0[S->sp] = (bee_word_t)(M + %zu);\n", here, next);
+                push(value);
+                free(value);
+                return words;
+            }
+        }
+        t = target(next, ARSHIFT(ir, BEE_OP1_SHIFT));
+        if (t == NONE)
+            break;
+        emit("    CHECKS(0, 1, %s);\n"
+             "    S->s0[S->sp++] = (bee_word_t)(M + %zu);\n"
+             "    CALL(word_%zx, %zu);\n", here, next, t, next);
+        return 1;
+    case BEE_OP_PUSHI:
+        {
+            char *value = xasprintf("%zd", ARSHIFT(ir, BEE_OP1_SHIFT));
+            push(value);
+            free(value);
+        }
+        return 1;
+    case BEE_OP_PUSHRELI:
+        {
+            char *addr = xasprintf("M + (%zd)", (bee_word_t)next + ARSHIFT(ir, BEE_OP1_SHIFT));
+            push(addr);
+            free(addr);
+        }
+        return 1;
+    default:
+        switch (ir & BEE_OP2_MASK) {
+        case BEE_OP_JUMPI:
+            t = target(next, ARSHIFT(ir, BEE_OP2_SHIFT));
+            if (t == NONE)
+                break;
+            emit("    goto l_%zx;\n", t);
+            return 0;
+        case BEE_OP_JUMPZI:
+            t = target(next, ARSHIFT(ir, BEE_OP2_SHIFT));
+            if (t == NONE)
+                break;
+            emit("    CHECKD(1, 0, %s);\n"
+                 "    if (S->d0[--S->dp] == 0) goto l_%zx;\n", here, t);
+            return 1;
+        case BEE_OP_TRAP:
+            // Errors are returned, as the interpreter does when there is
+            // no handler, and compiled code cannot run CATCH.
+            emit("    {\n"
+                 "        bee_word_t error = bee_trap(S, %#zx);\n"
+                 "        if (error != BEE_ERROR_OK) return error;\n"
+                 "    }\n", (bee_uword_t)ir >> BEE_OP2_SHIFT);
+            return 1;
+        case BEE_OP_INSN:
+            for (bee_uword_t ops = (bee_uword_t)ir >> BEE_OP2_SHIFT; ; ops >>= BEE_INSN_BITS) {
+                bee_uword_t opcode = ops & BEE_INSN_MASK;
+                if (opcode == BEE_INSN_NOP)
+                    return 1;
+                set_state(&here, next, (ops << BEE_OP2_SHIFT) | BEE_OP_INSN);
+                set_state(&after, next, ((ops >> BEE_INSN_BITS) << BEE_OP2_SHIFT) | BEE_OP_INSN);
+                if (!compile_insn(opcode))
+                    return 0;
+            }
+        default:
+            break;
+        }
+    }
+    emit("    EXIT(%s);\n", here);
+    return 0;
+}
+
+// Compile the code marked with `mark`, as the function that starts at
+// `entry`.
+static void compile_function(size_t mark, size_t entry)
+{
+    emit("\nstatic bee_word_t word_%zx(bee_state * restrict S)\n{\n", entry);
+    bool first = true;
+    for (size_t w = 0; w < image_words; w++) {
+        if (seen[w] != mark)
+            continue;
+        // Words are compiled in address order, so control falls through
+        // from each word to the next, but the entry point may not be first.
+        if (first && w != entry) {
+            emit("    goto l_%zx;\n", entry);
+            label[entry] = mark;
+        }
+        first = false;
+        if (label[w] == mark)
+            emit("l_%zx:\n", w);
+        unsigned words = compile_word(w);
+        if (words == 0)
+            continue;
+        size_t next = w + words;
+        if (next == image_words) {
+            set_state(&here, image_words, 0);
+            emit("    EXIT(%s);\n", here);
+        } else
+            // Words skipped by a large literal may be compiled in between.
+            for (size_t i = w + 1; i < next; i++)
+                if (seen[i] == mark) {
+                    emit("    goto l_%zx;\n", next);
+                    label[next] = mark;
+                    break;
+                }
+    }
+    emit("}\n");
+}
+
+static const char *prelude =
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "\n"
+    "#include <bee/bee.h>\n"
+    "\n"
+    "// Return code meaning that the interpreter should resume at S->pc and S->ir\n"
+    "#define INTERPRET 1\n"
+    "\n"
+    "// VM memory\n"
+    "static bee_word_t *M;\n"
+    "\n"
+    "// Resume the interpreter at word `w` of memory with ir `i`.\n"
+    "#define EXIT(w, i) do { S->pc = M + (w); S->ir = (bee_word_t)(i); return INTERPRET; } while (0)\n"
+    "\n"
+    "// The nth item on the data stack, counting from 1\n"
+    "#define D(n) S->d0[S->dp - (n)]\n"
+    "\n"
+    "static inline int bad_stack(bee_uword_t size, bee_uword_t sp, bee_uword_t pops, bee_uword_t pushes)\n"
+    "{\n"
+    "    return pops > sp || sp > size || size - (sp - pops) < pushes;\n"
+    "}\n"
+    "#define CHECKD(pops, pushes, w, i) if (bad_stack(S->dsize, S->dp, pops, pushes)) EXIT(w, i)\n"
+    "#define CHECKS(pops, pushes, w, i) if (bad_stack(S->ssize, S->sp, pops, pushes)) EXIT(w, i)\n"
+    "\n"
+    "#define UNALIGNED(a, n) ((bee_uword_t)(a) % (n) != 0)\n"
+    "#define ARSHIFT(n, p) ((n) < 0 ? ~(~(n) >> (p)) : (n) >> (p))\n"
+    "\n"
+    "// Call compiled function `f`, which should return to word `ret`.\n"
+    "#define CALL(f, ret)                                    \\\n"
+    "    do {                                                \\\n"
+    "        bee_word_t _error = f(S);                       \\\n"
+    "        if (_error != BEE_ERROR_OK)                     \\\n"
+    "            return _error;                              \\\n"
+    "        if (S->pc != M + (ret)) {                       \\\n"
+    "            S->ir = 0;                                  \\\n"
+    "            return INTERPRET;                           \\\n"
+    "        }                                               \\\n"
+    "    } while (0)\n";
+
+static void compile(const char *name)
+{
+    seen = malloc(image_words * sizeof(size_t));
+    label = malloc(image_words * sizeof(size_t));
+    is_entry = calloc(image_words, sizeof(bool));
+    is_code = calloc(image_words, sizeof(bool));
+    size_t *entries = malloc(image_words * sizeof(size_t)), nentries = 0;
+    if (seen == NULL || label == NULL || is_entry == NULL || is_code == NULL || entries == NULL)
+        die("could not allocate memory");
+    for (size_t w = 0; w < image_words; w++)
+        seen[w] = label[w] = NONE;
+
+    // Find the code reachable from the start of the object file.
+    if (image_words > 0) {
+        is_entry[0] = true;
+        entries[nentries++] = 0;
+    }
+    for (size_t f = 0; f < nentries; f++)
+        explore(f, entries[f], entries, &nentries);
+
+    emit("// Generated by bee2c from %s.\n\n", name);
+    emit("%s", prelude);
+    emit("\n#define IMAGE_WORDS %zu\n", image_words);
+    emit("#define MEMORY_WORDS %zu\n",
+         image_words > DEFAULT_MEMORY ? image_words : (size_t)DEFAULT_MEMORY);
+    emit("\nstatic const bee_uword_t image[IMAGE_WORDS + 1] = {");
+    for (size_t w = 0; w < image_words; w++)
+        emit("%s%#zx,", w % 4 == 0 ? "\n    " : " ", (bee_uword_t)image[w]);
+    emit("\n};\n");
+
+    emit("\n// Bit map of the words of compiled code\n"
+         "static const unsigned char code_map[IMAGE_WORDS / 8 + 1] = {");
+    for (size_t w = 0; w < image_words; w += 8) {
+        unsigned bits = 0;
+        for (size_t i = 0; i < 8 && w + i < image_words; i++)
+            bits |= (unsigned)is_code[w + i] << i;
+        emit("%s%#x,", w % 64 == 0 ? "\n    " : " ", bits);
+    }
+    emit("\n};\n"
+         "\n"
+         "static inline int is_code(void *addr)\n"
+         "{\n"
+         "    bee_uword_t w = (bee_uword_t)((char *)addr - (char *)M) / BEE_WORD_BYTES;\n"
+         "    return w < IMAGE_WORDS && (code_map[w / 8] >> (w %% 8) & 1);\n"
+         "}\n\n");
+
+    for (size_t f = 0; f < nentries; f++)
+        emit("static bee_word_t word_%zx(bee_state * restrict S);\n", entries[f]);
+    // Explore each function again just before compiling it, as later
+    // functions may have marked the words it shares with them.
+    for (size_t f = 0; f < nentries; f++) {
+        explore(nentries + f, entries[f], entries, &nentries);
+        compile_function(nentries + f, entries[f]);
+    }
+
+    emit("\nint main(int argc, char *argv[])\n"
+         "{\n"
+         "    if ((M = calloc(MEMORY_WORDS, BEE_WORD_BYTES)) == NULL) {\n"
+         "        fprintf(stderr, \"could not allocate %%d words of memory\\n\", MEMORY_WORDS);\n"
+         "        return 1;\n"
+         "    }\n"
+         "    memcpy(M, image, IMAGE_WORDS * BEE_WORD_BYTES);\n"
+         "    bee_state * restrict S = bee_init(M, BEE_DEFAULT_STACK_SIZE, BEE_DEFAULT_STACK_SIZE);\n"
+         "    if (S == NULL) {\n"
+         "        fprintf(stderr, \"could not allocate Bee state\\n\");\n"
+         "        return 1;\n"
+         "    }\n"
+         "    bee_register_args(argc, (const char **)argv);\n"
+         "\n");
+    if (image_words > 0)
+        emit("    bee_word_t ret = word_0(S);\n"
+             "    // If the code returned, carry on from where it returned to.\n"
+             "    if (ret == BEE_ERROR_OK)\n"
+             "        S->ir = 0;\n"
+             "    if (ret == BEE_ERROR_OK || ret == INTERPRET)\n"
+             "        ret = bee_run(S);\n");
+    else
+        emit("    bee_word_t ret = bee_run(S);\n");
+    emit("    bee_destroy(S);\n"
+         "    bee_finish();\n"
+         "    free(M);\n"
+         "    return ret;\n"
+         "}\n");
+
+    free(entries);
+    free(seen);
+    free(label);
+    free(is_entry);
+    free(is_code);
+    free(here);
+    free(after);
+}
+
+
+// Options table
+struct option longopts[] = {
+#define OPT(longname, shortname, arg, argstring, docstring) \
+  {longname, arg, NULL, shortname},
+#define ARG(argstring, docstring)
+#define DOC(docstring)
+#include "bee2c-cmdline.h"
+#undef OPT
+#undef ARG
+#undef DOC
+  {0, 0, 0, 0}
+};
+
+#define COPYRIGHT_STRING "(c) Reuben Thomas 2023"
+
+static void usage(void)
+{
+    char *shortopt, *buf;
+    printf ("Usage: %s [OPTION...] OBJECT-FILE\n"
+            "\n"
+            "Compile a " PACKAGE_NAME " object file to C.\n"
+            "\n",
+            program_name);
+#define OPT(longname, shortname, arg, argstring, docstring)             \
+    shortopt = xasprintf(", -%c ", shortname);                           \
+    buf = xasprintf("--%s%s%s", longname, shortname ? shortopt : (arg != no_argument ? "=" : ""), argstring); \
+    printf("  %-26s%s\n", buf, docstring);                              \
+    free(buf);                                                          \
+    free(shortopt);
+#define ARG(argstring, docstring)                 \
+    printf("  %-26s%s\n", argstring, docstring);
+#define DOC(text)                                 \
+    printf(text "\n");
+#include "bee2c-cmdline.h"
+#undef OPT
+#undef ARG
+#undef DOC
+}
+
+int main(int argc, char *argv[])
+{
+    set_program_name(argv[0]);
+
+    const char *output = NULL;
+    for (;;) {
+        int this_optind = optind ? optind : 1, longindex = -1;
+        int c = getopt_long(argc, argv, ":o:", longopts, &longindex);
+
+        if (c == -1)
+            break;
+        else if (c == ':')
+            die("option '%s' requires an argument", argv[this_optind]);
+        else if (c == '?')
+            die("unrecognised option '%s'\nTry '%s --help' for more information.", argv[this_optind], program_name);
+        else if (c == 'o')
+            longindex = 0;
+
+        switch (longindex) {
+            case 0:
+                output = optarg;
+                break;
+            case 1:
+                usage();
+                exit(EXIT_SUCCESS);
+            case 2:
+                printf("bee2c (" PACKAGE_NAME ") " VERSION " (%d-bit)\n"
+                       COPYRIGHT_STRING "\n"
+                       PACKAGE_NAME " comes with ABSOLUTELY NO WARRANTY.\n"
+                       "You may redistribute copies of " PACKAGE_NAME "\n"
+                       "under the terms of the GNU General Public License.\n"
+                       "For more information about these matters, see the file named COPYING.\n",
+                       BEE_WORD_BIT);
+                exit(EXIT_SUCCESS);
+            default:
+                break;
+            }
+    }
+
+    if (argc - optind != 1) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+    object_name = argv[optind];
+    FILE *handle = fopen(object_name, "rb");
+    if (handle == NULL)
+        die("cannot open file %s", object_name);
+    if (!load_object(handle))
+        die("could not read file %s", object_name);
+
+    out = stdout;
+    if (output != NULL && (out = fopen(output, "w")) == NULL)
+        die("cannot open file %s", output);
+    compile(object_name);
+    if (fclose(out) == EOF)
+        die("error writing output");
+    free(image);
+    return EXIT_SUCCESS;
+}
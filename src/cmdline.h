@@ -27,6 +27,13 @@ OPT("stack", 's', required_argument, "NUMBER", MEMORY_MESSAGE("data stack", MAX_
 OPT("return-stack", 'r', required_argument, "NUMBER", MEMORY_MESSAGE("return stack", MAX_MEMORY, BEE_DEFAULT_STACK_SIZE))
 OPT("gdb", '\0', optional_argument, "IN,OUT", "start as remote target for GDB; use file descriptors\n"
   "                            IN and OUT [default stdin and stdout]")
+OPT("jit", '\0', required_argument, "COMPILER", "compile hot code with COMPILER: none, trace,\n"
+  "                            register, template or mijit, if available\n"
+  "                            [default " DEFAULT_JIT "]")
+OPT("perf-map", '\0', optional_argument, "SYMBOLS", "write /tmp/perf-PID.map for perf, naming compiled\n"
+  "                            code after symbols listed by nm in file SYMBOLS")
+OPT("profile", '\0', required_argument, "FILE", "count calls and loops, compiling nothing, and write\n"
+  "                            the counts to FILE on exit, for bee-opt --profile")
 OPT("help", '\0', no_argument, "", "display this help message and exit")
 OPT("version", '\0', no_argument, "", "display version information and exit")
 ARG("OBJECT-FILE", "load and run object OBJECT-FILE")
@@ -226,6 +226,7 @@ static int handle_exception(bee_state * restrict S)
                 && *in_ptr++ == ':'
                 && length <= BUFFER_SIZE / 2) {
                 hex_to_mem(in_ptr, (uint8_t *)addr, length);
+                bee_invalidate((void *)addr, length);
                 strcpy(out_ptr, "OK");
             } else
                 strcpy(out_ptr, "E02");
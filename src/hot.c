@@ -0,0 +1,414 @@
+// Hot-spot detection for tiered execution.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bee/bee.h"
+
+#include "private.h"
+
+
+// Code starts out interpreted. The interpreter counts calls to each call
+// target and backward branches to each loop head; when a counter reaches
+// the threshold, the code at that address is handed to the JIT.
+// A threshold of 0 turns counting off. `hot_jit` is the compiler used.
+#ifdef HAVE_MIJIT
+int hot_jit = BEE_JIT_MIJIT;
+bee_uword_t hot_threshold = BEE_DEFAULT_HOT_THRESHOLD;
+#else
+int hot_jit = BEE_JIT_NONE;
+bee_uword_t hot_threshold = 0;
+#endif
+
+void bee_set_hot_threshold(bee_uword_t threshold)
+{
+    hot_threshold = threshold;
+}
+
+static void invalidate_all(void);
+
+int bee_set_jit(int jit)
+{
+    switch (jit) {
+    case BEE_JIT_NONE:
+        hot_threshold = trace_threshold = 0;
+        break;
+    case BEE_JIT_TRACE:
+        hot_threshold = 0;
+        trace_threshold = BEE_DEFAULT_TRACE_THRESHOLD;
+        break;
+    case BEE_JIT_REGISTER:
+#ifdef HAVE_TEMPLATE_JIT
+    case BEE_JIT_TEMPLATE:
+#endif
+#ifdef HAVE_MIJIT
+    case BEE_JIT_MIJIT:
+#endif
+        hot_threshold = BEE_DEFAULT_HOT_THRESHOLD;
+        trace_threshold = 0;
+        break;
+    default:
+        return -1;
+    }
+    // Code compiled by another tier would otherwise still be run.
+    if (jit != hot_jit)
+        invalidate_all();
+    hot_jit = jit;
+    return 0;
+}
+
+
+// Counters are kept in an open-addressed hash table keyed on address.
+static hot_counter *counters = NULL;
+static bee_uword_t counters_size = 0; // Always 0 or a power of 2
+static bee_uword_t counters_used = 0;
+
+#define INITIAL_COUNTERS 256
+
+static bee_uword_t hash(bee_word_t *addr)
+{
+    // Word addresses have zero low bits; mix in the high bits.
+    bee_uword_t h = (bee_uword_t)addr / BEE_WORD_BYTES;
+    return h ^ (h >> 16);
+}
+
+// Find the slot for `addr` in `table`, which must not be full.
+static _GL_ATTRIBUTE_PURE hot_counter *find(hot_counter *table, bee_uword_t size, bee_word_t *addr)
+{
+    bee_uword_t i = hash(addr) & (size - 1);
+    while (table[i].addr != NULL && table[i].addr != addr)
+        i = (i + 1) & (size - 1);
+    return &table[i];
+}
+
+static bool grow(void)
+{
+    bee_uword_t new_size = counters_size == 0 ? INITIAL_COUNTERS : counters_size * 2;
+    hot_counter *new_counters = calloc(new_size, sizeof(hot_counter));
+    if (new_counters == NULL)
+        return false;
+    for (bee_uword_t i = 0; i < counters_size; i++)
+        if (counters[i].addr != NULL)
+            *find(new_counters, new_size, counters[i].addr) = counters[i];
+    free(counters);
+    counters = new_counters;
+    counters_size = new_size;
+    return true;
+}
+
+_GL_ATTRIBUTE_PURE hot_counter *hot_lookup(bee_word_t *addr)
+{
+    if (counters_size == 0)
+        return NULL;
+    hot_counter *c = find(counters, counters_size, addr);
+    return c->addr == NULL ? NULL : c;
+}
+
+hot_counter *hot_counter_for(bee_word_t *addr)
+{
+    hot_counter *c = hot_lookup(addr);
+    if (c != NULL)
+        return c;
+    // Keep the table at most three-quarters full.
+    if ((counters_used + 1) * 4 > counters_size * 3 && !grow())
+        return NULL;
+    c = find(counters, counters_size, addr);
+    c->addr = addr;
+    counters_used++;
+    return c;
+}
+
+
+// Self-modifying code
+//
+// Each translation of code (trace, or native code) records the ranges of
+// code it was made from, including any inlined words and, for the template
+// JIT, code it is linked to. The words in these ranges are kept in a set.
+// A write to any of them, by the interpreter, a trap, or the host program
+// (see bee_invalidate), discards every translation made from it; the code
+// is translated afresh if it becomes hot again. Compiled code does not
+// write to code itself: it returns to the interpreter first.
+//
+// The set is rebuilt from scratch after each invalidation, which is
+// expected to be rare.
+bee_word_t *hot_code_start = NULL, *hot_code_end = NULL;
+bee_uword_t hot_invalidations = 0;
+
+static bee_word_t **code_words = NULL;
+static bee_uword_t code_words_size = 0; // Always 0 or a power of 2
+static bee_uword_t code_words_used = 0;
+
+// Ranges noted since the last call to hot_translated()
+static code_range *noted = NULL;
+static size_t nnoted = 0, noted_size = 0;
+static bool noted_failed = false;
+
+// Find the slot for `w` in `table`, which must not be full.
+static _GL_ATTRIBUTE_PURE bee_word_t **find_word(bee_word_t **table, bee_uword_t size, bee_word_t *w)
+{
+    bee_uword_t i = hash(w) & (size - 1);
+    while (table[i] != NULL && table[i] != w)
+        i = (i + 1) & (size - 1);
+    return &table[i];
+}
+
+static bool add_word(bee_word_t *w)
+{
+    // Keep the table at most three-quarters full.
+    if ((code_words_used + 1) * 4 > code_words_size * 3) {
+        bee_uword_t new_size = code_words_size == 0 ? INITIAL_COUNTERS : code_words_size * 2;
+        bee_word_t **new_words = calloc(new_size, sizeof(bee_word_t *));
+        if (new_words == NULL)
+            return false;
+        for (bee_uword_t i = 0; i < code_words_size; i++)
+            if (code_words[i] != NULL)
+                *find_word(new_words, new_size, code_words[i]) = code_words[i];
+        free(code_words);
+        code_words = new_words;
+        code_words_size = new_size;
+    }
+    bee_word_t **slot = find_word(code_words, code_words_size, w);
+    if (*slot == NULL) {
+        *slot = w;
+        code_words_used++;
+    }
+    return true;
+}
+
+static bool add_range(code_range r)
+{
+    for (bee_word_t *w = r.start; w < r.end; w++)
+        if (!add_word(w))
+            return false;
+    if (hot_code_start == NULL || r.start < hot_code_start)
+        hot_code_start = r.start;
+    if (r.end > hot_code_end)
+        hot_code_end = r.end;
+    return true;
+}
+
+static void clear_code_words(void)
+{
+    free(code_words);
+    code_words = NULL;
+    code_words_size = code_words_used = 0;
+    hot_code_start = hot_code_end = NULL;
+}
+
+// Tell compiled code that the set of code words has changed.
+static void code_changed(void)
+{
+#ifdef HAVE_MIJIT
+    mijit_bee_set_code_bounds(bee_jit, hot_code_start, hot_code_end);
+#endif
+}
+
+void hot_code(bee_word_t *start, bee_word_t *end)
+{
+    if (nnoted > 0 && noted[nnoted - 1].end == start) {
+        noted[nnoted - 1].end = end;
+        return;
+    }
+    if (nnoted == noted_size) {
+        size_t new_size = noted_size == 0 ? 16 : noted_size * 2;
+        code_range *new_noted = realloc(noted, new_size * sizeof(code_range));
+        if (new_noted == NULL) {
+            noted_failed = true;
+            return;
+        }
+        noted = new_noted;
+        noted_size = new_size;
+    }
+    noted[nnoted++] = (code_range){start, end};
+}
+
+bool hot_translated(hot_counter *c)
+{
+    bool ok = !noted_failed;
+    if (c != NULL && ok && nnoted > 0) {
+        code_range *ranges = realloc(c->ranges, (c->nranges + nnoted) * sizeof(code_range));
+        if (ranges == NULL)
+            ok = false;
+        else {
+            c->ranges = ranges;
+            for (size_t i = 0; i < nnoted; i++) {
+                c->ranges[c->nranges++] = noted[i];
+                ok = ok && add_range(noted[i]);
+            }
+            code_changed();
+        }
+    }
+    nnoted = 0;
+    noted_failed = false;
+    return ok;
+}
+
+_GL_ATTRIBUTE_PURE bool hot_is_code(void *addr, bee_uword_t bytes)
+{
+    bee_word_t *start = (bee_word_t *)((bee_uword_t)addr & -(bee_uword_t)BEE_WORD_BYTES);
+    bee_word_t *end = (bee_word_t *)ALIGN((uint8_t *)addr + bytes);
+    if (start < hot_code_start)
+        start = hot_code_start;
+    if (end > hot_code_end)
+        end = hot_code_end;
+    for (bee_word_t *w = start; w < end; w++)
+        if (*find_word(code_words, code_words_size, w) != NULL)
+            return true;
+    return false;
+}
+
+// Discard the translations made for `c`.
+static void invalidate(hot_counter *c)
+{
+    trace_free(c->trace);
+    c->trace = NULL;
+    regvm_free(c->block);
+    c->block = NULL;
+    c->code = NULL;
+#ifdef HAVE_MIJIT
+    if (c->compiled)
+        mijit_bee_invalidate(bee_jit, c->addr);
+#endif
+    c->compiled = false;
+    c->count = 0;
+    free(c->ranges);
+    c->ranges = NULL;
+    c->nranges = 0;
+}
+
+// Discard all translations.
+static void invalidate_all(void)
+{
+    for (bee_uword_t i = 0; i < counters_size; i++)
+        if (counters[i].addr != NULL)
+            invalidate(&counters[i]);
+    clear_code_words();
+    code_changed();
+}
+
+// Rebuild the set of code words from the translations that remain.
+static bool rebuild_code_words(void)
+{
+    clear_code_words();
+    for (bee_uword_t i = 0; i < counters_size; i++)
+        for (size_t j = 0; j < counters[i].nranges; j++)
+            if (!add_range(counters[i].ranges[j]))
+                return false;
+    return true;
+}
+
+void bee_invalidate(void *addr, bee_uword_t bytes)
+{
+    verified_invalidate(addr, bytes);
+    if (!hot_is_code(addr, bytes))
+        return;
+
+    uint8_t *start = addr, *end = start + bytes;
+    for (bee_uword_t i = 0; i < counters_size; i++)
+        for (size_t j = 0; j < counters[i].nranges; j++)
+            if ((uint8_t *)counters[i].ranges[j].start < end &&
+                (uint8_t *)counters[i].ranges[j].end > start) {
+                invalidate(&counters[i]);
+                break;
+            }
+    hot_invalidations++;
+
+    // If memory runs out, discard all translations.
+    if (!rebuild_code_words())
+        invalidate_all();
+    else
+        code_changed();
+}
+
+
+bee_uword_t hot_count(bee_word_t *addr)
+{
+    hot_counter *c = hot_counter_for(addr);
+    // If memory is short, just don't compile.
+    if (c == NULL)
+        return 0;
+    if (++c->count == hot_threshold) {
+        bool translated = false;
+        switch (hot_jit) {
+        case BEE_JIT_REGISTER:
+            translated = (c->block = regvm_compile(addr)) != NULL;
+            break;
+#ifdef HAVE_TEMPLATE_JIT
+        case BEE_JIT_TEMPLATE:
+            translated = (c->code = jit_compile(addr)) != NULL;
+            break;
+#endif
+#ifdef HAVE_MIJIT
+        case BEE_JIT_MIJIT:
+            translated = c->compiled = mijit_bee_compile(bee_jit, addr, hot_code);
+            break;
+#endif
+        default:
+            break;
+        }
+        if (!hot_translated(translated ? c : NULL) && translated)
+            invalidate(c);
+    }
+    return c->count;
+}
+
+_GL_ATTRIBUTE_PURE bee_uword_t bee_hot_count(bee_word_t *addr)
+{
+    hot_counter *c = hot_lookup(addr);
+    return c == NULL ? 0 : c->count;
+}
+
+int bee_write_profile(const char *file, bee_word_t *base, bee_uword_t bytes)
+{
+    FILE *fp = fopen(file, "w");
+    if (fp == NULL)
+        return -1;
+    for (bee_uword_t i = 0; i < counters_size; i++) {
+        bee_uword_t offset = (uint8_t *)counters[i].addr - (uint8_t *)base;
+        if (counters[i].addr != NULL && offset < bytes)
+            fprintf(fp, "%zx %zu\n", offset, counters[i].count);
+    }
+    return fclose(fp) == EOF ? -1 : 0;
+}
+
+// Counts of hits and misses in the inline caches of compiled code
+bee_uword_t hot_cache_hits = 0, hot_cache_misses = 0;
+
+void bee_cache_stats(bee_uword_t *hits, bee_uword_t *misses)
+{
+    *hits = hot_cache_hits;
+    *misses = hot_cache_misses;
+}
+
+void hot_reset(void)
+{
+    for (bee_uword_t i = 0; i < counters_size; i++)
+        if (counters[i].addr != NULL) {
+            trace_free(counters[i].trace);
+            regvm_free(counters[i].block);
+            free(counters[i].ranges);
+        }
+    free(counters);
+    counters = NULL;
+    counters_size = counters_used = 0;
+    clear_code_words();
+    free(noted);
+    noted = NULL;
+    nnoted = noted_size = 0;
+    noted_failed = false;
+#ifdef HAVE_TEMPLATE_JIT
+    jit_reset();
+#endif
+}
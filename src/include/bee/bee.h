@@ -59,8 +59,88 @@ int bee_push_stack(bee_word_t *s0, bee_uword_t ssize, bee_uword_t *sp, bee_word_
 bee_state *bee_init(bee_word_t *pc, bee_uword_t stack_size, bee_uword_t return_stack_size);
 void bee_destroy(bee_state * restrict S);
 bee_word_t bee_run(bee_state * restrict S);
+// Free what all VM states share: the JIT, compiled code, profiles, streams
+// and asynchronous operations, which are waited for. Call after the last
+// bee_destroy().
+void bee_finish(void);
 
 void bee_register_args(int argc, const char *argv[]);
+// Run trap `code`, as the TRAP instruction does, for compiled code.
+bee_word_t bee_trap(bee_state * restrict S, bee_uword_t code);
+
+// Trap libraries
+// A trap library is a table of functions, selected by the number on top of
+// the data stack. Each function declares how many arguments it takes from
+// the data stack, and how many results it leaves in their place. The stack
+// is checked once before the function is called with `args` pointing at
+// the deepest argument; it writes its results from there upwards, and
+// returns an error code, leaving the stack as it was on error.
+typedef bee_word_t bee_trap_fn(bee_state * restrict S, bee_word_t *args);
+typedef struct bee_trap_function {
+    bee_trap_fn *fn; // NULL for an invalid function number
+    bee_uword_t dpops, dpushes;
+} bee_trap_function;
+// Make TRAP `code` call the `nfunctions` functions in `table`, which must
+// remain valid. The built-in libraries, libc (TRAP 0), FFI (TRAP 1),
+// memory (TRAP 2), hash tables (TRAP 3), text (TRAP 4), buffered streams
+// (TRAP 5) and asynchronous I/O (TRAP 6), can be replaced. Returns 0 on
+// success, or -1 if memory runs out.
+int bee_register_trap_library(bee_uword_t code, const bee_trap_function *table, bee_uword_t nfunctions);
+
+// Tiered execution
+// Code is compiled by the JIT once it has been called, or has branched
+// backwards to, the given number of times. 0 means never.
+#define BEE_DEFAULT_HOT_THRESHOLD 100
+void bee_set_hot_threshold(bee_uword_t threshold);
+bee_uword_t bee_hot_count(bee_word_t *addr);
+// A loop is traced once it has branched backwards to its head the given
+// number of times. 0, the default, means never.
+void bee_set_trace_threshold(bee_uword_t threshold);
+#define BEE_DEFAULT_TRACE_THRESHOLD 10
+// Select the compiler used for hot code, with default thresholds.
+// Changing the compiler discards code compiled by the previous one.
+// Returns 0 on success, or -1 if the compiler is not available.
+enum {
+    BEE_JIT_NONE,
+    BEE_JIT_TRACE,
+    BEE_JIT_TEMPLATE,
+    BEE_JIT_MIJIT,
+    BEE_JIT_REGISTER, // Portable: translates hot blocks to a register VM
+};
+int bee_set_jit(int jit);
+// Discard any compiled code made from the `bytes` bytes at `addr`, which
+// have been written other than by the VM, and verify them again.
+void bee_invalidate(void *addr, bee_uword_t bytes);
+// Computed calls and jumps in compiled code remember the targets they
+// have recently reached. Return the number of times that the target was
+// found, and not found, for tuning.
+void bee_cache_stats(bee_uword_t *hits, bee_uword_t *misses);
+
+// Verification
+// Check the code in the `bytes` bytes at `code`, so that, when no JIT is
+// in use, the interpreter can run it without checking each instruction.
+// The code need not be valid: any part that cannot be verified is run
+// with checks. Returns 0 on success, or -1 if memory runs out.
+int bee_verify(bee_word_t *code, bee_uword_t bytes);
+
+// Profiling
+// Write /tmp/perf-PID.map, which Linux perf uses to name native code, for
+// code compiled from now on. Each region is named after the last of the
+// `nsymbols` symbols, sorted by address, at or before the code it was
+// compiled from, or if none, after its offset from `base`. `symbols` must
+// remain valid until bee_finish(). Returns 0 on success, or -1 if the
+// file cannot be opened.
+typedef struct bee_symbol {
+    bee_word_t *addr;
+    const char *name;
+} bee_symbol;
+int bee_perf_map(bee_word_t *base, const bee_symbol *symbols, bee_uword_t nsymbols);
+// Write the counts made so far of calls to each address, and backward
+// branches to each loop head, for addresses in the `bytes` bytes at `base`,
+// to `file`. Each line gives the offset of the address from `base` in hex,
+// then the count. Counting is done only while the hot threshold is not 0
+// (see bee_set_hot_threshold()). Returns 0 on success, or -1 on error.
+int bee_write_profile(const char *file, bee_word_t *base, bee_uword_t bytes);
 
 
 #endif
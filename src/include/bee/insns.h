@@ -0,0 +1,289 @@
+/* Bee instruction specification.
+
+   (c) Reuben Thomas 2023
+
+   The package is distributed under the GNU General Public License version 3,
+   or, at your option, any later version.
+
+   THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+   RISK.  */
+
+
+/* This file describes each BEE_INSN_* instruction once, and is included
+   with BEE_INSN defined to generate the opcodes, the interpreter, the
+   verifier's stack effects and unchecked code, and the disassembler. The
+   Mijit back end's opcodes are generated from it by mijit-bee/build.rs.
+   There is no include guard, as it may be included more than once.
+
+   BEE_INSN(name, opcode, dpops, dpushes, spops, spushes, kind, semantics)
+
+   `dpops` is the number of items that the instruction needs on the data
+   stack, and `dpushes` the number it leaves there in their place;
+   `spops` and `spushes` are the same for the return stack. The
+   interpreter checks them before running the instruction.
+
+   `kind` is one of:
+
+   SAFE: cannot raise an error once the stacks have been checked
+   RAISES: may raise an error
+   DYNAMIC: changes the stacks other than as above
+   CONTROL: transfers control, or ends the instruction word
+
+   The semantics are C statements, run with `S` pointing to the bee_state,
+   that may use:
+
+   POP(), PUSH(value): pop and push the data stack
+   RPOP(), RPUSH(value): pop and push the return stack
+   RAISE(code): raise error `code`, leaving the state as it is
+   WRITTEN(addr, bytes): note that memory has been written; this must be
+     the last statement
+
+   The semantics of CONTROL instructions are specific to bee_run(), and may
+   use its other macros.
+
+   The optional list of BEE_FUSED(name1, name2) gives pairs of SAFE or
+   RAISES instructions that often occur together, for which engines can
+   generate combined code.  */
+
+BEE_INSN(NOP, 0x00, 0, 0, 0, 0, CONTROL,
+         goto end;)
+BEE_INSN(NOT, 0x01, 1, 1, 0, 0, SAFE,
+         bee_word_t a = POP();
+         PUSH(~a);)
+BEE_INSN(AND, 0x02, 2, 1, 0, 0, SAFE,
+         bee_word_t a = POP(), b = POP();
+         PUSH(a & b);)
+BEE_INSN(OR, 0x03, 2, 1, 0, 0, SAFE,
+         bee_word_t a = POP(), b = POP();
+         PUSH(a | b);)
+BEE_INSN(XOR, 0x04, 2, 1, 0, 0, SAFE,
+         bee_word_t a = POP(), b = POP();
+         PUSH(a ^ b);)
+BEE_INSN(LSHIFT, 0x05, 2, 1, 0, 0, SAFE,
+         bee_word_t shift = POP(), value = POP();
+         PUSH(shift < (bee_word_t)BEE_WORD_BIT ? LSHIFT(value, shift) : 0);)
+BEE_INSN(RSHIFT, 0x06, 2, 1, 0, 0, SAFE,
+         bee_word_t shift = POP(), value = POP();
+         PUSH(shift < (bee_word_t)BEE_WORD_BIT ? (bee_word_t)((bee_uword_t)value >> shift) : 0);)
+BEE_INSN(ARSHIFT, 0x07, 2, 1, 0, 0, SAFE,
+         bee_word_t shift = POP(), value = POP();
+         PUSH(ARSHIFT(value, shift));)
+BEE_INSN(POP, 0x08, 1, 0, 0, 0, SAFE,
+         S->dp--;)
+BEE_INSN(DUP, 0x09, 1, 1, 0, 0, RAISES,
+         bee_uword_t depth = S->d0[S->dp - 1];
+         if (depth >= S->dp - 1)
+             RAISE(BEE_ERROR_STACK_UNDERFLOW);
+         S->d0[S->dp - 1] = S->d0[S->dp - (depth + 2)];)
+BEE_INSN(SET, 0x0a, 2, 0, 0, 0, RAISES,
+         bee_uword_t depth = S->d0[S->dp - 1];
+         if (depth >= S->dp - 1)
+             RAISE(BEE_ERROR_STACK_UNDERFLOW);
+         S->dp--;
+         bee_word_t value = POP();
+         S->d0[S->dp - (depth + 1)] = value;)
+BEE_INSN(SWAP, 0x0b, 1, 0, 0, 0, RAISES,
+         bee_uword_t depth = S->d0[S->dp - 1];
+         if (S->dp == 1 || depth >= S->dp - 2)
+             RAISE(BEE_ERROR_STACK_UNDERFLOW);
+         S->dp--;
+         bee_word_t temp = S->d0[S->dp - (depth + 2)];
+         S->d0[S->dp - (depth + 2)] = S->d0[S->dp - 1];
+         S->d0[S->dp - 1] = temp;)
+BEE_INSN(JUMP, 0x0c, 1, 0, 0, 0, CONTROL,
+         bee_word_t *addr = (bee_word_t *)POP();
+         if (!IS_ALIGNED(addr))
+             RAISE(BEE_ERROR_UNALIGNED_ADDRESS);
+         JUMP_TO(addr);)
+BEE_INSN(JUMPZ, 0x0d, 2, 0, 0, 0, CONTROL,
+         bee_word_t *addr = (bee_word_t *)POP();
+         bee_word_t flag = POP();
+         if (flag == 0) {
+             if (!IS_ALIGNED(addr))
+                 RAISE(BEE_ERROR_UNALIGNED_ADDRESS);
+             JUMP_TO(addr);
+         })
+BEE_INSN(CALL, 0x0e, 1, 0, 0, 1, CONTROL,
+         bee_word_t *addr = (bee_word_t *)POP();
+         if (!IS_ALIGNED(addr))
+             RAISE(BEE_ERROR_UNALIGNED_ADDRESS);
+         RPUSH((bee_uword_t)S->pc);
+         COUNT_CALL(addr);
+         JUMP_TO(addr);)
+BEE_INSN(RET, 0x0f, 0, 0, 1, 0, CONTROL,
+         /* Returning from a CATCH also pops the handler, and pushes 0.  */
+         if (S->sp < S->handler_sp)
+             CHECKD(0, 1);
+         bee_word_t *addr = (bee_word_t *)RPOP();
+         if (!IS_ALIGNED(addr))
+             RAISE(BEE_ERROR_UNALIGNED_ADDRESS);
+         if (S->sp < S->handler_sp) {
+             POPS((bee_word_t *)&S->handler_sp);
+             PUSH(0);
+         }
+         JUMP_TO(addr);)
+BEE_INSN(LOAD, 0x10, 1, 1, 0, 0, RAISES,
+         bee_word_t *addr = (bee_word_t *)POP();
+         if (!IS_ALIGNED(addr))
+             RAISE(BEE_ERROR_UNALIGNED_ADDRESS);
+         PUSH(*addr);)
+BEE_INSN(STORE, 0x11, 2, 0, 0, 0, RAISES,
+         bee_word_t *addr = (bee_word_t *)POP();
+         if (!IS_ALIGNED(addr))
+             RAISE(BEE_ERROR_UNALIGNED_ADDRESS);
+         *addr = POP();
+         WRITTEN(addr, BEE_WORD_BYTES);)
+BEE_INSN(LOAD1, 0x12, 1, 1, 0, 0, SAFE,
+         uint8_t *addr = (uint8_t *)POP();
+         PUSH(*addr);)
+BEE_INSN(STORE1, 0x13, 2, 0, 0, 0, SAFE,
+         uint8_t *addr = (uint8_t *)POP();
+         *addr = (uint8_t)POP();
+         WRITTEN(addr, 1);)
+BEE_INSN(LOAD2, 0x14, 1, 1, 0, 0, RAISES,
+         uint16_t *addr = (uint16_t *)POP();
+         if ((bee_uword_t)addr % 2 != 0)
+             RAISE(BEE_ERROR_UNALIGNED_ADDRESS);
+         PUSH(*addr);)
+BEE_INSN(STORE2, 0x15, 2, 0, 0, 0, RAISES,
+         uint16_t *addr = (uint16_t *)POP();
+         if ((bee_uword_t)addr % 2 != 0)
+             RAISE(BEE_ERROR_UNALIGNED_ADDRESS);
+         *addr = (uint16_t)POP();
+         WRITTEN(addr, 2);)
+BEE_INSN(LOAD4, 0x16, 1, 1, 0, 0, RAISES,
+         uint32_t *addr = (uint32_t *)POP();
+         if ((bee_uword_t)addr % 4 != 0)
+             RAISE(BEE_ERROR_UNALIGNED_ADDRESS);
+         PUSH(*addr);)
+BEE_INSN(STORE4, 0x17, 2, 0, 0, 0, RAISES,
+         uint32_t *addr = (uint32_t *)POP();
+         if ((bee_uword_t)addr % 4 != 0)
+             RAISE(BEE_ERROR_UNALIGNED_ADDRESS);
+         *addr = (uint32_t)POP();
+         WRITTEN(addr, 4);)
+BEE_INSN(LOAD_IA, 0x18, 1, 2, 0, 0, RAISES,
+         bee_word_t *addr = (bee_word_t *)POP();
+         if (!IS_ALIGNED(addr))
+             RAISE(BEE_ERROR_UNALIGNED_ADDRESS);
+         PUSH(*addr);
+         PUSH(addr + 1);)
+BEE_INSN(STORE_DB, 0x19, 2, 1, 0, 0, RAISES,
+         bee_word_t *addr = (bee_word_t *)POP();
+         if (!IS_ALIGNED(addr))
+             RAISE(BEE_ERROR_UNALIGNED_ADDRESS);
+         addr[-1] = POP();
+         PUSH(addr - 1);
+         WRITTEN(addr - 1, BEE_WORD_BYTES);)
+BEE_INSN(LOAD_IB, 0x1a, 1, 2, 0, 0, RAISES,
+         bee_word_t *addr = (bee_word_t *)POP();
+         if (!IS_ALIGNED(addr))
+             RAISE(BEE_ERROR_UNALIGNED_ADDRESS);
+         PUSH(addr[1]);
+         PUSH(addr + 1);)
+BEE_INSN(STORE_DA, 0x1b, 2, 1, 0, 0, RAISES,
+         bee_word_t *addr = (bee_word_t *)POP();
+         if (!IS_ALIGNED(addr))
+             RAISE(BEE_ERROR_UNALIGNED_ADDRESS);
+         *addr = POP();
+         PUSH(addr - 1);
+         WRITTEN(addr, BEE_WORD_BYTES);)
+BEE_INSN(LOAD_DA, 0x1c, 1, 2, 0, 0, RAISES,
+         bee_word_t *addr = (bee_word_t *)POP();
+         if (!IS_ALIGNED(addr))
+             RAISE(BEE_ERROR_UNALIGNED_ADDRESS);
+         PUSH(*addr);
+         PUSH(addr - 1);)
+BEE_INSN(STORE_IB, 0x1d, 2, 1, 0, 0, RAISES,
+         bee_word_t *addr = (bee_word_t *)POP();
+         if (!IS_ALIGNED(addr))
+             RAISE(BEE_ERROR_UNALIGNED_ADDRESS);
+         addr[1] = POP();
+         PUSH(addr + 1);
+         WRITTEN(addr + 1, BEE_WORD_BYTES);)
+BEE_INSN(LOAD_DB, 0x1e, 1, 2, 0, 0, RAISES,
+         bee_word_t *addr = (bee_word_t *)POP();
+         if (!IS_ALIGNED(addr))
+             RAISE(BEE_ERROR_UNALIGNED_ADDRESS);
+         PUSH(addr[-1]);
+         PUSH(addr - 1);)
+BEE_INSN(STORE_IA, 0x1f, 2, 1, 0, 0, RAISES,
+         bee_word_t *addr = (bee_word_t *)POP();
+         if (!IS_ALIGNED(addr))
+             RAISE(BEE_ERROR_UNALIGNED_ADDRESS);
+         *addr = POP();
+         PUSH(addr + 1);
+         WRITTEN(addr, BEE_WORD_BYTES);)
+BEE_INSN(NEG, 0x20, 1, 1, 0, 0, SAFE,
+         bee_uword_t a = POP();
+         PUSH(-a);)
+BEE_INSN(ADD, 0x21, 2, 1, 0, 0, SAFE,
+         bee_uword_t a = POP(), b = POP();
+         PUSH(b + a);)
+BEE_INSN(MUL, 0x22, 2, 1, 0, 0, SAFE,
+         bee_uword_t a = POP(), b = POP();
+         PUSH(a * b);)
+BEE_INSN(DIVMOD, 0x23, 2, 2, 0, 0, SAFE,
+         bee_word_t divisor = POP(), dividend = POP();
+         if (dividend == BEE_WORD_MIN && divisor == -1) {
+             PUSH(BEE_WORD_MIN);
+             PUSH(0);
+         } else {
+             PUSH(DIV_CATCH_ZERO(dividend, divisor));
+             PUSH(MOD_CATCH_ZERO(dividend, divisor));
+         })
+BEE_INSN(UDIVMOD, 0x24, 2, 2, 0, 0, SAFE,
+         bee_uword_t divisor = POP(), dividend = POP();
+         PUSH(DIV_CATCH_ZERO(dividend, divisor));
+         PUSH(MOD_CATCH_ZERO(dividend, divisor));)
+BEE_INSN(EQ, 0x25, 2, 1, 0, 0, SAFE,
+         bee_word_t a = POP(), b = POP();
+         PUSH(a == b);)
+BEE_INSN(LT, 0x26, 2, 1, 0, 0, SAFE,
+         bee_word_t a = POP(), b = POP();
+         PUSH(b < a);)
+BEE_INSN(ULT, 0x27, 2, 1, 0, 0, SAFE,
+         bee_uword_t a = POP(), b = POP();
+         PUSH(b < a);)
+BEE_INSN(PUSHS, 0x28, 1, 0, 0, 1, SAFE,
+         RPUSH(POP());)
+BEE_INSN(POPS, 0x29, 0, 1, 1, 0, SAFE,
+         PUSH(RPOP());)
+BEE_INSN(DUPS, 0x2a, 0, 1, 1, 1, SAFE,
+         PUSH(S->s0[S->sp - 1]);)
+BEE_INSN(CATCH, 0x2b, 1, 0, 0, 2, CONTROL,
+         bee_word_t *addr = (bee_word_t *)POP();
+         if (!IS_ALIGNED(addr))
+             RAISE(BEE_ERROR_UNALIGNED_ADDRESS);
+         RPUSH(S->handler_sp);
+         RPUSH((bee_uword_t)S->pc);
+         S->handler_sp = S->sp;
+         JUMP_TO(addr);)
+BEE_INSN(THROW, 0x2c, 1, 0, 0, 0, CONTROL,
+         RAISE(POP());)
+BEE_INSN(BREAK, 0x2d, 0, 0, 0, 0, CONTROL,
+         return BEE_ERROR_BREAK;)
+BEE_INSN(WORD_BYTES, 0x2e, 0, 1, 0, 0, SAFE,
+         PUSH(BEE_WORD_BYTES);)
+BEE_INSN(GET_SSIZE, 0x31, 0, 1, 0, 0, SAFE,
+         PUSH(S->ssize);)
+BEE_INSN(GET_SP, 0x32, 0, 1, 0, 0, SAFE,
+         PUSH(S->sp);)
+BEE_INSN(SET_SP, 0x33, 1, 0, 0, 0, DYNAMIC,
+         S->sp = POP();)
+BEE_INSN(GET_DSIZE, 0x34, 0, 1, 0, 0, SAFE,
+         PUSH(S->dsize);)
+BEE_INSN(GET_DP, 0x35, 0, 1, 0, 0, SAFE,
+         PUSH(S->dp);)
+BEE_INSN(SET_DP, 0x36, 1, 0, 0, 0, DYNAMIC,
+         bee_word_t value = POP();
+         S->dp = value;)
+BEE_INSN(GET_HANDLER_SP, 0x37, 0, 1, 0, 0, SAFE,
+         PUSH(S->handler_sp);)
+
+#ifdef BEE_FUSED
+BEE_FUSED(ADD, LOAD)
+BEE_FUSED(ADD, STORE)
+BEE_FUSED(LOAD, ADD)
+BEE_FUSED(SWAP, POP)
+#endif
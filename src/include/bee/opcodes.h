@@ -78,72 +78,23 @@ enum {
 /* Largest trap code.  */
 #define BEE_MAX_TRAP ((1L << (BEE_WORD_BIT - BEE_OP2_SHIFT)) - 1)
 
-/* OP_INSN opcodes.  */
+/* OP_INSN opcodes; see insns.h.  */
 #define BEE_INSN_BITS 6
 #define BEE_INSN_MASK ((1 << BEE_INSN_BITS) - 1)
 enum {
-  BEE_INSN_NOP = 0,
-  BEE_INSN_NOT,
-  BEE_INSN_AND,
-  BEE_INSN_OR,
-  BEE_INSN_XOR,
-  BEE_INSN_LSHIFT,
-  BEE_INSN_RSHIFT,
-  BEE_INSN_ARSHIFT,
-  BEE_INSN_POP = 0x8,
-  BEE_INSN_DUP,
-  BEE_INSN_SET,
-  BEE_INSN_SWAP,
-  BEE_INSN_JUMP,
-  BEE_INSN_JUMPZ,
-  BEE_INSN_CALL,
-  BEE_INSN_RET,
-  BEE_INSN_LOAD = 0x10,
-  BEE_INSN_STORE,
-  BEE_INSN_LOAD1,
-  BEE_INSN_STORE1,
-  BEE_INSN_LOAD2,
-  BEE_INSN_STORE2,
-  BEE_INSN_LOAD4,
-  BEE_INSN_STORE4,
-  BEE_INSN_LOAD_IA = 0x18,
-  BEE_INSN_POP_FD = 0x18,
-  BEE_INSN_STORE_DB = 0x19,
-  BEE_INSN_PUSH_FD = 0x19,
-  BEE_INSN_LOAD_IB = 0x1a,
-  BEE_INSN_POP_ED = 0x1a,
-  BEE_INSN_STORE_DA = 0x1b,
-  BEE_INSN_PUSH_ED = 0x1b,
-  BEE_INSN_LOAD_DA = 0x1c,
-  BEE_INSN_POP_FA = 0x1c,
-  BEE_INSN_STORE_IB = 0x1d,
-  BEE_INSN_PUSH_FA = 0x1d,
-  BEE_INSN_LOAD_DB = 0x1e,
-  BEE_INSN_POP_EA = 0x1e,
-  BEE_INSN_STORE_IA = 0x1f,
-  BEE_INSN_PUSH_EA = 0x1f,
-  BEE_INSN_NEG = 0x20,
-  BEE_INSN_ADD,
-  BEE_INSN_MUL,
-  BEE_INSN_DIVMOD,
-  BEE_INSN_UDIVMOD,
-  BEE_INSN_EQ,
-  BEE_INSN_LT,
-  BEE_INSN_ULT,
-  BEE_INSN_PUSHS = 0x28,
-  BEE_INSN_POPS,
-  BEE_INSN_DUPS,
-  BEE_INSN_CATCH,
-  BEE_INSN_THROW,
-  BEE_INSN_BREAK,
-  BEE_INSN_WORD_BYTES,
-  BEE_INSN_GET_SSIZE = 0x31,
-  BEE_INSN_GET_SP,
-  BEE_INSN_SET_SP,
-  BEE_INSN_GET_DSIZE,
-  BEE_INSN_GET_DP,
-  BEE_INSN_SET_DP,
-  BEE_INSN_GET_HANDLER_SP,
+#define BEE_INSN(name, opcode, ...) BEE_INSN_##name = opcode,
+#include "bee/insns.h"
+#undef BEE_INSN
+
+  /* Aliases.  */
+  BEE_INSN_POP_FD = BEE_INSN_LOAD_IA,
+  BEE_INSN_PUSH_FD = BEE_INSN_STORE_DB,
+  BEE_INSN_POP_ED = BEE_INSN_LOAD_IB,
+  BEE_INSN_PUSH_ED = BEE_INSN_STORE_DA,
+  BEE_INSN_POP_FA = BEE_INSN_LOAD_DA,
+  BEE_INSN_PUSH_FA = BEE_INSN_STORE_IB,
+  BEE_INSN_POP_EA = BEE_INSN_LOAD_DB,
+  BEE_INSN_PUSH_EA = BEE_INSN_STORE_IA,
 
   BEE_INSN_UNDEFINED = 0x3f
 };
@@ -0,0 +1,1237 @@
+// Template JIT compiler for x86-64.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "verify.h"
+
+#include "bee/bee.h"
+#include "bee/opcodes.h"
+
+#include "private.h"
+
+
+// Each instruction is translated into a fixed template of machine code.
+// Templates only handle the common case: if a stack check, alignment
+// check or guard fails, the compiled code exits to the interpreter at the
+// instruction that was about to run, which then runs it, and raises any
+// error, exactly as it would have done anyway.
+//
+// Compiled code is entered with a pointer to the VM state, and returns an
+// error code (normally BEE_ERROR_OK), with pc and ir set to resume the
+// interpreter. While it runs, VM registers are held in host registers:
+//
+//   rbx: S    r12: d0    r13: dp    r14: s0    r15: sp
+//
+// rax, rcx, rdx and rsi are scratch registers.
+
+verify(BEE_WORD_BYTES == 8);
+
+enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+    NONE = -1,
+};
+
+// Condition codes
+enum {
+    CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5,
+    CC_BE = 0x6, CC_A = 0x7, CC_L = 0xc,
+};
+
+#define S_REG RBX
+#define D0_REG R12
+#define DP_REG R13
+#define S0_REG R14
+#define SP_REG R15
+
+#define STATE(field) S_REG, NONE, (int32_t)offsetof(bee_state, field)
+#define TOS D0_REG, DP_REG, -8
+#define NOS D0_REG, DP_REG, -16
+#define NEW D0_REG, DP_REG, 0
+#define RTOS S0_REG, SP_REG, -8
+#define RNEW S0_REG, SP_REG, 0
+
+
+// Code buffer
+static uint8_t *buf;
+static size_t buf_len, buf_size;
+static bool failed;
+
+static void byte(uint8_t b)
+{
+    if (buf_len == buf_size) {
+        size_t new_size = buf_size == 0 ? 4096 : buf_size * 2;
+        uint8_t *new_buf = realloc(buf, new_size);
+        if (new_buf == NULL) {
+            failed = true;
+            return;
+        }
+        buf = new_buf;
+        buf_size = new_size;
+    }
+    buf[buf_len++] = b;
+}
+
+static void emit(const uint8_t *b, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        byte(b[i]);
+}
+
+static void imm32(int32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        byte((uint8_t)((uint32_t)v >> (i * 8)));
+}
+
+static void imm64(int64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        byte((uint8_t)((uint64_t)v >> (i * 8)));
+}
+
+static void patch32(size_t at, int32_t v)
+{
+    if (!failed)
+        memcpy(buf + at, &v, 4);
+}
+
+
+// Instruction encoding
+static void rex(bool w, int reg, int index, int base)
+{
+    uint8_t r = 0x40 | (w << 3) |
+        (reg != NONE && reg >= R8) << 2 |
+        (index != NONE && index >= R8) << 1 |
+        (base != NONE && base >= R8);
+    if (r != 0x40)
+        byte(r);
+}
+
+// Instruction with a register and a memory operand
+// [base + index * 8 + disp]; `op` is the opcode bytes.
+static void insn_mem(bool w, const char *op, int reg, int base, int index, int32_t disp)
+{
+    if (op[0] == 0x66)
+        byte(*op++);
+    rex(w, reg, index, base);
+    emit((const uint8_t *)op, strlen(op));
+    byte(0x84 | (reg & 7) << 3); // mod = 10, rm = SIB
+    byte((index == NONE ? 4 << 3 : 3 << 6 | (index & 7) << 3) | (base & 7));
+    imm32(disp);
+}
+
+// Instruction with two register operands
+static void insn_reg(bool w, const char *op, int reg, int rm)
+{
+    rex(w, reg, NONE, rm);
+    emit((const uint8_t *)op, strlen(op));
+    byte(0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// Memory operands are given as base, index (or NONE), displacement.
+#define LOAD(r, ...) insn_mem(true, "\x8b", r, __VA_ARGS__)
+#define STORE(r, ...) insn_mem(true, "\x89", r, __VA_ARGS__)
+#define LEA(r, ...) insn_mem(true, "\x8d", r, __VA_ARGS__)
+#define MOV(dst, src) insn_reg(true, "\x89", src, dst)
+#define SUB(dst, src) insn_reg(true, "\x29", src, dst)
+#define CMP(a, b) insn_reg(true, "\x39", b, a)
+#define TEST(a, b) insn_reg(true, "\x85", b, a)
+#define XOR32(dst, src) insn_reg(false, "\x31", src, dst)
+#define CMP_MEM(r, ...) insn_mem(true, "\x39", r, __VA_ARGS__)
+#define CMP_REG_MEM(r, ...) insn_mem(true, "\x3b", r, __VA_ARGS__)
+
+// Operation with an immediate operand: /ext is the ModRM reg field
+static void op_imm(int ext, int rm, int32_t v)
+{
+    rex(true, NONE, NONE, rm);
+    byte(0x81);
+    byte(0xc0 | ext << 3 | (rm & 7));
+    imm32(v);
+}
+#define ADD_IMM(r, v) op_imm(0, r, v)
+#define SUB_IMM(r, v) op_imm(5, r, v)
+#define CMP_IMM(r, v) op_imm(7, r, v)
+
+static void mov_imm(int r, int64_t v)
+{
+    rex(true, NONE, NONE, r);
+    byte(0xb8 | (r & 7));
+    imm64(v);
+}
+
+static void test_al(uint8_t v)
+{
+    byte(0xa8);
+    byte(v);
+}
+
+static void push_reg(int r)
+{
+    rex(false, NONE, NONE, r);
+    byte(0x50 | (r & 7));
+}
+
+static void pop_reg(int r)
+{
+    rex(false, NONE, NONE, r);
+    byte(0x58 | (r & 7));
+}
+
+// Emit a rel32 jump or conditional jump (cc < 0 for jmp), and return the
+// offset of the displacement to patch.
+static size_t jump(int cc)
+{
+    if (cc < 0)
+        byte(0xe9);
+    else {
+        byte(0x0f);
+        byte(0x80 | cc);
+    }
+    imm32(0);
+    return buf_len - 4;
+}
+
+static void patch_jump(size_t at, size_t target)
+{
+    patch32(at, (int32_t)(target - (at + 4)));
+}
+
+
+// Exits
+typedef struct {
+    bee_word_t *pc;
+    bee_word_t ir;
+    bool error; // Whether rax holds an error code to return
+    bee_word_t *ret; // Return address to push first, if any
+} jit_exit;
+
+typedef struct {
+    size_t at; // Offset of the displacement of a jump
+    size_t exit; // Index into `exits`
+} exit_fixup;
+
+static jit_exit *exits;
+static size_t nexits, exits_size;
+static exit_fixup *exit_fixups;
+static size_t nexit_fixups, exit_fixups_size;
+
+// The return address of the call being inlined, if any, and whether it is
+// on the return stack
+static bee_word_t *inline_ret;
+static bool inline_pushed;
+
+#define GROW(array, n, size)                                            \
+    do {                                                                \
+        if (n == size) {                                                \
+            size_t _new_size = size == 0 ? 64 : size * 2;               \
+            void *_new = realloc(array, _new_size * sizeof(*array));    \
+            if (_new == NULL) {                                         \
+                failed = true;                                          \
+                return;                                                 \
+            }                                                           \
+            array = _new;                                               \
+            size = _new_size;                                           \
+        }                                                               \
+    } while (0)
+
+// Record that the jump whose displacement is at `at` goes to an exit that
+// resumes the interpreter with `pc` and `ir`, returning BEE_ERROR_OK, or,
+// if `error` is true, the error code in rax. An exit with a NULL pc leaves
+// pc, ir and rax as they are. An exit from inlined code first pushes the
+// return address, if it is not already on the return stack.
+static void exit_from(size_t at, bee_word_t *pc, bee_word_t ir, bool error)
+{
+    bee_word_t *ret = inline_pushed ? NULL : inline_ret;
+    size_t i;
+    for (i = 0; i < nexits; i++)
+        if (exits[i].pc == pc && exits[i].ir == ir &&
+            exits[i].error == error && exits[i].ret == ret)
+            break;
+    if (i == nexits) {
+        GROW(exits, nexits, exits_size);
+        exits[nexits++] = (jit_exit){pc, ir, error, ret};
+    }
+    GROW(exit_fixups, nexit_fixups, exit_fixups_size);
+    exit_fixups[nexit_fixups++] = (exit_fixup){at, i};
+}
+
+// Jump (with condition `cc`, or unconditionally if negative) to an exit.
+static void exit_if(int cc, bee_word_t *pc, bee_word_t ir, bool error)
+{
+    exit_from(jump(cc), pc, ir, error);
+}
+
+// The state to resume at for the instruction being compiled
+static bee_word_t *cur_pc;
+static bee_word_t cur_ir;
+
+#define EXIT_IF(cc) exit_if(cc, cur_pc, cur_ir, false)
+
+// Check that there are `pops` items on the stack whose pointer is in
+// register `sp` and size is in `size`, and room for `pushes` more after
+// popping.
+static void check_stack(int sp, int32_t size_off, int pops, int pushes)
+{
+    if (pops > 0) {
+        CMP_IMM(sp, pops);
+        EXIT_IF(CC_B);
+    }
+    int extra = pushes > pops ? pushes - pops : 0;
+    if (extra > 0) {
+        insn_mem(true, "\x8d", RAX, sp, NONE, extra); // lea rax, [sp + extra]
+        CMP_REG_MEM(RAX, S_REG, NONE, size_off);
+    } else
+        CMP_REG_MEM(sp, S_REG, NONE, size_off);
+    EXIT_IF(CC_A);
+}
+#define GUARDD(pops, pushes) check_stack(DP_REG, offsetof(bee_state, dsize), pops, pushes)
+#define GUARDS(pops, pushes) check_stack(SP_REG, offsetof(bee_state, ssize), pops, pushes)
+
+// Exit if the address in rax is not aligned to `bytes` bytes.
+static void check_aligned(int bytes)
+{
+    if (bytes > 1) {
+        test_al((uint8_t)(bytes - 1));
+        EXIT_IF(CC_NE);
+    }
+}
+
+// Return to the interpreter at the address in rax.
+static void exit_dynamic(void)
+{
+    STORE(RAX, STATE(pc));
+    XOR32(RCX, RCX);
+    STORE(RCX, STATE(ir));
+    XOR32(RAX, RAX);
+    exit_if(-1, NULL, 0, true);
+}
+
+// Exit if the `bytes` bytes at the address in rax plus `offset` may have
+// been translated, so that the interpreter makes the write, and discards
+// the translations. rax is preserved.
+static void check_code(int32_t offset, int bytes)
+{
+    LEA(RDI, RAX, NONE, offset);
+    mov_imm(RCX, (bee_word_t)&hot_code_start);
+    CMP_REG_MEM(RDI, RCX, NONE, 0);
+    size_t below = jump(CC_B);
+    mov_imm(RCX, (bee_word_t)&hot_code_end);
+    CMP_REG_MEM(RDI, RCX, NONE, 0);
+    size_t above = jump(CC_AE);
+    MOV(RBP, RAX);
+    mov_imm(RSI, bytes);
+    mov_imm(RAX, (bee_word_t)hot_is_code);
+    byte(0xff); byte(0xd0); // call rax
+    test_al(1);
+    MOV(RAX, RBP);
+    EXIT_IF(CC_NE);
+    patch_jump(below, buf_len);
+    patch_jump(above, buf_len);
+}
+
+// Inline caches
+//
+// Each computed CALL, JUMP or JUMPZ remembers the last two targets it has
+// reached that have compiled code. While no code has been invalidated
+// since they were filled, a target in the cache is entered directly,
+// rather than returning to the interpreter, which would look it up.
+#define CACHE_ENTRIES 2
+
+// Unaligned, so it never matches a target
+#define CACHE_EMPTY ((bee_word_t *)(bee_uword_t)-1)
+
+typedef struct jit_cache {
+    struct jit_cache *next;
+    bee_uword_t invalidations; // The value of hot_invalidations when filled
+    struct {
+        bee_word_t *target;
+        uint8_t *entry; // The target's code, after its prologue
+    } entries[CACHE_ENTRIES];
+} jit_cache;
+
+static jit_cache *caches = NULL;
+
+static jit_cache *new_cache(void)
+{
+    jit_cache *cache = malloc(sizeof(jit_cache));
+    if (cache == NULL) {
+        failed = true;
+        return NULL;
+    }
+    cache->next = caches;
+    caches = cache;
+    cache->invalidations = hot_invalidations;
+    for (int i = 0; i < CACHE_ENTRIES; i++)
+        cache->entries[i].target = CACHE_EMPTY;
+    return cache;
+}
+
+static size_t prologue_size;
+
+// Called on a cache miss: if `target` has compiled code, add it to
+// `cache`, and return its entry point; otherwise, return NULL.
+static uint8_t *cache_miss(jit_cache *cache, bee_word_t *target)
+{
+    hot_cache_misses++;
+    hot_counter *c = hot_lookup(target);
+    if (c == NULL || c->code == NULL)
+        return NULL;
+    if (cache->invalidations != hot_invalidations) {
+        cache->invalidations = hot_invalidations;
+        for (int i = 0; i < CACHE_ENTRIES; i++)
+            cache->entries[i].target = CACHE_EMPTY;
+    }
+    memmove(&cache->entries[1], &cache->entries[0],
+            (CACHE_ENTRIES - 1) * sizeof(cache->entries[0]));
+    cache->entries[0].target = target;
+    cache->entries[0].entry = (uint8_t *)c->code + prologue_size;
+    return cache->entries[0].entry;
+}
+
+// Transfer control to the address in rax, through an inline cache.
+static void jump_dynamic(void)
+{
+    jit_cache *cache = new_cache();
+    mov_imm(RCX, (bee_word_t)cache);
+    mov_imm(RDX, (bee_word_t)&hot_invalidations);
+    LOAD(RDX, RDX, NONE, 0);
+    CMP_MEM(RDX, RCX, NONE, offsetof(jit_cache, invalidations));
+    size_t stale = jump(CC_NE);
+    for (int i = 0; i < CACHE_ENTRIES; i++) {
+        CMP_MEM(RAX, RCX, NONE, (int32_t)offsetof(jit_cache, entries[i].target));
+        size_t other = jump(CC_NE);
+        mov_imm(RDX, (bee_word_t)&hot_cache_hits);
+        insn_mem(true, "\xff", 0, RDX, NONE, 0); // inc qword [rdx]
+        insn_mem(false, "\xff", 4, RCX, NONE, (int32_t)offsetof(jit_cache, entries[i].entry)); // jmp
+        patch_jump(other, buf_len);
+    }
+    patch_jump(stale, buf_len);
+    MOV(RBP, RAX);
+    MOV(RDI, RCX);
+    MOV(RSI, RAX);
+    mov_imm(RAX, (bee_word_t)cache_miss);
+    byte(0xff); byte(0xd0); // call rax
+    TEST(RAX, RAX);
+    size_t uncached = jump(CC_E);
+    insn_reg(false, "\xff", 4, RAX); // jmp rax
+    patch_jump(uncached, buf_len);
+    MOV(RAX, RBP);
+    exit_dynamic();
+}
+
+static void push_rax(void)
+{
+    STORE(RAX, NEW);
+    ADD_IMM(DP_REG, 1);
+}
+
+
+// Prologue and epilogue
+static void prologue(void)
+{
+    push_reg(RBX);
+    push_reg(RBP);
+    push_reg(R12);
+    push_reg(R13);
+    push_reg(R14);
+    push_reg(R15);
+    SUB_IMM(RSP, 8); // Align the stack for calls
+    MOV(S_REG, RDI);
+    LOAD(D0_REG, STATE(d0));
+    LOAD(DP_REG, STATE(dp));
+    LOAD(S0_REG, STATE(s0));
+    LOAD(SP_REG, STATE(sp));
+}
+
+static void epilogue(void)
+{
+    STORE(DP_REG, STATE(dp));
+    STORE(SP_REG, STATE(sp));
+    ADD_IMM(RSP, 8);
+    pop_reg(R15);
+    pop_reg(R14);
+    pop_reg(R13);
+    pop_reg(R12);
+    pop_reg(RBP);
+    pop_reg(RBX);
+    byte(0xc3);
+}
+
+
+// Instruction templates
+
+// Binary operation `op` [NOS], rax
+static void binary(const char *op)
+{
+    GUARDD(2, 1);
+    LOAD(RAX, TOS);
+    insn_mem(true, op, RAX, NOS);
+    SUB_IMM(DP_REG, 1);
+}
+
+// Comparison, setting NOS to 1 if condition `cc` holds, else 0
+static void compare(int cc)
+{
+    GUARDD(2, 1);
+    LOAD(RCX, TOS);
+    XOR32(RAX, RAX);
+    CMP_MEM(RCX, NOS);
+    byte(0x0f); byte(0x90 | cc); byte(0xc0); // setcc al
+    STORE(RAX, NOS);
+    SUB_IMM(DP_REG, 1);
+}
+
+// Shift NOS by TOS with shift /ext
+static void shift(int ext)
+{
+    GUARDD(2, 1);
+    LOAD(RCX, TOS);
+    CMP_IMM(RCX, BEE_WORD_BIT);
+    EXIT_IF(CC_AE);
+    LOAD(RAX, NOS);
+    rex(true, NONE, NONE, RAX);
+    byte(0xd3); byte(0xc0 | ext << 3); // shift rax, cl
+    STORE(RAX, NOS);
+    SUB_IMM(DP_REG, 1);
+}
+
+// Load `bytes` bytes from the address at TOS, zero-extended
+static void load(int bytes)
+{
+    GUARDD(1, 1);
+    LOAD(RAX, TOS);
+    check_aligned(bytes);
+    switch (bytes) {
+    case 1:
+        insn_mem(false, "\x0f\xb6", RAX, RAX, NONE, 0);
+        break;
+    case 2:
+        insn_mem(false, "\x0f\xb7", RAX, RAX, NONE, 0);
+        break;
+    case 4:
+        insn_mem(false, "\x8b", RAX, RAX, NONE, 0);
+        break;
+    default:
+        LOAD(RAX, RAX, NONE, 0);
+        break;
+    }
+    STORE(RAX, TOS);
+}
+
+// Store `bytes` bytes of NOS to the address at TOS
+static void store(int bytes)
+{
+    GUARDD(2, 0);
+    LOAD(RAX, TOS);
+    check_aligned(bytes);
+    check_code(0, bytes);
+    LOAD(RCX, NOS);
+    switch (bytes) {
+    case 1:
+        insn_mem(false, "\x88", RCX, RAX, NONE, 0);
+        break;
+    case 2:
+        insn_mem(false, "\x66\x89", RCX, RAX, NONE, 0);
+        break;
+    case 4:
+        insn_mem(false, "\x89", RCX, RAX, NONE, 0);
+        break;
+    default:
+        STORE(RCX, RAX, NONE, 0);
+        break;
+    }
+    SUB_IMM(DP_REG, 2);
+}
+
+// Load from the address at TOS plus `offset`, replacing TOS with the
+// value and pushing the address plus `delta`.
+static void load_step(int32_t offset, int32_t delta)
+{
+    GUARDD(1, 2);
+    LOAD(RAX, TOS);
+    check_aligned(BEE_WORD_BYTES);
+    LOAD(RCX, RAX, NONE, offset);
+    STORE(RCX, TOS);
+    ADD_IMM(RAX, delta);
+    push_rax();
+}
+
+// Store NOS to the address at TOS plus `offset`, replacing both with the
+// address plus `delta`.
+static void store_step(int32_t offset, int32_t delta)
+{
+    GUARDD(2, 1);
+    LOAD(RAX, TOS);
+    check_aligned(BEE_WORD_BYTES);
+    check_code(offset, BEE_WORD_BYTES);
+    LOAD(RCX, NOS);
+    STORE(RCX, RAX, NONE, offset);
+    ADD_IMM(RAX, delta);
+    STORE(RAX, NOS);
+    SUB_IMM(DP_REG, 1);
+}
+
+static void push_state(int32_t off)
+{
+    GUARDD(0, 1);
+    LOAD(RAX, S_REG, NONE, off);
+    push_rax();
+}
+
+// Compile instruction opcode `opcode`. `last` is true if it is the last
+// instruction in its word. Return false if it is not supported.
+static bool compile_insn(bee_uword_t opcode, bool last)
+{
+    switch (opcode) {
+    case BEE_INSN_NOT:
+        GUARDD(1, 1);
+        insn_mem(true, "\xf7", 2, TOS);
+        break;
+    case BEE_INSN_AND:
+        binary("\x21");
+        break;
+    case BEE_INSN_OR:
+        binary("\x09");
+        break;
+    case BEE_INSN_XOR:
+        binary("\x31");
+        break;
+    case BEE_INSN_LSHIFT:
+        shift(4);
+        break;
+    case BEE_INSN_RSHIFT:
+        shift(5);
+        break;
+    case BEE_INSN_ARSHIFT:
+        shift(7);
+        break;
+    case BEE_INSN_POP:
+        GUARDD(1, 0);
+        SUB_IMM(DP_REG, 1);
+        break;
+    case BEE_INSN_DUP:
+        GUARDD(1, 1);
+        LOAD(RAX, TOS);
+        LEA(RCX, DP_REG, NONE, -1);
+        CMP(RAX, RCX);
+        EXIT_IF(CC_AE);
+        MOV(RDX, DP_REG);
+        SUB(RDX, RAX);
+        LOAD(RAX, D0_REG, RDX, -16);
+        STORE(RAX, TOS);
+        break;
+    case BEE_INSN_SET:
+        GUARDD(2, 1);
+        LOAD(RAX, TOS);
+        LEA(RCX, DP_REG, NONE, -2);
+        CMP(RAX, RCX);
+        EXIT_IF(CC_AE);
+        LOAD(RDX, NOS);
+        MOV(RCX, DP_REG);
+        SUB(RCX, RAX);
+        STORE(RDX, D0_REG, RCX, -24);
+        SUB_IMM(DP_REG, 2);
+        break;
+    case BEE_INSN_SWAP:
+        GUARDD(1, 0);
+        CMP_IMM(DP_REG, 2);
+        EXIT_IF(CC_B);
+        LOAD(RAX, TOS);
+        LEA(RCX, DP_REG, NONE, -2);
+        CMP(RAX, RCX);
+        EXIT_IF(CC_AE);
+        SUB_IMM(DP_REG, 1);
+        MOV(RCX, DP_REG);
+        SUB(RCX, RAX);
+        LOAD(RDX, D0_REG, RCX, -16);
+        LOAD(RSI, TOS);
+        STORE(RSI, D0_REG, RCX, -16);
+        STORE(RDX, TOS);
+        break;
+    case BEE_INSN_JUMP:
+        if (!last)
+            return false;
+        GUARDD(1, 0);
+        LOAD(RAX, TOS);
+        check_aligned(BEE_WORD_BYTES);
+        SUB_IMM(DP_REG, 1);
+        jump_dynamic();
+        break;
+    case BEE_INSN_JUMPZ:
+        {
+            if (!last)
+                return false;
+            GUARDD(2, 0);
+            LOAD(RAX, TOS);
+            LOAD(RCX, NOS);
+            TEST(RCX, RCX);
+            size_t not_taken = jump(CC_NE);
+            check_aligned(BEE_WORD_BYTES);
+            SUB_IMM(DP_REG, 2);
+            jump_dynamic();
+            patch_jump(not_taken, buf_len);
+            SUB_IMM(DP_REG, 2);
+        }
+        break;
+    case BEE_INSN_CALL:
+        if (!last)
+            return false;
+        GUARDD(1, 0);
+        GUARDS(0, 1);
+        LOAD(RAX, TOS);
+        check_aligned(BEE_WORD_BYTES);
+        SUB_IMM(DP_REG, 1);
+        mov_imm(RCX, (bee_word_t)cur_pc);
+        STORE(RCX, RNEW);
+        ADD_IMM(SP_REG, 1);
+        jump_dynamic();
+        break;
+    case BEE_INSN_RET:
+        if (inline_ret != NULL) {
+            // Return from inlined code, discarding the rest of the word.
+            if (inline_pushed)
+                SUB_IMM(SP_REG, 1);
+            break;
+        }
+        if (!last)
+            return false;
+        GUARDS(1, 0);
+        CMP_REG_MEM(SP_REG, STATE(handler_sp));
+        EXIT_IF(CC_BE);
+        LOAD(RAX, RTOS);
+        check_aligned(BEE_WORD_BYTES);
+        SUB_IMM(SP_REG, 1);
+        exit_dynamic();
+        break;
+    case BEE_INSN_LOAD:
+        load(8);
+        break;
+    case BEE_INSN_STORE:
+        store(8);
+        break;
+    case BEE_INSN_LOAD1:
+        load(1);
+        break;
+    case BEE_INSN_STORE1:
+        store(1);
+        break;
+    case BEE_INSN_LOAD2:
+        load(2);
+        break;
+    case BEE_INSN_STORE2:
+        store(2);
+        break;
+    case BEE_INSN_LOAD4:
+        load(4);
+        break;
+    case BEE_INSN_STORE4:
+        store(4);
+        break;
+    case BEE_INSN_LOAD_IA:
+        load_step(0, 8);
+        break;
+    case BEE_INSN_STORE_DB:
+        store_step(-8, -8);
+        break;
+    case BEE_INSN_LOAD_IB:
+        load_step(8, 8);
+        break;
+    case BEE_INSN_STORE_DA:
+        store_step(0, -8);
+        break;
+    case BEE_INSN_LOAD_DA:
+        load_step(0, -8);
+        break;
+    case BEE_INSN_STORE_IB:
+        store_step(8, 8);
+        break;
+    case BEE_INSN_LOAD_DB:
+        load_step(-8, -8);
+        break;
+    case BEE_INSN_STORE_IA:
+        store_step(0, 8);
+        break;
+    case BEE_INSN_NEG:
+        GUARDD(1, 1);
+        insn_mem(true, "\xf7", 3, TOS);
+        break;
+    case BEE_INSN_ADD:
+        binary("\x01");
+        break;
+    case BEE_INSN_MUL:
+        GUARDD(2, 1);
+        LOAD(RAX, NOS);
+        insn_mem(true, "\x0f\xaf", RAX, TOS); // imul rax, TOS
+        STORE(RAX, NOS);
+        SUB_IMM(DP_REG, 1);
+        break;
+    case BEE_INSN_DIVMOD:
+    case BEE_INSN_UDIVMOD:
+        // Division by zero and overflow are left to the interpreter.
+        GUARDD(2, 2);
+        LOAD(RCX, TOS);
+        TEST(RCX, RCX);
+        EXIT_IF(CC_E);
+        LOAD(RAX, NOS);
+        if (opcode == BEE_INSN_DIVMOD) {
+            CMP_IMM(RCX, -1);
+            EXIT_IF(CC_E);
+            byte(0x48); byte(0x99); // cqo
+            insn_reg(true, "\xf7", 7, RCX); // idiv rcx
+        } else {
+            XOR32(RDX, RDX);
+            insn_reg(true, "\xf7", 6, RCX); // div rcx
+        }
+        STORE(RAX, NOS);
+        STORE(RDX, TOS);
+        break;
+    case BEE_INSN_EQ:
+        compare(CC_E);
+        break;
+    case BEE_INSN_LT:
+        compare(CC_L);
+        break;
+    case BEE_INSN_ULT:
+        compare(CC_B);
+        break;
+    case BEE_INSN_PUSHS:
+        GUARDD(1, 0);
+        GUARDS(0, 1);
+        LOAD(RAX, TOS);
+        SUB_IMM(DP_REG, 1);
+        STORE(RAX, RNEW);
+        ADD_IMM(SP_REG, 1);
+        break;
+    case BEE_INSN_POPS:
+        GUARDS(1, 0);
+        GUARDD(0, 1);
+        LOAD(RAX, RTOS);
+        SUB_IMM(SP_REG, 1);
+        push_rax();
+        break;
+    case BEE_INSN_DUPS:
+        GUARDS(1, 1);
+        GUARDD(0, 1);
+        LOAD(RAX, RTOS);
+        push_rax();
+        break;
+    case BEE_INSN_WORD_BYTES:
+        GUARDD(0, 1);
+        mov_imm(RAX, BEE_WORD_BYTES);
+        push_rax();
+        break;
+    case BEE_INSN_GET_SSIZE:
+        push_state(offsetof(bee_state, ssize));
+        break;
+    case BEE_INSN_GET_SP:
+        GUARDD(0, 1);
+        MOV(RAX, SP_REG);
+        push_rax();
+        break;
+    case BEE_INSN_SET_SP:
+        GUARDD(1, 0);
+        LOAD(SP_REG, TOS);
+        SUB_IMM(DP_REG, 1);
+        break;
+    case BEE_INSN_GET_DSIZE:
+        push_state(offsetof(bee_state, dsize));
+        break;
+    case BEE_INSN_GET_DP:
+        GUARDD(0, 1);
+        MOV(RAX, DP_REG);
+        push_rax();
+        break;
+    case BEE_INSN_SET_DP:
+        GUARDD(1, 0);
+        LOAD(DP_REG, TOS);
+        break;
+    case BEE_INSN_GET_HANDLER_SP:
+        push_state(offsetof(bee_state, handler_sp));
+        break;
+    default:
+        // CATCH, THROW, BREAK and invalid opcodes
+        return false;
+    }
+    return true;
+}
+
+
+// Regions
+
+// A region is the code reachable from its entry point by falling through
+// or branching forwards, up to an unconditional control transfer. Loops
+// inside a region are compiled as native loops.
+#define MAX_REGION_WORDS 256
+
+typedef struct {
+    size_t at; // Offset of the displacement of a jump
+    bee_word_t *target;
+    bool call;
+} branch_fixup;
+
+static size_t word_offset[MAX_REGION_WORDS];
+#define NO_CODE SIZE_MAX
+static branch_fixup branch_fixups[MAX_REGION_WORDS];
+static size_t nbranch_fixups;
+
+// Jump (with condition `cc`, or unconditionally if negative) to `target`.
+static void branch(int cc, bee_word_t *target, bool call)
+{
+    size_t at = jump(cc);
+    if (nbranch_fixups < MAX_REGION_WORDS)
+        branch_fixups[nbranch_fixups++] = (branch_fixup){at, target, call};
+    else
+        failed = true;
+}
+
+// Whether a branch already compiled reaches `addr` or later
+static bool branch_beyond(bee_word_t *addr)
+{
+    for (size_t i = 0; i < nbranch_fixups; i++)
+        if (!branch_fixups[i].call && branch_fixups[i].target >= addr)
+            return true;
+    return false;
+}
+
+// Calls to words of at most this many instruction words are inlined.
+#define MAX_INLINE_WORDS 4
+
+// Return true if the word at `addr` is short straight-line code ending
+// with RET, as the last instruction in its word, that does not change the
+// return stack. Set `*inspects` if it
+// reads the return stack, so that the return address must be pushed.
+static bool inlinable(bee_word_t *addr, bool *inspects)
+{
+    *inspects = false;
+    for (unsigned i = 0; i < MAX_INLINE_WORDS; i++) {
+        bee_word_t ir = addr[i];
+        if ((ir & BEE_OP1_MASK) == BEE_OP_PUSHI || (ir & BEE_OP1_MASK) == BEE_OP_PUSHRELI)
+            continue;
+        if ((ir & BEE_OP2_MASK) != BEE_OP_INSN)
+            return false;
+        for (bee_uword_t ops = (bee_uword_t)ir >> BEE_OP2_SHIFT;
+             (ops & BEE_INSN_MASK) != BEE_INSN_NOP; ops >>= BEE_INSN_BITS)
+            switch (ops & BEE_INSN_MASK) {
+            case BEE_INSN_RET:
+                // Instructions after RET would run at the return address.
+                return ((ops >> BEE_INSN_BITS) & BEE_INSN_MASK) == BEE_INSN_NOP;
+            case BEE_INSN_DUPS:
+            case BEE_INSN_GET_SP:
+                *inspects = true;
+                break;
+            case BEE_INSN_JUMP:
+            case BEE_INSN_JUMPZ:
+            case BEE_INSN_CALL:
+            case BEE_INSN_PUSHS:
+            case BEE_INSN_POPS:
+            case BEE_INSN_SET_SP:
+            case BEE_INSN_CATCH:
+            case BEE_INSN_THROW:
+            case BEE_INSN_BREAK:
+                return false;
+            default:
+                if ((ops & BEE_INSN_MASK) > BEE_INSN_GET_HANDLER_SP)
+                    return false;
+                break;
+            }
+    }
+    return false;
+}
+
+static unsigned compile_word(bee_word_t *pc);
+
+// Run trap `code`. If it writes to translated code, return 1 rather than
+// BEE_ERROR_OK, so that the compiled code returns to the interpreter.
+static bee_word_t jit_trap(bee_state * restrict S, bee_uword_t code)
+{
+    bee_uword_t invalidations = hot_invalidations;
+    bee_word_t error = bee_trap(S, code);
+    return error == BEE_ERROR_OK && hot_invalidations != invalidations ? 1 : error;
+}
+
+// Compile a call to `target` at the CALLI word before `ret` inline.
+static void inline_call(bee_word_t *target, bee_word_t *ret, bool push)
+{
+    // The interpreter would check for room on the return stack, and
+    // returning from a CATCH frame is left to it.
+    GUARDS(0, 1);
+    CMP_REG_MEM(SP_REG, STATE(handler_sp));
+    EXIT_IF(CC_B);
+    if (push) {
+        mov_imm(RAX, (bee_word_t)ret);
+        STORE(RAX, RNEW);
+        ADD_IMM(SP_REG, 1);
+    }
+    inline_ret = ret;
+    inline_pushed = push;
+    unsigned n;
+    for (bee_word_t *pc = target; (n = compile_word(pc)) != 0; pc += n)
+        ;
+    inline_ret = NULL;
+}
+
+// Compile the instruction word at `pc`, and any following words that are
+// compiled with it. Return the number of words compiled, or 0 if control
+// cannot fall through to the next word.
+static unsigned compile_word(bee_word_t *pc)
+{
+    bee_word_t ir = *pc;
+    bee_word_t *next = pc + 1;
+    cur_pc = next;
+    cur_ir = ir;
+    hot_code(pc, next);
+
+    switch (ir & BEE_OP1_MASK) {
+    case BEE_OP_CALLI:
+        {
+            // Push a large literal; if either stack is full, the
+            // interpreter makes the call.
+            unsigned words = literal_words(pc);
+            if (words != 0) {
+                hot_code(pc, pc + words);
+                GUARDS(0, 1);
+                GUARDD(0, 1);
+                mov_imm(RAX, (bee_word_t)next);
+                STORE(RAX, RNEW);
+                mov_imm(RAX, *next);
+                push_rax();
+                return words;
+            }
+        }
+        {
+            bee_word_t *target = next + ARSHIFT(ir, BEE_OP1_SHIFT);
+            bool inspects;
+            if (inline_ret == NULL && inlinable(target, &inspects)) {
+                inline_call(target, next, inspects);
+                return 1;
+            }
+        }
+        GUARDS(0, 1);
+        mov_imm(RAX, (bee_word_t)next);
+        STORE(RAX, RNEW);
+        ADD_IMM(SP_REG, 1);
+        branch(-1, next + ARSHIFT(ir, BEE_OP1_SHIFT), true);
+        return 0;
+    case BEE_OP_PUSHI:
+        GUARDD(0, 1);
+        mov_imm(RAX, ARSHIFT(ir, BEE_OP1_SHIFT));
+        push_rax();
+        return 1;
+    case BEE_OP_PUSHRELI:
+        GUARDD(0, 1);
+        mov_imm(RAX, (bee_word_t)(next + ARSHIFT(ir, BEE_OP1_SHIFT)));
+        push_rax();
+        return 1;
+    default:
+        switch (ir & BEE_OP2_MASK) {
+        case BEE_OP_JUMPI:
+            branch(-1, next + ARSHIFT(ir, BEE_OP2_SHIFT), false);
+            return 0;
+        case BEE_OP_JUMPZI:
+            GUARDD(1, 0);
+            LOAD(RAX, TOS);
+            SUB_IMM(DP_REG, 1);
+            TEST(RAX, RAX);
+            branch(CC_E, next + ARSHIFT(ir, BEE_OP2_SHIFT), false);
+            return 1;
+        case BEE_OP_TRAP:
+            STORE(DP_REG, STATE(dp));
+            STORE(SP_REG, STATE(sp));
+            MOV(RDI, S_REG);
+            mov_imm(RSI, (bee_word_t)((bee_uword_t)ir >> BEE_OP2_SHIFT));
+            mov_imm(RAX, (bee_word_t)jit_trap);
+            byte(0xff); byte(0xd0); // call rax
+            LOAD(D0_REG, STATE(d0));
+            LOAD(DP_REG, STATE(dp));
+            LOAD(S0_REG, STATE(s0));
+            LOAD(SP_REG, STATE(sp));
+            TEST(RAX, RAX);
+            exit_if(CC_L, next, 0, true);
+            exit_if(CC_NE, next, 0, false);
+            return 1;
+        case BEE_OP_INSN:
+            for (bee_uword_t ops = (bee_uword_t)ir >> BEE_OP2_SHIFT; ; ops >>= BEE_INSN_BITS) {
+                bee_uword_t opcode = ops & BEE_INSN_MASK;
+                if (opcode == BEE_INSN_NOP)
+                    return 1;
+                cur_ir = (bee_word_t)((ops << BEE_OP2_SHIFT) | BEE_OP_INSN);
+                // Instructions that transfer control must end their word.
+                bool last = (ops >> BEE_INSN_BITS) == 0;
+                if (!compile_insn(opcode, last)) {
+                    EXIT_IF(-1);
+                    return 0;
+                }
+                if (opcode == BEE_INSN_JUMP || opcode == BEE_INSN_CALL ||
+                    opcode == BEE_INSN_RET)
+                    return 0;
+            }
+        default:
+            EXIT_IF(-1);
+            return 0;
+        }
+    }
+}
+
+
+// Executable memory is allocated in chunks, and freed all at once.
+#define CHUNK_SIZE ((size_t)1024 * 1024)
+
+typedef struct chunk {
+    struct chunk *next;
+    size_t size, used;
+    uint8_t code[];
+} chunk;
+
+static chunk *chunks = NULL;
+
+static uint8_t *alloc_code(size_t size)
+{
+    size = (size + 15) & ~(size_t)15;
+    if (chunks == NULL || chunks->used + size > chunks->size) {
+        size_t chunk_size = sizeof(chunk) + size > CHUNK_SIZE ? sizeof(chunk) + size : CHUNK_SIZE;
+        chunk *c = mmap(NULL, chunk_size, PROT_READ | PROT_WRITE | PROT_EXEC,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (c == MAP_FAILED)
+            return NULL;
+        c->next = chunks;
+        c->size = chunk_size - sizeof(chunk);
+        c->used = 0;
+        chunks = c;
+    }
+    uint8_t *code = chunks->code + chunks->used;
+    chunks->used += size;
+    return code;
+}
+
+jit_code *jit_compile(bee_word_t *addr)
+{
+    buf_len = nexits = nexit_fixups = nbranch_fixups = 0;
+    failed = false;
+    inline_ret = NULL;
+
+    prologue();
+    prologue_size = buf_len;
+
+    // Compile words until control cannot reach the next one. Words that
+    // are compiled with the word before them have no code of their own.
+    size_t words = 0;
+    bool falls_through = true;
+    while (words < MAX_REGION_WORDS && falls_through) {
+        word_offset[words] = buf_len;
+        unsigned n = compile_word(addr + words);
+        for (unsigned i = 1; i < n && words + i < MAX_REGION_WORDS; i++)
+            word_offset[words + i] = NO_CODE;
+        words += n == 0 ? 1 : n;
+        falls_through = n != 0 || branch_beyond(addr + words);
+    }
+    size_t region_words = words < MAX_REGION_WORDS ? words : MAX_REGION_WORDS;
+    if (falls_through) {
+        cur_pc = addr + words;
+        cur_ir = 0;
+        EXIT_IF(-1);
+    }
+
+    // Resolve branches to a word in the region, to other compiled code,
+    // which is linked once the code is in place, or else to an exit.
+    size_t nlinks = 0;
+    for (size_t i = 0; i < nbranch_fixups; i++) {
+        bee_word_t *target = branch_fixups[i].target;
+        hot_counter *c;
+        if (target >= addr && target < addr + region_words &&
+            word_offset[target - addr] != NO_CODE)
+            patch_jump(branch_fixups[i].at, word_offset[target - addr]);
+        else if ((c = hot_lookup(target)) != NULL && c->code != NULL) {
+            // The code depends on the code it is linked to.
+            for (size_t j = 0; j < c->nranges; j++)
+                hot_code(c->ranges[j].start, c->ranges[j].end);
+            branch_fixups[nlinks++] = branch_fixups[i];
+        }
+        else
+            exit_from(branch_fixups[i].at, target, 0, false);
+    }
+
+    // Emit the exits, each of which ends by jumping to the epilogue.
+    size_t *epilogue_jumps = malloc(nexits * sizeof(size_t));
+    if (epilogue_jumps == NULL)
+        return NULL;
+    for (size_t i = 0; i < nexits; i++) {
+        for (size_t j = 0; j < nexit_fixups; j++)
+            if (exit_fixups[j].exit == i)
+                patch_jump(exit_fixups[j].at, buf_len);
+        if (exits[i].ret != NULL) {
+            mov_imm(RCX, (bee_word_t)exits[i].ret);
+            STORE(RCX, RNEW);
+            ADD_IMM(SP_REG, 1);
+        }
+        if (exits[i].pc != NULL) {
+            mov_imm(RCX, (bee_word_t)exits[i].pc);
+            STORE(RCX, STATE(pc));
+            mov_imm(RCX, exits[i].ir);
+            STORE(RCX, STATE(ir));
+            if (!exits[i].error)
+                XOR32(RAX, RAX);
+        }
+        epilogue_jumps[i] = jump(-1);
+    }
+    for (size_t i = 0; i < nexits; i++)
+        patch_jump(epilogue_jumps[i], buf_len);
+    free(epilogue_jumps);
+    epilogue();
+    if (failed)
+        return NULL;
+
+    // Copy the code into executable memory, and link it to other code.
+    uint8_t *code = alloc_code(buf_len);
+    if (code == NULL)
+        return NULL;
+    memcpy(code, buf, buf_len);
+    for (size_t i = 0; i < nlinks; i++) {
+        uint8_t *next = code + branch_fixups[i].at + 4;
+        uint8_t *target = (uint8_t *)hot_lookup(branch_fixups[i].target)->code + prologue_size;
+        ptrdiff_t rel = target - next;
+        if (rel != (int32_t)rel)
+            return NULL; // Leave the code unused.
+        int32_t rel32 = (int32_t)rel;
+        memcpy(code + branch_fixups[i].at, &rel32, 4);
+    }
+    perf_map_code(code, buf_len, addr);
+    return (jit_code *)(void *)code;
+}
+
+void jit_reset(void)
+{
+    while (caches != NULL) {
+        jit_cache *next = caches->next;
+        free(caches);
+        caches = next;
+    }
+    while (chunks != NULL) {
+        chunk *next = chunks->next;
+        munmap(chunks, sizeof(chunk) + chunks->size);
+        chunks = next;
+    }
+    free(buf);
+    buf = NULL;
+    buf_size = 0;
+    free(exits);
+    exits = NULL;
+    exits_size = 0;
+    free(exit_fixups);
+    exit_fixups = NULL;
+    exit_fixups_size = 0;
+}
@@ -35,6 +35,22 @@ bee_word_t *memory;
 static bool gdb_target = false;
 static int gdb_fdin = STDIN_FILENO, gdb_fdout = STDOUT_FILENO;
 
+static bool perf_map = false;
+static const char *perf_map_symbols_file = NULL;
+static bee_symbol *symbols = NULL;
+static char **symbol_names = NULL; // The names in `symbols`, to be freed
+static bee_uword_t nsymbols = 0;
+
+static const char *profile_file = NULL;
+
+// Names of compilers for `--jit`, indexed by BEE_JIT_*
+static const char *jit_names[] = {"none", "trace", "template", "mijit", "register", NULL};
+#ifdef HAVE_MIJIT
+#define DEFAULT_JIT "mijit"
+#else
+#define DEFAULT_JIT "none"
+#endif
+
 static _GL_ATTRIBUTE_FORMAT_PRINTF_STANDARD(1, 0) void verror(const char *format, va_list args)
 {
     vfprintf(stderr, format, args);
@@ -75,15 +91,51 @@ static int skip_hashbang(FILE *fp)
     return 0;
 }
 
-// Load an object file
-static bool load_object(FILE *fp, bee_word_t *ptr)
+// Load an object file, returning its length, or -1 on error
+static off_t load_object(FILE *fp, bee_word_t *ptr)
 {
     off_t len;
-    return fp != NULL &&
+    if (fp != NULL &&
         skip_hashbang(fp) != -1 &&
         (len = fleno(fp)) >= 0 &&
         (off_t)fread(ptr, 1, len, fp) == len &&
-        fclose(fp) != EOF;
+        fclose(fp) != EOF)
+        return len;
+    return -1;
+}
+
+static int compare_symbols(const void *a, const void *b)
+{
+    const bee_symbol *s1 = a, *s2 = b;
+    return s1->addr < s2->addr ? -1 : s1->addr > s2->addr;
+}
+
+// Read symbols from the output of nm, whose values are offsets in the
+// object file, and sort them by address. Lines without a value, such as
+// those for undefined symbols, are ignored.
+static bool load_symbols(FILE *fp, bee_word_t *base)
+{
+    if (fp == NULL)
+        return false;
+    bee_uword_t size = 0;
+    char line[1024], name[1024], type;
+    bee_uword_t value;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "%zx %c %1023s", &value, &type, name) != 3)
+            continue;
+        if (nsymbols == size) {
+            size = size == 0 ? 64 : size * 2;
+            if ((symbols = realloc(symbols, size * sizeof(bee_symbol))) == NULL ||
+                (symbol_names = realloc(symbol_names, size * sizeof(char *))) == NULL)
+                return false;
+        }
+        symbols[nsymbols].addr = (bee_word_t *)((uint8_t *)base + value);
+        if ((symbols[nsymbols].name = symbol_names[nsymbols] = strdup(name)) == NULL)
+            return false;
+        nsymbols++;
+    }
+    qsort(symbols, nsymbols, sizeof(bee_symbol), compare_symbols);
+    return fclose(fp) != EOF;
 }
 
 
@@ -112,7 +164,7 @@ static void usage(void)
             program_name);
 #define OPT(longname, shortname, arg, argstring, docstring)             \
     shortopt = xasprintf(", -%c ", shortname);                           \
-    buf = xasprintf("--%s%s%s", longname, shortname ? shortopt : (arg == optional_argument ? "=" : ""), argstring); \
+    buf = xasprintf("--%s%s%s", longname, shortname ? shortopt : (arg != no_argument ? "=" : ""), argstring); \
     printf("  %-26s%s\n", buf, docstring);                              \
     free(buf);                                                          \
     free(shortopt);
@@ -191,9 +243,26 @@ int main(int argc, char *argv[])
                     die("option '--gdb': could not open file descriptors");
                 break;
             case 4:
+                {
+                    int i;
+                    for (i = 0; jit_names[i] != NULL; i++)
+                        if (strcmp(optarg, jit_names[i]) == 0)
+                            break;
+                    if (jit_names[i] == NULL || bee_set_jit(i) != 0)
+                        die("option '--jit': compiler '%s' is not available", optarg);
+                }
+                break;
+            case 5:
+                perf_map = true;
+                perf_map_symbols_file = optarg;
+                break;
+            case 6:
+                profile_file = optarg;
+                break;
+            case 7:
                 usage();
                 exit(EXIT_SUCCESS);
-            case 5:
+            case 8:
                 printf(PACKAGE_NAME " " VERSION " (%d-bit, %s)\n"
                        COPYRIGHT_STRING "\n"
                        PACKAGE_NAME " comes with ABSOLUTELY NO WARRANTY.\n"
@@ -213,6 +282,12 @@ int main(int argc, char *argv[])
             }
     }
 
+    // Count everything in the interpreter, so that no counts are missed.
+    if (profile_file != NULL) {
+        bee_set_jit(BEE_JIT_NONE);
+        bee_set_hot_threshold(BEE_UWORD_MAX);
+    }
+
     if ((memory = (bee_word_t *)calloc(memory_size, BEE_WORD_BYTES)) == NULL)
         die("could not allocate %zu words of memory", memory_size);
     bee_state * restrict S = bee_init(memory, stack_size, return_stack_size);
@@ -229,8 +304,18 @@ int main(int argc, char *argv[])
     FILE *handle = fopen(argv[optind], "rb");
     if (handle == NULL)
         die("cannot not open file %s", argv[optind]);
-    if (!load_object(handle, memory))
+    off_t len = load_object(handle, memory);
+    if (len < 0)
         die("could not read file %s, or file is invalid", argv[optind]);
+    // If memory runs out, the code is simply run with checks.
+    (void)bee_verify(memory, len);
+    if (perf_map) {
+        if (perf_map_symbols_file != NULL &&
+            !load_symbols(fopen(perf_map_symbols_file, "r"), memory))
+            die("could not read symbols from %s", perf_map_symbols_file);
+        if (bee_perf_map(memory, symbols, nsymbols) != 0)
+            die("could not open perf map");
+    }
 
     bee_word_t ret;
     if (gdb_target == true) {
@@ -238,7 +323,14 @@ int main(int argc, char *argv[])
         ret = EXIT_SUCCESS;
     } else
         ret = bee_run(S);
+    if (profile_file != NULL && bee_write_profile(profile_file, memory, len) != 0)
+        die("could not write profile to %s", profile_file);
     bee_destroy(S);
+    bee_finish();
+    for (bee_uword_t i = 0; i < nsymbols; i++)
+        free(symbol_names[i]);
+    free(symbol_names);
+    free(symbols);
     free(memory);
     return ret;
 }
@@ -0,0 +1,82 @@
+// perf map output, to name compiled code in profiles.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bee/bee.h"
+
+#include "private.h"
+
+
+// Linux perf reads /tmp/perf-PID.map to name code that is not in any
+// file. Each line gives the start address and size of a region in hex,
+// then its name.
+static FILE *perf_map = NULL;
+static bee_word_t *perf_map_base;
+static const bee_symbol *perf_map_symbols;
+static bee_uword_t perf_map_nsymbols;
+
+int bee_perf_map(bee_word_t *base, const bee_symbol *symbols, bee_uword_t nsymbols)
+{
+    char file[64];
+    snprintf(file, sizeof(file), "/tmp/perf-%ld.map", (long)getpid());
+    perf_map_close();
+    if ((perf_map = fopen(file, "w")) == NULL)
+        return -1;
+    perf_map_base = base;
+    perf_map_symbols = symbols;
+    perf_map_nsymbols = nsymbols;
+    return 0;
+}
+
+// Return the last symbol at or before `addr`, or NULL if none.
+static _GL_ATTRIBUTE_PURE const bee_symbol *find_symbol(bee_word_t *addr)
+{
+    const bee_symbol *sym = NULL;
+    bee_uword_t lo = 0, hi = perf_map_nsymbols;
+    while (lo < hi) {
+        bee_uword_t mid = lo + (hi - lo) / 2;
+        if (perf_map_symbols[mid].addr <= addr) {
+            sym = &perf_map_symbols[mid];
+            lo = mid + 1;
+        } else
+            hi = mid;
+    }
+    return sym;
+}
+
+void perf_map_code(void *code, bee_uword_t size, bee_word_t *addr)
+{
+    if (perf_map == NULL)
+        return;
+    fprintf(perf_map, "%zx %zx bee:", (bee_uword_t)code, size);
+    const bee_symbol *sym = find_symbol(addr);
+    if (sym == NULL)
+        fprintf(perf_map, "%#zx\n",
+                (bee_uword_t)(addr - perf_map_base) * BEE_WORD_BYTES);
+    else if (addr == sym->addr)
+        fprintf(perf_map, "%s\n", sym->name);
+    else
+        fprintf(perf_map, "%s+%#zx\n", sym->name,
+                (bee_uword_t)(addr - sym->addr) * BEE_WORD_BYTES);
+    // perf may read the map while the program is still running.
+    fflush(perf_map);
+}
+
+void perf_map_close(void)
+{
+    if (perf_map != NULL)
+        fclose(perf_map);
+    perf_map = NULL;
+}
@@ -8,6 +8,9 @@
 // THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
 // RISK.
 
+#include <stdbool.h>
+
+
 // Errors
 #define THROW(code)                             \
     do {                                        \
@@ -38,6 +41,20 @@
 #define PUSHD(val)                                                      \
     THROW_IF_ERROR(bee_push_stack(S->d0, S->dsize, &S->dp, val))
 
+// Unchecked stack access, once the stacks have been checked
+#define POP() (S->d0[--S->dp])
+#define PUSH(val)                                                       \
+    do {                                                                \
+        bee_word_t _val = (bee_word_t)(val);                            \
+        S->d0[S->dp++] = _val;                                          \
+    } while (0)
+#define RPOP() (S->s0[--S->sp])
+#define RPUSH(val)                                                      \
+    do {                                                                \
+        bee_word_t _val = (bee_word_t)(val);                            \
+        S->s0[S->sp++] = _val;                                          \
+    } while (0)
+
 
 // Memory access
 
@@ -50,6 +67,23 @@
     (((uint8_t *)((bee_uword_t)(a) & (BEE_WORD_BYTES - 1)) == 0))
 
 
+// Large literals
+//
+// A literal too big for PUSHI is compiled as a CALLI over the literal,
+// followed by POPS and LOAD, either in one word or in two. Return the
+// number of words in such a sequence starting at `pc`, or 0 if there is
+// none.
+#define LITERAL_CALLI ((1 << BEE_OP1_SHIFT) | BEE_OP_CALLI)
+#define LITERAL_INSN(op) (((bee_word_t)(op) << BEE_OP2_SHIFT) | BEE_OP_INSN)
+
+unsigned literal_words(bee_word_t *pc);
+
+
+// Division macros
+#define DIV_CATCH_ZERO(a, b) ((b) == 0 ? 0 : (a) / (b))
+#define MOD_CATCH_ZERO(a, b) ((b) == 0 ? (a) : (a) % (b))
+
+
 // Portable left shift (the behaviour of << with overflow (including on any
 // negative number) is undefined)
 #define LSHIFT(n, p)                            \
@@ -67,13 +101,101 @@
 #endif
 
 
+// Tiered execution
+typedef struct trace trace;
+typedef struct regvm_block regvm_block;
+
+// Native code returns an error code, with pc and ir set to resume the
+// interpreter.
+typedef bee_word_t jit_code(bee_state * restrict S);
+
+typedef struct code_range {
+    bee_word_t *start, *end;
+} code_range;
+
+typedef struct hot_counter {
+    bee_word_t *addr;
+    bee_uword_t count;
+    bool compiled; // Whether Mijit has compiled the code at `addr`
+    jit_code *code; // Native code compiled by the template JIT, if any
+    trace *trace; // The trace of the loop at `addr`, if any
+    regvm_block *block; // The block at `addr` translated for the register VM
+    code_range *ranges; // The code that the above were made from
+    bee_uword_t nranges;
+} hot_counter;
+
+extern int hot_jit;
+extern bee_uword_t hot_threshold;
+hot_counter *hot_lookup(bee_word_t *addr);
+hot_counter *hot_counter_for(bee_word_t *addr);
+bee_uword_t hot_count(bee_word_t *addr);
+void hot_reset(void);
+
+// Compilers note each range of code that they translate with hot_code(),
+// then attach the ranges to the counter for the translation with
+// hot_translated(), or discard them by passing NULL.
+extern bee_word_t *hot_code_start, *hot_code_end; // Bounds of all such code
+extern bee_uword_t hot_invalidations;
+extern bee_uword_t hot_cache_hits, hot_cache_misses; // See bee_cache_stats()
+void hot_code(bee_word_t *start, bee_word_t *end);
+bool hot_translated(hot_counter *c);
+bool hot_is_code(void *addr, bee_uword_t bytes);
+
+extern bee_uword_t trace_threshold;
+bool trace_start(bee_word_t *addr);
+bool trace_record(bee_word_t *pc);
+void trace_run(bee_state * restrict S, trace *t);
+void trace_free(trace *t);
+
+regvm_block *regvm_compile(bee_word_t *addr);
+void regvm_run(bee_state * restrict S, regvm_block *b);
+void regvm_free(regvm_block *b);
+
+#ifdef HAVE_TEMPLATE_JIT
+jit_code *jit_compile(bee_word_t *addr);
+void jit_reset(void);
+#endif
+
+// Code checked by bee_verify() runs without checks (see verifier.c).
+extern bee_word_t *verified_start, *verified_end; // Bounds of all such code
+extern bool verified_stale; // Whether the code may have changed unnoticed
+void verified_refresh(void);
+void verified_run(bee_state * restrict S);
+void verified_invalidate(void *addr, bee_uword_t bytes);
+void verified_reset(void);
+
+// Whether writing the `bytes` bytes at `addr` may change code that has been
+// compiled or verified, so that bee_invalidate() must be called.
+#define WRITES_CODE(addr, bytes)                                        \
+    (((bee_word_t *)(addr) < hot_code_end &&                            \
+      (uint8_t *)(addr) + (bytes) > (uint8_t *)hot_code_start) ||       \
+     ((bee_word_t *)(addr) < verified_end &&                            \
+      (uint8_t *)(addr) + (bytes) > (uint8_t *)verified_start))
+
+// Name native code compiled from `addr` in the perf map, if one is open.
+void perf_map_code(void *code, bee_uword_t size, bee_word_t *addr);
+void perf_map_close(void);
+
+
 // Traps
 bee_word_t trap(bee_state * restrict S, bee_word_t code);
-bee_word_t trap_libc(bee_state * restrict S);
+extern const bee_trap_function trap_libc_functions[];
+extern const bee_trap_function trap_ffi_functions[];
+extern const bee_trap_function trap_memory_functions[];
+extern const bee_trap_function trap_hash_functions[];
+extern const bee_trap_function trap_text_functions[];
+extern const bee_trap_function trap_stream_functions[];
+// Flush output streams, or close all streams.
+void streams_flush(void);
+void streams_close(void);
+extern const bee_trap_function trap_async_functions[];
+// Wait for asynchronous operations, and free their resources.
+void async_reset(void);
 
 
 // Jit compiler
 #ifdef HAVE_MIJIT
 #include "../mijit-bee/mijit-bee.h"
 extern mijit_bee_jit *bee_jit;
+extern bee_uword_t bee_jit_crossings;
 #endif
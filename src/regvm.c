@@ -0,0 +1,545 @@
+// Translation of hot basic blocks to code for a register machine.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bee/bee.h"
+#include "bee/opcodes.h"
+
+#include "private.h"
+
+
+// When code becomes hot, the straight-line code that starts there is
+// translated, up to and including a static control transfer, or until
+// just before an instruction that cannot be translated. Stack items become
+// registers: the items that the block reads are loaded into registers on
+// entry, and each instruction takes its operands from registers and
+// writes its result to a new one. Stack shuffles such as POP, and DUP and
+// SWAP with a literal depth, merely rename registers; operations on
+// constants are done at translation time; and any result that is never
+// used is not computed.
+//
+// Each exit from a block stores the registers that hold changed stack
+// items, and sets pc and ir to resume. An exit is also taken before any
+// instruction whose check fails, or that writes to code, so that the
+// interpreter runs it, and raises any error, exactly as it would have done
+// anyway. The stacks are checked once on entry: if they are too shallow or
+// too full for the block, it is not run.
+
+// Registers 0 to MAX_INPUTS - 1 hold the items loaded on entry, top first;
+// constants are allocated downwards from MAX_REGS - 1, and other results
+// upwards from MAX_INPUTS.
+#define MAX_INPUTS 16
+#define MAX_REGS 256
+#define MAX_STACK 64 // Items in a block's view of the stack, including inputs
+
+// Operations that do not correspond to an instruction
+enum {
+    REG_JUMPZ = BEE_INSN_MASK + 1, // Take exit `exit` if `a` is 0, else the next
+    REG_EXIT, // Take exit `exit`
+    REG_RETURN_ADDRESS, // Write `a` just above the return stack, as CALLI does
+    REG_DEAD, // Do nothing (a result that is not used)
+};
+
+typedef struct reg_insn {
+    uint8_t opcode; // An instruction opcode, or one of the above
+    uint8_t dst, a, b; // The result register, and operands: `a` was on top
+    uint16_t exit; // The exit taken if a check fails
+} reg_insn;
+
+typedef struct reg_slot {
+    uint8_t slot, reg;
+} reg_slot;
+
+typedef struct reg_exit {
+    // Interpreter state to resume at
+    bee_word_t *pc;
+    bee_word_t ir;
+    bee_word_t *ret; // A return address to push, or NULL
+    uint16_t depth; // The stack depth, counting the MAX_INPUTS slots
+    uint16_t slots, nslots; // The stack slots to store, in `regvm_block.slots`
+} reg_exit;
+
+struct regvm_block {
+    uint16_t inputs; // Items read from the stack on entry
+    uint16_t pushes; // Most items that the block has above them at once
+    bool calls; // Whether a return address is pushed or written
+    uint16_t nconsts;
+    bee_word_t *consts; // Registers MAX_REGS - nconsts and up
+    reg_insn *insns;
+    reg_exit *exits;
+    reg_slot *slots;
+};
+
+void regvm_free(regvm_block *b)
+{
+    if (b != NULL) {
+        free(b->consts);
+        free(b->insns);
+        free(b->exits);
+        free(b->slots);
+        free(b);
+    }
+}
+
+// Compute the result of pure instruction `opcode` on operands `a` (the
+// top of the stack) and `b`.
+static inline _GL_ATTRIBUTE_PURE bee_word_t compute(unsigned opcode, bee_word_t a, bee_word_t b)
+{
+    switch (opcode) {
+    case BEE_INSN_NOT:
+        return ~a;
+    case BEE_INSN_AND:
+        return a & b;
+    case BEE_INSN_OR:
+        return a | b;
+    case BEE_INSN_XOR:
+        return a ^ b;
+    case BEE_INSN_LSHIFT:
+        return a < (bee_word_t)BEE_WORD_BIT ? LSHIFT(b, a) : 0;
+    case BEE_INSN_RSHIFT:
+        return a < (bee_word_t)BEE_WORD_BIT ? (bee_word_t)((bee_uword_t)b >> a) : 0;
+    case BEE_INSN_ARSHIFT:
+        return ARSHIFT(b, a);
+    case BEE_INSN_NEG:
+        return (bee_word_t)-(bee_uword_t)a;
+    case BEE_INSN_ADD:
+        return (bee_word_t)((bee_uword_t)b + (bee_uword_t)a);
+    case BEE_INSN_MUL:
+        return (bee_word_t)((bee_uword_t)b * (bee_uword_t)a);
+    case BEE_INSN_EQ:
+        return b == a;
+    case BEE_INSN_LT:
+        return b < a;
+    case BEE_INSN_ULT:
+        return (bee_uword_t)b < (bee_uword_t)a;
+    default:
+        abort();
+    }
+}
+
+
+// Translation
+static bee_word_t *block_start;
+static uint8_t stack[MAX_STACK]; // The register holding each stack slot
+static unsigned top; // The number of slots in use
+static unsigned low; // The lowest slot that the block has touched
+static unsigned high; // The most slots in use at once
+static unsigned nregs, nconsts;
+static bee_word_t consts[MAX_REGS - MAX_INPUTS];
+static reg_insn insns[MAX_REGS];
+static unsigned ninsns;
+static reg_exit exits[MAX_REGS];
+static unsigned nexits;
+static reg_slot slots[MAX_REGS * MAX_STACK];
+static unsigned nslots;
+static bool failed;
+
+// The register that holds slot `s` on entry
+#define INPUT(s) (MAX_INPUTS - 1 - (s))
+
+static bool is_const(uint8_t reg)
+{
+    return reg >= MAX_REGS - nconsts;
+}
+
+static bee_word_t const_value(uint8_t reg)
+{
+    return consts[MAX_REGS - 1 - reg];
+}
+
+// Whether `n` more registers and `n` more slots are available.
+static bool room(unsigned n)
+{
+    return nregs + nconsts + n <= MAX_REGS && top + n <= MAX_STACK &&
+        ninsns + 1 < MAX_REGS && nexits + 2 <= MAX_REGS;
+}
+
+static uint8_t new_const(bee_word_t value)
+{
+    consts[nconsts] = value;
+    return (uint8_t)(MAX_REGS - 1 - nconsts++);
+}
+
+static uint8_t pop(void)
+{
+    top--;
+    if (top < low)
+        low = top;
+    return stack[top];
+}
+
+static void push(uint8_t reg)
+{
+    stack[top++] = reg;
+    if (top > high)
+        high = top;
+}
+
+// Record an exit resuming at `pc` and `ir`, with the current stack.
+static unsigned exit_to(bee_word_t *pc, bee_word_t ir, bee_word_t *ret)
+{
+    reg_exit *e = &exits[nexits];
+    *e = (reg_exit){pc, ir, ret, top, nslots, 0};
+    for (unsigned s = low; s < top; s++)
+        if (s >= MAX_INPUTS || stack[s] != INPUT(s))
+            slots[nslots++] = (reg_slot){s, stack[s]};
+    e->nslots = nslots - e->slots;
+    return nexits++;
+}
+
+static void emit(uint8_t opcode, uint8_t dst, uint8_t a, uint8_t b, unsigned guard)
+{
+    insns[ninsns++] = (reg_insn){opcode, dst, a, b, guard};
+}
+
+// Translate instruction `opcode` of the instruction word before `pc`, which
+// starts the instructions left in `ops`. Return false if it cannot be
+// translated.
+static bool translate_insn(bee_word_t *pc, bee_uword_t ops)
+{
+    unsigned opcode = ops & BEE_INSN_MASK;
+    bee_word_t ir = (bee_word_t)((ops << BEE_OP2_SHIFT) | BEE_OP_INSN);
+    if (!room(2))
+        return false;
+    switch (opcode) {
+    case BEE_INSN_NOT:
+    case BEE_INSN_NEG:
+        {
+            if (top == 0)
+                return false;
+            uint8_t a = pop();
+            if (is_const(a))
+                push(new_const(compute(opcode, const_value(a), 0)));
+            else {
+                emit(opcode, nregs, a, a, 0);
+                push(nregs++);
+            }
+        }
+        break;
+    case BEE_INSN_AND:
+    case BEE_INSN_OR:
+    case BEE_INSN_XOR:
+    case BEE_INSN_LSHIFT:
+    case BEE_INSN_RSHIFT:
+    case BEE_INSN_ARSHIFT:
+    case BEE_INSN_ADD:
+    case BEE_INSN_MUL:
+    case BEE_INSN_EQ:
+    case BEE_INSN_LT:
+    case BEE_INSN_ULT:
+        {
+            if (top < 2)
+                return false;
+            uint8_t a = pop(), b = pop();
+            if (is_const(a) && is_const(b))
+                push(new_const(compute(opcode, const_value(a), const_value(b))));
+            else {
+                emit(opcode, nregs, a, b, 0);
+                push(nregs++);
+            }
+        }
+        break;
+    case BEE_INSN_POP:
+        if (top == 0)
+            return false;
+        pop();
+        break;
+    case BEE_INSN_DUP:
+    case BEE_INSN_SWAP:
+        {
+            // Only a literal depth can be renamed.
+            if (top == 0 || !is_const(stack[top - 1]))
+                return false;
+            bee_uword_t depth = const_value(stack[top - 1]);
+            bee_uword_t below = opcode == BEE_INSN_DUP ? 1 : 2;
+            if (top < below || depth >= top - below)
+                return false;
+            unsigned s = top - below - depth - 1;
+            if (s < low)
+                low = s;
+            if (opcode == BEE_INSN_DUP)
+                stack[top - 1] = stack[s];
+            else {
+                pop();
+                uint8_t temp = stack[s];
+                stack[s] = stack[top - 1];
+                stack[top - 1] = temp;
+            }
+        }
+        break;
+    case BEE_INSN_LOAD:
+    case BEE_INSN_LOAD1:
+        {
+            if (top == 0)
+                return false;
+            unsigned guard = exit_to(pc, ir, NULL);
+            uint8_t a = pop();
+            emit(opcode, nregs, a, a, guard);
+            push(nregs++);
+        }
+        break;
+    case BEE_INSN_STORE:
+    case BEE_INSN_STORE1:
+        {
+            if (top < 2)
+                return false;
+            unsigned guard = exit_to(pc, ir, NULL);
+            uint8_t a = pop(), b = pop();
+            emit(opcode, 0, a, b, guard);
+        }
+        break;
+    case BEE_INSN_WORD_BYTES:
+        push(new_const(BEE_WORD_BYTES));
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+// Translate the instruction word at `pc`. Return the number of words
+// translated, or 0 if the block ends.
+static unsigned translate_word(bee_word_t *pc)
+{
+    bee_word_t ir = *pc, *next = pc + 1;
+    hot_code(pc, next);
+    if (!room(2)) {
+        emit(REG_EXIT, 0, 0, 0, exit_to(next, ir, NULL));
+        return 0;
+    }
+    switch (ir & BEE_OP1_MASK) {
+    case BEE_OP_CALLI:
+        {
+            unsigned words = literal_words(pc);
+            if (words != 0) {
+                hot_code(next, pc + words);
+                emit(REG_RETURN_ADDRESS, 0, new_const((bee_word_t)next), 0, 0);
+                push(new_const(*next));
+                return words;
+            }
+            emit(REG_EXIT, 0, 0, 0, exit_to(next + ARSHIFT(ir, BEE_OP1_SHIFT), 0, next));
+        }
+        return 0;
+    case BEE_OP_PUSHI:
+        push(new_const(ARSHIFT(ir, BEE_OP1_SHIFT)));
+        return 1;
+    case BEE_OP_PUSHRELI:
+        push(new_const((bee_word_t)(next + ARSHIFT(ir, BEE_OP1_SHIFT))));
+        return 1;
+    default:
+        switch (ir & BEE_OP2_MASK) {
+        case BEE_OP_JUMPI:
+            emit(REG_EXIT, 0, 0, 0, exit_to(next + ARSHIFT(ir, BEE_OP2_SHIFT), 0, NULL));
+            return 0;
+        case BEE_OP_JUMPZI:
+            {
+                if (top == 0)
+                    break;
+                bee_word_t *target = next + ARSHIFT(ir, BEE_OP2_SHIFT);
+                uint8_t flag = pop();
+                if (is_const(flag))
+                    emit(REG_EXIT, 0, 0, 0, exit_to(const_value(flag) == 0 ? target : next, 0, NULL));
+                else {
+                    unsigned taken = exit_to(target, 0, NULL);
+                    exit_to(next, 0, NULL);
+                    emit(REG_JUMPZ, 0, flag, flag, taken);
+                }
+            }
+            return 0;
+        case BEE_OP_INSN:
+            for (bee_uword_t ops = (bee_uword_t)ir >> BEE_OP2_SHIFT;
+                 (ops & BEE_INSN_MASK) != BEE_INSN_NOP;
+                 ops >>= BEE_INSN_BITS)
+                if (!translate_insn(next, ops)) {
+                    // Nothing can be done if the block would be empty.
+                    if (pc == block_start && ops == (bee_uword_t)ir >> BEE_OP2_SHIFT)
+                        failed = true;
+                    emit(REG_EXIT, 0, 0, 0,
+                         exit_to(next, (bee_word_t)((ops << BEE_OP2_SHIFT) | BEE_OP_INSN), NULL));
+                    return 0;
+                }
+            return 1;
+        default:
+            break;
+        }
+    }
+    // Leave the word to the interpreter.
+    if (pc == block_start)
+        failed = true;
+    emit(REG_EXIT, 0, 0, 0, exit_to(next, ir, NULL));
+    return 0;
+}
+
+// Remove instructions whose results are not used.
+static void eliminate_dead_code(void)
+{
+    bool live[MAX_REGS] = {false};
+    for (unsigned i = ninsns; i-- > 0; ) {
+        reg_insn *insn = &insns[i];
+        switch (insn->opcode) {
+        case REG_JUMPZ:
+            for (unsigned j = 0; j < exits[insn->exit + 1].nslots; j++)
+                live[slots[exits[insn->exit + 1].slots + j].reg] = true;
+            live[insn->a] = true;
+            // Fall through
+        case REG_EXIT:
+            for (unsigned j = 0; j < exits[insn->exit].nslots; j++)
+                live[slots[exits[insn->exit].slots + j].reg] = true;
+            break;
+        case REG_RETURN_ADDRESS:
+            live[insn->a] = true;
+            break;
+        case BEE_INSN_LOAD:
+        case BEE_INSN_LOAD1:
+        case BEE_INSN_STORE:
+        case BEE_INSN_STORE1:
+            for (unsigned j = 0; j < exits[insn->exit].nslots; j++)
+                live[slots[exits[insn->exit].slots + j].reg] = true;
+            live[insn->dst] = false;
+            live[insn->a] = live[insn->b] = true;
+            break;
+        default:
+            if (!live[insn->dst])
+                insn->opcode = REG_DEAD;
+            else {
+                live[insn->dst] = false;
+                live[insn->a] = live[insn->b] = true;
+            }
+            break;
+        }
+    }
+}
+
+// Copy `n` elements of `src` into a new array, or return false.
+#define COPY(dst, src, n)                                       \
+    (((dst) = malloc((n) * sizeof((src)[0]))) != NULL &&        \
+     memcpy((dst), (src), (n) * sizeof((src)[0])) != NULL)
+
+regvm_block *regvm_compile(bee_word_t *addr)
+{
+    block_start = addr;
+    for (top = 0; top < MAX_INPUTS; top++)
+        stack[top] = INPUT(top);
+    low = high = top;
+    nregs = MAX_INPUTS;
+    nconsts = ninsns = nexits = nslots = 0;
+    failed = false;
+    unsigned words;
+    for (bee_word_t *pc = addr; (words = translate_word(pc)) != 0; pc += words)
+        ;
+    if (failed)
+        return NULL;
+    eliminate_dead_code();
+
+    regvm_block *b = calloc(1, sizeof(regvm_block));
+    if (b == NULL)
+        return NULL;
+    b->inputs = MAX_INPUTS - low;
+    // A block may push items and pop them again before it exits, so the
+    // highest point reached must fit on the stack, not just its exits.
+    b->pushes = high - MAX_INPUTS;
+    for (unsigned i = 0; i < nexits; i++)
+        b->calls |= exits[i].ret != NULL;
+    for (unsigned i = 0; i < ninsns; i++)
+        b->calls |= insns[i].opcode == REG_RETURN_ADDRESS;
+    b->nconsts = nconsts;
+    // Store constants in register order.
+    for (unsigned i = 0; i < nconsts / 2; i++) {
+        bee_word_t temp = consts[i];
+        consts[i] = consts[nconsts - 1 - i];
+        consts[nconsts - 1 - i] = temp;
+    }
+    if ((nconsts != 0 && !COPY(b->consts, consts, nconsts)) ||
+        !COPY(b->insns, insns, ninsns) ||
+        !COPY(b->exits, exits, nexits) ||
+        (nslots != 0 && !COPY(b->slots, slots, nslots))) {
+        regvm_free(b);
+        return NULL;
+    }
+    return b;
+}
+
+
+// Execution
+void regvm_run(bee_state * restrict S, regvm_block *b)
+{
+    if (S->dp > S->dsize || S->dp < b->inputs || S->dsize - S->dp < b->pushes ||
+        (b->calls && S->sp >= S->ssize))
+        return;
+
+    bee_word_t reg[MAX_REGS];
+    for (unsigned i = 0; i < b->inputs; i++)
+        reg[i] = S->d0[S->dp - 1 - i];
+    if (b->nconsts != 0)
+        memcpy(reg + MAX_REGS - b->nconsts, b->consts, b->nconsts * sizeof(bee_word_t));
+
+    reg_insn *insn;
+    unsigned taken;
+    for (insn = b->insns; ; insn++) {
+        taken = insn->exit;
+        switch (insn->opcode) {
+#define PURE(name)                                                      \
+        case BEE_INSN_##name:                                           \
+            reg[insn->dst] = compute(BEE_INSN_##name, reg[insn->a], reg[insn->b]); \
+            break;
+        PURE(NOT) PURE(AND) PURE(OR) PURE(XOR) PURE(LSHIFT) PURE(RSHIFT)
+        PURE(ARSHIFT) PURE(NEG) PURE(ADD) PURE(MUL) PURE(EQ) PURE(LT) PURE(ULT)
+#undef PURE
+        case BEE_INSN_LOAD:
+            if (!IS_ALIGNED(reg[insn->a]))
+                goto exit;
+            reg[insn->dst] = *(bee_word_t *)reg[insn->a];
+            break;
+        case BEE_INSN_LOAD1:
+            reg[insn->dst] = *(uint8_t *)reg[insn->a];
+            break;
+        case BEE_INSN_STORE:
+            if (!IS_ALIGNED(reg[insn->a]) || WRITES_CODE(reg[insn->a], BEE_WORD_BYTES))
+                goto exit;
+            *(bee_word_t *)reg[insn->a] = reg[insn->b];
+            break;
+        case BEE_INSN_STORE1:
+            if (WRITES_CODE(reg[insn->a], 1))
+                goto exit;
+            *(uint8_t *)reg[insn->a] = (uint8_t)reg[insn->b];
+            break;
+        case REG_RETURN_ADDRESS:
+            S->s0[S->sp] = reg[insn->a];
+            break;
+        case REG_JUMPZ:
+            if (reg[insn->a] != 0)
+                taken++;
+            goto exit;
+        case REG_EXIT:
+            goto exit;
+        default:
+            break;
+        }
+    }
+
+ exit:
+    {
+        reg_exit *e = &b->exits[taken];
+        bee_uword_t base = S->dp - MAX_INPUTS;
+        for (reg_slot *s = b->slots + e->slots; s < b->slots + e->slots + e->nslots; s++)
+            S->d0[base + s->slot] = reg[s->reg];
+        S->dp = base + e->depth;
+        if (e->ret != NULL)
+            S->s0[S->sp++] = (bee_word_t)e->ret;
+        S->pc = e->pc;
+        S->ir = e->ir;
+    }
+}
@@ -0,0 +1,466 @@
+// Trace recording and execution for hot loops.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "bee/bee.h"
+#include "bee/opcodes.h"
+
+#include "private.h"
+
+
+// When a loop head becomes hot, the interpreter records the instruction
+// words executed in one iteration, following calls and returns, until
+// control returns to the loop head. The trace is then compiled into a
+// linear sequence of operations, with a guard wherever the recorded path
+// could be left: a different conditional branch outcome, a different
+// computed jump target, or a failing check. A failed guard exits to the
+// interpreter at the instruction that was about to run, which then runs
+// it, and raises any error, exactly as it would have done anyway.
+bee_uword_t trace_threshold = 0;
+
+void bee_set_trace_threshold(bee_uword_t threshold)
+{
+    trace_threshold = threshold;
+}
+
+
+// Trace operations
+enum {
+    TRACE_INSN,         // Run instruction opcode `operand`
+    TRACE_PUSH,         // Push `operand`
+    TRACE_CALLI,        // Push `operand` on the return stack
+    TRACE_IF_ZERO,      // Pop a flag, which must be zero
+    TRACE_IF_NONZERO,   // Pop a flag, which must not be zero
+    TRACE_JUMP,         // Pop an address, which must be `operand`
+    TRACE_CALL,         // As TRACE_JUMP, then push `ret` on the return stack
+    TRACE_RET,          // Pop the return stack, which must give `operand`
+    TRACE_LOOP,         // Go back to the start of the trace
+};
+
+typedef struct trace_op {
+    int type;
+    bee_word_t operand;
+    bee_word_t *ret;
+    // Interpreter state to resume at if this operation exits
+    bee_word_t *pc;
+    bee_word_t ir;
+} trace_op;
+
+struct trace {
+    size_t len;
+    trace_op ops[];
+};
+
+
+// Recording
+#define MAX_TRACE_WORDS 1024
+static bee_word_t *trace_head;
+static bee_word_t *recorded[MAX_TRACE_WORDS];
+static size_t recorded_len;
+
+static trace *trace_compile(void);
+
+bool trace_start(bee_word_t *addr)
+{
+    trace_head = addr;
+    recorded_len = 0;
+    return true;
+}
+
+bool trace_record(bee_word_t *pc)
+{
+    if (recorded_len > 0 && pc == trace_head) {
+        trace *t = trace_compile();
+        hot_counter *c = t != NULL ? hot_counter_for(trace_head) : NULL;
+        if (c != NULL && c->trace == NULL && hot_translated(c))
+            c->trace = t;
+        else {
+            hot_translated(NULL);
+            trace_free(t);
+        }
+        return false;
+    }
+    if (recorded_len == MAX_TRACE_WORDS)
+        return false;
+    recorded[recorded_len++] = pc;
+    return true;
+}
+
+void trace_free(trace *t)
+{
+    free(t);
+}
+
+
+// Compilation
+static trace *compiled;
+static size_t compiled_size;
+
+static bool emit(int type, bee_word_t operand, bee_word_t *ret, bee_word_t *pc, bee_word_t ir)
+{
+    if (compiled->len == compiled_size) {
+        compiled_size *= 2;
+        trace *t = realloc(compiled, sizeof(trace) + compiled_size * sizeof(trace_op));
+        if (t == NULL)
+            return false;
+        compiled = t;
+    }
+    compiled->ops[compiled->len++] = (trace_op){type, operand, ret, pc, ir};
+    return true;
+}
+
+// Return whether instruction opcode `opcode` can be traced as a
+// TRACE_INSN operation.
+static bool traceable(bee_uword_t opcode)
+{
+    switch (opcode) {
+    case BEE_INSN_NOT:
+    case BEE_INSN_AND:
+    case BEE_INSN_OR:
+    case BEE_INSN_XOR:
+    case BEE_INSN_POP:
+    case BEE_INSN_DUP:
+    case BEE_INSN_SWAP:
+    case BEE_INSN_LOAD:
+    case BEE_INSN_STORE:
+    case BEE_INSN_LOAD1:
+    case BEE_INSN_STORE1:
+    case BEE_INSN_LOAD_IA:
+    case BEE_INSN_STORE_IA:
+    case BEE_INSN_NEG:
+    case BEE_INSN_ADD:
+    case BEE_INSN_MUL:
+    case BEE_INSN_EQ:
+    case BEE_INSN_LT:
+    case BEE_INSN_ULT:
+    case BEE_INSN_PUSHS:
+    case BEE_INSN_POPS:
+    case BEE_INSN_DUPS:
+    case BEE_INSN_WORD_BYTES:
+    case BEE_INSN_GET_DP:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Compile one recorded instruction word at `pc`, which was followed by
+// the word at `next`.
+static bool compile_word(bee_word_t *pc, bee_word_t *next)
+{
+    bee_word_t ir = *pc;
+    bee_word_t *fallthrough = pc + 1;
+    hot_code(pc, fallthrough);
+
+    switch (ir & BEE_OP1_MASK) {
+    case BEE_OP_CALLI:
+        return next == fallthrough + ARSHIFT(ir, BEE_OP1_SHIFT) &&
+            emit(TRACE_CALLI, (bee_word_t)fallthrough, NULL, fallthrough, ir);
+    case BEE_OP_PUSHI:
+        return next == fallthrough &&
+            emit(TRACE_PUSH, ARSHIFT(ir, BEE_OP1_SHIFT), NULL, fallthrough, ir);
+    case BEE_OP_PUSHRELI:
+        return next == fallthrough &&
+            emit(TRACE_PUSH, (bee_word_t)(fallthrough + ARSHIFT(ir, BEE_OP1_SHIFT)), NULL, fallthrough, ir);
+    default:
+        switch (ir & BEE_OP2_MASK) {
+        case BEE_OP_JUMPI:
+            return next == fallthrough + ARSHIFT(ir, BEE_OP2_SHIFT);
+        case BEE_OP_JUMPZI:
+            {
+                bee_word_t *target = fallthrough + ARSHIFT(ir, BEE_OP2_SHIFT);
+                if (target == fallthrough)
+                    return next == fallthrough &&
+                        emit(TRACE_INSN, BEE_INSN_POP, NULL, fallthrough, ir);
+                if (next == target)
+                    return emit(TRACE_IF_ZERO, 0, NULL, fallthrough, ir);
+                return next == fallthrough &&
+                    emit(TRACE_IF_NONZERO, 0, NULL, fallthrough, ir);
+            }
+        case BEE_OP_INSN:
+            {
+                // Instructions after a transfer in the same word run at
+                // its target, so that is where they resume on exit.
+                bool transferred = false;
+                bee_word_t *resume = fallthrough;
+                for (bee_uword_t ops = (bee_uword_t)ir >> BEE_OP2_SHIFT; ; ops >>= BEE_INSN_BITS) {
+                    bee_uword_t opcode = ops & BEE_INSN_MASK;
+                    bee_word_t op_ir = (bee_word_t)((ops << BEE_OP2_SHIFT) | BEE_OP_INSN);
+                    if (opcode == BEE_INSN_NOP)
+                        break;
+                    int type = TRACE_INSN;
+                    switch (opcode) {
+                    case BEE_INSN_JUMP:
+                        type = TRACE_JUMP;
+                        break;
+                    case BEE_INSN_CALL:
+                        type = TRACE_CALL;
+                        break;
+                    case BEE_INSN_RET:
+                        type = TRACE_RET;
+                        break;
+                    default:
+                        if (!traceable(opcode))
+                            return false;
+                    }
+                    if (type != TRACE_INSN) {
+                        if (transferred)
+                            return false;
+                        transferred = true;
+                        if (!emit(type, (bee_word_t)next, fallthrough, fallthrough, op_ir))
+                            return false;
+                        resume = next;
+                    } else if (!emit(TRACE_INSN, opcode, NULL, resume, op_ir))
+                        return false;
+                }
+                return transferred || next == fallthrough;
+            }
+        default:
+            return false;
+        }
+    }
+}
+
+static trace *trace_compile(void)
+{
+    compiled_size = recorded_len * 2;
+    compiled = malloc(sizeof(trace) + compiled_size * sizeof(trace_op));
+    if (compiled == NULL)
+        return NULL;
+    compiled->len = 0;
+
+    for (size_t i = 0; i < recorded_len; i++) {
+        bee_word_t *next = i + 1 < recorded_len ? recorded[i + 1] : trace_head;
+        if (!compile_word(recorded[i], next)) {
+            free(compiled);
+            return NULL;
+        }
+    }
+    if (!emit(TRACE_LOOP, 0, NULL, NULL, 0)) {
+        free(compiled);
+        return NULL;
+    }
+    return compiled;
+}
+
+
+// Execution
+#define CHECK(ssize, sp, pops, pushes)                                  \
+    if (bee_check_stack(ssize, sp, pops, pushes) != BEE_ERROR_OK)       \
+        goto exit
+#define NEEDD(pops, pushes) CHECK(S->dsize, S->dp, pops, pushes)
+#define NEEDS(pops, pushes) CHECK(S->ssize, S->sp, pops, pushes)
+#define EXIT_UNLESS(cond)                       \
+    if (!(cond))                                \
+        goto exit
+// Leave writes to translated code to the interpreter.
+#define NOT_CODE(addr, bytes)                                   \
+    EXIT_UNLESS(!hot_is_code((void *)(addr), bytes))
+
+#define TOP (S->d0[S->dp - 1])
+#define NEXT (S->d0[S->dp - 2])
+
+void trace_run(bee_state * restrict S, trace *t)
+{
+    trace_op *op = t->ops;
+    for (;; op++) {
+        switch (op->type) {
+        case TRACE_PUSH:
+            NEEDD(0, 1);
+            S->d0[S->dp++] = op->operand;
+            break;
+        case TRACE_CALLI:
+            NEEDS(0, 1);
+            S->s0[S->sp++] = op->operand;
+            break;
+        case TRACE_IF_ZERO:
+            NEEDD(1, 0);
+            EXIT_UNLESS(TOP == 0);
+            S->dp--;
+            break;
+        case TRACE_IF_NONZERO:
+            NEEDD(1, 0);
+            EXIT_UNLESS(TOP != 0);
+            S->dp--;
+            break;
+        case TRACE_JUMP:
+            NEEDD(1, 0);
+            EXIT_UNLESS(TOP == op->operand);
+            S->dp--;
+            break;
+        case TRACE_CALL:
+            NEEDD(1, 0);
+            NEEDS(0, 1);
+            EXIT_UNLESS(TOP == op->operand);
+            S->dp--;
+            S->s0[S->sp++] = (bee_word_t)op->ret;
+            break;
+        case TRACE_RET:
+            NEEDS(1, 0);
+            EXIT_UNLESS(S->sp > S->handler_sp && S->s0[S->sp - 1] == op->operand);
+            S->sp--;
+            break;
+        case TRACE_LOOP:
+            op = t->ops - 1;
+            break;
+        case TRACE_INSN:
+            switch (op->operand) {
+            case BEE_INSN_NOT:
+                NEEDD(1, 1);
+                TOP = ~TOP;
+                break;
+            case BEE_INSN_AND:
+                NEEDD(2, 1);
+                NEXT &= TOP;
+                S->dp--;
+                break;
+            case BEE_INSN_OR:
+                NEEDD(2, 1);
+                NEXT |= TOP;
+                S->dp--;
+                break;
+            case BEE_INSN_XOR:
+                NEEDD(2, 1);
+                NEXT ^= TOP;
+                S->dp--;
+                break;
+            case BEE_INSN_POP:
+                NEEDD(1, 0);
+                S->dp--;
+                break;
+            case BEE_INSN_DUP:
+                {
+                    NEEDD(1, 1);
+                    bee_uword_t depth = TOP;
+                    EXIT_UNLESS(depth < S->dp - 1);
+                    TOP = S->d0[S->dp - (depth + 2)];
+                }
+                break;
+            case BEE_INSN_SWAP:
+                {
+                    NEEDD(1, 0);
+                    bee_uword_t depth = TOP;
+                    EXIT_UNLESS(S->dp >= 2 && depth < S->dp - 2);
+                    S->dp--;
+                    bee_word_t temp = S->d0[S->dp - (depth + 2)];
+                    S->d0[S->dp - (depth + 2)] = TOP;
+                    TOP = temp;
+                }
+                break;
+            case BEE_INSN_LOAD:
+                NEEDD(1, 1);
+                EXIT_UNLESS(IS_ALIGNED(TOP));
+                TOP = *(bee_word_t *)TOP;
+                break;
+            case BEE_INSN_STORE:
+                NEEDD(2, 0);
+                EXIT_UNLESS(IS_ALIGNED(TOP));
+                NOT_CODE(TOP, BEE_WORD_BYTES);
+                *(bee_word_t *)TOP = NEXT;
+                S->dp -= 2;
+                break;
+            case BEE_INSN_LOAD1:
+                NEEDD(1, 1);
+                TOP = *(uint8_t *)TOP;
+                break;
+            case BEE_INSN_STORE1:
+                NEEDD(2, 0);
+                NOT_CODE(TOP, 1);
+                *(uint8_t *)TOP = (uint8_t)NEXT;
+                S->dp -= 2;
+                break;
+            case BEE_INSN_LOAD_IA:
+                {
+                    NEEDD(1, 2);
+                    bee_word_t *addr = (bee_word_t *)TOP;
+                    EXIT_UNLESS(IS_ALIGNED(addr));
+                    TOP = *addr;
+                    S->d0[S->dp++] = (bee_word_t)(addr + 1);
+                }
+                break;
+            case BEE_INSN_STORE_IA:
+                {
+                    NEEDD(2, 1);
+                    bee_word_t *addr = (bee_word_t *)TOP;
+                    EXIT_UNLESS(IS_ALIGNED(addr));
+                    NOT_CODE(addr, BEE_WORD_BYTES);
+                    *addr = NEXT;
+                    S->dp--;
+                    TOP = (bee_word_t)(addr + 1);
+                }
+                break;
+            case BEE_INSN_NEG:
+                NEEDD(1, 1);
+                TOP = (bee_word_t)-(bee_uword_t)TOP;
+                break;
+            case BEE_INSN_ADD:
+                NEEDD(2, 1);
+                NEXT = (bee_word_t)((bee_uword_t)NEXT + (bee_uword_t)TOP);
+                S->dp--;
+                break;
+            case BEE_INSN_MUL:
+                NEEDD(2, 1);
+                NEXT = (bee_word_t)((bee_uword_t)NEXT * (bee_uword_t)TOP);
+                S->dp--;
+                break;
+            case BEE_INSN_EQ:
+                NEEDD(2, 1);
+                NEXT = NEXT == TOP;
+                S->dp--;
+                break;
+            case BEE_INSN_LT:
+                NEEDD(2, 1);
+                NEXT = NEXT < TOP;
+                S->dp--;
+                break;
+            case BEE_INSN_ULT:
+                NEEDD(2, 1);
+                NEXT = (bee_uword_t)NEXT < (bee_uword_t)TOP;
+                S->dp--;
+                break;
+            case BEE_INSN_PUSHS:
+                NEEDD(1, 0);
+                NEEDS(0, 1);
+                S->s0[S->sp++] = S->d0[--S->dp];
+                break;
+            case BEE_INSN_POPS:
+                NEEDS(1, 0);
+                NEEDD(0, 1);
+                S->d0[S->dp++] = S->s0[--S->sp];
+                break;
+            case BEE_INSN_DUPS:
+                NEEDS(1, 1);
+                NEEDD(0, 1);
+                S->d0[S->dp++] = S->s0[S->sp - 1];
+                break;
+            case BEE_INSN_WORD_BYTES:
+                NEEDD(0, 1);
+                S->d0[S->dp++] = BEE_WORD_BYTES;
+                break;
+            case BEE_INSN_GET_DP:
+                {
+                    NEEDD(0, 1);
+                    bee_word_t value = S->dp;
+                    S->d0[S->dp++] = value;
+                }
+                break;
+            }
+            break;
+        }
+    }
+
+ exit:
+    S->pc = op->pc;
+    S->ir = op->ir;
+}
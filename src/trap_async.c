@@ -0,0 +1,428 @@
+// Asynchronous I/O traps.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include "config.h"
+
+#ifdef HAVE_PTHREAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "bee/bee.h"
+
+#include "private.h"
+#include "traps.h"
+
+
+// An operation is submitted, giving a token, and runs while the program
+// carries on; POLL or WAIT then collects its result, which is as for the
+// corresponding libc trap, and frees the token. io_uring is used where the
+// kernel supports it, and otherwise a pool of threads makes ordinary
+// system calls.
+//
+// The program must not use a buffer until its operation has been
+// collected; any code read into it is invalidated then. bee_finish()
+// waits for all operations, so that memory can be freed after it.
+
+#define MAX_OPS 256 // operations in flight
+#define THREADS 4
+#define MODE (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)
+
+enum { FREE, PENDING, DONE };
+
+typedef struct async_op {
+    int state;
+    int function; // TRAP_ASYNC_READ etc.
+    int fd, flags;
+    void *buf;
+    size_t len;
+    off_t offset; // -1 for the current position
+    char *path;
+    ssize_t result;
+} async_op;
+
+// The state of an operation is only changed with `lock` held.
+static async_op ops[MAX_OPS];
+static bool initialised = false;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Thread pool
+static pthread_cond_t queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t completed = PTHREAD_COND_INITIALIZER;
+static size_t queue[MAX_OPS], queue_head = 0, queue_length = 0;
+static pthread_t threads[THREADS];
+static size_t nthreads = 0;
+static bool stopping = false;
+
+static ssize_t perform(const async_op *op)
+{
+    switch (op->function) {
+    case TRAP_ASYNC_READ:
+        return op->offset == -1 ? read(op->fd, op->buf, op->len) :
+            pread(op->fd, op->buf, op->len, op->offset);
+    case TRAP_ASYNC_WRITE:
+        return op->offset == -1 ? write(op->fd, op->buf, op->len) :
+            pwrite(op->fd, op->buf, op->len, op->offset);
+    case TRAP_ASYNC_FSYNC:
+        return fsync(op->fd);
+    case TRAP_ASYNC_OPEN:
+        return open(op->path, op->flags, MODE);
+    case TRAP_ASYNC_CLOSE:
+        return close(op->fd);
+    default:
+        return -1;
+    }
+}
+
+static void *worker(void *arg _GL_UNUSED)
+{
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (queue_length == 0 && !stopping)
+            pthread_cond_wait(&queued, &lock);
+        if (queue_length == 0)
+            break;
+        async_op *op = &ops[queue[queue_head]];
+        queue_head = (queue_head + 1) % MAX_OPS;
+        queue_length--;
+        async_op copy = *op;
+        pthread_mutex_unlock(&lock);
+        ssize_t result = perform(&copy);
+        pthread_mutex_lock(&lock);
+        op->result = result;
+        op->state = DONE;
+        pthread_cond_broadcast(&completed);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+// io_uring, used through system calls, as there is no need for liburing.
+static int ring_fd = -1;
+static void *sq_ring, *cq_ring;
+static size_t sq_ring_size, cq_ring_size, sqes_size;
+static struct io_uring_sqe *sqes;
+static struct io_uring_cqe *cqes;
+static unsigned *sq_tail, *sq_mask, *sq_array, *cq_head, *cq_tail, *cq_mask;
+static unsigned unsubmitted = 0; // entries not yet taken by the kernel
+
+static const uint8_t ring_opcodes[] = {
+    [TRAP_ASYNC_READ] = IORING_OP_READ,
+    [TRAP_ASYNC_WRITE] = IORING_OP_WRITE,
+    [TRAP_ASYNC_FSYNC] = IORING_OP_FSYNC,
+    [TRAP_ASYNC_OPEN] = IORING_OP_OPENAT,
+    [TRAP_ASYNC_CLOSE] = IORING_OP_CLOSE,
+};
+
+static void ring_destroy(void)
+{
+    if (sq_ring != NULL && sq_ring != MAP_FAILED)
+        munmap(sq_ring, sq_ring_size);
+    if (cq_ring != NULL && cq_ring != MAP_FAILED)
+        munmap(cq_ring, cq_ring_size);
+    if (sqes != NULL && sqes != MAP_FAILED)
+        munmap(sqes, sqes_size);
+    sq_ring = cq_ring = sqes = NULL;
+    close(ring_fd);
+    ring_fd = -1;
+    unsubmitted = 0;
+}
+
+static bool ring_init(void)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring_fd = syscall(__NR_io_uring_setup, MAX_OPS, &p);
+    if (ring_fd < 0)
+        return false;
+
+    // Check that the kernel supports all the operations.
+    const unsigned nprobe_ops = 256;
+    struct io_uring_probe *probe = calloc(1, sizeof(struct io_uring_probe) + nprobe_ops * sizeof(struct io_uring_probe_op));
+    bool ok = probe != NULL &&
+        syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, nprobe_ops) == 0;
+    for (size_t i = 0; ok && i < sizeof(ring_opcodes) / sizeof(ring_opcodes[0]); i++)
+        ok = ring_opcodes[i] <= probe->last_op &&
+            (probe->ops[ring_opcodes[i]].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    if (!ok) {
+        ring_destroy();
+        return false;
+    }
+
+    sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED) {
+        ring_destroy();
+        return false;
+    }
+    sq_tail = (unsigned *)((char *)sq_ring + p.sq_off.tail);
+    sq_mask = (unsigned *)((char *)sq_ring + p.sq_off.ring_mask);
+    sq_array = (unsigned *)((char *)sq_ring + p.sq_off.array);
+    cq_head = (unsigned *)((char *)cq_ring + p.cq_off.head);
+    cq_tail = (unsigned *)((char *)cq_ring + p.cq_off.tail);
+    cq_mask = (unsigned *)((char *)cq_ring + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *)((char *)cq_ring + p.cq_off.cqes);
+    return true;
+}
+
+static void ring_enter(unsigned min_complete, unsigned flags)
+{
+    long n = syscall(__NR_io_uring_enter, ring_fd, unsubmitted, min_complete, flags, NULL, 0);
+    if (n > 0)
+        unsubmitted -= n;
+}
+
+// There are never more operations in flight than ring entries, so there
+// is always room. If the kernel does not take the entry at once, it is
+// submitted on the next system call.
+static void ring_submit(size_t index)
+{
+    async_op *op = &ops[index];
+    unsigned tail = *sq_tail, i = tail & *sq_mask;
+    struct io_uring_sqe *sqe = &sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = ring_opcodes[op->function];
+    sqe->fd = op->fd;
+    sqe->addr = (uint64_t)(uintptr_t)op->buf;
+    sqe->len = op->len > UINT32_MAX ? UINT32_MAX : op->len;
+    sqe->off = (uint64_t)op->offset;
+    sqe->user_data = index;
+    if (op->function == TRAP_ASYNC_OPEN) {
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t)(uintptr_t)op->path;
+        sqe->len = MODE;
+        sqe->open_flags = op->flags;
+    }
+    sq_array[i] = i;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    unsubmitted++;
+    ring_enter(0, 0);
+}
+
+// Mark completed operations as done.
+static void ring_reap(void)
+{
+    unsigned head = *cq_head, tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+        async_op *op = &ops[cqe->user_data];
+        op->result = cqe->res < 0 ? -1 : cqe->res;
+        op->state = DONE;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+#endif
+
+static bool init(void)
+{
+    if (!initialised) {
+#ifdef HAVE_LINUX_IO_URING_H
+        if (ring_init())
+            return initialised = true;
+#endif
+        stopping = false;
+        for (nthreads = 0; nthreads < THREADS; nthreads++)
+            if (pthread_create(&threads[nthreads], NULL, worker, NULL) != 0)
+                break;
+        initialised = nthreads > 0;
+    }
+    return initialised;
+}
+
+// Start `op`, returning its token, or 0 on error.
+static bee_word_t submit(const async_op *op)
+{
+    if (!init())
+        goto error;
+    pthread_mutex_lock(&lock);
+    size_t i;
+    for (i = 0; i < MAX_OPS && ops[i].state != FREE; i++)
+        ;
+    if (i == MAX_OPS) {
+        pthread_mutex_unlock(&lock);
+        goto error;
+    }
+    ops[i] = *op;
+    ops[i].state = PENDING;
+#ifdef HAVE_LINUX_IO_URING_H
+    if (ring_fd >= 0)
+        ring_submit(i);
+    else
+#endif
+    {
+        queue[(queue_head + queue_length++) % MAX_OPS] = i;
+        pthread_cond_signal(&queued);
+    }
+    pthread_mutex_unlock(&lock);
+    return i + 1;
+
+ error:
+    free(op->path);
+    return 0;
+}
+
+// Return the operation for `token`, or NULL; `lock` must be held.
+static async_op *lookup(bee_word_t token)
+{
+    if (token <= 0 || token > MAX_OPS || ops[token - 1].state == FREE)
+        return NULL;
+    return &ops[token - 1];
+}
+
+// Wait for `op` to complete; `lock` must be held.
+static void wait_for(async_op *op)
+{
+    while (op->state != DONE) {
+#ifdef HAVE_LINUX_IO_URING_H
+        if (ring_fd >= 0) {
+            ring_enter(1, IORING_ENTER_GETEVENTS);
+            ring_reap();
+            continue;
+        }
+#endif
+        pthread_cond_wait(&completed, &lock);
+    }
+}
+
+// Return the result of `op`, which has completed, and free it; `lock` must
+// be held.
+static ssize_t collect(async_op *op)
+{
+    if (op->function == TRAP_ASYNC_READ && op->result > 0)
+        bee_invalidate(op->buf, op->result);
+    free(op->path);
+    op->path = NULL;
+    op->state = FREE;
+    return op->result;
+}
+
+void async_reset(void)
+{
+    if (!initialised)
+        return;
+    pthread_mutex_lock(&lock);
+    for (size_t i = 0; i < MAX_OPS; i++)
+        if (ops[i].state != FREE) {
+            wait_for(&ops[i]);
+            collect(&ops[i]);
+        }
+    stopping = true;
+    pthread_cond_broadcast(&queued);
+    pthread_mutex_unlock(&lock);
+    for (size_t i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+    nthreads = 0;
+#ifdef HAVE_LINUX_IO_URING_H
+    if (ring_fd >= 0)
+        ring_destroy();
+#endif
+    initialised = false;
+}
+
+static bee_word_t async_read(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( a-addr u fd off -- token )
+{
+    args[0] = submit(&(async_op){.function = TRAP_ASYNC_READ, .buf = (void *)args[0],
+                                 .len = args[1], .fd = (int)args[2], .offset = (off_t)args[3]});
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t async_write(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( a-addr u fd off -- token )
+{
+    args[0] = submit(&(async_op){.function = TRAP_ASYNC_WRITE, .buf = (void *)args[0],
+                                 .len = args[1], .fd = (int)args[2], .offset = (off_t)args[3]});
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t async_fsync(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( fd -- token )
+{
+    args[0] = submit(&(async_op){.function = TRAP_ASYNC_FSYNC, .fd = (int)args[0]});
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t async_open(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( c-addr flags -- token )
+{
+    // The name is copied, so that the program can reuse its buffer.
+    char *path = strdup((const char *)args[0]);
+    args[0] = path == NULL ? 0 :
+        submit(&(async_op){.function = TRAP_ASYNC_OPEN, .path = path, .flags = (int)args[1]});
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t async_close(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( fd -- token )
+{
+    args[0] = submit(&(async_op){.function = TRAP_ASYNC_CLOSE, .fd = (int)args[0]});
+    return BEE_ERROR_OK;
+}
+
+// An invalid token gives the result -1 at once.
+static bee_word_t async_poll(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( token -- x flag )
+{
+    bool complete = true;
+    ssize_t result = -1;
+    pthread_mutex_lock(&lock);
+    async_op *op = lookup(args[0]);
+    if (op != NULL) {
+#ifdef HAVE_LINUX_IO_URING_H
+        if (ring_fd >= 0)
+            ring_reap();
+#endif
+        complete = op->state == DONE;
+        if (complete)
+            result = collect(op);
+    }
+    pthread_mutex_unlock(&lock);
+    args[0] = result;
+    args[1] = complete;
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t async_wait(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( token -- x )
+{
+    ssize_t result = -1;
+    pthread_mutex_lock(&lock);
+    async_op *op = lookup(args[0]);
+    if (op != NULL) {
+        wait_for(op);
+        result = collect(op);
+    }
+    pthread_mutex_unlock(&lock);
+    args[0] = result;
+    return BEE_ERROR_OK;
+}
+
+const bee_trap_function trap_async_functions[TRAP_ASYNC_FUNCTIONS] = {
+    [TRAP_ASYNC_READ] = {async_read, 4, 1},
+    [TRAP_ASYNC_WRITE] = {async_write, 4, 1},
+    [TRAP_ASYNC_FSYNC] = {async_fsync, 1, 1},
+    [TRAP_ASYNC_OPEN] = {async_open, 2, 1},
+    [TRAP_ASYNC_CLOSE] = {async_close, 1, 1},
+    [TRAP_ASYNC_POLL] = {async_poll, 1, 2},
+    [TRAP_ASYNC_WAIT] = {async_wait, 1, 1},
+};
+
+#endif
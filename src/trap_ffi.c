@@ -0,0 +1,98 @@
+// FFI traps: call functions in shared libraries.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include "config.h"
+
+#ifdef HAVE_DLFCN_H
+
+#include <dlfcn.h>
+
+#include "bee/bee.h"
+
+#include "private.h"
+#include "traps.h"
+
+
+// A library is opened, and a symbol in it resolved, once; the address of
+// the symbol is then passed to one of the CALL functions, which calls it
+// with that many word-sized arguments through a function type fixed at
+// compile time, so that a call costs little more than a direct C call.
+// Results narrower than a word are not extended. Code written by the
+// function is not noticed: use bee_invalidate() in the function if it
+// writes code.
+
+static bee_word_t ffi_dlopen(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( c-addr -- handle )
+{
+    // A null name opens the program itself.
+    void *handle = dlopen((const char *)args[0], RTLD_NOW | RTLD_LOCAL);
+    args[0] = (bee_word_t)(size_t)handle;
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t ffi_dlsym(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( handle c-addr -- a-addr )
+{
+    void *addr = dlsym((void *)args[0], (const char *)args[1]);
+    args[0] = (bee_word_t)(size_t)addr;
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t ffi_dlclose(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( handle -- n )
+{
+    args[0] = dlclose((void *)args[0]);
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t ffi_dlerror(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( -- c-addr )
+{
+    char *msg = dlerror();
+    args[0] = (bee_word_t)(size_t)(void *)msg;
+    return BEE_ERROR_OK;
+}
+
+// ( x1 ... xn a-addr -- x )
+#define W bee_word_t
+#define CALL(n, types, ...)                                             \
+    static bee_word_t ffi_call##n(bee_state * restrict S _GL_UNUSED,    \
+                                  bee_word_t *args)                     \
+    {                                                                   \
+        if (args[n] == 0)                                               \
+            return BEE_ERROR_INVALID_FUNCTION;                          \
+        args[0] = ((bee_word_t (*)types)args[n])(__VA_ARGS__);          \
+        return BEE_ERROR_OK;                                            \
+    }
+CALL(0, (void), )
+CALL(1, (W), args[0])
+CALL(2, (W, W), args[0], args[1])
+CALL(3, (W, W, W), args[0], args[1], args[2])
+CALL(4, (W, W, W, W), args[0], args[1], args[2], args[3])
+CALL(5, (W, W, W, W, W), args[0], args[1], args[2], args[3], args[4])
+CALL(6, (W, W, W, W, W, W), args[0], args[1], args[2], args[3], args[4], args[5])
+CALL(7, (W, W, W, W, W, W, W), args[0], args[1], args[2], args[3], args[4], args[5], args[6])
+CALL(8, (W, W, W, W, W, W, W, W), args[0], args[1], args[2], args[3], args[4], args[5], args[6], args[7])
+#undef CALL
+#undef W
+
+const bee_trap_function trap_ffi_functions[TRAP_FFI_FUNCTIONS] = {
+    [TRAP_FFI_DLOPEN] = {ffi_dlopen, 1, 1},
+    [TRAP_FFI_DLSYM] = {ffi_dlsym, 2, 1},
+    [TRAP_FFI_DLCLOSE] = {ffi_dlclose, 1, 1},
+    [TRAP_FFI_DLERROR] = {ffi_dlerror, 0, 1},
+    [TRAP_FFI_CALL0] = {ffi_call0, 1, 1},
+    [TRAP_FFI_CALL1] = {ffi_call1, 2, 1},
+    [TRAP_FFI_CALL2] = {ffi_call2, 3, 1},
+    [TRAP_FFI_CALL3] = {ffi_call3, 4, 1},
+    [TRAP_FFI_CALL4] = {ffi_call4, 5, 1},
+    [TRAP_FFI_CALL5] = {ffi_call5, 6, 1},
+    [TRAP_FFI_CALL6] = {ffi_call6, 7, 1},
+    [TRAP_FFI_CALL7] = {ffi_call7, 8, 1},
+    [TRAP_FFI_CALL8] = {ffi_call8, 9, 1},
+};
+
+#endif
@@ -0,0 +1,258 @@
+// Hash table traps.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "c-ctype.h"
+
+#include "bee/bee.h"
+
+#include "private.h"
+#include "traps.h"
+
+
+// A table maps byte strings to words, for example names to execution
+// tokens. It copies its keys into an arena, so that the caller can reuse
+// its buffers, and finds them by open addressing. Space used by deleted
+// keys is reclaimed when the table is rehashed. Keys returned by NEXT
+// remain valid until the table is next changed.
+
+#define MIN_SLOTS 16
+#define MIN_ARENA 256
+#define EMPTY SIZE_MAX
+#define DELETED (SIZE_MAX - 1)
+
+typedef struct hash_entry {
+    size_t key; // offset of the key in the arena, or EMPTY or DELETED
+    size_t length, hash;
+    bee_word_t value;
+} hash_entry;
+
+typedef struct hash_table {
+    bool caseless;
+    size_t nslots; // a power of 2
+    size_t count; // number of keys
+    size_t used; // number of slots that are not EMPTY
+    hash_entry *slots;
+    char *arena;
+    size_t arena_used, arena_size;
+} hash_table;
+
+static size_t hash(const hash_table *t, const char *key, size_t length)
+{
+    // FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = key[i];
+        h = (h ^ (t->caseless ? c_tolower(c) : c)) * 1099511628211ULL;
+    }
+    return (size_t)h;
+}
+
+static bool equal(const hash_table *t, const char *a, const char *b, size_t length)
+{
+    if (!t->caseless)
+        return memcmp(a, b, length) == 0;
+    for (size_t i = 0; i < length; i++)
+        if (c_tolower((unsigned char)a[i]) != c_tolower((unsigned char)b[i]))
+            return false;
+    return true;
+}
+
+// Return the slot holding `key`, or else the slot in which to insert it.
+// There is always an EMPTY slot, so the search terminates.
+static _GL_ATTRIBUTE_PURE hash_entry *find(hash_table *t, const char *key, size_t length, size_t h)
+{
+    hash_entry *free_slot = NULL;
+    for (size_t i = h & (t->nslots - 1); ; i = (i + 1) & (t->nslots - 1)) {
+        hash_entry *e = &t->slots[i];
+        if (e->key == EMPTY)
+            return free_slot != NULL ? free_slot : e;
+        else if (e->key == DELETED) {
+            if (free_slot == NULL)
+                free_slot = e;
+        } else if (e->hash == h && e->length == length &&
+                   equal(t, t->arena + e->key, key, length))
+            return e;
+    }
+}
+
+// Rehash `t` into `nslots` slots, compacting its arena.
+static bool resize(hash_table *t, size_t nslots)
+{
+    hash_entry *slots = malloc(nslots * sizeof(hash_entry));
+    char *arena = t->arena_size > 0 ? malloc(t->arena_size) : NULL;
+    if (slots == NULL || (arena == NULL && t->arena_size > 0)) {
+        free(slots);
+        free(arena);
+        return false;
+    }
+    for (size_t i = 0; i < nslots; i++)
+        slots[i].key = EMPTY;
+
+    size_t arena_used = 0;
+    for (size_t i = 0; i < t->nslots; i++) {
+        hash_entry *e = &t->slots[i];
+        if (e->key != EMPTY && e->key != DELETED) {
+            size_t j;
+            for (j = e->hash & (nslots - 1); slots[j].key != EMPTY; j = (j + 1) & (nslots - 1))
+                ;
+            slots[j] = *e;
+            slots[j].key = arena_used;
+            memcpy(arena + arena_used, t->arena + e->key, e->length);
+            arena_used += e->length;
+        }
+    }
+
+    free(t->slots);
+    free(t->arena);
+    t->slots = slots;
+    t->nslots = nslots;
+    t->used = t->count;
+    t->arena = arena;
+    t->arena_used = arena_used;
+    return true;
+}
+
+static bee_word_t hash_new(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( flags -- handle )
+{
+    hash_table *t = calloc(1, sizeof(hash_table));
+    if (t != NULL) {
+        t->caseless = (args[0] & TRAP_HASH_CASELESS) != 0;
+        if (!resize(t, MIN_SLOTS)) {
+            free(t);
+            t = NULL;
+        }
+    }
+    args[0] = (bee_word_t)t;
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t hash_free(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( handle -- )
+{
+    hash_table *t = (hash_table *)args[0];
+    if (t != NULL) {
+        free(t->slots);
+        free(t->arena);
+        free(t);
+    }
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t hash_insert(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( handle c-addr u x -- ior )
+{
+    hash_table *t = (hash_table *)args[0];
+    const char *key = (const char *)args[1];
+    size_t length = args[2];
+    size_t h = hash(t, key, length);
+    hash_entry *e = find(t, key, length, h);
+    if (e->key == EMPTY || e->key == DELETED) {
+        // Keep the load factor at most 3/4, counting deleted keys.
+        if (e->key == EMPTY && (t->used + 1) * 4 > t->nslots * 3) {
+            size_t nslots = t->nslots;
+            while ((t->count + 1) * 2 > nslots)
+                nslots *= 2;
+            if (!resize(t, nslots))
+                goto error;
+            e = find(t, key, length, h);
+        }
+        if (length > t->arena_size - t->arena_used) {
+            size_t size = t->arena_size > 0 ? t->arena_size : MIN_ARENA;
+            while (length > size - t->arena_used) {
+                if (size > SIZE_MAX / 2)
+                    goto error;
+                size *= 2;
+            }
+            char *arena = realloc(t->arena, size);
+            if (arena == NULL)
+                goto error;
+            t->arena = arena;
+            t->arena_size = size;
+        }
+        memcpy(t->arena + t->arena_used, key, length);
+        if (e->key == EMPTY)
+            t->used++;
+        *e = (hash_entry){t->arena_used, length, h, 0};
+        t->arena_used += length;
+        t->count++;
+    }
+    e->value = args[3];
+    args[0] = 0;
+    return BEE_ERROR_OK;
+
+ error:
+    args[0] = -1;
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t hash_lookup(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( handle c-addr u -- x flag )
+{
+    hash_table *t = (hash_table *)args[0];
+    const char *key = (const char *)args[1];
+    size_t length = args[2];
+    hash_entry *e = find(t, key, length, hash(t, key, length));
+    bool found = e->key != EMPTY && e->key != DELETED;
+    args[0] = found ? e->value : 0;
+    args[1] = found;
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t hash_delete(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( handle c-addr u -- flag )
+{
+    hash_table *t = (hash_table *)args[0];
+    const char *key = (const char *)args[1];
+    size_t length = args[2];
+    hash_entry *e = find(t, key, length, hash(t, key, length));
+    bool found = e->key != EMPTY && e->key != DELETED;
+    if (found) {
+        e->key = DELETED;
+        t->count--;
+    }
+    args[0] = found;
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t hash_count(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( handle -- u )
+{
+    args[0] = ((hash_table *)args[0])->count;
+    return BEE_ERROR_OK;
+}
+
+// Start with u1 = 0. u2 is 0 after the last key.
+static bee_word_t hash_next(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( handle u1 -- u2 c-addr u x )
+{
+    hash_table *t = (hash_table *)args[0];
+    for (size_t i = args[1]; i < t->nslots; i++) {
+        hash_entry *e = &t->slots[i];
+        if (e->key != EMPTY && e->key != DELETED) {
+            args[0] = i + 1;
+            args[1] = (bee_word_t)(t->arena + e->key);
+            args[2] = e->length;
+            args[3] = e->value;
+            return BEE_ERROR_OK;
+        }
+    }
+    args[0] = args[1] = args[2] = args[3] = 0;
+    return BEE_ERROR_OK;
+}
+
+const bee_trap_function trap_hash_functions[TRAP_HASH_FUNCTIONS] = {
+    [TRAP_HASH_NEW] = {hash_new, 1, 1},
+    [TRAP_HASH_FREE] = {hash_free, 1, 0},
+    [TRAP_HASH_INSERT] = {hash_insert, 4, 1},
+    [TRAP_HASH_LOOKUP] = {hash_lookup, 3, 2},
+    [TRAP_HASH_DELETE] = {hash_delete, 3, 1},
+    [TRAP_HASH_COUNT] = {hash_count, 1, 1},
+    [TRAP_HASH_NEXT] = {hash_next, 2, 4},
+};
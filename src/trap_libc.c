@@ -43,182 +43,159 @@ void bee_register_args(int argc, const char *argv[])
 }
 
 
-bee_word_t trap_libc(bee_state * restrict S)
-{
-    int error = BEE_ERROR_OK;
-    bee_word_t temp = 0;
-
-    bee_uword_t function = 0;
-    POPD((bee_word_t *)&function);
-
-    switch (function) {
-    case TRAP_LIBC_STRLEN: // ( a-addr -- u )
-        {
-            const char *s;
-            POPD((bee_word_t *)&s);
-            PUSHD(strlen(s));
-        }
-        break;
-    case TRAP_LIBC_STRNCPY: // ( a-addr1 a-addr2 u -- a-addr3 )
-        {
-            const char *src;
-            char *dest;
-            size_t n;
-            POPD((bee_word_t *)&n);
-            POPD((bee_word_t *)&src);
-            POPD((bee_word_t *)&dest);
-            PUSHD((bee_word_t)(size_t)(void *)strncpy(dest, src, n));
-        }
-        break;
-    case TRAP_LIBC_STDIN:
-        PUSHD((bee_word_t)(STDIN_FILENO));
-        break;
-    case TRAP_LIBC_STDOUT:
-        PUSHD((bee_word_t)(STDOUT_FILENO));
-        break;
-    case TRAP_LIBC_STDERR:
-        PUSHD((bee_word_t)(STDERR_FILENO));
-        break;
-    case TRAP_LIBC_O_RDONLY:
-        PUSHD((bee_word_t)(O_RDONLY));
-        break;
-    case TRAP_LIBC_O_WRONLY:
-        PUSHD((bee_word_t)(O_WRONLY));
-        break;
-    case TRAP_LIBC_O_RDWR:
-        PUSHD((bee_word_t)(O_RDWR));
-        break;
-    case TRAP_LIBC_O_CREAT:
-        PUSHD((bee_word_t)(O_CREAT));
-        break;
-    case TRAP_LIBC_O_TRUNC:
-        PUSHD((bee_word_t)(O_TRUNC));
-        break;
-    case TRAP_LIBC_OPEN: // ( c-addr flags -- fd )
-        {
-            bee_uword_t flags;
-            POPD((bee_word_t *)&flags);
-            char *file;
-            POPD((bee_word_t *)&file);
-            int fd = open(file, flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
-            PUSHD((bee_word_t)fd);
-            if (fd >= 0)
-                set_binary_mode(fd, O_BINARY); // Best effort
-        }
-        break;
-    case TRAP_LIBC_CLOSE:
-        {
-            POPD(&temp);
-            int fd = temp;
-            PUSHD((bee_word_t)close(fd));
-        }
-        break;
-    case TRAP_LIBC_READ:
-        {
-            POPD(&temp);
-            int fd = temp;
-            bee_uword_t nbytes;
-            POPD((bee_word_t *)&nbytes);
-            uint8_t *buf;
-            POPD((bee_word_t *)&buf);
-            PUSHD(read(fd, buf, nbytes));
-        }
-        break;
-    case TRAP_LIBC_WRITE:
-        {
-            POPD(&temp);
-            int fd = temp;
-            bee_uword_t nbytes;
-            POPD((bee_word_t *)&nbytes);
-            uint8_t *buf;
-            POPD((bee_word_t *)&buf);
-            PUSHD(write(fd, buf, nbytes));
-        }
-        break;
-    case TRAP_LIBC_SEEK_SET:
-        PUSHD((bee_word_t)(SEEK_SET));
-        break;
-    case TRAP_LIBC_SEEK_CUR:
-        PUSHD((bee_word_t)(SEEK_CUR));
-        break;
-    case TRAP_LIBC_SEEK_END:
-        PUSHD((bee_word_t)(SEEK_END));
-        break;
-    case TRAP_LIBC_LSEEK:
-        {
-            POPD(&temp);
-            int whence = temp;
-            off_t off;
-            POPD(&off);
-            POPD(&temp);
-            int fd = temp;
-            off_t res = lseek(fd, off, whence);
-            PUSHD(res);
-        }
-        break;
-    case TRAP_LIBC_FDATASYNC:
-        {
-            POPD(&temp);
-            int fd = temp;
-            PUSHD(fdatasync(fd));
-        }
-        break;
-    case TRAP_LIBC_RENAME:
-        {
-            char *to, *from;
-            POPD((bee_word_t *)&to);
-            POPD((bee_word_t *)&from);
-            PUSHD(rename(from, to));
-        }
-        break;
-    case TRAP_LIBC_REMOVE:
-        {
-            char *file;
-            POPD((bee_word_t *)&file);
-            PUSHD(remove(file));
-        }
-        break;
-    case TRAP_LIBC_FILE_SIZE:
-        {
-            struct stat st;
-            POPD(&temp);
-            int fd = temp;
-            int res = fstat(fd, &st);
-            PUSHD(st.st_size);
-            PUSHD(res);
-        }
-        break;
-    case TRAP_LIBC_RESIZE_FILE:
-        {
-            POPD(&temp);
-            int fd = temp;
-            off_t off;
-            POPD(&off);
-            int res = ftruncate(fd, off);
-            PUSHD(res);
-        }
-        break;
-    case TRAP_LIBC_FILE_STATUS:
-        {
-            struct stat st;
-            POPD(&temp);
-            int fd = temp;
-            int res = fstat(fd, &st);
-            PUSHD(st.st_mode);
-            PUSHD(res);
-        }
-        break;
-    case TRAP_LIBC_ARGC: // ( -- u )
-        PUSHD(main_argc);
-        break;
-    case TRAP_LIBC_ARGV: // ( -- a-addr )
-        PUSHD((bee_word_t)main_argv);
-        break;
-    default:
-        error = BEE_ERROR_INVALID_FUNCTION;
-        break;
+// Functions that push a constant
+#define CONSTANT(name, value)                                           \
+    static bee_word_t libc_##name(bee_state * restrict S _GL_UNUSED,    \
+                                  bee_word_t *args)                     \
+    {                                                                   \
+        args[0] = (bee_word_t)(value);                                  \
+        return BEE_ERROR_OK;                                            \
     }
+CONSTANT(stdin, STDIN_FILENO)
+CONSTANT(stdout, STDOUT_FILENO)
+CONSTANT(stderr, STDERR_FILENO)
+CONSTANT(o_rdonly, O_RDONLY)
+CONSTANT(o_wronly, O_WRONLY)
+CONSTANT(o_rdwr, O_RDWR)
+CONSTANT(o_creat, O_CREAT)
+CONSTANT(o_trunc, O_TRUNC)
+CONSTANT(seek_set, SEEK_SET)
+CONSTANT(seek_cur, SEEK_CUR)
+CONSTANT(seek_end, SEEK_END)
+#undef CONSTANT
 
- error:
-    return error;
+static bee_word_t libc_strlen(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( a-addr -- u )
+{
+    args[0] = strlen((const char *)args[0]);
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t libc_strncpy(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( a-addr1 a-addr2 u -- a-addr3 )
+{
+    char *dest = (char *)args[0];
+    size_t n = args[2];
+    args[0] = (bee_word_t)(size_t)(void *)strncpy(dest, (const char *)args[1], n);
+    bee_invalidate(dest, n);
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t libc_open(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( c-addr flags -- fd )
+{
+    int fd = open((const char *)args[0], (bee_uword_t)args[1],
+                  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+    args[0] = (bee_word_t)fd;
+    if (fd >= 0)
+        set_binary_mode(fd, O_BINARY); // Best effort
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t libc_close(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( fd -- n )
+{
+    args[0] = (bee_word_t)close((int)args[0]);
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t libc_read(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( a-addr u fd -- n )
+{
+    uint8_t *buf = (uint8_t *)args[0];
+    ssize_t res = read((int)args[2], buf, (bee_uword_t)args[1]);
+    args[0] = res;
+    if (res > 0)
+        bee_invalidate(buf, res);
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t libc_write(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( a-addr u fd -- n )
+{
+    args[0] = write((int)args[2], (uint8_t *)args[0], (bee_uword_t)args[1]);
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t libc_lseek(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( fd off whence -- off' )
+{
+    args[0] = lseek((int)args[0], (off_t)args[1], (int)args[2]);
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t libc_fdatasync(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( fd -- n )
+{
+    args[0] = fdatasync((int)args[0]);
+    return BEE_ERROR_OK;
 }
+
+static bee_word_t libc_rename(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( c-addr1 c-addr2 -- n )
+{
+    args[0] = rename((const char *)args[0], (const char *)args[1]);
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t libc_remove(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( c-addr -- n )
+{
+    args[0] = remove((const char *)args[0]);
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t libc_file_size(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( fd -- u n )
+{
+    struct stat st;
+    int res = fstat((int)args[0], &st);
+    args[0] = st.st_size;
+    args[1] = res;
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t libc_resize_file(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( off fd -- n )
+{
+    args[0] = ftruncate((int)args[1], (off_t)args[0]);
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t libc_file_status(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( fd -- mode n )
+{
+    struct stat st;
+    int res = fstat((int)args[0], &st);
+    args[0] = st.st_mode;
+    args[1] = res;
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t libc_argc(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( -- u )
+{
+    args[0] = main_argc;
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t libc_argv(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( -- a-addr )
+{
+    args[0] = (bee_word_t)main_argv;
+    return BEE_ERROR_OK;
+}
+
+const bee_trap_function trap_libc_functions[TRAP_LIBC_FUNCTIONS] = {
+    [TRAP_LIBC_STRLEN] = {libc_strlen, 1, 1},
+    [TRAP_LIBC_STRNCPY] = {libc_strncpy, 3, 1},
+    [TRAP_LIBC_STDIN] = {libc_stdin, 0, 1},
+    [TRAP_LIBC_STDOUT] = {libc_stdout, 0, 1},
+    [TRAP_LIBC_STDERR] = {libc_stderr, 0, 1},
+    [TRAP_LIBC_O_RDONLY] = {libc_o_rdonly, 0, 1},
+    [TRAP_LIBC_O_WRONLY] = {libc_o_wronly, 0, 1},
+    [TRAP_LIBC_O_RDWR] = {libc_o_rdwr, 0, 1},
+    [TRAP_LIBC_O_CREAT] = {libc_o_creat, 0, 1},
+    [TRAP_LIBC_O_TRUNC] = {libc_o_trunc, 0, 1},
+    [TRAP_LIBC_OPEN] = {libc_open, 2, 1},
+    [TRAP_LIBC_CLOSE] = {libc_close, 1, 1},
+    [TRAP_LIBC_READ] = {libc_read, 3, 1},
+    [TRAP_LIBC_WRITE] = {libc_write, 3, 1},
+    [TRAP_LIBC_SEEK_SET] = {libc_seek_set, 0, 1},
+    [TRAP_LIBC_SEEK_CUR] = {libc_seek_cur, 0, 1},
+    [TRAP_LIBC_SEEK_END] = {libc_seek_end, 0, 1},
+    [TRAP_LIBC_LSEEK] = {libc_lseek, 3, 1},
+    [TRAP_LIBC_FDATASYNC] = {libc_fdatasync, 1, 1},
+    [TRAP_LIBC_RENAME] = {libc_rename, 2, 1},
+    [TRAP_LIBC_REMOVE] = {libc_remove, 1, 1},
+    [TRAP_LIBC_FILE_SIZE] = {libc_file_size, 1, 2},
+    [TRAP_LIBC_RESIZE_FILE] = {libc_resize_file, 2, 1},
+    [TRAP_LIBC_FILE_STATUS] = {libc_file_status, 1, 2},
+    [TRAP_LIBC_ARGC] = {libc_argc, 0, 1},
+    [TRAP_LIBC_ARGV] = {libc_argv, 0, 1},
+};
@@ -0,0 +1,72 @@
+// Bulk memory traps.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include "config.h"
+
+#include <string.h>
+
+#include "bee/bee.h"
+
+#include "private.h"
+#include "traps.h"
+
+
+// These do in one trap what would otherwise take several instructions per
+// byte. The C library's routines are used because they are already
+// vectorised, and pick the best instructions for the CPU at run time.
+// Arguments are in the same order as for the C functions.
+
+static bee_word_t memory_memmove(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( a-addr1 a-addr2 u -- a-addr1 )
+{
+    void *dest = (void *)args[0];
+    size_t n = args[2];
+    memmove(dest, (const void *)args[1], n);
+    bee_invalidate(dest, n);
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t memory_memset(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( a-addr c u -- a-addr )
+{
+    void *dest = (void *)args[0];
+    size_t n = args[2];
+    memset(dest, (int)args[1], n);
+    bee_invalidate(dest, n);
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t memory_memcmp(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( a-addr1 a-addr2 u -- -1|0|1 )
+{
+    // The result is normalised, as for Forth's COMPARE.
+    int res = memcmp((const void *)args[0], (const void *)args[1], args[2]);
+    args[0] = (res > 0) - (res < 0);
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t memory_memchr(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( a-addr1 c u -- a-addr2|0 )
+{
+    void *addr = memchr((const void *)args[0], (int)args[1], args[2]);
+    args[0] = (bee_word_t)(size_t)addr;
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t memory_memmem(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( a-addr1 u1 a-addr2 u2 -- a-addr3|0 )
+{
+    void *addr = memmem((const void *)args[0], args[1], (const void *)args[2], args[3]);
+    args[0] = (bee_word_t)(size_t)addr;
+    return BEE_ERROR_OK;
+}
+
+const bee_trap_function trap_memory_functions[TRAP_MEMORY_FUNCTIONS] = {
+    [TRAP_MEMORY_MEMMOVE] = {memory_memmove, 3, 1},
+    [TRAP_MEMORY_MEMSET] = {memory_memset, 3, 1},
+    [TRAP_MEMORY_MEMCMP] = {memory_memcmp, 3, 1},
+    [TRAP_MEMORY_MEMCHR] = {memory_memchr, 3, 1},
+    [TRAP_MEMORY_MEMMEM] = {memory_memmem, 4, 1},
+};
@@ -0,0 +1,156 @@
+// Buffered stream traps.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "bee/bee.h"
+
+#include "private.h"
+#include "traps.h"
+
+
+// A stream buffers reads from, or writes to, a file descriptor, so that
+// character I/O such as KEY and EMIT does not need a system call per
+// character. Streams are stdio streams on a duplicate of the descriptor,
+// so closing one leaves the descriptor open, and they are flushed when
+// the C library exits. Output is also flushed whenever bee_run() returns,
+// and streams are closed by bee_finish().
+
+typedef struct stream {
+    FILE *fp;
+    bool writing;
+    struct stream *prev, *next;
+} stream;
+
+static stream *streams = NULL;
+
+void streams_flush(void)
+{
+    for (stream *s = streams; s != NULL; s = s->next)
+        if (s->writing)
+            fflush(s->fp);
+}
+
+void streams_close(void)
+{
+    while (streams != NULL) {
+        stream *s = streams;
+        streams = s->next;
+        fclose(s->fp);
+        free(s);
+    }
+}
+
+static bee_word_t stream_fdopen(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( fd mode -- handle )
+{
+    bool writing = args[1] == TRAP_STREAM_OUTPUT;
+    stream *s = NULL;
+    int fd = -1;
+    if (args[1] != TRAP_STREAM_INPUT && !writing)
+        goto error;
+    if ((s = malloc(sizeof(stream))) == NULL || (fd = dup((int)args[0])) == -1 ||
+        (s->fp = fdopen(fd, writing ? "w" : "r")) == NULL)
+        goto error;
+    s->writing = writing;
+    s->prev = NULL;
+    s->next = streams;
+    if (streams != NULL)
+        streams->prev = s;
+    streams = s;
+    args[0] = (bee_word_t)s;
+    return BEE_ERROR_OK;
+
+ error:
+    if (fd != -1)
+        close(fd);
+    free(s);
+    args[0] = 0;
+    return BEE_ERROR_OK;
+}
+
+// Must be used before any other operation on the stream.
+static bee_word_t stream_setvbuf(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( handle mode -- ior )
+{
+    static const int modes[] = {
+        [TRAP_STREAM_FULLY_BUFFERED] = _IOFBF,
+        [TRAP_STREAM_LINE_BUFFERED] = _IOLBF,
+        [TRAP_STREAM_UNBUFFERED] = _IONBF,
+    };
+    bee_uword_t mode = args[1];
+    if (mode >= sizeof(modes) / sizeof(modes[0]))
+        args[0] = -1;
+    else
+        args[0] = setvbuf(((stream *)args[0])->fp, NULL, modes[mode], BUFSIZ) == 0 ? 0 : -1;
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t stream_getc(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( handle -- char|-1 )
+{
+    int c = getc(((stream *)args[0])->fp);
+    args[0] = c == EOF ? -1 : c;
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t stream_putc(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( char handle -- ior )
+{
+    args[0] = putc((unsigned char)args[0], ((stream *)args[1])->fp) == EOF ? -1 : 0;
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t stream_read(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( a-addr u1 handle -- u2 )
+{
+    void *buf = (void *)args[0];
+    size_t n = fread(buf, 1, args[1], ((stream *)args[2])->fp);
+    bee_invalidate(buf, n);
+    args[0] = n;
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t stream_write(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( a-addr u1 handle -- u2 )
+{
+    args[0] = fwrite((const void *)args[0], 1, args[1], ((stream *)args[2])->fp);
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t stream_flush(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( handle -- ior )
+{
+    args[0] = fflush(((stream *)args[0])->fp) == 0 ? 0 : -1;
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t stream_close(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( handle -- ior )
+{
+    stream *s = (stream *)args[0];
+    if (s->prev != NULL)
+        s->prev->next = s->next;
+    else
+        streams = s->next;
+    if (s->next != NULL)
+        s->next->prev = s->prev;
+    args[0] = fclose(s->fp) == 0 ? 0 : -1;
+    free(s);
+    return BEE_ERROR_OK;
+}
+
+const bee_trap_function trap_stream_functions[TRAP_STREAM_FUNCTIONS] = {
+    [TRAP_STREAM_FDOPEN] = {stream_fdopen, 2, 1},
+    [TRAP_STREAM_SETVBUF] = {stream_setvbuf, 2, 1},
+    [TRAP_STREAM_GETC] = {stream_getc, 1, 1},
+    [TRAP_STREAM_PUTC] = {stream_putc, 2, 1},
+    [TRAP_STREAM_READ] = {stream_read, 3, 1},
+    [TRAP_STREAM_WRITE] = {stream_write, 3, 1},
+    [TRAP_STREAM_FLUSH] = {stream_flush, 1, 1},
+    [TRAP_STREAM_CLOSE] = {stream_close, 1, 1},
+};
@@ -0,0 +1,157 @@
+// Text traps, for the inner loops of a Forth text interpreter.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "c-ctype.h"
+
+#include "bee/bee.h"
+
+#include "private.h"
+#include "traps.h"
+
+
+// Strings are given as an address and a length, as in Forth. A delimiter
+// of space matches any character up to and including space, so that tabs
+// and line ends separate names, as PARSE-NAME allows.
+//
+// Scanning for spaces is done a word at a time, using the tests from
+// "Bit Twiddling Hacks", and finishing byte by byte in the word where the
+// test succeeds.
+
+#define ONES ((bee_uword_t)-1 / 0xff) // 0x0101...01
+#define HIGHS (ONES * 0x80) // 0x8080...80
+
+static bee_uword_t load_word(const char *p)
+{
+    bee_uword_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+// Non-zero if some byte of `w` is at most ' '.
+static bee_uword_t has_space(bee_uword_t w)
+{
+    return (w - ONES * (' ' + 1)) & ~w & HIGHS;
+}
+
+// Non-zero if some byte of `w` is more than ' '.
+static bee_uword_t has_non_space(bee_uword_t w)
+{
+    return (((w & ~HIGHS) + ONES * (0x7f - ' ')) | w) & HIGHS;
+}
+
+static bee_word_t text_skip(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( c-addr1 u1 char -- c-addr2 u2 )
+{
+    const char *p = (const char *)args[0];
+    size_t n = args[1];
+    unsigned char c = args[2];
+    if (c == ' ') {
+        for (; n >= sizeof(bee_uword_t) && !has_non_space(load_word(p)); n -= sizeof(bee_uword_t))
+            p += sizeof(bee_uword_t);
+        for (; n > 0 && (unsigned char)*p <= ' '; n--)
+            p++;
+    } else
+        for (; n > 0 && (unsigned char)*p == c; n--)
+            p++;
+    args[0] = (bee_word_t)p;
+    args[1] = n;
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t text_scan(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( c-addr1 u1 char -- c-addr2 u2 )
+{
+    const char *p = (const char *)args[0];
+    size_t n = args[1];
+    unsigned char c = args[2];
+    if (c == ' ') {
+        for (; n >= sizeof(bee_uword_t) && !has_space(load_word(p)); n -= sizeof(bee_uword_t))
+            p += sizeof(bee_uword_t);
+        for (; n > 0 && (unsigned char)*p > ' '; n--)
+            p++;
+    } else {
+        const char *q = memchr(p, c, n);
+        if (q != NULL) {
+            n -= q - p;
+            p = q;
+        } else {
+            p += n;
+            n = 0;
+        }
+    }
+    args[0] = (bee_word_t)p;
+    args[1] = n;
+    return BEE_ERROR_OK;
+}
+
+// As COMPARE, but ignoring ASCII case.
+static bee_word_t text_compare_caseless(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( c-addr1 u1 c-addr2 u2 -- n )
+{
+    const char *p = (const char *)args[0], *q = (const char *)args[2];
+    size_t n1 = args[1], n2 = args[3];
+    size_t n = n1 < n2 ? n1 : n2, i = 0;
+    // Skip words that are identical, then fold case byte by byte.
+    for (; i + sizeof(bee_uword_t) <= n && load_word(p + i) == load_word(q + i); i += sizeof(bee_uword_t))
+        ;
+    for (; i < n; i++) {
+        int c1 = c_tolower((unsigned char)p[i]), c2 = c_tolower((unsigned char)q[i]);
+        if (c1 != c2) {
+            args[0] = c1 < c2 ? -1 : 1;
+            return BEE_ERROR_OK;
+        }
+    }
+    args[0] = (n1 > n2) - (n1 < n2);
+    return BEE_ERROR_OK;
+}
+
+// As >NUMBER, with the base given explicitly. Digits above 9 are letters
+// of either case; a base outside 2 to 36 converts nothing.
+static bee_word_t text_to_number(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( ud1 c-addr1 u1 base -- ud2 c-addr2 u2 )
+{
+    bee_uword_t lo = args[0], hi = args[1];
+    const char *p = (const char *)args[2];
+    size_t n = args[3];
+    bee_uword_t base = args[4];
+    const unsigned half = BEE_WORD_BIT / 2;
+    const bee_uword_t half_mask = ((bee_uword_t)1 << half) - 1;
+    if (base >= 2 && base <= 36)
+        for (; n > 0; n--, p++) {
+            int c = c_tolower((unsigned char)*p);
+            bee_uword_t digit;
+            if (c >= '0' && c <= '9')
+                digit = c - '0';
+            else if (c >= 'a' && c <= 'z')
+                digit = c - 'a' + 10;
+            else
+                break;
+            if (digit >= base)
+                break;
+            // ud = ud * base + digit, a half word at a time
+            bee_uword_t p0 = (lo & half_mask) * base + digit;
+            bee_uword_t p1 = (lo >> half) * base + (p0 >> half);
+            lo = (p1 << half) | (p0 & half_mask);
+            hi = hi * base + (p1 >> half);
+        }
+    args[0] = lo;
+    args[1] = hi;
+    args[2] = (bee_word_t)p;
+    args[3] = n;
+    return BEE_ERROR_OK;
+}
+
+const bee_trap_function trap_text_functions[TRAP_TEXT_FUNCTIONS] = {
+    [TRAP_TEXT_SKIP] = {text_skip, 3, 2},
+    [TRAP_TEXT_SCAN] = {text_scan, 3, 2},
+    [TRAP_TEXT_COMPARE_CASELESS] = {text_compare_caseless, 4, 1},
+    [TRAP_TEXT_TO_NUMBER] = {text_to_number, 5, 4},
+};
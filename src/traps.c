@@ -10,22 +10,87 @@
 
 #include "config.h"
 
+#include <stdlib.h>
+
 #include "bee/bee.h"
 
 #include "private.h"
 #include "traps.h"
 
 
+// Libraries registered with bee_register_trap_library(), indexed by code
+typedef struct trap_library {
+    const bee_trap_function *table;
+    bee_uword_t nfunctions;
+} trap_library;
+
+static trap_library *libraries = NULL;
+static bee_uword_t nlibraries = 0;
+
+// Libraries used for codes that have not been registered
+static const trap_library builtin[] = {
+    [TRAP_LIBC] = {trap_libc_functions, TRAP_LIBC_FUNCTIONS},
+#ifdef HAVE_DLFCN_H
+    [TRAP_FFI] = {trap_ffi_functions, TRAP_FFI_FUNCTIONS},
+#endif
+    [TRAP_MEMORY] = {trap_memory_functions, TRAP_MEMORY_FUNCTIONS},
+    [TRAP_HASH] = {trap_hash_functions, TRAP_HASH_FUNCTIONS},
+    [TRAP_TEXT] = {trap_text_functions, TRAP_TEXT_FUNCTIONS},
+    [TRAP_STREAM] = {trap_stream_functions, TRAP_STREAM_FUNCTIONS},
+#ifdef HAVE_PTHREAD_H
+    [TRAP_ASYNC] = {trap_async_functions, TRAP_ASYNC_FUNCTIONS},
+#endif
+};
+#define NBUILTIN (sizeof(builtin) / sizeof(builtin[0]))
+
+int bee_register_trap_library(bee_uword_t code, const bee_trap_function *table, bee_uword_t nfunctions)
+{
+    if (code >= nlibraries) {
+        if (code >= BEE_UWORD_MAX / sizeof(trap_library))
+            return -1;
+        trap_library *new_libraries = realloc(libraries, (code + 1) * sizeof(trap_library));
+        if (new_libraries == NULL)
+            return -1;
+        for (bee_uword_t i = nlibraries; i < code; i++)
+            new_libraries[i] = (trap_library){NULL, 0};
+        libraries = new_libraries;
+        nlibraries = code + 1;
+    }
+    libraries[code] = (trap_library){table, nfunctions};
+    return 0;
+}
+
 bee_word_t trap(bee_state * restrict S, bee_word_t code)
 {
     int error = BEE_ERROR_OK;
 
-    switch (code) {
-    case TRAP_LIBC:
-        return trap_libc(S);
-    default:
+    const trap_library *l;
+    if ((bee_uword_t)code < nlibraries && libraries[code].table != NULL)
+        l = &libraries[code];
+    else if ((bee_uword_t)code < NBUILTIN && builtin[code].table != NULL)
+        l = &builtin[code];
+    else
         return BEE_ERROR_INVALID_LIBRARY;
-    }
 
+    // The function number is popped only once the call has succeeded, so
+    // that the stack is left as it was on error.
+    CHECKD(1, 0);
+    bee_uword_t function = (bee_uword_t)S->d0[S->dp - 1];
+    if (function >= l->nfunctions || l->table[function].fn == NULL)
+        return BEE_ERROR_INVALID_FUNCTION;
+    const bee_trap_function *f = &l->table[function];
+    CHECKD(f->dpops + 1, f->dpushes);
+    THROW_IF_ERROR(f->fn(S, S->d0 + (S->dp - 1 - f->dpops)));
+    S->dp = S->dp - 1 - f->dpops + f->dpushes;
+
+ error:
+    return error;
+}
+
+bee_word_t bee_trap(bee_state * restrict S, bee_uword_t code)
+{
+    bee_word_t error = trap(S, code);
+    if (error == BEE_ERROR_OK && (S->sp > S->ssize || S->dp > S->dsize))
+        error = BEE_ERROR_STACK_OVERFLOW;
     return error;
 }
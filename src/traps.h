@@ -10,6 +10,12 @@
 
 enum {
     TRAP_LIBC,
+    TRAP_FFI,
+    TRAP_MEMORY,
+    TRAP_HASH,
+    TRAP_TEXT,
+    TRAP_STREAM,
+    TRAP_ASYNC,
 };
 
 enum {
@@ -40,4 +46,98 @@ enum {
 
     TRAP_LIBC_ARGC = 0x100,
     TRAP_LIBC_ARGV,
+
+    TRAP_LIBC_FUNCTIONS // The size of the table of functions
+};
+
+enum {
+    TRAP_FFI_DLOPEN,
+    TRAP_FFI_DLSYM,
+    TRAP_FFI_DLCLOSE,
+    TRAP_FFI_DLERROR,
+    TRAP_FFI_CALL0, // TRAP_FFI_CALL0 + n calls a function of n arguments
+    TRAP_FFI_CALL1,
+    TRAP_FFI_CALL2,
+    TRAP_FFI_CALL3,
+    TRAP_FFI_CALL4,
+    TRAP_FFI_CALL5,
+    TRAP_FFI_CALL6,
+    TRAP_FFI_CALL7,
+    TRAP_FFI_CALL8,
+
+    TRAP_FFI_FUNCTIONS
+};
+
+enum {
+    TRAP_MEMORY_MEMMOVE,
+    TRAP_MEMORY_MEMSET,
+    TRAP_MEMORY_MEMCMP,
+    TRAP_MEMORY_MEMCHR,
+    TRAP_MEMORY_MEMMEM,
+
+    TRAP_MEMORY_FUNCTIONS
+};
+
+enum {
+    TRAP_HASH_NEW,
+    TRAP_HASH_FREE,
+    TRAP_HASH_INSERT,
+    TRAP_HASH_LOOKUP,
+    TRAP_HASH_DELETE,
+    TRAP_HASH_COUNT,
+    TRAP_HASH_NEXT,
+
+    TRAP_HASH_FUNCTIONS
+};
+
+// Flags for TRAP_HASH_NEW
+enum {
+    TRAP_HASH_CASELESS = 1, // Compare keys ignoring ASCII case
+};
+
+enum {
+    TRAP_TEXT_SKIP,
+    TRAP_TEXT_SCAN,
+    TRAP_TEXT_COMPARE_CASELESS,
+    TRAP_TEXT_TO_NUMBER,
+
+    TRAP_TEXT_FUNCTIONS
+};
+
+enum {
+    TRAP_STREAM_FDOPEN,
+    TRAP_STREAM_SETVBUF,
+    TRAP_STREAM_GETC,
+    TRAP_STREAM_PUTC,
+    TRAP_STREAM_READ,
+    TRAP_STREAM_WRITE,
+    TRAP_STREAM_FLUSH,
+    TRAP_STREAM_CLOSE,
+
+    TRAP_STREAM_FUNCTIONS
+};
+
+// Modes for TRAP_STREAM_FDOPEN
+enum {
+    TRAP_STREAM_INPUT,
+    TRAP_STREAM_OUTPUT,
+};
+
+// Modes for TRAP_STREAM_SETVBUF
+enum {
+    TRAP_STREAM_FULLY_BUFFERED,
+    TRAP_STREAM_LINE_BUFFERED,
+    TRAP_STREAM_UNBUFFERED,
+};
+
+enum {
+    TRAP_ASYNC_READ,
+    TRAP_ASYNC_WRITE,
+    TRAP_ASYNC_FSYNC,
+    TRAP_ASYNC_OPEN,
+    TRAP_ASYNC_CLOSE,
+    TRAP_ASYNC_POLL,
+    TRAP_ASYNC_WAIT,
+
+    TRAP_ASYNC_FUNCTIONS
 };
@@ -0,0 +1,495 @@
+// Static verification of code, so that it can be run without checks.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "bee/bee.h"
+#include "bee/opcodes.h"
+
+#include "private.h"
+
+
+// bee_verify() treats each word of a region of code as the start of a
+// block, which runs on until a static control transfer, or until just
+// before a TRAP, or an instruction that is invalid or whose effect cannot
+// be known in advance, such as CALL, JUMP or SET_DP. For each word it
+// records the length of the block, and the lowest and highest depths of
+// each stack that the block reaches, relative to their depths on entry.
+// Static branch targets are always aligned; those outside the region
+// simply end the block.
+//
+// bee_run() runs verified blocks with verified_run(), which checks the
+// stack depths once at the start of each block, then executes it without
+// the checks that bee_run() makes for each instruction. Before anything
+// else it returns, with pc and ir set to resume, so that bee_run() raises
+// any error with the same state as if it had run the code itself.
+// Addresses taken from the stack are still checked.
+//
+// Blocks are limited in length, so that when code is written only the
+// blocks that start a little way before it need be verified again.
+//
+// A CALLI to a short word of straight-line code that ends with RET and
+// neither reads nor changes the return stack does not end a block: the
+// word is spliced into it, and verified_run() runs the callee in place,
+// without pushing or popping the return address. Writing to a spliced
+// word verifies its whole region again.
+#define MAX_BLOCK_WORDS 64
+
+// Calls to words of at most this many instruction words are spliced.
+#define MAX_INLINE_WORDS 4
+
+// Flags of a verified word
+enum {
+    VERIFIED_INLINE = 1, // A CALLI whose callee is spliced
+    VERIFIED_SPLICED = 2, // Part of a spliced callee
+};
+
+typedef struct verified_block {
+    int16_t dmin, dmax, smin, smax;
+    uint8_t words; // 0 if no block can start here
+    uint8_t flags;
+} verified_block;
+
+typedef struct region {
+    bee_word_t *start, *end;
+    verified_block *blocks;
+} region;
+
+static region *regions = NULL;
+static size_t nregions = 0;
+bee_word_t *verified_start = NULL, *verified_end = NULL;
+
+// The effect of an instruction on the stacks
+typedef struct effect {
+    bool known; // false for instructions that end a block
+    uint8_t dpops, dpushes, spops, spushes;
+} effect;
+
+// Instructions whose effect is fixed are SAFE or RAISES (see bee/insns.h).
+#define KNOWN_SAFE true
+#define KNOWN_RAISES true
+#define KNOWN_DYNAMIC false
+#define KNOWN_CONTROL false
+
+static const effect insn_effects[BEE_INSN_MASK + 1] = {
+#define BEE_INSN(name, opcode, dpops, dpushes, spops, spushes, kind, ...) \
+    [BEE_INSN_##name] = {KNOWN_##kind, dpops, dpushes, spops, spushes},
+#include "bee/insns.h"
+#undef BEE_INSN
+};
+
+// Apply `e` to the current depths `d` and `s`, noting the extremes in `b`.
+static void apply(verified_block *b, int *d, int *s, effect e)
+{
+    *d -= e.dpops;
+    if (*d < b->dmin)
+        b->dmin = *d;
+    *d += e.dpushes;
+    if (*d > b->dmax)
+        b->dmax = *d;
+    *s -= e.spops;
+    if (*s < b->smin)
+        b->smin = *s;
+    *s += e.spushes;
+    if (*s > b->smax)
+        b->smax = *s;
+}
+
+// If the word at `target` in `r` can be spliced into a block, apply the
+// effect of calling it to `b`, `d` and `s`, mark its words as spliced, and
+// return true. Recursion needs a CALLI, so a spliced word cannot recurse.
+static bool splice(region *r, bee_word_t *target, verified_block *b, int *d, int *s)
+{
+    if (target < r->start || target >= r->end)
+        return false;
+    verified_block nb = *b;
+    int nd = *d, ns = *s;
+    apply(&nb, &nd, &ns, (effect){true, 0, 0, 0, 1});
+    bee_word_t *pc;
+    bool ret = false;
+    for (pc = target; !ret; pc++) {
+        if (pc == target + MAX_INLINE_WORDS || pc == r->end)
+            return false;
+        bee_word_t ir = *pc;
+        switch (ir & BEE_OP1_MASK) {
+        case BEE_OP_CALLI:
+            return false;
+        case BEE_OP_PUSHI:
+        case BEE_OP_PUSHRELI:
+            apply(&nb, &nd, &ns, (effect){true, 0, 1, 0, 0});
+            continue;
+        default:
+            if ((ir & BEE_OP2_MASK) != BEE_OP_INSN)
+                return false;
+            break;
+        }
+        bee_uword_t op;
+        for (bee_uword_t ops = (bee_uword_t)ir >> BEE_OP2_SHIFT;
+             (op = ops & BEE_INSN_MASK) != BEE_INSN_NOP; ops >>= BEE_INSN_BITS) {
+            if (op == BEE_INSN_RET) {
+                // Instructions after RET would run at the return address.
+                if (((ops >> BEE_INSN_BITS) & BEE_INSN_MASK) != BEE_INSN_NOP)
+                    return false;
+                ret = true;
+                break;
+            }
+            effect e = insn_effects[op];
+            if (!e.known || e.spops != 0 || e.spushes != 0 || op == BEE_INSN_GET_SP)
+                return false;
+            apply(&nb, &nd, &ns, e);
+        }
+    }
+    apply(&nb, &nd, &ns, (effect){true, 0, 0, 1, 0});
+
+    while (pc > target)
+        r->blocks[--pc - r->start].flags |= VERIFIED_SPLICED;
+    *b = nb;
+    *d = nd;
+    *s = ns;
+    return true;
+}
+
+// Verify the block that starts at `w` in `r`, using the blocks already
+// verified for the words after it.
+static void verify_word(region *r, bee_word_t *w)
+{
+    verified_block b = {0, 0, 0, 0, 1, r->blocks[w - r->start].flags & VERIFIED_SPLICED};
+    int d = 0, s = 0;
+    bee_word_t *next = NULL; // The word that the block falls through to
+    bee_word_t ir = *w;
+    switch (ir & BEE_OP1_MASK) {
+    case BEE_OP_CALLI:
+        // A large literal is pushed as by bee_run().
+        if (r->end - w >= 4 && (b.words = literal_words(w)) != 0) {
+            apply(&b, &d, &s, (effect){true, 0, 1, 0, 1});
+            apply(&b, &d, &s, (effect){true, 0, 0, 1, 0});
+            next = w + b.words;
+        } else if (splice(r, w + 1 + ARSHIFT(ir, BEE_OP1_SHIFT), &b, &d, &s)) {
+            b.flags |= VERIFIED_INLINE;
+            next = w + 1;
+        } else
+            apply(&b, &d, &s, (effect){true, 0, 0, 0, 1});
+        break;
+    case BEE_OP_PUSHI:
+    case BEE_OP_PUSHRELI:
+        apply(&b, &d, &s, (effect){true, 0, 1, 0, 0});
+        next = w + 1;
+        break;
+    default:
+        switch (ir & BEE_OP2_MASK) {
+        case BEE_OP_JUMPI:
+            break;
+        case BEE_OP_JUMPZI:
+            apply(&b, &d, &s, (effect){true, 1, 0, 0, 0});
+            break;
+        case BEE_OP_INSN:
+            {
+                bee_uword_t ops = (bee_uword_t)ir >> BEE_OP2_SHIFT, op;
+                while ((op = ops & BEE_INSN_MASK) != BEE_INSN_NOP && insn_effects[op].known) {
+                    apply(&b, &d, &s, insn_effects[op]);
+                    ops >>= BEE_INSN_BITS;
+                }
+                if (op == BEE_INSN_NOP)
+                    next = w + 1;
+                else if (ops == (bee_uword_t)ir >> BEE_OP2_SHIFT)
+                    b.words = 0;
+            }
+            break;
+        default:
+            b.words = 0;
+            break;
+        }
+    }
+
+    if (next != NULL && next < r->end) {
+        verified_block *n = &r->blocks[next - r->start];
+        if (n->words != 0 && b.words + n->words <= MAX_BLOCK_WORDS) {
+            if (d + n->dmin < b.dmin)
+                b.dmin = d + n->dmin;
+            if (d + n->dmax > b.dmax)
+                b.dmax = d + n->dmax;
+            if (s + n->smin < b.smin)
+                b.smin = s + n->smin;
+            if (s + n->smax > b.smax)
+                b.smax = s + n->smax;
+            b.words += n->words;
+        }
+    }
+    r->blocks[w - r->start] = b;
+}
+
+// Verify every word of `r`, splicing calls afresh.
+static void verify_region(region *r)
+{
+    for (bee_word_t *w = r->start; w < r->end; w++)
+        r->blocks[w - r->start].flags &= ~VERIFIED_SPLICED;
+    for (bee_word_t *w = r->end; w > r->start; )
+        verify_word(r, --w);
+}
+
+int bee_verify(bee_word_t *code, bee_uword_t bytes)
+{
+    bee_uword_t words = bytes / BEE_WORD_BYTES;
+    if (words == 0)
+        return 0;
+    verified_block *blocks = calloc(words, sizeof(verified_block));
+    region *new_regions = realloc(regions, (nregions + 1) * sizeof(region));
+    if (new_regions != NULL)
+        regions = new_regions;
+    if (blocks == NULL || new_regions == NULL) {
+        free(blocks);
+        return -1;
+    }
+
+    region *r = &regions[nregions++];
+    *r = (region){code, code + words, blocks};
+    verify_region(r);
+    if (verified_start == NULL || r->start < verified_start)
+        verified_start = r->start;
+    if (r->end > verified_end)
+        verified_end = r->end;
+    return 0;
+}
+
+// Compiled code only notices writes to the code that it was compiled from,
+// so after it has run, all the code is verified again.
+bool verified_stale = false;
+
+void verified_refresh(void)
+{
+    for (size_t i = 0; i < nregions; i++)
+        verify_region(&regions[i]);
+    verified_stale = false;
+}
+
+void verified_invalidate(void *addr, bee_uword_t bytes)
+{
+    bee_word_t *start = (bee_word_t *)((bee_uword_t)addr & -(bee_uword_t)BEE_WORD_BYTES);
+    bee_word_t *end = (bee_word_t *)ALIGN((uint8_t *)addr + bytes);
+    for (size_t i = 0; i < nregions; i++) {
+        region *r = &regions[i];
+        if (start >= r->end || end <= r->start)
+            continue;
+        // Any block that includes the words written starts at most
+        // MAX_BLOCK_WORDS before them, unless they are spliced.
+        bee_word_t *hi = end < r->end ? end : r->end;
+        bee_word_t *lo = start - r->start > MAX_BLOCK_WORDS ? start - MAX_BLOCK_WORDS : r->start;
+        bool spliced = false;
+        for (bee_word_t *w = start > r->start ? start : r->start; w < hi; w++)
+            spliced |= (r->blocks[w - r->start].flags & VERIFIED_SPLICED) != 0;
+        if (spliced)
+            verify_region(r);
+        else
+            for (bee_word_t *w = hi; w > lo; )
+                verify_word(r, --w);
+    }
+}
+
+void verified_reset(void)
+{
+    for (size_t i = 0; i < nregions; i++)
+        free(regions[i].blocks);
+    free(regions);
+    regions = NULL;
+    nregions = 0;
+    verified_start = verified_end = NULL;
+    verified_stale = false;
+}
+
+
+static _GL_ATTRIBUTE_PURE region *find_region(bee_word_t *pc)
+{
+    for (size_t i = 0; i < nregions; i++)
+        if (pc >= regions[i].start && pc < regions[i].end)
+            return &regions[i];
+    return NULL;
+}
+
+// Whether a stack of `size` words holding `depth` words can go `min` words
+// lower and `max` words higher.
+static bool fits(bee_uword_t size, bee_uword_t depth, int min, int max)
+{
+    return depth <= size && depth >= (bee_uword_t)-min && size - depth >= (bee_uword_t)max;
+}
+
+// Each instruction that verified_run() can execute is a function that
+// returns one of the following, generated from bee/insns.h.
+enum {
+    RUN_NEXT, // Go on to the next instruction
+    RUN_BEFORE, // Return to bee_run() before this instruction
+    RUN_AFTER, // Return to bee_run() after it, as code has been written
+};
+
+// Undo the instruction so that bee_run() can raise the error.
+#define RAISE(code)                             \
+    do {                                        \
+        S->dp = entry_dp;                       \
+        return RUN_BEFORE;                      \
+    } while (0)
+
+#define WRITTEN(addr, bytes)                                            \
+    do {                                                                \
+        if (WRITES_CODE(addr, bytes)) {                                 \
+            bee_invalidate((addr), (bytes));                            \
+            return RUN_AFTER;                                           \
+        }                                                               \
+    } while (0)
+
+#define BEE_INSN(name, opcode, dpops, dpushes, spops, spushes, kind, ...) \
+    RUN_##kind(name, __VA_ARGS__)
+#define RUN_SAFE(name, ...)                                             \
+    static inline int run_##name(bee_state * restrict S)                \
+    {                                                                   \
+        __VA_ARGS__                                                     \
+        return RUN_NEXT;                                                \
+    }
+#define RUN_RAISES(name, ...)                                           \
+    static inline int run_##name(bee_state * restrict S)                \
+    {                                                                   \
+        bee_uword_t entry_dp = S->dp;                                   \
+        __VA_ARGS__                                                     \
+        return RUN_NEXT;                                                \
+    }
+#define RUN_DYNAMIC(name, ...)
+#define RUN_CONTROL(name, ...)
+#include "bee/insns.h"
+#undef BEE_INSN
+
+// Pairs of instructions, with the first in the low bits
+#define PAIR(a, b) (BEE_INSN_##a | BEE_INSN_##b << BEE_INSN_BITS)
+#define PAIR_MASK ((1 << 2 * BEE_INSN_BITS) - 1)
+
+void verified_run(bee_state * restrict S)
+{
+    bee_uword_t ops; // Instructions left in the current word
+    bee_word_t *ret = NULL; // The return address of a spliced call being run
+    for (;;) {
+        S->ir = 0;
+        region *r = find_region(S->pc);
+        if (r == NULL)
+            return;
+        verified_block *block = &r->blocks[S->pc - r->start];
+        if (block->words == 0 ||
+            !fits(S->dsize, S->dp, block->dmin, block->dmax) ||
+            !fits(S->ssize, S->sp, block->smin, block->smax))
+            return;
+
+        for (bee_word_t *end = S->pc + block->words; ret != NULL || S->pc < end; ) {
+            bee_word_t ir = *S->pc++;
+            switch (ir & BEE_OP1_MASK) {
+            case BEE_OP_CALLI:
+                // A CALLI that does not end the block is spliced, or
+                // starts a large literal.
+                if (r->blocks[S->pc - 1 - r->start].flags & VERIFIED_INLINE) {
+                    // Returning from a CATCH frame is left to bee_run().
+                    if (S->sp < S->handler_sp) {
+                        S->pc--;
+                        return;
+                    }
+                    ret = S->pc;
+                    S->pc += ARSHIFT(ir, BEE_OP1_SHIFT);
+                    break;
+                }
+                if (S->pc < end) {
+                    S->s0[S->sp] = (bee_uword_t)S->pc;
+                    PUSH(*S->pc);
+                    S->pc += literal_words(S->pc - 1) - 1;
+                    break;
+                }
+                S->s0[S->sp++] = (bee_uword_t)S->pc;
+                S->pc += ARSHIFT(ir, BEE_OP1_SHIFT);
+                goto next_block;
+            case BEE_OP_PUSHI:
+                PUSH(ARSHIFT(ir, BEE_OP1_SHIFT));
+                break;
+            case BEE_OP_PUSHRELI:
+                PUSH(S->pc + ARSHIFT(ir, BEE_OP1_SHIFT));
+                break;
+            default:
+                switch (ir & BEE_OP2_MASK) {
+                case BEE_OP_JUMPI:
+                    S->pc += ARSHIFT(ir, BEE_OP2_SHIFT);
+                    goto next_block;
+                case BEE_OP_JUMPZI:
+                    if (POP() == 0)
+                        S->pc += ARSHIFT(ir, BEE_OP2_SHIFT);
+                    goto next_block;
+                case BEE_OP_INSN:
+                    for (ops = (bee_uword_t)ir >> BEE_OP2_SHIFT;
+                         (ops & BEE_INSN_MASK) != BEE_INSN_NOP;
+                         ops >>= BEE_INSN_BITS) {
+                        int run;
+                        // Fused pairs run as one, without dispatching again.
+                        switch (ops & PAIR_MASK) {
+#define BEE_INSN(name, ...)
+#define BEE_FUSED(a, b)                                                 \
+                        case PAIR(a, b):                                \
+                            if ((run = run_##a(S)) == RUN_NEXT) {       \
+                                ops >>= BEE_INSN_BITS;                  \
+                                run = run_##b(S);                       \
+                            }                                           \
+                            break;
+#include "bee/insns.h"
+#undef BEE_FUSED
+#undef BEE_INSN
+                        default:
+                            switch (ops & BEE_INSN_MASK) {
+#define BEE_INSN(name, opcode, dpops, dpushes, spops, spushes, kind, ...) \
+                            CASE_##kind(name)
+#define CASE_SAFE(name)                                                 \
+                            case BEE_INSN_##name:                       \
+                                run = run_##name(S);                    \
+                                break;
+#define CASE_RAISES CASE_SAFE
+#define CASE_DYNAMIC(name)
+#define CASE_CONTROL(name)
+#include "bee/insns.h"
+#undef BEE_INSN
+                            case BEE_INSN_RET:
+                                if (ret == NULL)
+                                    goto resume;
+                                // Return from a spliced call; its RET
+                                // ends its word.
+                                S->pc = ret;
+                                ret = NULL;
+                                ops = 0;
+                                run = RUN_NEXT;
+                                break;
+                            default:
+                                goto resume;
+                            }
+                        }
+                        if (run == RUN_AFTER)
+                            ops >>= BEE_INSN_BITS;
+                        if (run != RUN_NEXT)
+                            goto resume;
+                    }
+                    break;
+                default:
+                    S->pc--;
+                    return;
+                }
+            }
+        }
+    next_block:
+        ;
+    }
+
+ resume:
+    // Return to bee_run() before the instructions left in `ops`, pushing
+    // the return address of any spliced call, as the CALLI would have.
+    S->ir = (bee_word_t)((ops << BEE_OP2_SHIFT) | BEE_OP_INSN);
+    if (ret != NULL)
+        S->s0[S->sp++] = (bee_uword_t)ret;
+}
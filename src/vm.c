@@ -43,8 +43,19 @@ verify(CHAR_BIT == 8);
 
 #ifdef HAVE_MIJIT
 mijit_bee_jit *bee_jit;
+
+// Number of times the interpreter has entered the JIT.
+bee_uword_t bee_jit_crossings;
 #endif
 
+// Mark the next instruction word fetched as a possible entry point to
+// compiled or verified code.
+#define JIT_ENTRY()                             \
+    do {                                        \
+        jit_entry = tiered;                     \
+        verified_entry = verifying;             \
+    } while (0)
+
 
 // Stacks
 
@@ -93,7 +104,8 @@ bee_state *bee_init(bee_word_t *pc, bee_uword_t ssize, bee_uword_t dsize)
         S->s0 = (bee_word_t *)calloc(S->ssize, BEE_WORD_BYTES);
         if (S->s0 != NULL) {
 #ifdef HAVE_MIJIT
-            bee_jit = mijit_bee_new();
+            if (bee_jit == NULL)
+                bee_jit = mijit_bee_new(true);
             if (bee_jit != NULL)
                 return S;
 #else
@@ -109,24 +121,90 @@ bee_state *bee_init(bee_word_t *pc, bee_uword_t ssize, bee_uword_t dsize)
 
 void bee_destroy(bee_state * restrict S)
 {
-#ifdef HAVE_MIJIT
-    mijit_bee_drop(bee_jit);
-#endif
     free(S->s0);
     free(S->d0);
     free(S);
 }
 
+// Free state shared by all VM states.
+void bee_finish(void)
+{
+#ifdef HAVE_MIJIT
+    mijit_bee_drop(bee_jit);
+    bee_jit = NULL;
+#endif
+#ifdef HAVE_PTHREAD_H
+    async_reset();
+#endif
+    hot_reset();
+    verified_reset();
+    perf_map_close();
+    streams_close();
+}
+
 
 // Address checking
 #define CHECK_ALIGNED(a)                                        \
     if (!IS_ALIGNED(a))                                         \
         THROW(BEE_ERROR_UNALIGNED_ADDRESS);
 
-// Division macros
-#define DIV_CATCH_ZERO(a, b) ((b) == 0 ? 0 : (a) / (b))
-#define MOD_CATCH_ZERO(a, b) ((b) == 0 ? (a) : (a) % (b))
+// Raise an error in the semantics of an instruction (see bee/insns.h).
+#define RAISE(code) THROW(code)
+
+// Check the stacks for an instruction, starting with the data stack unless
+// the instruction pops only the return stack.
+#define CHECK_STACKS(dpops, dpushes, spops, spushes)                    \
+    do {                                                                \
+        bool _sfirst = (dpops) == 0 && (spops) != 0;                    \
+        if (_sfirst)                                                    \
+            CHECKS(spops, spushes);                                     \
+        if ((dpops) != 0 || (dpushes) != 0)                             \
+            CHECKD(dpops, dpushes);                                     \
+        if (!_sfirst && ((spops) != 0 || (spushes) != 0))               \
+            CHECKS(spops, spushes);                                     \
+    } while (0)
+
+// Transfer control to `addr`, which should already have been checked.
+#define JUMP_TO(addr)                           \
+    do {                                        \
+        S->pc = (addr);                         \
+        JIT_ENTRY();                            \
+    } while (0)
+
+// Count a call to `addr`.
+#define COUNT_CALL(addr)                        \
+    do {                                        \
+        if (unlikely(hot_threshold != 0))       \
+            hot_count(addr);                    \
+    } while (0)
+
+// Count a backward branch to `addr`, and start recording a trace if it
+// has become hot.
+#define COUNT_LOOP(addr)                                                \
+    do {                                                                \
+        if (unlikely(tiered) && hot_count(addr) == trace_threshold &&   \
+            trace_threshold != 0)                                       \
+            recording = trace_start(addr);                              \
+    } while (0)
 
+// Discard compiled code made from the `bytes` bytes at `addr`, which have
+// just been written, and verify them again.
+#define WRITTEN(addr, bytes)                                            \
+    do {                                                                \
+        if (unlikely(WRITES_CODE(addr, bytes)))                         \
+            bee_invalidate((addr), (bytes));                            \
+    } while (0)
+
+_GL_ATTRIBUTE_PURE unsigned literal_words(bee_word_t *pc)
+{
+    if (pc[0] != LITERAL_CALLI)
+        return 0;
+    if (pc[2] == LITERAL_INSN(BEE_INSN_POPS | BEE_INSN_LOAD << BEE_INSN_BITS))
+        return 3;
+    if (pc[2] == LITERAL_INSN(BEE_INSN_POPS) && pc[3] == LITERAL_INSN(BEE_INSN_LOAD))
+        return 4;
+    return 0;
+}
 
 // Execution function
 bee_word_t bee_run(bee_state * restrict S)
@@ -134,19 +212,101 @@ bee_word_t bee_run(bee_state * restrict S)
     bee_word_t error = BEE_ERROR_OK;
     CHECK_ALIGNED(S->pc);
 
+    // Compiled code is entered only at the start of a block: the first
+    // instruction word, and the target of each control transfer, and then
+    // only if the code there is hot. It runs until it reaches an
+    // instruction it cannot handle, which the interpreter then executes,
+    // carrying on until the next block start.
+    bool tiered = hot_threshold != 0 || trace_threshold != 0;
+    bool jit_entry = false, recording = false;
+    // Verified code is run without checks in the same places, but only
+    // when no JIT is in use, as it is neither counted nor traced.
+    bool verifying = !tiered && verified_end != NULL;
+    bool verified_entry = false;
+    if (tiered)
+        verified_stale = true;
+    else if (verifying && verified_stale)
+        verified_refresh();
+    if ((tiered || verifying) && S->ir == 0) {
+        S->ir = *S->pc++;
+        JIT_ENTRY();
+    }
+
     for (;; S->ir = *S->pc++) {
+        if (unlikely(recording))
+            recording = trace_record(S->pc - 1);
+        if (jit_entry) {
+            jit_entry = false;
+            hot_counter *c = hot_lookup(S->pc - 1);
 #ifdef HAVE_MIJIT
-        mijit_bee_run(bee_jit, (mijit_bee_registers *)S);
+            if (c != NULL && c->compiled) {
+                // The JIT may return part way through an instruction
+                // word, leaving the rest of it in ir.
+                S->pc--;
+                S->ir = 0;
+                mijit_bee_run(bee_jit, (mijit_bee_registers *)S);
+                bee_jit_crossings++;
+                if (S->ir == 0)
+                    S->ir = *S->pc++;
+            } else
 #endif
+#ifdef HAVE_TEMPLATE_JIT
+            if (c != NULL && c->code != NULL) {
+                THROW_IF_ERROR(c->code(S));
+                // If the compiled code exited at the start of a block,
+                // enter any code compiled for it at once; calls and
+                // branches in compiled code are not counted otherwise.
+                if (S->ir == 0) {
+                    COUNT_CALL(S->pc);
+                    jit_entry = true;
+                    continue;
+                }
+            } else
+#endif
+            if (c != NULL && c->block != NULL) {
+                // The block exits with pc and ir set to resume, or with ir
+                // 0 at the start of the next block, as native code does.
+                regvm_run(S, c->block);
+                if (S->ir == 0) {
+                    COUNT_CALL(S->pc);
+                    jit_entry = true;
+                    continue;
+                }
+            } else
+            if (c != NULL && c->trace != NULL && !recording)
+                // The trace exits with pc and ir ready to resume.
+                trace_run(S, c->trace);
+        }
+        if (verified_entry) {
+            verified_entry = false;
+            // verified_run() starts at the beginning of a word, and
+            // returns with pc and ir set to resume.
+            S->pc--;
+            verified_run(S);
+            if (S->ir == 0)
+                S->ir = *S->pc++;
+        }
 
         switch (S->ir & BEE_OP1_MASK) {
         case BEE_OP_CALLI:
             {
+                // Push a large literal directly if no error can occur;
+                // the return address is still written, as by PUSHS.
+                unsigned words;
+                if (S->ir == LITERAL_CALLI && !recording &&
+                    S->sp < S->ssize && S->dp < S->dsize &&
+                    (words = literal_words(S->pc - 1)) != 0) {
+                    S->s0[S->sp] = (bee_uword_t)S->pc;
+                    S->d0[S->dp++] = *S->pc;
+                    S->pc += words - 1;
+                    break;
+                }
                 CHECKS(0, 1);
                 PUSHS((bee_uword_t)S->pc);
                 bee_word_t *addr = S->pc + ARSHIFT(S->ir, BEE_OP1_SHIFT);
                 CHECK_ALIGNED(addr);
-                S->pc = addr;
+                COUNT_CALL(addr);
+                JUMP_TO(addr);
             }
             break;
         case BEE_OP_PUSHI:
@@ -163,7 +323,9 @@ bee_word_t bee_run(bee_state * restrict S)
                 {
                     bee_word_t *addr = S->pc + ARSHIFT(S->ir, BEE_OP2_SHIFT);
                     CHECK_ALIGNED(addr);
-                    S->pc = addr;
+                    if (addr < S->pc)
+                        COUNT_LOOP(addr);
+                    JUMP_TO(addr);
                 }
                 break;
             case BEE_OP_JUMPZI:
@@ -174,7 +336,9 @@ bee_word_t bee_run(bee_state * restrict S)
                     POPD(&flag);
                     if (flag == 0) {
                         CHECK_ALIGNED(addr);
-                        S->pc = addr;
+                        if (addr < S->pc)
+                            COUNT_LOOP(addr);
+                        JUMP_TO(addr);
                     }
                 }
                 break;
@@ -193,517 +357,38 @@ bee_word_t bee_run(bee_state * restrict S)
                                               << BEE_OP2_SHIFT) |
                                              BEE_OP_INSN);
                         switch (opcode) {
-                        case BEE_INSN_NOP:
-                            goto end;
-                            break;
-                        case BEE_INSN_NOT:
-                            {
-                                CHECKD(1, 1);
-                                bee_word_t a;
-                                POPD(&a);
-                                PUSHD(~a);
-                            }
-                            break;
-                        case BEE_INSN_AND:
-                            {
-                                CHECKD(2, 1);
-                                bee_word_t a, b;
-                                POPD(&a);
-                                POPD(&b);
-                                PUSHD(a & b);
-                            }
-                            break;
-                        case BEE_INSN_OR:
-                            {
-                                CHECKD(2, 1);
-                                bee_word_t a, b;
-                                POPD(&a);
-                                POPD(&b);
-                                PUSHD(a | b);
-                            }
-                            break;
-                        case BEE_INSN_XOR:
-                            {
-                                CHECKD(2, 1);
-                                bee_word_t a, b;
-                                POPD(&a);
-                                POPD(&b);
-                                PUSHD(a ^ b);
-                            }
-                            break;
-                        case BEE_INSN_LSHIFT:
-                            {
-                                CHECKD(2, 1);
-                                bee_word_t shift, value;
-                                POPD(&shift);
-                                POPD(&value);
-                                PUSHD(shift < (bee_word_t)BEE_WORD_BIT ? LSHIFT(value, shift) : 0);
-                            }
-                            break;
-                        case BEE_INSN_RSHIFT:
-                            {
-                                CHECKD(2, 1);
-                                bee_word_t shift, value;
-                                POPD(&shift);
-                                POPD(&value);
-                                PUSHD(shift < (bee_word_t)BEE_WORD_BIT ? (bee_word_t)((bee_uword_t)value >> shift) : 0);
-                            }
-                            break;
-                        case BEE_INSN_ARSHIFT:
-                            {
-                                CHECKD(2, 1);
-                                bee_word_t shift, value;
-                                POPD(&shift);
-                                POPD(&value);
-                                PUSHD(ARSHIFT(value, shift));
-                            }
-                            break;
-                        case BEE_INSN_POP:
-                            CHECKD(1, 0);
-                            S->dp--;
-                            break;
-                        case BEE_INSN_DUP:
-                            {
-                                CHECKD(1, 1);
-                                bee_uword_t depth;
-                                POPD((bee_word_t *)&depth);
-                                if (depth >= S->dp) {
-                                    PUSHD(depth);
-                                    THROW(BEE_ERROR_STACK_UNDERFLOW);
-                                } else
-                                    PUSHD(S->d0[S->dp - (depth + 1)]);
-                            }
-                            break;
-                        case BEE_INSN_SET:
-                            {
-                                CHECKD(2, 1);
-                                bee_uword_t depth;
-                                POPD((bee_word_t *)&depth);
-                                if (depth >= S->dp) {
-                                    PUSHD(depth);
-                                    THROW(BEE_ERROR_STACK_UNDERFLOW);
-                                } else {
-                                    bee_word_t value;
-                                    POPD(&value);
-                                    S->d0[S->dp - (depth + 1)] = value;
-                                }
-                            }
-                            break;
-                        case BEE_INSN_SWAP:
-                            {
-                                CHECKD(1, 0);
-                                bee_uword_t depth;
-                                POPD((bee_word_t *)&depth);
-                                if (S->dp == 0 || depth >= S->dp - 1) {
-                                    PUSHD(depth);
-                                    THROW(BEE_ERROR_STACK_UNDERFLOW);
-                                } else {
-                                    bee_word_t temp = S->d0[S->dp - (depth + 2)];
-                                    S->d0[S->dp - (depth + 2)] = S->d0[S->dp - 1];
-                                    S->d0[S->dp - 1] = temp;
-                                }
-                            }
-                            break;
-                        case BEE_INSN_JUMP:
-                            {
-                                CHECKD(1, 0);
-                                bee_word_t *addr;
-                                POPD((bee_word_t *)&addr);
-                                CHECK_ALIGNED(addr);
-                                S->pc = addr;
-                            }
-                            break;
-                        case BEE_INSN_JUMPZ:
-                            {
-                                CHECKD(2, 0);
-                                bee_word_t *addr;
-                                POPD((bee_word_t *)&addr);
-                                bee_word_t flag;
-                                POPD(&flag);
-                                if (flag == 0) {
-                                    CHECK_ALIGNED(addr);
-                                    S->pc = addr;
-                                }
-                            }
-                            break;
-                        case BEE_INSN_CALL:
-                            {
-                                CHECKD(1, 0);
-                                CHECKS(0, 1);
-                                bee_word_t *addr;
-                                POPD((bee_word_t *)&addr);
-                                CHECK_ALIGNED(addr);
-                                PUSHS((bee_uword_t)S->pc);
-                                S->pc = addr;
-                            }
-                            break;
-                        case BEE_INSN_RET:
-                            {
-                                CHECKS(1, 0);
-                                if (S->sp < S->handler_sp) {
-                                    CHECKS(1, 0);
-                                    CHECKD(0, 1);
-                                }
-                                bee_word_t *addr;
-                                POPS((bee_word_t *)&addr);
-                                CHECK_ALIGNED(addr);
-                                if (S->sp < S->handler_sp) {
-                                    POPS((bee_word_t *)&S->handler_sp);
-                                    PUSHD(0);
-                                }
-                                S->pc = addr;
-                            }
-                            break;
-                        case BEE_INSN_LOAD:
-                            {
-                                CHECKD(1, 1);
-                                bee_word_t *addr;
-                                POPD((bee_word_t *)&addr);
-                                CHECK_ALIGNED(addr);
-                                PUSHD(*addr);
-                            }
-                            break;
-                        case BEE_INSN_STORE:
-                            {
-                                CHECKD(2, 0);
-                                bee_word_t *addr;
-                                POPD((bee_word_t *)&addr);
-                                CHECK_ALIGNED(addr);
-                                bee_word_t value;
-                                POPD(&value);
-                                *addr = value;
-                            }
-                            break;
-                        case BEE_INSN_LOAD1:
-                            {
-                                CHECKD(1, 1);
-                                uint8_t *addr;
-                                POPD((bee_word_t *)&addr);
-                                uint8_t value = *addr;
-                                PUSHD((bee_word_t)value);
-                            }
-                            break;
-                        case BEE_INSN_STORE1:
-                            {
-                                CHECKD(2, 0);
-                                uint8_t *addr;
-                                POPD((bee_word_t *)&addr);
-                                bee_word_t value;
-                                POPD(&value);
-                                *addr = (uint8_t)value;
-                            }
-                            break;
-                        case BEE_INSN_LOAD2:
-                            {
-                                CHECKD(1, 1);
-                                uint16_t *addr;
-                                POPD((bee_word_t *)&addr);
-                                if ((bee_uword_t)addr % 2 != 0)
-                                    THROW(BEE_ERROR_UNALIGNED_ADDRESS);
-                                PUSHD(*addr);
-                            }
-                            break;
-                        case BEE_INSN_STORE2:
-                            {
-                                CHECKD(2, 0);
-                                uint16_t *addr;
-                                POPD((bee_word_t *)&addr);
-                                if ((bee_uword_t)addr % 2 != 0)
-                                    THROW(BEE_ERROR_UNALIGNED_ADDRESS);
-                                bee_word_t value;
-                                POPD(&value);
-                                *addr = (uint16_t)value;
-                            }
-                            break;
-                        case BEE_INSN_LOAD4:
-                            {
-                                CHECKD(1, 1);
-                                uint32_t *addr;
-                                POPD((bee_word_t *)&addr);
-                                if ((bee_uword_t)addr % 4 != 0)
-                                    THROW(BEE_ERROR_UNALIGNED_ADDRESS);
-                                PUSHD(*addr);
-                            }
-                            break;
-                        case BEE_INSN_STORE4:
-                            {
-                                CHECKD(2, 0);
-                                uint32_t *addr;
-                                POPD((bee_word_t *)&addr);
-                                if ((bee_uword_t)addr % 4 != 0)
-                                    THROW(BEE_ERROR_UNALIGNED_ADDRESS);
-                                bee_word_t value;
-                                POPD(&value);
-                                *addr = (uint32_t)value;
-                            }
-                            break;
-                        case BEE_INSN_LOAD_IA:
-                            {
-                                CHECKD(1, 2);
-                                bee_word_t *addr;
-                                POPD((bee_word_t *)&addr);
-                                CHECK_ALIGNED(addr);
-                                PUSHD(*addr);
-                                PUSHD((bee_word_t)(addr + 1));
-                            }
-                            break;
-                        case BEE_INSN_STORE_DB:
-                            {
-                                CHECKD(2, 1);
-                                bee_word_t *addr;
-                                POPD((bee_word_t *)&addr);
-                                CHECK_ALIGNED(addr);
-                                bee_word_t value;
-                                POPD(&value);
-                                addr[-1] = value;
-                                PUSHD((bee_word_t)(addr - 1));
-                            }
-                            break;
-                        case BEE_INSN_LOAD_IB:
-                            {
-                                CHECKD(1, 2);
-                                bee_word_t *addr;
-                                POPD((bee_word_t *)&addr);
-                                CHECK_ALIGNED(addr);
-                                PUSHD(addr[1]);
-                                PUSHD((bee_word_t)(addr + 1));
-                            }
-                            break;
-                        case BEE_INSN_STORE_DA:
-                            {
-                                CHECKD(2, 1);
-                                bee_word_t *addr;
-                                POPD((bee_word_t *)&addr);
-                                CHECK_ALIGNED(addr);
-                                bee_word_t value;
-                                POPD(&value);
-                                *addr = value;
-                                PUSHD((bee_word_t)(addr - 1));
-                            }
-                            break;
-                        case BEE_INSN_LOAD_DA:
-                            {
-                                CHECKD(1, 2);
-                                bee_word_t *addr;
-                                POPD((bee_word_t *)&addr);
-                                CHECK_ALIGNED(addr);
-                                PUSHD(*addr);
-                                PUSHD((bee_word_t)(addr - 1));
-                            }
-                            break;
-                        case BEE_INSN_STORE_IB:
-                            {
-                                CHECKD(2, 1);
-                                bee_word_t *addr;
-                                POPD((bee_word_t *)&addr);
-                                CHECK_ALIGNED(addr);
-                                bee_word_t value;
-                                POPD(&value);
-                                addr[1] = value;
-                                PUSHD((bee_word_t)(addr + 1));
-                            }
-                            break;
-                        case BEE_INSN_LOAD_DB:
-                            {
-                                CHECKD(1, 2);
-                                bee_word_t *addr;
-                                POPD((bee_word_t *)&addr);
-                                CHECK_ALIGNED(addr);
-                                PUSHD(addr[-1]);
-                                PUSHD((bee_word_t)(addr - 1));
-                            }
-                            break;
-                        case BEE_INSN_STORE_IA:
-                            {
-                                CHECKD(2, 1);
-                                bee_word_t *addr;
-                                POPD((bee_word_t *)&addr);
-                                CHECK_ALIGNED(addr);
-                                bee_word_t value;
-                                POPD(&value);
-                                *addr = value;
-                                PUSHD((bee_word_t)(addr + 1));
-                            }
-                            break;
-                        case BEE_INSN_NEG:
-                            {
-                                CHECKD(1, 1);
-                                bee_uword_t a;
-                                POPD((bee_word_t *)&a);
-                                PUSHD((bee_word_t)-a);
-                            }
-                            break;
-                        case BEE_INSN_ADD:
-                            {
-                                CHECKD(2, 1);
-                                bee_uword_t a, b;
-                                POPD((bee_word_t *)&a);
-                                POPD((bee_word_t *)&b);
-                                PUSHD((bee_word_t)(b + a));
-                            }
-                            break;
-                        case BEE_INSN_MUL:
-                            {
-                                CHECKD(2, 1);
-                                bee_uword_t a, b;
-                                POPD((bee_word_t *)&a);
-                                POPD((bee_word_t *)&b);
-                                PUSHD((bee_word_t)(a * b));
-                            }
-                            break;
-                        case BEE_INSN_DIVMOD:
-                            {
-                                CHECKD(2, 2);
-                                bee_word_t divisor, dividend;
-                                POPD(&divisor);
-                                POPD(&dividend);
-                                if (dividend == BEE_WORD_MIN && divisor == -1) {
-                                    PUSHD(BEE_WORD_MIN);
-                                    PUSHD(0);
-                                } else {
-                                    PUSHD(DIV_CATCH_ZERO(dividend, divisor));
-                                    PUSHD(MOD_CATCH_ZERO(dividend, divisor));
-                                }
-                            }
-                            break;
-                        case BEE_INSN_UDIVMOD:
-                            {
-                                CHECKD(2, 2);
-                                bee_uword_t divisor, dividend;
-                                POPD((bee_word_t *)&divisor);
-                                POPD((bee_word_t *)&dividend);
-                                PUSHD(DIV_CATCH_ZERO(dividend, divisor));
-                                PUSHD(MOD_CATCH_ZERO(dividend, divisor));
-                            }
-                            break;
-                        case BEE_INSN_EQ:
-                            {
-                                CHECKD(2, 1);
-                                bee_word_t a, b;
-                                POPD(&a);
-                                POPD(&b);
-                                PUSHD(a == b);
-                            }
-                            break;
-                        case BEE_INSN_LT:
-                            {
-                                CHECKD(2, 1);
-                                bee_word_t a, b;
-                                POPD(&a);
-                                POPD(&b);
-                                PUSHD(b < a);
-                            }
-                            break;
-                        case BEE_INSN_ULT:
-                            {
-                                CHECKD(2, 1);
-                                bee_uword_t a, b;
-                                POPD((bee_word_t *)&a);
-                                POPD((bee_word_t *)&b);
-                                PUSHD(b < a);
-                            }
-                            break;
-                        case BEE_INSN_PUSHS:
-                            {
-                                CHECKD(1, 0);
-                                CHECKS(0, 1);
-                                bee_word_t value;
-                                POPD(&value);
-                                PUSHS(value);
-                            }
-                            break;
-                        case BEE_INSN_POPS:
-                            {
-                                CHECKS(1, 0);
-                                CHECKD(0, 1);
-                                bee_word_t value;
-                                POPS(&value);
-                                PUSHD(value);
-                            }
-                            break;
-                        case BEE_INSN_DUPS:
-                            CHECKS(1, 1);
-                            CHECKD(0, 1);
-                            PUSHD(S->s0[S->sp - 1]);
-                            break;
-                        case BEE_INSN_CATCH:
-                            {
-                                CHECKS(0, 2);
-                                CHECKD(1, 0);
-                                bee_word_t *addr;
-                                POPD((bee_word_t *)&addr);
-                                CHECK_ALIGNED(addr);
-                                PUSHS(S->handler_sp);
-                                PUSHS((bee_uword_t)S->pc);
-                                S->handler_sp = S->sp;
-                                S->pc = addr;
-                            }
-                            break;
-                        case BEE_INSN_THROW:
-                            {
-                                CHECKD(1, 0);
-                                POPD(&error);
-                            error:
-                                if (S->handler_sp < 2)
-                                    return error;
-                                // Don't push error code if the stack is full.
-                                if (S->dp < S->dsize)
-                                    S->d0[S->dp++] = error;
-                                S->sp = S->handler_sp;
-                                bee_word_t *addr;
-                                POPS((bee_word_t *)&addr);
-                                POPS((bee_word_t *)&S->handler_sp);
-                                // If this check fails, we will pop the next handler.
-                                CHECK_ALIGNED(addr);
-                                S->pc = addr;
-                            }
-                            break;
-                        case BEE_INSN_BREAK:
-                            return BEE_ERROR_BREAK;
-                        case BEE_INSN_WORD_BYTES:
-                            CHECKD(0, 1);
-                            PUSHD(BEE_WORD_BYTES);
-                            break;
-                        case BEE_INSN_GET_SSIZE:
-                            CHECKD(0, 1);
-                            PUSHD(S->ssize);
-                            break;
-                        case BEE_INSN_GET_SP:
-                            CHECKD(0, 1);
-                            PUSHD(S->sp);
-                            break;
-                        case BEE_INSN_SET_SP:
-                            CHECKD(1, 0);
-                            POPD((bee_word_t *)&S->sp);
-                            break;
-                        case BEE_INSN_GET_DSIZE:
-                            CHECKD(0, 1);
-                            PUSHD(S->dsize);
-                            break;
-                        case BEE_INSN_GET_DP:
-                            {
-                                CHECKD(0, 1);
-                                bee_word_t value = S->dp;
-                                PUSHD(value);
-                            }
-                            break;
-                        case BEE_INSN_SET_DP:
-                            {
-                                CHECKD(1, 0);
-                                bee_word_t value;
-                                POPD(&value);
-                                S->dp = value;
-                            }
-                            break;
-                        case BEE_INSN_GET_HANDLER_SP:
-                            CHECKD(0, 1);
-                            PUSHD(S->handler_sp);
-                            break;
+#define BEE_INSN(name, op, dpops, dpushes, spops, spushes, kind, ...) \
+                        case BEE_INSN_##name:                           \
+                            CHECK_STACKS(dpops, dpushes, spops, spushes); \
+                            {                                           \
+                                __VA_ARGS__                             \
+                            }                                           \
+                            break;
+#include "bee/insns.h"
+#undef BEE_INSN
                         default:
                             THROW(BEE_ERROR_INVALID_OPCODE);
                             break;
                         }
                         continue;
+                    error:
+                        if (S->handler_sp < 2) {
+                            streams_flush();
+                            return error;
+                        }
+                        // Don't push error code if the stack is full.
+                        if (S->dp < S->dsize)
+                            S->d0[S->dp++] = error;
+                        S->sp = S->handler_sp;
+                        {
+                            bee_word_t *addr;
+                            POPS((bee_word_t *)&addr);
+                            POPS((bee_word_t *)&S->handler_sp);
+                            // If this check fails, we will pop the next handler.
+                            CHECK_ALIGNED(addr);
+                            JUMP_TO(addr);
+                        }
+                        continue;
                     end:
                         break;
                     } while (true);
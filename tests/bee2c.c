@@ -0,0 +1,138 @@
+// Test that programs compiled by bee2c run as they do in the interpreter.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include <sys/wait.h>
+
+#include "tests.h"
+
+
+// Write the code from m0 to `end` to the object file `name`.bin.
+static void write_object(const char *name, bee_word_t *end)
+{
+    char *file = xasprintf("%s.bin", name);
+    FILE *fp = fopen(file, "wb");
+    assert(fp != NULL);
+    assert(fwrite(m0, BEE_WORD_BYTES, end - m0, fp) == (size_t)(end - m0));
+    assert(fclose(fp) == 0);
+    free(file);
+}
+
+// Run the code at m0 in the interpreter.
+static bee_word_t interpret(bee_state *S)
+{
+    S->pc = m0;
+    S->ir = 0;
+    S->dp = S->sp = S->handler_sp = 0;
+    return bee_run(S);
+}
+
+// Compile the object file `name`.bin with bee2c and a C compiler, run it,
+// and return its exit status, or -1 on error.
+static int compile_and_run(const char *name)
+{
+    const char *libtool = getenv("LIBTOOL"), *bee2c = getenv("BEE2C"),
+        *cc = getenv("BEE_CC"), *libbee = getenv("LIBBEE");
+    assert(libtool != NULL && bee2c != NULL && cc != NULL && libbee != NULL);
+    char *compile = xasprintf("%s -o %s.c %s.bin && %s --mode=link %s -o %s %s.c %s",
+                              bee2c, name, name, libtool, cc, name, name, libbee);
+    int status = system(compile);
+    free(compile);
+    if (status != 0) {
+        printf("Error in bee2c tests: could not compile %s\n", name);
+        return -1;
+    }
+    char *run = xasprintf("%s --mode=execute ./%s", libtool, name);
+    status = system(run);
+    free(run);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Code that falls through into a word that is also called ( -- 33 )
+static bee_word_t *fallthrough(void)
+{
+    pushi(5);
+    bee_word_t *calls = label();
+    calli(m0); calli(m0); calli(m0); // Patched below.
+    ass(BEE_INSN_THROW);
+    bee_word_t *add10 = label();
+    pushi(10); ass(BEE_INSN_ADD);
+    bee_word_t *add1 = label();
+    pushi(1); ass(BEE_INSN_ADD); ass(BEE_INSN_RET);
+    bee_word_t *twice = label();
+    pushi(0); ass(BEE_INSN_DUP); ass(BEE_INSN_ADD); ass(BEE_INSN_RET);
+    bee_word_t *end = label();
+    ass_goto(calls);
+    calli(add10); calli(twice); calli(add1);
+    return end;
+}
+
+// A jump into the middle of another word ( -- 8 )
+static bee_word_t *jump_into(void)
+{
+    pushi(3);
+    bee_word_t *calls = label();
+    calli(m0); calli(m0); // Patched below.
+    ass(BEE_INSN_THROW);
+    bee_word_t *add3 = label();
+    pushi(1); ass(BEE_INSN_ADD);
+    bee_word_t *add2 = label();
+    pushi(2); ass(BEE_INSN_ADD); ass(BEE_INSN_RET);
+    bee_word_t *jump_add2 = label();
+    jumpi(add2);
+    bee_word_t *end = label();
+    ass_goto(calls);
+    calli(jump_add2); calli(add3);
+    return end;
+}
+
+// Large literals, one of whose data words is not valid code ( -- 19 )
+static bee_word_t *literals(void)
+{
+    push((bee_word_t)0x123456789abcdef0ULL);
+    bee_word_t *call = label();
+    calli(m0); // Patched below.
+    ass(BEE_INSN_THROW);
+    bee_word_t *top_bits = label();
+    pushi(56); ass(BEE_INSN_RSHIFT);
+    push(BEE_WORD_MIN); pushi(BEE_WORD_BIT - 1); ass(BEE_INSN_RSHIFT);
+    ass(BEE_INSN_ADD); ass(BEE_INSN_RET);
+    bee_word_t *end = label();
+    ass_goto(call);
+    calli(top_bits);
+    return end;
+}
+
+bool test(bee_state *S)
+{
+    struct {
+        const char *name;
+        bee_word_t *(*assemble)(void);
+    } programs[] = {
+        {"bee2c-fallthrough", fallthrough},
+        {"bee2c-jump", jump_into},
+        {"bee2c-literals", literals},
+    };
+
+    bee_set_jit(BEE_JIT_NONE);
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(programs) / sizeof(programs[0]); i++) {
+        ass_goto(m0);
+        write_object(programs[i].name, programs[i].assemble());
+        bee_word_t ret = interpret(S);
+        int status = compile_and_run(programs[i].name);
+        printf("%s: interpreter returned %zd, compiled program exited with %d\n",
+               programs[i].name, ret, status);
+        if (ret < 0 || ret > 255 || status != ret) {
+            printf("Error in bee2c tests: results differ\n");
+            ok = false;
+        }
+    }
+    return ok;
+}
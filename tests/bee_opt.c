@@ -0,0 +1,157 @@
+// Test that programs optimized by bee-opt run as they did before.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include "tests.h"
+
+
+// The counts of rewrites reported by bee-opt --verbose
+enum { FOLDS, TAIL_CALLS, THREADS, PACKS, NOP_JUMPS, BODIES, MOVED, NCOUNTS };
+
+// The word that a profile should say is hot, or NULL for no profile
+static bee_word_t *hot;
+
+// Write the code from m0 to `end` to the object file `name`.bin.
+static void write_object(const char *name, bee_word_t *end)
+{
+    char *file = xasprintf("%s.bin", name);
+    FILE *fp = fopen(file, "wb");
+    assert(fp != NULL);
+    assert(fwrite(m0, BEE_WORD_BYTES, end - m0, fp) == (size_t)(end - m0));
+    assert(fclose(fp) == 0);
+    free(file);
+}
+
+// Write a profile `name`.prof in which `hot` has been called many times.
+static void write_profile(const char *name)
+{
+    char *file = xasprintf("%s.prof", name);
+    FILE *fp = fopen(file, "w");
+    assert(fp != NULL);
+    fprintf(fp, "%zx %d\n", (size_t)(hot - m0) * BEE_WORD_BYTES, 1000);
+    assert(fclose(fp) == 0);
+    free(file);
+}
+
+// Optimize `name`.bin with bee-opt --verify, and read the counts of
+// rewrites into `counts`. Return false if bee-opt fails.
+static bool optimize(const char *name, bee_uword_t counts[NCOUNTS])
+{
+    const char *bee_opt = getenv("BEE_OPT");
+    assert(bee_opt != NULL);
+    char *profile = hot == NULL ? xasprintf("%s", "") : xasprintf("--profile=%s.prof ", name);
+    char *cmd = xasprintf("%s --verify --verbose %s-o %s-opt.bin %s.bin 2> %s.log",
+                          bee_opt, profile, name, name, name);
+    int status = system(cmd);
+    free(cmd);
+    free(profile);
+
+    char *file = xasprintf("%s.log", name);
+    FILE *fp = fopen(file, "r");
+    assert(fp != NULL);
+    memset(counts, 0, NCOUNTS * sizeof(bee_uword_t));
+    int n = fscanf(fp, "%zu constants folded, %zu tail calls, %zu jumps threaded, "
+                   "%zu words packed, %zu runs of NOPs jumped\n",
+                   &counts[FOLDS], &counts[TAIL_CALLS], &counts[THREADS],
+                   &counts[PACKS], &counts[NOP_JUMPS]);
+    if (hot != NULL)
+        n += fscanf(fp, "%zu bodies, %zu moved\n", &counts[BODIES], &counts[MOVED]);
+    assert(fclose(fp) == 0);
+    free(file);
+    return status == 0 && n == (hot == NULL ? 5 : 7);
+}
+
+// Constants to fold ( -- 43 )
+static bee_word_t *fold(void)
+{
+    pushi(6); pushi(7); ass(BEE_INSN_MUL);
+    pushi(1); ass(BEE_INSN_ADD);
+    ass(BEE_INSN_THROW);
+    return label();
+}
+
+// A call before RET, and one before RET followed by NOT, which runs at the
+// return address, so the call must be kept ( -- -9 )
+static bee_word_t *tail_call(void)
+{
+    pushi(2);
+    bee_word_t *calls = label();
+    calli(m0); calli(m0); // Patched below.
+    ass(BEE_INSN_THROW);
+    bee_word_t *add3 = label();
+    pushi(3); ass(BEE_INSN_ADD); ass(BEE_INSN_RET);
+    bee_word_t *tail = label();
+    calli(add3); ass(BEE_INSN_RET);
+    bee_word_t *not_tail = label();
+    calli(add3); ass(BEE_INSN_RET | BEE_INSN_NOT << BEE_INSN_BITS);
+    bee_word_t *end = label();
+    ass_goto(calls);
+    calli(tail); calli(not_tail);
+    return end;
+}
+
+// Instructions in words of their own ( -- 10 )
+static bee_word_t *pack(void)
+{
+    pushi(5);
+    pushi(0); ass(BEE_INSN_DUP);
+    ass(BEE_INSN_ADD);
+    ass(BEE_INSN_THROW);
+    return label();
+}
+
+// A hot word after a cold one ( -- 9 )
+static bee_word_t *layout(void)
+{
+    pushi(1);
+    bee_word_t *calls = label();
+    calli(m0); calli(m0); // Patched below.
+    ass(BEE_INSN_THROW);
+    bee_word_t *cold = label();
+    pushi(2); ass(BEE_INSN_ADD); ass(BEE_INSN_RET);
+    hot = label();
+    pushi(3); ass(BEE_INSN_MUL); ass(BEE_INSN_RET);
+    bee_word_t *end = label();
+    ass_goto(calls);
+    calli(cold); calli(hot);
+    return end;
+}
+
+bool test(bee_state *S _GL_UNUSED)
+{
+    struct {
+        const char *name;
+        bee_word_t *(*assemble)(void);
+        unsigned count; // The rewrite that should be made
+    } programs[] = {
+        {"bee-opt-fold", fold, FOLDS},
+        {"bee-opt-tail-call", tail_call, TAIL_CALLS},
+        {"bee-opt-pack", pack, PACKS},
+        {"bee-opt-layout", layout, MOVED},
+    };
+
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(programs) / sizeof(programs[0]); i++) {
+        ass_goto(m0);
+        hot = NULL;
+        write_object(programs[i].name, programs[i].assemble());
+        if (hot != NULL)
+            write_profile(programs[i].name);
+        bee_uword_t counts[NCOUNTS];
+        bool verified = optimize(programs[i].name, counts);
+        printf("%s: %s, %zu folds, %zu tail calls, %zu packs, %zu bodies moved\n",
+               programs[i].name, verified ? "verified" : "failed", counts[FOLDS],
+               counts[TAIL_CALLS], counts[PACKS], counts[MOVED]);
+        if (!verified || counts[programs[i].count] == 0) {
+            printf("Error in bee-opt tests\n");
+            ok = false;
+        }
+    }
+    return ok;
+}
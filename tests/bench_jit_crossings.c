@@ -0,0 +1,98 @@
+// Benchmark the cost of crossing between the interpreter and the JIT.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include <time.h>
+
+#include "tests.h"
+
+#include "private.h"
+
+
+#ifdef HAVE_MIJIT
+#define ITERATIONS 1000000
+#define CROSSINGS 1000000
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+#endif
+
+bool test(bee_state *S _GL_UNUSED)
+{
+#ifndef HAVE_MIJIT
+    printf("Bee was built without Mijit: nothing to benchmark\n");
+    return true;
+#else
+    // Measure the cost of one crossing: enter the JIT at an instruction it
+    // does not implement, so that it marshals the registers in and out
+    // and returns at once.
+    bee_word_t *break_insn = label();
+    ass(BEE_INSN_BREAK);
+    double start = now();
+    for (unsigned i = 0; i < CROSSINGS; i++) {
+        S->pc = break_insn;
+        mijit_bee_run(bee_jit, (mijit_bee_registers *)S);
+    }
+    double crossing_ns = (now() - start) * 1e9 / CROSSINGS;
+    printf("Cost of one crossing: %.1fns\n", crossing_ns);
+
+    // A loop mixing instructions that the JIT does and does not
+    // implement.
+    bee_word_t *entry = label();
+    pushi(ITERATIONS);
+    bee_word_t *loop = label();
+    ass(BEE_INSN_GET_DP); // Not implemented by the JIT.
+    ass(BEE_INSN_POP);
+    pushi(-1);
+    ass(BEE_INSN_ADD);
+    pushi(0);
+    ass(BEE_INSN_DUP);
+    bee_word_t *jumpz = label();
+    jumpzi(jumpz); // Patched below.
+    jumpi(loop);
+    bee_word_t *done = label();
+    ass(BEE_INSN_POP);
+    pushi(0);
+    ass(BEE_INSN_THROW);
+    ass_goto(jumpz);
+    jumpzi(done);
+
+    // Before mixed-mode execution, the JIT was entered before every
+    // instruction word; count them by stepping through the loop with
+    // compiled code disabled.
+    bee_set_jit(BEE_JIT_NONE);
+    S->pc = entry;
+    S->ir = 0;
+    S->dp = 0;
+    bee_uword_t words = 1;
+    for (; single_step(S) == BEE_ERROR_BREAK; words++)
+        ;
+    bee_set_jit(BEE_JIT_MIJIT);
+
+    S->pc = entry;
+    S->ir = 0;
+    S->dp = 0;
+    bee_jit_crossings = 0;
+    start = now();
+    bee_word_t ret = bee_run(S);
+    double elapsed = now() - start;
+    assert(ret == 0);
+
+    printf("Loop of %d iterations took %.3fs\n", ITERATIONS, elapsed);
+    printf("Crossings before: %zu (estimated marshalling cost %.3fs)\n",
+           words, words * crossing_ns / 1e9);
+    printf("Crossings after: %zu (estimated marshalling cost %.3fs)\n",
+           bee_jit_crossings, bee_jit_crossings * crossing_ns / 1e9);
+    return true;
+#endif
+}
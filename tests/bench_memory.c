@@ -0,0 +1,172 @@
+// Benchmark the memory traps against the equivalent Bee loops.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include <time.h>
+
+#include "traps.h"
+
+#include "tests.h"
+
+
+#define BYTES 65536
+#define REPEATS 100
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Increment the addresses two and three items down ( a1 a2 u -- a1+1 a2+1 u )
+static void next2(void)
+{
+    pushi(0); ass(BEE_INSN_SWAP);
+    pushi(1); ass(BEE_INSN_ADD);
+    pushi(0); ass(BEE_INSN_SWAP);
+    pushi(1); ass(BEE_INSN_SWAP);
+    pushi(1); ass(BEE_INSN_ADD);
+    pushi(1); ass(BEE_INSN_SWAP);
+}
+
+// Increment the address three items down ( a x u -- a+1 x u )
+static void next1(void)
+{
+    pushi(1); ass(BEE_INSN_SWAP);
+    pushi(1); ass(BEE_INSN_ADD);
+    pushi(1); ass(BEE_INSN_SWAP);
+}
+
+// Assemble the head of a loop that runs while the count on top of the
+// stack is non-zero, and return the address of its exit branch.
+static bee_word_t *loop_head(bee_word_t **head)
+{
+    *head = label();
+    pushi(0); ass(BEE_INSN_DUP);
+    bee_word_t *exit_branch = label();
+    jumpzi(exit_branch);
+    return exit_branch;
+}
+
+// Finish a loop started with loop_head(), decrementing the count, and
+// return the address of its exit.
+static bee_word_t *loop_tail(bee_word_t *head, bee_word_t *exit_branch)
+{
+    pushi(-1); ass(BEE_INSN_ADD);
+    jumpi(head);
+    bee_word_t *done = label();
+    ass_goto(exit_branch);
+    jumpzi(done);
+    ass_goto(done);
+    pushi(0); ass(BEE_INSN_THROW);
+    return done;
+}
+
+// Make the branch at `branch` go to `addr`.
+static void patch(bee_word_t *branch, bee_word_t *addr)
+{
+    bee_word_t *here = label();
+    ass_goto(branch);
+    jumpzi(addr);
+    ass_goto(here);
+}
+
+static void run(bee_state *S, const char *name, bee_word_t *entry, bee_word_t *args, unsigned nargs)
+{
+    double start = now();
+    for (unsigned i = 0; i < REPEATS; i++) {
+        S->pc = entry;
+        S->ir = 0;
+        S->sp = S->handler_sp = 0;
+        S->dp = nargs;
+        memcpy(S->d0, args, nargs * BEE_WORD_BYTES);
+        bee_word_t ret = bee_run(S);
+        assert(ret == 0);
+    }
+    printf("%s: %.1fus\n", name, (now() - start) * 1e6 / REPEATS);
+}
+
+bool test(bee_state *S)
+{
+    uint8_t *src = malloc(BYTES), *dest = malloc(BYTES);
+    assert(src != NULL && dest != NULL);
+    memset(src, 'a', BYTES);
+    memset(dest, 'a', BYTES);
+    src[BYTES - 1] = 'b';
+
+    // Copy ( a-addr1 a-addr2 u ), from a-addr1 to a-addr2
+    bee_word_t *head, *exit_branch;
+    bee_word_t *copy_loop = label();
+    exit_branch = loop_head(&head);
+    pushi(2); ass(BEE_INSN_DUP); ass(BEE_INSN_LOAD1);
+    pushi(2); ass(BEE_INSN_DUP); ass(BEE_INSN_STORE1);
+    next2();
+    loop_tail(head, exit_branch);
+
+    // Fill ( a-addr c u )
+    bee_word_t *fill_loop = label();
+    exit_branch = loop_head(&head);
+    pushi(1); ass(BEE_INSN_DUP);
+    pushi(3); ass(BEE_INSN_DUP); ass(BEE_INSN_STORE1);
+    next1();
+    loop_tail(head, exit_branch);
+
+    // Compare ( a-addr1 a-addr2 u ), stopping at the first difference
+    bee_word_t *compare_loop = label();
+    exit_branch = loop_head(&head);
+    pushi(2); ass(BEE_INSN_DUP); ass(BEE_INSN_LOAD1);
+    pushi(2); ass(BEE_INSN_DUP); ass(BEE_INSN_LOAD1);
+    ass(BEE_INSN_EQ);
+    bee_word_t *differ_branch = label();
+    jumpzi(differ_branch);
+    next2();
+    patch(differ_branch, loop_tail(head, exit_branch));
+
+    // Search ( a-addr c u ) for the byte c
+    bee_word_t *search_loop = label();
+    exit_branch = loop_head(&head);
+    pushi(2); ass(BEE_INSN_DUP); ass(BEE_INSN_LOAD1);
+    pushi(2); ass(BEE_INSN_DUP); ass(BEE_INSN_EQ);
+    pushi(0); ass(BEE_INSN_EQ);
+    bee_word_t *found_branch = label();
+    jumpzi(found_branch);
+    next1();
+    patch(found_branch, loop_tail(head, exit_branch));
+
+    // Call a memory trap ( x1 ... xn function )
+    bee_word_t *trap = label();
+    ass_trap(TRAP_MEMORY);
+    pushi(0); ass(BEE_INSN_THROW);
+
+    bee_set_jit(BEE_JIT_NONE);
+    struct {
+        const char *name;
+        bee_word_t *loop;
+        bee_word_t args[5];
+        unsigned nargs;
+    } benchmarks[] = {
+        {"copy", copy_loop, {(bee_word_t)src, (bee_word_t)dest, BYTES}, 3},
+        {"memmove", trap, {(bee_word_t)dest, (bee_word_t)src, BYTES, TRAP_MEMORY_MEMMOVE}, 4},
+        {"fill", fill_loop, {(bee_word_t)dest, 'a', BYTES}, 3},
+        {"memset", trap, {(bee_word_t)dest, 'a', BYTES, TRAP_MEMORY_MEMSET}, 4},
+        {"compare", compare_loop, {(bee_word_t)src, (bee_word_t)dest, BYTES}, 3},
+        {"memcmp", trap, {(bee_word_t)src, (bee_word_t)dest, BYTES, TRAP_MEMORY_MEMCMP}, 4},
+        {"search", search_loop, {(bee_word_t)src, 'b', BYTES}, 3},
+        {"memchr", trap, {(bee_word_t)src, 'b', BYTES, TRAP_MEMORY_MEMCHR}, 4},
+        {"memmem", trap, {(bee_word_t)src, BYTES, (bee_word_t)"ab", 2, TRAP_MEMORY_MEMMEM}, 5},
+    };
+    printf("%d bytes, interpreted\n", BYTES);
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+        run(S, benchmarks[i].name, benchmarks[i].loop, benchmarks[i].args, benchmarks[i].nargs);
+
+    free(src);
+    free(dest);
+    return true;
+}
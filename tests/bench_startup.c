@@ -0,0 +1,71 @@
+// Benchmark the time to start running a short program.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include <time.h>
+
+#include "tests.h"
+
+#include "private.h"
+
+
+#define REPEATS 100
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+bool test(bee_state *S)
+{
+    // A trivial program, which ends with an instruction that the JIT does
+    // not implement.
+    bee_word_t *entry = label();
+    pushi(1);
+    pushi(2);
+    ass(BEE_INSN_ADD);
+    ass(BEE_INSN_POP);
+    pushi(0);
+    ass(BEE_INSN_THROW);
+
+    // The interpreter needs no set-up.
+    bee_set_jit(BEE_JIT_NONE);
+    double start = now();
+    for (unsigned i = 0; i < REPEATS; i++) {
+        S->pc = entry;
+        S->ir = 0;
+        S->sp = S->handler_sp = S->dp = 0;
+        bee_word_t ret = bee_run(S);
+        assert(ret == 0);
+    }
+    printf("Interpreter: %.1fus\n", (now() - start) * 1e6 / REPEATS);
+
+#ifndef HAVE_MIJIT
+    printf("Bee was built without Mijit: no JIT to benchmark\n");
+#else
+    // The JIT must be created, then compiles instruction handlers either
+    // all at once, or as they are first used.
+    const char *names[] = {"Eager JIT", "Lazy JIT"};
+    for (int lazy = 0; lazy <= 1; lazy++) {
+        start = now();
+        for (unsigned i = 0; i < REPEATS; i++) {
+            mijit_bee_jit *jit = mijit_bee_new(lazy);
+            S->pc = entry;
+            S->ir = 0;
+            S->sp = S->handler_sp = S->dp = 0;
+            mijit_bee_run(jit, (mijit_bee_registers *)S);
+            mijit_bee_drop(jit);
+        }
+        printf("%s: %.1fus\n", names[lazy], (now() - start) * 1e6 / REPEATS);
+    }
+#endif
+    return true;
+}
@@ -0,0 +1,79 @@
+// Test hot-spot counting.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include "tests.h"
+
+
+bool test(bee_state *S)
+{
+    // Set a threshold high enough that nothing is compiled, so that
+    // every call and loop iteration is counted by the interpreter.
+    bee_set_hot_threshold(BEE_DEFAULT_HOT_THRESHOLD);
+
+    bee_word_t *word = label();
+    ass(BEE_INSN_RET);
+
+    bee_word_t *entry = label();
+    pushi(5);
+    bee_word_t *loop = label();
+    calli(word);
+    pushi(-1);
+    ass(BEE_INSN_ADD);
+    pushi(0);
+    ass(BEE_INSN_DUP);
+    bee_word_t *jumpz = label();
+    jumpzi(jumpz); // Patched below.
+    jumpi(loop);
+    bee_word_t *done = label();
+    ass(BEE_INSN_POP);
+    pushi(0);
+    ass(BEE_INSN_THROW);
+    ass_goto(jumpz);
+    jumpzi(done);
+
+    S->pc = entry;
+    bee_word_t ret = bee_run(S);
+    printf("bee_run() returned %zd; should be 0\n", ret);
+    if (ret != 0)
+        return false;
+
+    bee_uword_t calls = bee_hot_count(word), iterations = bee_hot_count(loop);
+    printf("Calls to word: %zu; should be 5\n", calls);
+    printf("Backward branches to loop: %zu; should be 4\n", iterations);
+    printf("Count of entry: %zu; should be 0\n", bee_hot_count(entry));
+    if (calls != 5 || iterations != 4 || bee_hot_count(entry) != 0) {
+        printf("Error in hot tests\n");
+        return false;
+    }
+
+    // The profile lists the same counts, by offset.
+    const char *profile = "hot.prof";
+    bee_uword_t bytes = (label() - m0) * BEE_WORD_BYTES, offset, count, lines = 0;
+    bool ok = bee_write_profile(profile, m0, bytes) == 0;
+    FILE *fp = fopen(profile, "r");
+    if (ok && fp != NULL) {
+        while (fscanf(fp, "%zx %zu", &offset, &count) == 2) {
+            bee_word_t *addr = (bee_word_t *)((uint8_t *)m0 + offset);
+            printf("Profile: %#zx %zu\n", offset, count);
+            lines++;
+            if (!((addr == word && count == calls) || (addr == loop && count == iterations)))
+                ok = false;
+        }
+        fclose(fp);
+    }
+    remove(profile);
+    if (!ok || lines != 2) {
+        printf("Error in hot tests: bad profile\n");
+        return false;
+    }
+
+    printf("hot tests ran OK\n");
+    return true;
+}
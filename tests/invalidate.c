@@ -0,0 +1,112 @@
+// Test that writes to code discard the code compiled from it.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include "traps.h"
+
+#include "tests.h"
+
+
+#define HOT_THRESHOLD 2
+#define TRACE_THRESHOLD 3
+#define ITERATIONS 40
+#define HALF (ITERATIONS / 2)
+#define QUARTER (ITERATIONS / 4)
+
+// Assemble code that jumps to the address that follows it if the second
+// item on the stack is not `n`, and return the address of the jump.
+static bee_word_t *unless_equal(bee_word_t n)
+{
+    pushi(1); ass(BEE_INSN_DUP);
+    pushi(n); ass(BEE_INSN_EQ);
+    bee_word_t *jumpz = label();
+    jumpzi(jumpz); // Patched by patch_jump().
+    return jumpz;
+}
+
+// Patch the jump at `jumpz` to go to the current address.
+static void patch_jump(bee_word_t *jumpz)
+{
+    bee_word_t *here = label();
+    ass_goto(jumpz);
+    jumpzi(here);
+    ass_goto(here);
+}
+
+bool test(bee_state *S)
+{
+    // A word that pushes a constant, which is changed by the program
+    bee_word_t *konst = label();
+    pushi(1); ass(BEE_INSN_RET);
+    bee_word_t original = *konst;
+
+    // The instruction word copied over `konst` by the STRNCPY trap
+    bee_word_t *source = label();
+    word(PUSHI(3));
+
+    // Sum the values returned by `konst` for n from ITERATIONS down to 1,
+    // storing PUSHI 2 in `konst` when n is HALF, and copying PUSHI 3 into
+    // it when n is QUARTER ( n acc )
+    bee_word_t *entry = label();
+    pushi(ITERATIONS);
+    pushi(0);
+    bee_word_t *loop = label();
+    calli(konst); ass(BEE_INSN_ADD); // ( n acc' )
+    bee_word_t *not_half = unless_equal(HALF);
+    pushi(PUSHI(2)); pushreli(konst); ass(BEE_INSN_STORE);
+    patch_jump(not_half);
+    bee_word_t *not_quarter = unless_equal(QUARTER);
+    pushreli(konst); pushreli(source); pushi(BEE_WORD_BYTES);
+    pushi(TRAP_LIBC_STRNCPY); ass_trap(TRAP_LIBC);
+    ass(BEE_INSN_POP);
+    patch_jump(not_quarter);
+    pushi(0); ass(BEE_INSN_SWAP);
+    pushi(-1); ass(BEE_INSN_ADD);
+    pushi(0); ass(BEE_INSN_SWAP); // ( n' acc )
+    pushi(1); ass(BEE_INSN_DUP); pushi(0); ass(BEE_INSN_EQ);
+    jumpzi(loop);
+    ass(BEE_INSN_THROW);
+    bee_word_t expected = (ITERATIONS - HALF + 1) * 1 + (HALF - QUARTER) * 2 + (QUARTER - 1) * 3;
+
+    struct { const char *name; int jit; } tiers[] = {
+        {"interpreter", BEE_JIT_NONE},
+        {"trace", BEE_JIT_TRACE},
+        {"template JIT", BEE_JIT_TEMPLATE},
+        {"Mijit", BEE_JIT_MIJIT},
+    };
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(tiers) / sizeof(tiers[0]); i++) {
+        if (bee_set_jit(tiers[i].jit) != 0) {
+            printf("%s: not available\n", tiers[i].name);
+            continue;
+        }
+        if (tiers[i].jit == BEE_JIT_TRACE)
+            bee_set_trace_threshold(TRACE_THRESHOLD);
+        else if (tiers[i].jit != BEE_JIT_NONE)
+            bee_set_hot_threshold(HOT_THRESHOLD);
+
+        // Restore the code, as a host program might.
+        *konst = original;
+        bee_invalidate(konst, BEE_WORD_BYTES);
+        S->pc = entry;
+        S->ir = 0;
+        S->sp = S->handler_sp = S->dp = 0;
+        bee_word_t ret = bee_run(S);
+        printf("%s: bee_run() returned %zd; should be %zd\n", tiers[i].name, ret, expected);
+        if (ret != expected)
+            ok = false;
+    }
+
+    if (!ok) {
+        printf("Error in invalidate tests\n");
+        return false;
+    }
+    printf("invalidate tests ran OK\n");
+    return true;
+}
@@ -0,0 +1,249 @@
+// Test the template JIT by comparing it with the interpreter.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include <unistd.h>
+
+#include "traps.h"
+
+#include "tests.h"
+
+
+#define HOT_THRESHOLD 2
+#define ITERATIONS 20
+#define DEPTH 300
+
+// Assemble up to three instructions in one word.
+static void ass3(bee_uword_t a, bee_uword_t b, bee_uword_t c)
+{
+    word((bee_word_t)(((c << (2 * BEE_INSN_BITS)) | (b << BEE_INSN_BITS) | a) << BEE_OP2_SHIFT) | BEE_OP_INSN);
+}
+
+// Run the code at `entry` with the given initial stack depth (filled with
+// its indices), and return the result and final stacks as a string.
+static char *run(bee_state *S, bee_word_t *entry, bee_uword_t depth)
+{
+    S->pc = entry;
+    S->ir = 0;
+    S->sp = S->handler_sp = 0;
+    for (S->dp = 0; S->dp < depth; S->dp++)
+        S->d0[S->dp] = S->dp;
+    bee_word_t ret = bee_run(S);
+    return xasprintf("returned %zd, dp = %zu, sp = %zu, stack: %s",
+                     ret, S->dp, S->sp, val_data_stack(S));
+}
+
+bool test(bee_state *S)
+{
+    if (bee_set_jit(BEE_JIT_TEMPLATE) != 0) {
+        printf("Bee was built without the template JIT: nothing to test\n");
+        return true;
+    }
+
+    // A word using most instructions ( acc i -- acc' i )
+    bee_word_t *body = label();
+    pushi(0); ass(BEE_INSN_DUP); // ( acc i i )
+    pushi(2); ass3(BEE_INSN_DUP, BEE_INSN_ADD, BEE_INSN_NOP); // ( acc i t )
+    pushi(7); ass(BEE_INSN_MUL);
+    pushi(1); ass3(BEE_INSN_DUP, BEE_INSN_XOR, BEE_INSN_NOT);
+    pushi(3); ass(BEE_INSN_LSHIFT);
+    pushi(1); ass3(BEE_INSN_RSHIFT, BEE_INSN_NEG, BEE_INSN_NOP);
+    pushi(2); ass(BEE_INSN_ARSHIFT);
+    pushi(-13); ass3(BEE_INSN_DIVMOD, BEE_INSN_ADD, BEE_INSN_NOP);
+    pushi(5); ass3(BEE_INSN_UDIVMOD, BEE_INSN_XOR, BEE_INSN_NOP);
+    pushi(0); ass3(BEE_INSN_DIVMOD, BEE_INSN_ADD, BEE_INSN_NOP); // Division by zero
+    pushi(0); ass3(BEE_INSN_DUP, BEE_INSN_PUSHS, BEE_INSN_DUPS);
+    ass3(BEE_INSN_ADD, BEE_INSN_POPS, BEE_INSN_ADD);
+    pushi(0); ass(BEE_INSN_DUP);
+    pushi(100); ass(BEE_INSN_LT);
+    pushi(1); ass(BEE_INSN_DUP);
+    pushi(-1); ass3(BEE_INSN_ULT, BEE_INSN_ADD, BEE_INSN_NOP);
+    pushi(0); ass3(BEE_INSN_SWAP, BEE_INSN_ADD, BEE_INSN_NOP);
+    pushi(0); ass(BEE_INSN_DUP);
+    pushi(0); ass3(BEE_INSN_EQ, BEE_INSN_OR, BEE_INSN_NOP);
+    ass3(BEE_INSN_GET_DP, BEE_INSN_OR, BEE_INSN_WORD_BYTES);
+    ass3(BEE_INSN_ADD, BEE_INSN_GET_SP, BEE_INSN_ADD);
+    pushi(TRAP_LIBC_O_RDWR); ass_trap(TRAP_LIBC);
+    ass(BEE_INSN_ADD);
+    pushi(1); ass3(BEE_INSN_SET, BEE_INSN_RET, BEE_INSN_NOP); // ( t i )
+
+    // Call it in a loop, ending with BREAK.
+    bee_word_t *calls = label();
+    pushi(0);
+    pushi(ITERATIONS);
+    bee_word_t *loop1 = label();
+    calli(body);
+    pushi(-1); ass(BEE_INSN_ADD);
+    pushi(0); ass(BEE_INSN_DUP);
+    bee_word_t *jumpz = label();
+    jumpzi(jumpz); // Patched below.
+    jumpi(loop1);
+    bee_word_t *done = label();
+    ass(BEE_INSN_BREAK);
+    bee_word_t *end = label();
+    ass_goto(jumpz);
+    jumpzi(done);
+    ass_goto(end);
+
+    // A loop using memory ( addr n )
+    bee_word_t *memory = label();
+    pushreli(m0 + size / 2);
+    pushi(0); pushi(1); ass(BEE_INSN_DUP); // ( addr 0 addr )
+    ass3(BEE_INSN_STORE_IB, BEE_INSN_POP, BEE_INSN_NOP); // ( addr )
+    pushi(ITERATIONS);
+    bee_word_t *loop2 = label();
+    pushi(0); ass(BEE_INSN_DUP); // ( addr n n )
+    pushi(2); ass3(BEE_INSN_DUP, BEE_INSN_STORE_IA, BEE_INSN_NOP); // ( addr n a1 )
+    pushi(1); ass(BEE_INSN_DUP); // ( addr n a1 n )
+    pushi(1); ass3(BEE_INSN_DUP, BEE_INSN_STORE1, BEE_INSN_NOP); // ( addr n a1 )
+    pushi(0x1234); pushi(1); ass(BEE_INSN_DUP); // ( addr n a1 0x1234 a1 )
+    pushi(2); ass3(BEE_INSN_ADD, BEE_INSN_STORE2, BEE_INSN_NOP); // ( addr n a1 )
+    pushi(0); ass3(BEE_INSN_DUP, BEE_INSN_LOAD1, BEE_INSN_NOP); // ( addr n a1 b )
+    pushi(1); ass(BEE_INSN_DUP);
+    pushi(2); ass3(BEE_INSN_ADD, BEE_INSN_LOAD2, BEE_INSN_ADD); // ( addr n a1 s )
+    pushi(1); ass3(BEE_INSN_DUP, BEE_INSN_LOAD4, BEE_INSN_ADD); // ( addr n a1 s )
+    pushi(0); ass3(BEE_INSN_SWAP, BEE_INSN_LOAD_DB, BEE_INSN_POP); // ( addr n s n )
+    ass(BEE_INSN_ADD); // ( addr n s )
+    pushi(2); ass3(BEE_INSN_DUP, BEE_INSN_STORE_IB, BEE_INSN_POP); // ( addr n )
+    pushi(-1); ass(BEE_INSN_ADD);
+    pushi(0); ass(BEE_INSN_DUP);
+    pushi(0); ass(BEE_INSN_EQ);
+    jumpzi(loop2);
+    ass3(BEE_INSN_POP, BEE_INSN_LOAD_IB, BEE_INSN_POP); // ( s )
+    ass(BEE_INSN_BREAK);
+
+    // A loop that ends by underflowing the stack
+    bee_word_t *underflow = label();
+    ass(BEE_INSN_POP);
+    jumpi(underflow);
+
+    // Calls to short words, which are inlined ( acc n )
+    bee_word_t *inc = label();
+    pushi(1); ass3(BEE_INSN_ADD, BEE_INSN_RET, BEE_INSN_NOP);
+    bee_word_t *rdepth = label();
+    ass3(BEE_INSN_GET_SP, BEE_INSN_RET, BEE_INSN_NOP);
+    bee_word_t *div0 = label();
+    pushi(0); ass3(BEE_INSN_UDIVMOD, BEE_INSN_ADD, BEE_INSN_RET); // Division by zero
+    bee_word_t *drop2 = label();
+    ass3(BEE_INSN_POP, BEE_INSN_POP, BEE_INSN_RET);
+    bee_word_t *ret_not = label();
+    ass3(BEE_INSN_RET, BEE_INSN_NOT, BEE_INSN_NOP); // NOT runs after returning
+    bee_word_t *inlined = label();
+    pushi(0);
+    pushi(ITERATIONS);
+    bee_word_t *loop3 = label();
+    pushi(1); ass(BEE_INSN_DUP); // ( acc n acc )
+    calli(inc); calli(ret_not); ass(BEE_INSN_NOT);
+    calli(rdepth); ass(BEE_INSN_ADD); calli(div0);
+    pushi(1); ass(BEE_INSN_SET); // ( acc' n )
+    pushi(-1); ass(BEE_INSN_ADD);
+    pushi(0); ass(BEE_INSN_DUP);
+    pushi(0); ass(BEE_INSN_EQ);
+    jumpzi(loop3);
+    ass(BEE_INSN_BREAK);
+
+    // A loop that ends by underflowing the stack in an inlined word
+    bee_word_t *underflow2 = label();
+    calli(drop2);
+    jumpi(underflow2);
+
+    // Computed calls, alternating between two words ( acc n )
+    bee_word_t *inc2 = label();
+    pushi(2); ass3(BEE_INSN_ADD, BEE_INSN_RET, BEE_INSN_NOP);
+    bee_word_t *dec = label();
+    pushi(-1); ass3(BEE_INSN_ADD, BEE_INSN_RET, BEE_INSN_NOP);
+    bee_word_t *table = label();
+    word((bee_word_t)inc2);
+    word((bee_word_t)dec);
+    bee_word_t *computed = label();
+    pushi(0);
+    pushi(ITERATIONS);
+    bee_word_t *loop4 = label();
+    pushi(1); ass(BEE_INSN_DUP); // ( acc n acc )
+    pushi(1); ass(BEE_INSN_DUP);
+    pushi(1); ass3(BEE_INSN_AND, BEE_INSN_WORD_BYTES, BEE_INSN_MUL);
+    pushreli(table); ass3(BEE_INSN_ADD, BEE_INSN_LOAD, BEE_INSN_NOP); // ( acc n acc xt )
+    ass(BEE_INSN_CALL);
+    pushi(1); ass(BEE_INSN_SET); // ( acc' n )
+    pushi(-1); ass(BEE_INSN_ADD);
+    pushi(0); ass(BEE_INSN_DUP);
+    pushi(0); ass(BEE_INSN_EQ);
+    jumpzi(loop4);
+    ass(BEE_INSN_BREAK);
+
+    struct { const char *name; bee_word_t *entry; bee_uword_t depth; } programs[] = {
+        {"calls", calls, 0},
+        {"memory", memory, 0},
+        {"underflow", underflow, DEPTH},
+        {"inlined", inlined, 0},
+        {"inlined underflow", underflow2, DEPTH},
+        {"computed calls", computed, 0},
+    };
+
+    // Name the compiled code in a perf map.
+    bee_symbol symbols[] = {
+        {body, "body"}, {calls, "calls"}, {memory, "memory"},
+        {underflow, "underflow"}, {inlined, "inlined"},
+    };
+    if (bee_perf_map(m0, symbols, sizeof(symbols) / sizeof(symbols[0])) != 0) {
+        printf("Error in jit tests: could not open perf map\n");
+        return false;
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(programs) / sizeof(programs[0]); i++) {
+        bee_set_jit(BEE_JIT_NONE);
+        char *interpreted = run(S, programs[i].entry, programs[i].depth);
+        bee_set_jit(BEE_JIT_TEMPLATE);
+        bee_set_hot_threshold(HOT_THRESHOLD);
+        char *compiled = run(S, programs[i].entry, programs[i].depth);
+        printf("%s: interpreter %s\n", programs[i].name, interpreted);
+        printf("%s: template JIT %s\n", programs[i].name, compiled);
+        if (strcmp(interpreted, compiled) != 0) {
+            printf("Error in jit tests: results differ\n");
+            ok = false;
+        }
+        free(interpreted);
+        free(compiled);
+    }
+
+    // Check that computed calls found their targets in the cache.
+    bee_uword_t hits, misses;
+    bee_cache_stats(&hits, &misses);
+    printf("inline caches: %zu hits, %zu misses\n", hits, misses);
+    if (hits == 0) {
+        printf("Error in jit tests: no inline cache hits\n");
+        ok = false;
+    }
+
+    // Check that the loop in `inlined` was named.
+    char *perf_map = xasprintf("/tmp/perf-%ld.map", (long)getpid());
+    FILE *fp = fopen(perf_map, "r");
+    bool named = false;
+    char line[256];
+    while (fp != NULL && fgets(line, sizeof(line), fp) != NULL) {
+        printf("perf map: %s", line);
+        char *name = xasprintf("bee:inlined+%#zx\n", (loop3 - inlined) * BEE_WORD_BYTES);
+        if (strstr(line, name) != NULL)
+            named = true;
+        free(name);
+    }
+    if (fp != NULL)
+        fclose(fp);
+    remove(perf_map);
+    free(perf_map);
+    if (!named) {
+        printf("Error in jit tests: perf map does not name loop\n");
+        ok = false;
+    }
+
+    if (ok)
+        printf("jit tests ran OK\n");
+    return ok;
+}
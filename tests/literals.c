@@ -0,0 +1,126 @@
+// Test large literals, which the interpreter and JIT push directly.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include "tests.h"
+
+#include "private.h"
+
+
+#define HOT_THRESHOLD 2
+#define ITERATIONS 10
+#define BIG1 ((bee_word_t)0x123456789abcdef0)
+#define BIG2 BEE_WORD_MIN
+
+// Assemble a large literal with POPS and LOAD in one word.
+static void push_packed(bee_word_t literal)
+{
+    calli(label() + 2);
+    word(literal);
+    ass(BEE_INSN_POPS | BEE_INSN_LOAD << BEE_INSN_BITS);
+}
+
+bool test(bee_state *S)
+{
+    // Sum both kinds of literal in a loop ( acc n )
+    bee_word_t *sum = label();
+    pushi(0);
+    pushi(ITERATIONS);
+    bee_word_t *loop = label();
+    pushi(0); ass(BEE_INSN_SWAP);
+    push(BIG1); ass(BEE_INSN_ADD);
+    push_packed(BIG2); ass(BEE_INSN_ADD);
+    pushi(0); ass(BEE_INSN_SWAP); // ( acc' n )
+    pushi(-1); ass(BEE_INSN_ADD);
+    pushi(0); ass(BEE_INSN_DUP);
+    pushi(0); ass(BEE_INSN_EQ);
+    jumpzi(loop);
+    pushi(0); ass(BEE_INSN_THROW);
+
+    // Push a literal when the data stack is full
+    bee_word_t *data_full = label();
+    pushi(S->dsize); ass(BEE_INSN_SET_DP);
+    push(BIG1);
+    ass(BEE_INSN_RET);
+
+    // Push a literal when the return stack is full
+    bee_word_t *return_full = label();
+    pushi(S->ssize); ass(BEE_INSN_SET_SP);
+    push_packed(BIG2);
+    ass(BEE_INSN_RET);
+
+    // Call each of the above repeatedly, so that it is compiled.
+    bee_word_t *words[] = {data_full, return_full};
+    bee_word_t *drivers[2];
+    for (size_t i = 0; i < 2; i++) {
+        drivers[i] = label();
+        calli(words[i]);
+        pushi(0); ass(BEE_INSN_THROW);
+    }
+
+    bee_word_t total = (bee_word_t)(((bee_uword_t)BIG1 + (bee_uword_t)BIG2) * ITERATIONS);
+    struct {
+        const char *name;
+        bee_word_t *entry;
+        bee_word_t ret;
+        bee_word_t *pc; // Where the error was raised
+        bee_uword_t dp, sp;
+    } programs[] = {
+        {"sum", sum, 0, NULL, 2, 0},
+        {"data stack full", drivers[0], BEE_ERROR_STACK_OVERFLOW, data_full + 5, S->dsize, 2},
+        {"return stack full", drivers[1], BEE_ERROR_STACK_OVERFLOW, return_full + 3, 0, S->ssize},
+    };
+    struct { const char *name; int jit; } tiers[] = {
+        {"interpreter", BEE_JIT_NONE},
+        {"template JIT", BEE_JIT_TEMPLATE},
+        {"register VM", BEE_JIT_REGISTER},
+    };
+
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(tiers) / sizeof(tiers[0]); i++) {
+        if (bee_set_jit(tiers[i].jit) != 0) {
+            printf("%s: not available\n", tiers[i].name);
+            continue;
+        }
+        bee_set_hot_threshold(tiers[i].jit == BEE_JIT_NONE ? 0 : HOT_THRESHOLD);
+        for (size_t j = 0; j < sizeof(programs) / sizeof(programs[0]); j++) {
+            bee_word_t ret = 0;
+            for (unsigned k = 0; k <= HOT_THRESHOLD; k++) {
+                S->pc = programs[j].entry;
+                S->ir = 0;
+                S->sp = S->handler_sp = S->dp = 0;
+                ret = bee_run(S);
+            }
+            printf("%s: %s: returned %zd, pc = %p, dp = %zu, sp = %zu\n",
+                   tiers[i].name, programs[j].name, ret, S->pc, S->dp, S->sp);
+            if (ret != programs[j].ret ||
+                (programs[j].pc != NULL && S->pc != programs[j].pc) ||
+                S->dp != programs[j].dp || S->sp != programs[j].sp) {
+                printf("Error in literals tests: should return %zd, pc = %p, dp = %zu, sp = %zu\n",
+                       programs[j].ret, programs[j].pc, programs[j].dp, programs[j].sp);
+                ok = false;
+            }
+            if (j == 0 && S->d0[0] != total) {
+                printf("Error in literals tests: sum is %zd; should be %zd\n", S->d0[0], total);
+                ok = false;
+            }
+            // Check that the loop was compiled by this tier alone.
+            hot_counter *c = j == 0 ? hot_lookup(loop) : NULL;
+            if (j == 0 && ((c != NULL && c->code != NULL) != (tiers[i].jit == BEE_JIT_TEMPLATE) ||
+                           (c != NULL && c->block != NULL) != (tiers[i].jit == BEE_JIT_REGISTER))) {
+                printf("Error in literals tests: loop was not compiled by the %s\n", tiers[i].name);
+                ok = false;
+            }
+        }
+    }
+
+    if (ok)
+        printf("literals tests ran OK\n");
+    return ok;
+}
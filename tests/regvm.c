@@ -0,0 +1,133 @@
+// Test that code translated for the register VM runs as it does in the
+// interpreter.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include "tests.h"
+
+
+#define HOT_THRESHOLD 2
+#define ITERATIONS 10
+
+bool test(bee_state *S)
+{
+    // A variable
+    bee_word_t *var = label();
+    word(0);
+
+    // A word that squares the top of the stack, with a dead computation
+    bee_word_t *square = label();
+    pushi(3); pushi(4); ass(BEE_INSN_ADD); ass(BEE_INSN_POP);
+    pushi(0); ass(BEE_INSN_DUP); ass(BEE_INSN_MUL); ass(BEE_INSN_RET);
+
+    // A word that pushes a large literal that is not a valid instruction
+    // word
+    bee_word_t *big = label();
+    push((bee_word_t)0x123456789abcdef0ULL); ass(BEE_INSN_RET);
+
+    // A word that pushes a constant, which is changed by the program
+    bee_word_t *konst = label();
+    pushi(1); ass(BEE_INSN_RET);
+    bee_word_t original = *konst;
+
+    // Sum the squares of n for n from ITERATIONS down to 1, plus two large
+    // literals, `konst` and folded constants each time, storing the sum in
+    // `var`, and PUSHI 2 in `konst` half way through ( acc n )
+    bee_word_t *sum = label();
+    pushi(0);
+    pushi(ITERATIONS);
+    bee_word_t *loop = label();
+    pushi(0); ass(BEE_INSN_DUP);
+    calli(square);
+    push(BEE_WORD_MIN); ass(BEE_INSN_ADD);
+    calli(big); ass(BEE_INSN_ADD);
+    calli(konst); ass(BEE_INSN_ADD);
+    pushi(2); pushi(3); ass(BEE_INSN_MUL); pushi(-6); ass(BEE_INSN_ADD); ass(BEE_INSN_ADD);
+    pushi(2); ass(BEE_INSN_DUP); ass(BEE_INSN_ADD);
+    pushi(1); ass(BEE_INSN_SET); // ( acc' n )
+    pushi(1); ass(BEE_INSN_DUP); pushreli(var); ass(BEE_INSN_STORE);
+    pushi(0); ass(BEE_INSN_DUP); pushi(ITERATIONS / 2); ass(BEE_INSN_EQ);
+    bee_word_t *not_half = label();
+    jumpzi(not_half);
+    pushi(PUSHI(2)); pushreli(konst); ass(BEE_INSN_STORE);
+    bee_word_t *here = label();
+    ass_goto(not_half);
+    jumpzi(here);
+    ass_goto(here);
+    pushi(-1); ass(BEE_INSN_ADD);
+    pushi(0); ass(BEE_INSN_DUP); pushi(0); ass(BEE_INSN_EQ);
+    jumpzi(loop);
+    pushreli(var); ass(BEE_INSN_LOAD);
+    pushi(0); ass(BEE_INSN_THROW);
+
+    // Errors raised part way through blocks
+    bee_word_t *unaligned = label();
+    pushi(1); pushi(1); ass(BEE_INSN_ADD); pushi(1); ass(BEE_INSN_LOAD);
+    ass(BEE_INSN_RET);
+    bee_word_t *underflow = label();
+    pushi(1); ass(BEE_INSN_ADD); ass(BEE_INSN_ADD);
+    ass(BEE_INSN_RET);
+    bee_word_t *data_full = label();
+    pushi(1); pushi(2);
+    ass(BEE_INSN_RET);
+    bee_word_t *data_full_inside = label();
+    pushi(1); pushi(2); ass(BEE_INSN_ADD); ass(BEE_INSN_POP);
+    ass(BEE_INSN_RET);
+    bee_word_t *return_full = label();
+    calli(return_full);
+
+    // Call each of the above repeatedly, so that it is translated.
+    bee_word_t *words[] = {unaligned, underflow, data_full, data_full_inside, return_full};
+    bee_word_t *drivers[5];
+    for (size_t i = 0; i < 5; i++) {
+        drivers[i] = label();
+        calli(words[i]);
+        pushi(0); ass(BEE_INSN_THROW);
+    }
+    bee_word_t *end = label();
+
+    struct {
+        const char *name;
+        bee_word_t *entry;
+        bee_uword_t dp;
+        run_result r[2];
+    } programs[] = {
+        {"sum", sum, 0, {{0}}},
+        {"unaligned load", drivers[0], 0, {{0}}},
+        {"data stack underflow", drivers[1], 1, {{0}}},
+        {"data stack full", drivers[2], S->dsize - 1, {{0}}},
+        {"data stack full inside block", drivers[3], S->dsize - 1, {{0}}},
+        {"return stack full", drivers[4], 0, {{0}}},
+    };
+    const size_t nprograms = sizeof(programs) / sizeof(programs[0]);
+
+    for (int translated = 0; translated <= 1; translated++) {
+        bee_set_jit(translated ? BEE_JIT_REGISTER : BEE_JIT_NONE);
+        bee_set_hot_threshold(translated ? HOT_THRESHOLD : 0);
+        for (size_t i = 0; i < nprograms; i++)
+            for (unsigned k = 0; k <= HOT_THRESHOLD; k++) {
+                *konst = original;
+                bee_invalidate(konst, BEE_WORD_BYTES);
+                if (k > 0)
+                    free(programs[i].r[translated].d0);
+                programs[i].r[translated] = run_snapshot(S, programs[i].entry, programs[i].dp);
+            }
+    }
+    bee_invalidate(m0, (end - m0) * BEE_WORD_BYTES);
+
+    bool ok = true;
+    for (size_t i = 0; i < nprograms; i++) {
+        if (!same_result("regvm", programs[i].name, programs[i].r))
+            ok = false;
+    }
+
+    if (ok)
+        printf("regvm tests ran OK\n");
+    return ok;
+}
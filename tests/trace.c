@@ -0,0 +1,91 @@
+// Test tracing of hot loops.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include "tests.h"
+
+
+#define TRACE_THRESHOLD 3
+#define ITERATIONS 50
+
+bool test(bee_state *S)
+{
+    bee_set_hot_threshold(0);
+    bee_set_trace_threshold(TRACE_THRESHOLD);
+
+    // A word called from the loop
+    bee_word_t *add = label();
+    ass(BEE_INSN_ADD);
+    ass(BEE_INSN_RET);
+
+    // Sum the numbers from ITERATIONS down to 1 ( sum n )
+    bee_word_t *entry = label();
+    pushi(0);
+    pushi(ITERATIONS);
+    bee_word_t *loop = label();
+    pushi(0); ass(BEE_INSN_DUP); // ( sum n n )
+    pushi(1); ass(BEE_INSN_SWAP); // ( n n sum )
+    calli(add); // ( n sum' )
+    pushi(0); ass(BEE_INSN_SWAP); // ( sum' n )
+    pushi(-1); ass(BEE_INSN_ADD); // ( sum' n' )
+    pushi(0); ass(BEE_INSN_DUP); pushi(0); ass(BEE_INSN_EQ);
+    jumpzi(loop);
+    ass(BEE_INSN_POP);
+    ass(BEE_INSN_THROW);
+
+    S->pc = entry;
+    bee_word_t ret = bee_run(S);
+    printf("bee_run() returned %zd; should be %d\n", ret, ITERATIONS * (ITERATIONS + 1) / 2);
+    if (ret != ITERATIONS * (ITERATIONS + 1) / 2)
+        return false;
+
+    // The interpreter counts backward branches until the trace has been
+    // recorded; after that, the loop runs in the trace until it exits.
+    bee_uword_t count = bee_hot_count(loop);
+    printf("Backward branches interpreted: %zu; should be %d\n", count, TRACE_THRESHOLD + 1);
+    if (count != TRACE_THRESHOLD + 1) {
+        printf("Error in trace tests\n");
+        return false;
+    }
+
+    // A word that returns, then loads from the address on top of the stack
+    // at the return address
+    bee_word_t *ret_load = label();
+    ass(BEE_INSN_RET | BEE_INSN_LOAD << BEE_INSN_BITS);
+
+    // Load from an aligned address in each iteration but the last ( n )
+    bee_word_t *var = label();
+    word(0);
+    entry = label();
+    pushi(ITERATIONS);
+    loop = label();
+    pushreli(var);
+    pushi(1); ass(BEE_INSN_DUP); pushi(1); ass(BEE_INSN_EQ); ass(BEE_INSN_ADD);
+    calli(ret_load);
+    bee_word_t *after_call = label();
+    ass(BEE_INSN_POP);
+    pushi(-1); ass(BEE_INSN_ADD);
+    pushi(0); ass(BEE_INSN_DUP); pushi(0); ass(BEE_INSN_EQ);
+    jumpzi(loop);
+    pushi(0); ass(BEE_INSN_THROW);
+
+    S->pc = entry;
+    S->ir = 0;
+    S->dp = S->sp = 0;
+    ret = bee_run(S);
+    printf("bee_run() returned %zd at pc = %p; should be %d at %p\n",
+           ret, S->pc, BEE_ERROR_UNALIGNED_ADDRESS, after_call);
+    if (ret != BEE_ERROR_UNALIGNED_ADDRESS || S->pc != after_call) {
+        printf("Error in trace tests\n");
+        return false;
+    }
+
+    printf("trace tests ran OK\n");
+    return true;
+}
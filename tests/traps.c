@@ -9,11 +9,46 @@
 // THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
 // RISK.
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "traps.h"
 
 #include "tests.h"
 
 
+// A library of test functions
+#define TEST_LIBRARY 0x100
+
+static bee_word_t sum3(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( a b c -- a+b+c )
+{
+    args[0] += args[1] + args[2];
+    return BEE_ERROR_OK;
+}
+
+static bee_word_t split(bee_state * restrict S _GL_UNUSED, bee_word_t *args) // ( u -- u/256 u%256 )
+{
+    bee_uword_t u = args[0];
+    args[0] = u / 256;
+    args[1] = u % 256;
+    return BEE_ERROR_OK;
+}
+
+static const bee_trap_function library[] = {
+    {sum3, 3, 1},
+    {NULL, 0, 0},
+    {split, 1, 2},
+};
+
+// Run trap `code` with `n` items from `items` on the data stack, and
+// return the error code.
+static bee_word_t run_trap(bee_state *S, bee_uword_t code, bee_uword_t n, const bee_word_t *items)
+{
+    S->dp = n;
+    memcpy(S->d0, items, n * BEE_WORD_BYTES);
+    return bee_trap(S, code);
+}
+
 bool test(bee_state *S)
 {
     // Data for ARGC/ARGV tests
@@ -49,6 +84,329 @@ bool test(bee_state *S)
         exit(1);
     }
 
+    // Registered libraries
+    assert(bee_register_trap_library(TEST_LIBRARY, library, sizeof(library) / sizeof(library[0])) == 0);
+    pushi(1); pushi(2); pushi(3); pushi(0); ass_trap(TEST_LIBRARY);
+    end = label();
+    S->dp = 0;
+    while (S->pc < end)
+        assert(single_step(S) == BEE_ERROR_BREAK);
+    printf("sum3 gives %zd, and should be 6\n", S->d0[S->dp - 1]);
+    if (S->dp != 1 || S->d0[0] != 6) {
+        printf("Error in traps tests: pc = %p\n", S->pc);
+        exit(1);
+    }
+
+    struct {
+        const char *name;
+        bee_uword_t code, n;
+        bee_word_t items[4];
+        bee_word_t error;
+        bee_uword_t dp;
+        bee_word_t results[3];
+    } cases[] = {
+        {"split", TEST_LIBRARY, 2, {0x1234, 2}, BEE_ERROR_OK, 2, {0x12, 0x34}},
+        {"missing function", TEST_LIBRARY, 1, {1}, BEE_ERROR_INVALID_FUNCTION, 1, {1}},
+        {"function out of range", TEST_LIBRARY, 1, {3}, BEE_ERROR_INVALID_FUNCTION, 1, {3}},
+        {"too few arguments", TEST_LIBRARY, 3, {1, 2, 0}, BEE_ERROR_STACK_UNDERFLOW, 3, {1, 2, 0}},
+        {"unregistered library", TEST_LIBRARY - 1, 1, {0}, BEE_ERROR_INVALID_LIBRARY, 1, {0}},
+        {"libc", TRAP_LIBC, 1, {TRAP_LIBC_ARGC}, BEE_ERROR_OK, 1, {3}},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        bee_word_t error = run_trap(S, cases[i].code, cases[i].n, cases[i].items);
+        printf("%s: error %zd, dp = %zu\n", cases[i].name, error, S->dp);
+        if (error != cases[i].error || S->dp != cases[i].dp ||
+            memcmp(S->d0, cases[i].results, S->dp * BEE_WORD_BYTES) != 0) {
+            printf("Error in traps tests: should give error %zd, dp = %zu\n",
+                   cases[i].error, cases[i].dp);
+            exit(1);
+        }
+    }
+
+    // Memory
+    char buf[] = "abcdefghij";
+    bee_word_t move[] = {(bee_word_t)(buf + 2), (bee_word_t)buf, 5, TRAP_MEMORY_MEMMOVE};
+    assert(run_trap(S, TRAP_MEMORY, 4, move) == BEE_ERROR_OK && S->dp == 1);
+    printf("memmove gives %s, and should be ababcdehij\n", buf);
+    if (S->d0[0] != (bee_word_t)(buf + 2) || strcmp(buf, "ababcdehij") != 0) {
+        printf("Error in traps tests: memmove failed\n");
+        exit(1);
+    }
+    bee_word_t fill[] = {(bee_word_t)(buf + 7), 'z', 3, TRAP_MEMORY_MEMSET};
+    assert(run_trap(S, TRAP_MEMORY, 4, fill) == BEE_ERROR_OK && S->dp == 1);
+    printf("memset gives %s, and should be ababcdezzz\n", buf);
+    if (S->d0[0] != (bee_word_t)(buf + 7) || strcmp(buf, "ababcdezzz") != 0) {
+        printf("Error in traps tests: memset failed\n");
+        exit(1);
+    }
+    struct {
+        const char *name;
+        bee_uword_t n;
+        bee_word_t items[5];
+        bee_word_t result;
+    } memory_cases[] = {
+        {"memcmp less", 4, {(bee_word_t)buf, (bee_word_t)"abac", 4, TRAP_MEMORY_MEMCMP}, -1},
+        {"memcmp equal", 4, {(bee_word_t)buf, (bee_word_t)"abac", 3, TRAP_MEMORY_MEMCMP}, 0},
+        {"memcmp greater", 4, {(bee_word_t)"b", (bee_word_t)buf, 1, TRAP_MEMORY_MEMCMP}, 1},
+        {"memchr", 4, {(bee_word_t)buf, 'c', 10, TRAP_MEMORY_MEMCHR}, (bee_word_t)(buf + 4)},
+        {"memchr not found", 4, {(bee_word_t)buf, 'z', 7, TRAP_MEMORY_MEMCHR}, 0},
+        {"memmem", 5, {(bee_word_t)buf, 10, (bee_word_t)"bcd", 3, TRAP_MEMORY_MEMMEM}, (bee_word_t)(buf + 3)},
+        {"memmem not found", 5, {(bee_word_t)buf, 10, (bee_word_t)"abb", 3, TRAP_MEMORY_MEMMEM}, 0},
+    };
+    for (size_t i = 0; i < sizeof(memory_cases) / sizeof(memory_cases[0]); i++) {
+        bee_word_t error = run_trap(S, TRAP_MEMORY, memory_cases[i].n, memory_cases[i].items);
+        printf("%s: error %zd, result %zd\n", memory_cases[i].name, error, S->d0[0]);
+        if (error != BEE_ERROR_OK || S->dp != 1 || S->d0[0] != memory_cases[i].result) {
+            printf("Error in traps tests: should give %zd\n", memory_cases[i].result);
+            exit(1);
+        }
+    }
+
+    // Hash tables: insert enough keys to rehash, delete some, and check
+    // that the rest can be found ignoring case, and iterated over.
+    bee_word_t new_table[] = {TRAP_HASH_CASELESS, TRAP_HASH_NEW};
+    assert(run_trap(S, TRAP_HASH, 2, new_table) == BEE_ERROR_OK && S->dp == 1);
+    bee_word_t table = S->d0[0];
+    assert(table != 0);
+    char key[16];
+    for (int i = 0; i < 100; i++) {
+        snprintf(key, sizeof(key), "Key%d", i);
+        bee_word_t insert[] = {table, (bee_word_t)key, strlen(key), i, TRAP_HASH_INSERT};
+        assert(run_trap(S, TRAP_HASH, 5, insert) == BEE_ERROR_OK && S->dp == 1 && S->d0[0] == 0);
+    }
+    for (int i = 0; i < 100; i += 2) {
+        snprintf(key, sizeof(key), "key%d", i);
+        bee_word_t delete[] = {table, (bee_word_t)key, strlen(key), TRAP_HASH_DELETE};
+        assert(run_trap(S, TRAP_HASH, 4, delete) == BEE_ERROR_OK && S->dp == 1 && S->d0[0] == 1);
+    }
+    bee_word_t replace[] = {table, (bee_word_t)"KEY1", 4, 1000, TRAP_HASH_INSERT};
+    assert(run_trap(S, TRAP_HASH, 5, replace) == BEE_ERROR_OK && S->d0[0] == 0);
+    bee_word_t count[] = {table, TRAP_HASH_COUNT};
+    assert(run_trap(S, TRAP_HASH, 2, count) == BEE_ERROR_OK && S->dp == 1);
+    printf("hash table has %zd keys, and should have 50\n", S->d0[0]);
+    if (S->d0[0] != 50) {
+        printf("Error in traps tests: wrong number of keys\n");
+        exit(1);
+    }
+    for (int i = 0; i < 100; i++) {
+        snprintf(key, sizeof(key), "KEY%d", i);
+        bee_word_t lookup[] = {table, (bee_word_t)key, strlen(key), TRAP_HASH_LOOKUP};
+        assert(run_trap(S, TRAP_HASH, 4, lookup) == BEE_ERROR_OK && S->dp == 2);
+        bee_word_t value = i == 1 ? 1000 : i;
+        if (S->d0[1] != i % 2 || S->d0[0] != (i % 2 ? value : 0)) {
+            printf("Error in traps tests: lookup of %s gives %zd %zd\n", key, S->d0[0], S->d0[1]);
+            exit(1);
+        }
+    }
+    bee_word_t total = 0, n = 0;
+    for (bee_word_t iter = 0; ; n++) {
+        bee_word_t next[] = {table, iter, TRAP_HASH_NEXT};
+        assert(run_trap(S, TRAP_HASH, 3, next) == BEE_ERROR_OK && S->dp == 4);
+        if ((iter = S->d0[0]) == 0)
+            break;
+        total += S->d0[3];
+        assert(S->d0[2] > 3 && memcmp((const char *)S->d0[1], "Key", 3) == 0);
+    }
+    printf("iteration gives %zd keys with total %zd, and should give 50 with total 3499\n", n, total);
+    if (n != 50 || total != 3499) {
+        printf("Error in traps tests: iteration failed\n");
+        exit(1);
+    }
+    bee_word_t free_table[] = {table, TRAP_HASH_FREE};
+    assert(run_trap(S, TRAP_HASH, 2, free_table) == BEE_ERROR_OK && S->dp == 0);
+
+    // Text
+    const char *text = " \t\n   \r  \t  PARSE-NAME\tskips, spaces";
+    bee_word_t len = strlen(text);
+    const char *two_to_word_bit_plus_1 = BEE_WORD_BIT == 64 ? "18446744073709551617" : "4294967297";
+    const char *name = strchr(text, 'P'), *after_name = strchr(name, '\t'), *comma = strchr(text, ',');
+    struct {
+        const char *name;
+        bee_uword_t n;
+        bee_word_t items[6];
+        bee_uword_t dp;
+        bee_word_t results[4];
+    } text_cases[] = {
+        {"skip spaces", 4, {(bee_word_t)text, len, ' ', TRAP_TEXT_SKIP}, 2,
+         {(bee_word_t)name, len - (name - text)}},
+        {"skip all", 4, {(bee_word_t)text, name - text, ' ', TRAP_TEXT_SKIP}, 2,
+         {(bee_word_t)name, 0}},
+        {"skip character", 4, {(bee_word_t)"xxxxxxxxxxy", 11, 'x', TRAP_TEXT_SKIP}, 2,
+         {0, 1}},
+        {"scan for space", 4, {(bee_word_t)name, len - (name - text), ' ', TRAP_TEXT_SCAN}, 2,
+         {(bee_word_t)after_name, len - (after_name - text)}},
+        {"scan for character", 4, {(bee_word_t)text, len, ',', TRAP_TEXT_SCAN}, 2,
+         {(bee_word_t)comma, len - (comma - text)}},
+        {"scan not found", 4, {(bee_word_t)text, len, ';', TRAP_TEXT_SCAN}, 2,
+         {(bee_word_t)(text + len), 0}},
+        {"compare equal", 5, {(bee_word_t)"Parse-Name-Word", 15, (bee_word_t)"pARSE-nAME-wORD", 15, TRAP_TEXT_COMPARE_CASELESS}, 1,
+         {0}},
+        {"compare less", 5, {(bee_word_t)"parse-name-a", 12, (bee_word_t)"PARSE-NAME-B", 12, TRAP_TEXT_COMPARE_CASELESS}, 1,
+         {-1}},
+        {"compare shorter", 5, {(bee_word_t)"parse-name-a", 12, (bee_word_t)"PARSE-NAME", 10, TRAP_TEXT_COMPARE_CASELESS}, 1,
+         {1}},
+        {"decimal number", 6, {0, 0, (bee_word_t)"1234x", 5, 10, TRAP_TEXT_TO_NUMBER}, 4,
+         {1234, 0, 0, 1}},
+        {"hex number", 6, {1, 0, (bee_word_t)"fF", 2, 16, TRAP_TEXT_TO_NUMBER}, 4,
+         {0x1ff, 0, 0, 0}},
+        {"double number", 6, {0, 0, (bee_word_t)two_to_word_bit_plus_1, strlen(two_to_word_bit_plus_1), 10, TRAP_TEXT_TO_NUMBER}, 4,
+         {1, 1, 0, 0}},
+        {"invalid base", 6, {5, 6, (bee_word_t)"0", 1, 37, TRAP_TEXT_TO_NUMBER}, 4,
+         {5, 6, 0, 1}},
+    };
+    // Fill in results that are not constant.
+    text_cases[2].results[0] = text_cases[2].items[0] + 10;
+    for (size_t i = 9; i < sizeof(text_cases) / sizeof(text_cases[0]); i++)
+        text_cases[i].results[2] = text_cases[i].items[2] + text_cases[i].items[3] - text_cases[i].results[3];
+    for (size_t i = 0; i < sizeof(text_cases) / sizeof(text_cases[0]); i++) {
+        bee_word_t error = run_trap(S, TRAP_TEXT, text_cases[i].n, text_cases[i].items);
+        printf("%s: error %zd, dp = %zu\n", text_cases[i].name, error, S->dp);
+        if (error != BEE_ERROR_OK || S->dp != text_cases[i].dp ||
+            memcmp(S->d0, text_cases[i].results, S->dp * BEE_WORD_BYTES) != 0) {
+            printf("Error in traps tests: wrong result\n");
+            exit(1);
+        }
+    }
+
+    // Streams: write to a pipe, checking that output appears only when
+    // it is flushed, then read it back.
+    int fds[2];
+    assert(pipe(fds) == 0 && fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+    char in[8];
+    bee_word_t open_write[] = {fds[1], TRAP_STREAM_OUTPUT, TRAP_STREAM_FDOPEN};
+    assert(run_trap(S, TRAP_STREAM, 3, open_write) == BEE_ERROR_OK && S->dp == 1);
+    bee_word_t out = S->d0[0];
+    assert(out != 0);
+    bee_word_t full[] = {out, TRAP_STREAM_FULLY_BUFFERED, TRAP_STREAM_SETVBUF};
+    assert(run_trap(S, TRAP_STREAM, 3, full) == BEE_ERROR_OK && S->d0[0] == 0);
+    bee_word_t putc_a[] = {'a', out, TRAP_STREAM_PUTC};
+    assert(run_trap(S, TRAP_STREAM, 3, putc_a) == BEE_ERROR_OK && S->d0[0] == 0);
+    bee_word_t write_bc[] = {(bee_word_t)"bc", 2, out, TRAP_STREAM_WRITE};
+    assert(run_trap(S, TRAP_STREAM, 4, write_bc) == BEE_ERROR_OK && S->d0[0] == 2);
+    assert(read(fds[0], in, sizeof(in)) == -1);
+    bee_word_t flush[] = {out, TRAP_STREAM_FLUSH};
+    assert(run_trap(S, TRAP_STREAM, 2, flush) == BEE_ERROR_OK && S->d0[0] == 0);
+    assert(read(fds[0], in, sizeof(in)) == 3 && memcmp(in, "abc", 3) == 0);
+
+    // Destroying another VM state leaves the stream open.
+    bee_state *other = bee_init(m0, BEE_DEFAULT_STACK_SIZE, BEE_DEFAULT_STACK_SIZE);
+    assert(other != NULL);
+    bee_destroy(other);
+
+    // Output is flushed when the program ends with THROW.
+    bee_word_t *emit = label();
+    pushi('d'); push(out); pushi(TRAP_STREAM_PUTC); ass_trap(TRAP_STREAM);
+    pushi(0); ass(BEE_INSN_THROW);
+    S->pc = emit;
+    S->ir = 0;
+    S->dp = S->sp = S->handler_sp = 0;
+    assert(bee_run(S) == 0);
+    ssize_t nread = read(fds[0], in, sizeof(in));
+    printf("program output %zd bytes, and should output 1\n", nread);
+    if (nread != 1 || in[0] != 'd') {
+        printf("Error in traps tests: output not flushed\n");
+        exit(1);
+    }
+
+    bee_word_t close_out[] = {out, TRAP_STREAM_CLOSE};
+    assert(run_trap(S, TRAP_STREAM, 2, close_out) == BEE_ERROR_OK && S->d0[0] == 0);
+
+    // A line-buffered stream is flushed at the end of a line.
+    assert(run_trap(S, TRAP_STREAM, 3, open_write) == BEE_ERROR_OK);
+    out = close_out[0] = S->d0[0];
+    bee_word_t line[] = {out, TRAP_STREAM_LINE_BUFFERED, TRAP_STREAM_SETVBUF};
+    assert(run_trap(S, TRAP_STREAM, 3, line) == BEE_ERROR_OK && S->d0[0] == 0);
+    bee_word_t putc_e[] = {'e', out, TRAP_STREAM_PUTC}, putc_nl[] = {'\n', out, TRAP_STREAM_PUTC};
+    assert(run_trap(S, TRAP_STREAM, 3, putc_e) == BEE_ERROR_OK);
+    assert(read(fds[0], in, sizeof(in)) == -1);
+    assert(run_trap(S, TRAP_STREAM, 3, putc_nl) == BEE_ERROR_OK);
+    assert(read(fds[0], in, sizeof(in)) == 2 && memcmp(in, "e\n", 2) == 0);
+    assert(run_trap(S, TRAP_STREAM, 2, close_out) == BEE_ERROR_OK && S->d0[0] == 0);
+
+    // Closing a stream leaves the descriptor open.
+    assert(write(fds[1], "xyz", 3) == 3);
+    bee_word_t open_read[] = {fds[0], TRAP_STREAM_INPUT, TRAP_STREAM_FDOPEN};
+    assert(run_trap(S, TRAP_STREAM, 3, open_read) == BEE_ERROR_OK);
+    bee_word_t stream_in = S->d0[0];
+    assert(stream_in != 0);
+    bee_word_t getc_in[] = {stream_in, TRAP_STREAM_GETC};
+    assert(run_trap(S, TRAP_STREAM, 2, getc_in) == BEE_ERROR_OK && S->d0[0] == 'x');
+    bee_word_t read_in[] = {(bee_word_t)in, sizeof(in), stream_in, TRAP_STREAM_READ};
+    assert(run_trap(S, TRAP_STREAM, 4, read_in) == BEE_ERROR_OK && S->d0[0] == 2);
+    assert(memcmp(in, "yz", 2) == 0);
+    assert(run_trap(S, TRAP_STREAM, 2, getc_in) == BEE_ERROR_OK && S->d0[0] == -1);
+    bee_word_t close_in[] = {stream_in, TRAP_STREAM_CLOSE};
+    assert(run_trap(S, TRAP_STREAM, 2, close_in) == BEE_ERROR_OK && S->d0[0] == 0);
+    close(fds[0]);
+    close(fds[1]);
+
+#ifdef HAVE_PTHREAD_H
+    // Asynchronous I/O: open a file, make two writes at once, sync it, then
+    // read it back, polling until the read completes.
+    const char *async_file = "async.tmp";
+    bee_word_t async_open[] = {(bee_word_t)async_file, O_RDWR | O_CREAT | O_TRUNC, TRAP_ASYNC_OPEN};
+    assert(run_trap(S, TRAP_ASYNC, 3, async_open) == BEE_ERROR_OK && S->dp == 1);
+    bee_word_t wait[] = {S->d0[0], TRAP_ASYNC_WAIT};
+    assert(wait[0] != 0);
+    assert(run_trap(S, TRAP_ASYNC, 2, wait) == BEE_ERROR_OK && S->dp == 1);
+    bee_word_t fd = S->d0[0];
+    assert(fd >= 0);
+    bee_word_t write_world[] = {(bee_word_t)"world", 5, fd, 5, TRAP_ASYNC_WRITE};
+    assert(run_trap(S, TRAP_ASYNC, 5, write_world) == BEE_ERROR_OK);
+    bee_word_t world = S->d0[0];
+    bee_word_t write_hello[] = {(bee_word_t)"hello", 5, fd, 0, TRAP_ASYNC_WRITE};
+    assert(run_trap(S, TRAP_ASYNC, 5, write_hello) == BEE_ERROR_OK);
+    wait[0] = S->d0[0];
+    assert(run_trap(S, TRAP_ASYNC, 2, wait) == BEE_ERROR_OK && S->d0[0] == 5);
+    wait[0] = world;
+    assert(run_trap(S, TRAP_ASYNC, 2, wait) == BEE_ERROR_OK && S->d0[0] == 5);
+    bee_word_t async_fsync[] = {fd, TRAP_ASYNC_FSYNC};
+    assert(run_trap(S, TRAP_ASYNC, 2, async_fsync) == BEE_ERROR_OK);
+    wait[0] = S->d0[0];
+    assert(run_trap(S, TRAP_ASYNC, 2, wait) == BEE_ERROR_OK && S->d0[0] == 0);
+    char async_buf[16] = "";
+    bee_word_t async_read[] = {(bee_word_t)async_buf, sizeof(async_buf), fd, 0, TRAP_ASYNC_READ};
+    assert(run_trap(S, TRAP_ASYNC, 5, async_read) == BEE_ERROR_OK);
+    bee_word_t poll[] = {S->d0[0], TRAP_ASYNC_POLL};
+    do
+        assert(run_trap(S, TRAP_ASYNC, 2, poll) == BEE_ERROR_OK && S->dp == 2);
+    while (S->d0[1] == 0);
+    printf("asynchronous read gives %zd bytes: %.10s\n", S->d0[0], async_buf);
+    if (S->d0[0] != 10 || memcmp(async_buf, "helloworld", 10) != 0) {
+        printf("Error in traps tests: asynchronous I/O failed\n");
+        exit(1);
+    }
+    // The token has been freed.
+    assert(run_trap(S, TRAP_ASYNC, 2, poll) == BEE_ERROR_OK && S->d0[0] == -1 && S->d0[1] == 1);
+    bee_word_t async_close[] = {fd, TRAP_ASYNC_CLOSE};
+    assert(run_trap(S, TRAP_ASYNC, 2, async_close) == BEE_ERROR_OK);
+    wait[0] = S->d0[0];
+    assert(run_trap(S, TRAP_ASYNC, 2, wait) == BEE_ERROR_OK && S->d0[0] == 0);
+    remove(async_file);
+#endif
+
+#ifdef HAVE_DLFCN_H
+    // FFI: find labs in the program, and call it
+    bee_word_t open_self[] = {0, TRAP_FFI_DLOPEN};
+    assert(run_trap(S, TRAP_FFI, 2, open_self) == BEE_ERROR_OK && S->dp == 1);
+    bee_word_t handle = S->d0[0];
+    assert(handle != 0);
+    bee_word_t find_labs[] = {handle, (bee_word_t)"labs", TRAP_FFI_DLSYM};
+    assert(run_trap(S, TRAP_FFI, 3, find_labs) == BEE_ERROR_OK && S->dp == 1);
+    bee_word_t labs_addr = S->d0[0];
+    bee_word_t call_labs[] = {-42, labs_addr, TRAP_FFI_CALL0 + 1};
+    bee_word_t error = run_trap(S, TRAP_FFI, 3, call_labs);
+    printf("labs(-42) gives %zd, and should be 42\n", S->d0[0]);
+    if (error != BEE_ERROR_OK || S->dp != 1 || S->d0[0] != 42) {
+        printf("Error in traps tests: FFI call failed\n");
+        exit(1);
+    }
+    bee_word_t call_null[] = {1, 2, 0, TRAP_FFI_CALL2};
+    assert(run_trap(S, TRAP_FFI, 4, call_null) == BEE_ERROR_INVALID_FUNCTION);
+    bee_word_t close_self[] = {handle, TRAP_FFI_DLCLOSE};
+    assert(run_trap(S, TRAP_FFI, 2, close_self) == BEE_ERROR_OK && S->d0[0] == 0);
+#endif
+
     printf("traps tests ran OK\n");
     return true;
 }
@@ -130,18 +130,9 @@ _GL_ATTRIBUTE_PURE bee_word_t *label(void)
 }
 
 static const char *mnemonic[BEE_INSN_UNDEFINED + 1] = {
-// 0x00
-    "NOP", "NOT", "AND", "OR", "XOR", "LSHIFT", "RSHIFT", "ARSHIFT",
-    "POP", "DUP", "SET", "SWAP", "JUMP", "JUMPZ", "CALL", "RET",
-// 0x10
-    "LOAD", "STORE", "LOAD1", "STORE1", "LOAD2", "STORE2", "LOAD4", "STORE4",
-    "LOAD_IA", "STORE_DB", "LOAD_IB", "STORE_DA", "LOAD_DA", "STORE_IB", "LOAD_DB", "STORE_IA",
-// 0x20
-    "NEG", "ADD", "MUL", "DIVMOD", "UDIVMOD", "EQ", "LT", "ULT",
-    "PUSHS", "POPS", "DUPS", "CATCH", "THROW", "BREAK", "BEE_WORD_BYTES", NULL,
-// 0x30
-    NULL, "GET_SSIZE", "GET_SP", "SET_SP", "GET_DSIZE", "GET_SP", "SET_SP", "GET_HANDLER_SP",
-    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+#define BEE_INSN(name, opcode, ...) [opcode] = #name,
+#include "bee/insns.h"
+#undef BEE_INSN
 };
 
 _GL_ATTRIBUTE_CONST const char *disass(bee_word_t opcode, bee_word_t *pc)
@@ -316,52 +307,14 @@ static bee_word_t *compute_next_pc(bee_state * restrict S, bee_word_t *ir)
             switch (*ir) {
             case BEE_INSN_NOP:
                 break;
-            case BEE_INSN_NOT:
-            case BEE_INSN_AND:
-            case BEE_INSN_OR:
-            case BEE_INSN_XOR:
-            case BEE_INSN_LSHIFT:
-            case BEE_INSN_RSHIFT:
-            case BEE_INSN_ARSHIFT:
-            case BEE_INSN_POP:
-            case BEE_INSN_DUP:
-            case BEE_INSN_SET:
-            case BEE_INSN_SWAP:
-            case BEE_INSN_LOAD:
-            case BEE_INSN_STORE:
-            case BEE_INSN_LOAD1:
-            case BEE_INSN_STORE1:
-            case BEE_INSN_LOAD2:
-            case BEE_INSN_STORE2:
-            case BEE_INSN_LOAD4:
-            case BEE_INSN_STORE4:
-            case BEE_INSN_LOAD_IA:
-            case BEE_INSN_STORE_DB:
-            case BEE_INSN_LOAD_IB:
-            case BEE_INSN_STORE_DA:
-            case BEE_INSN_LOAD_DA:
-            case BEE_INSN_STORE_IB:
-            case BEE_INSN_LOAD_DB:
-            case BEE_INSN_STORE_IA:
-            case BEE_INSN_NEG:
-            case BEE_INSN_ADD:
-            case BEE_INSN_MUL:
-            case BEE_INSN_DIVMOD:
-            case BEE_INSN_UDIVMOD:
-            case BEE_INSN_EQ:
-            case BEE_INSN_LT:
-            case BEE_INSN_ULT:
-            case BEE_INSN_PUSHS:
-            case BEE_INSN_POPS:
-            case BEE_INSN_DUPS:
-            case BEE_INSN_WORD_BYTES:
-            case BEE_INSN_GET_SSIZE:
-            case BEE_INSN_GET_SP:
-            case BEE_INSN_SET_SP:
-            case BEE_INSN_GET_DSIZE:
-            case BEE_INSN_GET_DP:
-            case BEE_INSN_SET_DP:
-            case BEE_INSN_GET_HANDLER_SP:
+#define BEE_INSN(name, opcode, dpops, dpushes, spops, spushes, kind, ...) \
+            NEXT_##kind(name)
+#define NEXT_SAFE(name) case BEE_INSN_##name:
+#define NEXT_RAISES NEXT_SAFE
+#define NEXT_DYNAMIC NEXT_SAFE
+#define NEXT_CONTROL(name)
+#include "bee/insns.h"
+#undef BEE_INSN
                 next_pc = S->pc - 1;
                 break;
             case BEE_INSN_JUMP:
@@ -506,6 +459,36 @@ bool run_test(const char *name, bee_state *S, bool errors_allowed)
     return ok;
 }
 
+run_result run_snapshot(bee_state *S, bee_word_t *pc, bee_uword_t dp)
+{
+    S->pc = pc;
+    S->ir = 0;
+    S->sp = S->handler_sp = 0;
+    S->dp = dp;
+    run_result r = {bee_run(S), S->pc, S->ir, S->dp, S->sp, NULL};
+    r.d0 = calloc(S->dp + 1, BEE_WORD_BYTES);
+    assert(r.d0 != NULL);
+    memcpy(r.d0, S->d0, S->dp * BEE_WORD_BYTES);
+    return r;
+}
+
+bool same_result(const char *name, const char *test, run_result r[2])
+{
+    bool ok = true;
+    printf("%s: returned %zd, pc = %p, ir = %#zx, dp = %zu, sp = %zu\n",
+           test, r[1].ret, r[1].pc, r[1].ir, r[1].dp, r[1].sp);
+    if (r[0].ret != r[1].ret || r[0].pc != r[1].pc || r[0].ir != r[1].ir ||
+        r[0].dp != r[1].dp || r[0].sp != r[1].sp ||
+        memcmp(r[0].d0, r[1].d0, r[0].dp * BEE_WORD_BYTES) != 0) {
+        printf("Error in %s tests: should return %zd, pc = %p, ir = %#zx, dp = %zu, sp = %zu\n",
+               name, r[0].ret, r[0].pc, r[0].ir, r[0].dp, r[0].sp);
+        ok = false;
+    }
+    free(r[0].d0);
+    free(r[1].d0);
+    return ok;
+}
+
 char *correct[64];
 unsigned steps = 0;
 bee_word_t *m0;
@@ -520,5 +503,6 @@ int main(void)
     ass_goto(m0);
     assert(test(S));
     bee_destroy(S);
+    bee_finish();
     free(m0);
 }
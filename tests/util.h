@@ -11,6 +11,16 @@
 
 #include <stdbool.h>
 
+// The instruction word PUSHI `n`
+#define PUSHI(n) ((bee_word_t)((bee_uword_t)(n) << BEE_OP1_SHIFT | BEE_OP_PUSHI))
+
+// The state left by a run, with a copy of the data stack
+typedef struct {
+    bee_word_t ret, *pc, ir;
+    bee_uword_t dp, sp;
+    bee_word_t *d0;
+} run_result;
+
 int byte_size(bee_word_t v); // return number of significant bytes in a bee_word_t quantity
 
 void align(void);		// align assembly pointer to next word
@@ -36,6 +46,8 @@ const char *error_to_msg(int code);	// translate error code to message
 bee_word_t single_step(bee_state * restrict S); // single step
 bee_state *init_defaults(bee_word_t *pc); // initialize with stacks of size BEE_DEFAULT_STACK_SIZE
 bool run_test(const char *name, bee_state *S, bool errors_allowed); // run a test, checking the results after each instruction
+run_result run_snapshot(bee_state *S, bee_word_t *pc, bee_uword_t dp); // run from pc with dp items on the data stack, and return the state left
+bool same_result(const char *name, const char *test, run_result r[2]); // show r[1], and check that it matches r[0]; free both
 extern char *correct[64];
 extern unsigned steps;
 extern bee_word_t *m0;
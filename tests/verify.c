@@ -0,0 +1,128 @@
+// Test that verified code runs as it does with checks.
+//
+// (c) Reuben Thomas 2023
+//
+// The package is distributed under the GNU General Public License version 3,
+// or, at your option, any later version.
+//
+// THIS PROGRAM IS PROVIDED AS IS, WITH NO WARRANTY. USE IS AT THE USER’S
+// RISK.
+
+#include "tests.h"
+
+
+#define ITERATIONS 10
+
+bool test(bee_state *S)
+{
+    // A word that squares the top of the stack
+    bee_word_t *square = label();
+    pushi(0); ass(BEE_INSN_DUP); ass(BEE_INSN_MUL); ass(BEE_INSN_RET);
+
+    // A word that pushes a constant, which is changed by the program
+    bee_word_t *konst = label();
+    pushi(1); ass(BEE_INSN_RET);
+    bee_word_t original = *konst;
+
+    // Sum the squares of n for n from ITERATIONS down to 1, plus a large
+    // literal and `konst` each time, storing PUSHI 2 in `konst` half way
+    // through ( acc n )
+    bee_word_t *sum = label();
+    pushi(0);
+    pushi(ITERATIONS);
+    bee_word_t *loop = label();
+    pushi(0); ass(BEE_INSN_DUP);
+    calli(square);
+    push(BEE_WORD_MIN); ass(BEE_INSN_ADD);
+    calli(konst); ass(BEE_INSN_ADD);
+    pushi(2); ass(BEE_INSN_DUP); ass(BEE_INSN_ADD);
+    pushi(1); ass(BEE_INSN_SET); // ( acc' n )
+    pushi(0); ass(BEE_INSN_DUP); pushi(ITERATIONS / 2); ass(BEE_INSN_EQ);
+    bee_word_t *not_half = label();
+    jumpzi(not_half);
+    pushi(PUSHI(2)); pushreli(konst); ass(BEE_INSN_STORE);
+    bee_word_t *here = label();
+    ass_goto(not_half);
+    jumpzi(here);
+    ass_goto(here);
+    pushi(-1); ass(BEE_INSN_ADD);
+    pushi(0); ass(BEE_INSN_DUP); pushi(0); ass(BEE_INSN_EQ);
+    jumpzi(loop);
+    pushi(0); ass(BEE_INSN_THROW);
+    bee_uword_t expected = ITERATIONS * (ITERATIONS + 1) * (2 * ITERATIONS + 1) / 6 +
+        (ITERATIONS - ITERATIONS / 2 + 1) * 1 + (ITERATIONS / 2 - 1) * 2 +
+        ITERATIONS * (bee_uword_t)BEE_WORD_MIN;
+
+    // Errors raised part way through verified blocks
+    bee_word_t *underflow = label();
+    pushi(1); ass(BEE_INSN_ADD); ass(BEE_INSN_ADD);
+    bee_word_t *bad_dup = label();
+    pushi(1); pushi(1); ass(BEE_INSN_ADD); ass(BEE_INSN_DUP);
+    bee_word_t *unaligned = label();
+    pushi(1); pushi(1); ass(BEE_INSN_LOAD);
+    bee_word_t *data_full = label();
+    pushi(1);
+    jumpi(data_full);
+    bee_word_t *return_full = label();
+    calli(return_full);
+    bee_word_t *invalid = label();
+    pushi(1); ass(BEE_INSN_NOT); ass(BEE_INSN_UNDEFINED);
+
+    // An error raised in a word that is spliced into its caller
+    bee_word_t *load_word = label();
+    ass(BEE_INSN_LOAD); ass(BEE_INSN_RET);
+    bee_word_t *spliced = label();
+    pushi(1);
+    calli(load_word);
+
+    // A word with an instruction after RET, which runs at the return address
+    bee_word_t *ret_not = label();
+    ass(BEE_INSN_RET | BEE_INSN_NOT << BEE_INSN_BITS);
+    bee_word_t *after_ret = label();
+    pushi(1);
+    calli(ret_not);
+    pushi(0); ass(BEE_INSN_THROW);
+    bee_word_t *end = label();
+
+    struct {
+        const char *name;
+        bee_word_t *entry;
+        run_result r[2];
+    } programs[] = {
+        {"sum", sum, {{0}}},
+        {"data stack underflow", underflow, {{0}}},
+        {"bad DUP", bad_dup, {{0}}},
+        {"unaligned load", unaligned, {{0}}},
+        {"data stack full", data_full, {{0}}},
+        {"return stack full", return_full, {{0}}},
+        {"invalid opcode", invalid, {{0}}},
+        {"error in spliced word", spliced, {{0}}},
+        {"instruction after RET", after_ret, {{0}}},
+    };
+    const size_t nprograms = sizeof(programs) / sizeof(programs[0]);
+
+    bee_set_jit(BEE_JIT_NONE);
+    for (int verified = 0; verified <= 1; verified++) {
+        if (verified)
+            assert(bee_verify(m0, (end - m0) * BEE_WORD_BYTES) == 0);
+        for (size_t i = 0; i < nprograms; i++) {
+            *konst = original;
+            bee_invalidate(konst, BEE_WORD_BYTES);
+            programs[i].r[verified] = run_snapshot(S, programs[i].entry, 0);
+        }
+    }
+
+    bool ok = true;
+    run_result *r = programs[0].r;
+    if (r[0].ret != 0 || r[0].dp != 2 || (bee_uword_t)r[0].d0[0] != expected) {
+        printf("Error in verify tests: sum is %zd; should be %zd\n", r[0].d0[0], (bee_word_t)expected);
+        ok = false;
+    }
+    for (size_t i = 0; i < nprograms; i++)
+        if (!same_result("verify", programs[i].name, programs[i].r))
+            ok = false;
+
+    if (ok)
+        printf("verify tests ran OK\n");
+    return ok;
+}